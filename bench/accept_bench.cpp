@@ -0,0 +1,118 @@
+#include "http_server.h"
+#include "socket_util.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// connection churn: every client connects, sends one request, reads the
+// response and closes, over and over. The client resets the connection
+// (SO_LINGER 0) so neither side piles up TIME_WAIT sockets. Each accept mode
+// runs on both backends; accept_skew is the busiest loop's share of the
+// accepts over a fair share. On epoll with a single acceptor loop 0 accepts
+// everything and deals the connections out, elsewhere the loop that accepts
+// a connection serves it.
+// usage: accept_bench [loops] [clients] [seconds_per_case]
+
+using namespace ekko;
+
+static double
+now_us()
+{
+	return std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+client(int port, double deadline, std::vector<double> *lat)
+{
+	static const char req[] = "GET / HTTP/1.1\r\nHost: bench\r\n\r\n";
+	struct linger lg = { 1, 0 };
+	char buf[4096];
+
+	while (now_us() < deadline) {
+		double start = now_us();
+		int fd = ConnectTo("127.0.0.1", port);
+		if (fd < 0)
+			return;
+		std::string resp;
+		size_t end = std::string::npos, need = 0;
+		if (write(fd, req, sizeof(req) - 1) == (ssize_t) sizeof(req) - 1) {
+			while (end == std::string::npos || resp.size() < need) {
+				ssize_t n = read(fd, buf, sizeof(buf));
+				if (n <= 0)
+					break;
+				resp.append(buf, n);
+				if (end == std::string::npos && (end = resp.find("\r\n\r\n")) != std::string::npos) {
+					size_t pos = resp.find("Content-Length: ");
+					need = end + 4 + (pos < end ? atol(resp.c_str() + pos + 16) : 0);
+				}
+			}
+		}
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+		close(fd);
+		if (end == std::string::npos || resp.size() < need)
+			return;
+		lat->push_back(now_us() - start);
+	}
+}
+
+static void
+run_case(const char *name, AcceptMode mode, bool use_uring, int nloops, int nclients, double seconds)
+{
+	HttpServer server("127.0.0.1", 0, nloops, use_uring);
+	server.SetAcceptMode(mode);
+	server.SetHandler([](const HttpRequest&, HttpResponse &resp) { resp.SetBody("hello");});
+	if (server.Start() != 0)
+		exit(1);
+
+	std::vector<std::vector<double> > lat(nclients);
+	std::vector<std::thread> threads;
+	double start = now_us(), deadline = start + seconds * 1e6;
+	for (int i = 0; i < nclients; ++i)
+		threads.emplace_back(client, server.GetPort(), deadline, &lat[i]);
+	for (auto &t : threads)
+		t.join();
+	double elapsed = (now_us() - start) / 1e6;
+
+	uint64_t total = 0, busiest = 0;
+	for (int i = 0; i < nloops; ++i) {
+		uint64_t n = server.GetServer().GetAccepted(i);
+		total += n;
+		busiest = std::max(busiest, n);
+	}
+	const char *backend = server.GetServer().IsUring() ? "uring" : "epoll";
+	server.Stop();
+
+	std::vector<double> all;
+	for (auto &v : lat)
+		all.insert(all.end(), v.begin(), v.end());
+	std::sort(all.begin(), all.end());
+	if (all.empty())
+		exit(1);
+	printf("%s\t%s\t%d\t%d\t%.0f\t%.1f\t%.1f\t%.2f\n", name, backend, nloops, nclients,
+		all.size() / elapsed, all[all.size() / 2], all[all.size() * 99 / 100],
+		total ? (double) busiest * nloops / total : 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nloops = argc > 1 ? atoi(argv[1]) : 4;
+	int nclients = argc > 2 ? atoi(argv[2]) : 16;
+	double seconds = argc > 3 ? atof(argv[3]) : 2;
+
+	printf("mode\tbackend\tloops\tclients\tconn_per_sec\tp50_us\tp99_us\taccept_skew\n");
+	for (int uring = 1; uring >= 0; --uring) {
+		run_case("single", ACCEPT_SINGLE, uring, nloops, nclients, seconds);
+		run_case("sharded", ACCEPT_SHARDED, uring, nloops, nclients, seconds);
+		run_case("sharded_cpu", ACCEPT_SHARDED_CPU, uring, nloops, nclients, seconds);
+	}
+}
@@ -0,0 +1,86 @@
+#include "tcp_server.h"
+#include "socket_util.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// ping-pong echo over loopback: every client thread owns one blocking
+// connection and measures each round trip
+// usage: echo_bench [loops] [clients] [seconds] [msg_size]
+
+using namespace ekko;
+
+static double
+now_us()
+{
+	return std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+client(int port, int msg_size, double deadline, std::vector<double> *lat)
+{
+	std::vector<char> msg(msg_size, 'e'), buf(msg_size);
+	int fd = ConnectTo("127.0.0.1", port);
+	if (fd < 0)
+		return;
+	while (now_us() < deadline) {
+		double start = now_us();
+		if (write(fd, msg.data(), msg_size) != msg_size)
+			break;
+		int got = 0;
+		while (got < msg_size) {
+			ssize_t n = read(fd, buf.data() + got, msg_size - got);
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		if (got != msg_size)
+			break;
+		lat->push_back(now_us() - start);
+	}
+	close(fd);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nloops = argc > 1 ? atoi(argv[1]) : 1;
+	int nclients = argc > 2 ? atoi(argv[2]) : 8;
+	double seconds = argc > 3 ? atof(argv[3]) : 3;
+	int msg_size = argc > 4 ? atoi(argv[4]) : 64;
+
+	TcpServer server("127.0.0.1", 0, nloops);
+	server.SetMessageCallback([](const TcpConnection::ptr &conn, Buffer &buf) {
+		conn->Send(buf.Peek(), buf.ReadableBytes());
+		buf.RetrieveAll();
+	});
+	if (server.Start() != 0)
+		return 1;
+
+	std::vector<std::vector<double> > lat(nclients);
+	std::vector<std::thread> threads;
+	double start = now_us(), deadline = start + seconds * 1e6;
+	for (int i = 0; i < nclients; ++i)
+		threads.emplace_back(client, server.GetPort(), msg_size, deadline, &lat[i]);
+	for (auto &t : threads)
+		t.join();
+	double elapsed = (now_us() - start) / 1e6;
+
+	std::vector<double> all;
+	for (auto &v : lat)
+		all.insert(all.end(), v.begin(), v.end());
+	std::sort(all.begin(), all.end());
+	if (all.empty())
+		return 1;
+	printf("loops\tclients\tmsg_size\treq_per_sec\tMB_per_sec\tp50_us\tp99_us\tp999_us\n");
+	printf("%d\t%d\t%d\t%.0f\t%.1f\t%.1f\t%.1f\t%.1f\n", nloops, nclients, msg_size,
+		all.size() / elapsed, all.size() * (double) msg_size * 2 / elapsed / 1e6,
+		all[all.size() / 2], all[all.size() * 99 / 100], all[all.size() * 999 / 1000]);
+	server.Stop();
+}
@@ -0,0 +1,104 @@
+#include "scheduler.h"
+#include "fiber_context.h"
+#include "fiber_sync.h"
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// context-switch cost and memory per fiber
+#define NSWITCHES 10000000
+#define NYIELDS 2000000
+#define NFIBERS 10000
+
+using namespace ekko;
+
+static double
+now_ns()
+{
+	return std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long
+rss_kb()
+{
+	long pages = 0, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp) {
+		if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(fp);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static struct fiber_context_t s_main_ctx, s_fiber_ctx;
+
+static void
+ping()
+{
+	while (1)
+		fiber_context_switch(&s_fiber_ctx, &s_main_ctx);
+}
+
+int
+main()
+{
+	// raw switch: one round trip is two switches
+	std::vector<char> stack(16384);
+	fiber_context_make(&s_fiber_ctx, stack.data(), stack.size(), ping);
+	double start = now_ns();
+	for (int i = 0; i < NSWITCHES / 2; ++i)
+		fiber_context_switch(&s_main_ctx, &s_fiber_ctx);
+	printf("raw_switch_ns\t%.1f\n", (now_ns() - start) / NSWITCHES);
+
+	struct thread_pool_t pool;
+	thread_pool_init(&pool, 1);
+	Scheduler *scheduler = new Scheduler(&pool, 1, 16384);
+
+	// two fibers yielding to each other through the ready queue
+	std::vector<Fiber::ptr> fibers;
+	start = now_ns();
+	for (int f = 0; f < 2; ++f)
+		fibers.push_back(scheduler->Spawn([] {
+			for (int i = 0; i < NYIELDS / 2; ++i)
+				Fiber::Yield();
+		}));
+	for (auto &f : fibers)
+		f->Join();
+	printf("yield_ns\t%.1f\n", (now_ns() - start) / NYIELDS);
+	fibers.clear();
+
+	// park NFIBERS on a condition and look at what they cost
+	FiberMutex mutex;
+	FiberCondition cond;
+	bool release = false;
+	std::atomic<int> parked(0);
+	long rss_before = rss_kb();
+	start = now_ns();
+	for (int i = 0; i < NFIBERS; ++i)
+		fibers.push_back(scheduler->Spawn([&] {
+			FiberMutex::Lock lock(mutex);
+			++parked;
+			while (!release)
+				cond.wait(mutex);
+		}));
+	while (parked != NFIBERS)
+		usleep(1000);
+	double spawn_ns = (now_ns() - start) / NFIBERS;
+	long rss_after = rss_kb();
+	printf("spawn_and_park_ns\t%.1f\n", spawn_ns);
+	printf("fiber_object_bytes\t%zu\n", sizeof(Fiber));
+	printf("fiber_stack_bytes\t%zu\n", fibers[0]->GetStackSize());
+	printf("rss_per_fiber_bytes\t%.1f\n", (rss_after - rss_before) * 1024.0 / NFIBERS);
+
+	scheduler->Spawn([&] {
+		FiberMutex::Lock lock(mutex);
+		release = true;
+		cond.notify_all();
+	});
+	delete scheduler;
+	thread_pool_destroy(&pool);
+}
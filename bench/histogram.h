@@ -0,0 +1,109 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief 2^HIST_SUB_BITS buckets per power of two: values are kept to 0.1%
+#define HIST_SUB_BITS 10
+/// @brief values from 2^HIST_MAX_BITS on, about 18 minutes in ns, are clamped
+#define HIST_MAX_BITS 40
+
+namespace ekko {
+
+/**
+ * @brief a log-linear histogram in the manner of HdrHistogram: every power
+ * of two is cut into the same number of linear sub-buckets, so a percentile
+ * is off by at most 1/2^HIST_SUB_BITS of its value, whatever its magnitude.
+ * Recording is an index computation and an increment; histograms of the
+ * same layout merge by adding their buckets.
+*/
+class Histogram {
+public:
+    Histogram() :counts_(((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS), 0) {}
+
+    void Record(uint64_t v) {
+        if (v >= (1ULL << HIST_MAX_BITS))
+            v = (1ULL << HIST_MAX_BITS) - 1;
+        ++counts_[Index(v)];
+        ++count_;
+        sum_ += v;
+        if (v < min_)
+            min_ = v;
+        if (v > max_)
+            max_ = v;
+    }
+
+    void Merge(const Histogram &other) {
+        for (size_t i = 0; i < counts_.size(); ++i)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if (other.min_ < min_)
+            min_ = other.min_;
+        if (other.max_ > max_)
+            max_ = other.max_;
+    }
+
+    void Reset() {
+        counts_.assign(counts_.size(), 0);
+        count_ = sum_ = max_ = 0;
+        min_ = UINT64_MAX;
+    }
+
+    uint64_t Count() const { return count_;}
+
+    uint64_t Min() const { return count_ ? min_ : 0;}
+
+    uint64_t Max() const { return max_;}
+
+    double Mean() const { return count_ ? (double) sum_ / count_ : 0;}
+
+    /// @return the highest value equivalent to the p-th percentile, p in [0, 100]
+    uint64_t Percentile(double p) const {
+        uint64_t rank, seen = 0;
+        if (count_ == 0)
+            return 0;
+        rank = (uint64_t) (count_ * p / 100.0);
+        if (rank >= count_)
+            rank = count_ - 1;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen > rank)
+                return Highest(i) < max_ ? Highest(i) : max_;
+        }
+        return max_;
+    }
+
+private:
+    static size_t Index(uint64_t v) {
+        if (v < (1ULL << HIST_SUB_BITS))
+            return v;
+        int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+        return ((size_t) (shift + 1) << HIST_SUB_BITS) + (v >> shift) - (1ULL << HIST_SUB_BITS);
+    }
+
+    /// @brief the largest value landing in bucket i
+    static uint64_t Highest(size_t i) {
+        if (i < (1ULL << HIST_SUB_BITS))
+            return i;
+        int shift = (i >> HIST_SUB_BITS) - 1;
+        uint64_t mant = (i & ((1ULL << HIST_SUB_BITS) - 1)) + (1ULL << HIST_SUB_BITS);
+        return ((mant + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+
+    uint64_t count_ = 0;
+
+    uint64_t sum_ = 0;
+
+    uint64_t min_ = UINT64_MAX;
+
+    uint64_t max_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,788 @@
+#include "histogram.h"
+#include "http_server.h"
+#include "static_file.h"
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// An HTTP/1.1 load generator: every thread drives its share of the
+// connections from its own epoll, non-blocking.
+//
+// closed loop (rate=0): each connection keeps `pipeline` requests in flight
+// and sends the next one as a response comes back; latency is from send.
+// open loop (rate=N): requests are due at a constant N per second whatever
+// the server does and wait for a free connection slot when there is none.
+// Latency counts from when a request was due, not from when it could be
+// sent, so a stalled server shows up in the percentiles instead of slowing
+// the load down (coordinated omission).
+//
+// A run is a list of key=value settings; a scenario script has one run per
+// line, its name first. server=hello|static starts the frame's HttpServer on
+// loopback for the run, server=none loads target=host:port. Without -f or
+// settings the built-in scenarios run. Each run prints one line: tsv with a
+// header, or a JSON object per line with -o json.
+// usage: http_load [-o tsv|json] [-f script | key=value ...]
+// keys: server backend loops accept target path method header body threads
+//       conns pipeline keepalive rate duration warmup
+
+using namespace ekko;
+
+#define READ_BUF 65536
+/// @brief a connection refused or reset is tried again after this long
+#define RETRY_NS 10000000ULL
+
+static const char *s_builtin =
+	"hello_closed      server=hello conns=64\n"
+	"hello_pipelined   server=hello conns=16 pipeline=16\n"
+	"hello_open        server=hello conns=64 rate=20000\n"
+	"hello_no_keepalive server=hello conns=16 keepalive=0\n"
+	"hello_epoll       server=hello backend=epoll conns=64\n"
+	"static_4k         server=static conns=64\n"
+	"static_4k_open    server=static conns=64 rate=20000\n";
+
+static uint64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct Scenario {
+	std::string name = "cli";
+	std::string server = "none";
+	std::string backend = "uring";
+	std::string accept = "single";
+	std::string target = "127.0.0.1:8080";
+	std::string path;
+	std::string method = "GET";
+	std::vector<std::string> headers;
+	std::string body;
+	int loops = 1;
+	int threads = 1;
+	int conns = 16;
+	int pipeline = 1;
+	bool keepalive = true;
+	double rate = 0;
+	double duration = 3;
+	double warmup = 0.5;
+};
+
+/// @return false on an unknown key
+static bool
+set_option(Scenario &sc, const std::string &key, const std::string &val)
+{
+	if (key == "server") sc.server = val;
+	else if (key == "backend") sc.backend = val;
+	else if (key == "accept") sc.accept = val;
+	else if (key == "target") sc.target = val;
+	else if (key == "path") sc.path = val;
+	else if (key == "method") sc.method = val;
+	else if (key == "header") sc.headers.push_back(val);
+	else if (key == "body") sc.body = val;
+	else if (key == "loops") sc.loops = atoi(val.c_str());
+	else if (key == "threads") sc.threads = atoi(val.c_str());
+	else if (key == "conns") sc.conns = atoi(val.c_str());
+	else if (key == "pipeline") sc.pipeline = atoi(val.c_str());
+	else if (key == "keepalive") sc.keepalive = atoi(val.c_str()) != 0;
+	else if (key == "rate") sc.rate = atof(val.c_str());
+	else if (key == "duration") sc.duration = atof(val.c_str());
+	else if (key == "warmup") sc.warmup = atof(val.c_str());
+	else return false;
+	return true;
+}
+
+static bool
+parse_setting(Scenario &sc, const std::string &tok)
+{
+	size_t eq = tok.find('=');
+	if (eq == std::string::npos || !set_option(sc, tok.substr(0, eq), tok.substr(eq + 1))) {
+		fprintf(stderr, "http_load: bad setting '%s'\n", tok.c_str());
+		return false;
+	}
+	return true;
+}
+
+/// @brief one run per line: a name, then its settings; '#' starts a comment
+static bool
+parse_script(std::istream &in, std::vector<Scenario> &runs)
+{
+	std::string line, tok;
+	while (std::getline(in, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream words(line);
+		Scenario sc;
+		if (!(words >> sc.name))
+			continue;
+		while (words >> tok) {
+			if (!parse_setting(sc, tok))
+				return false;
+		}
+		runs.push_back(sc);
+	}
+	return true;
+}
+
+struct Result {
+	Histogram latency;
+	uint64_t requests = 0;
+	uint64_t non_2xx = 0;
+	uint64_t errors = 0;
+	uint64_t connects = 0;
+	uint64_t bytes = 0;
+	/// @brief open loop: due before the end and never sent
+	uint64_t unsent = 0;
+
+	void Merge(const Result &o) {
+		latency.Merge(o.latency);
+		requests += o.requests;
+		non_2xx += o.non_2xx;
+		errors += o.errors;
+		connects += o.connects;
+		bytes += o.bytes;
+		unsent += o.unsent;
+	}
+};
+
+enum ConnState { CLOSED, CONNECTING, OPEN };
+
+/// @brief where a response is in its parse
+enum Phase { HEAD, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER, UNTIL_CLOSE };
+
+struct Conn {
+	int fd = -1;
+	ConnState state = CLOSED;
+	uint64_t retry_at = 0;
+	/// @brief when each request on the wire was due, oldest first
+	std::deque<uint64_t> sent;
+	std::string out;
+	size_t out_off = 0;
+	std::vector<char> in;
+	size_t in_r = 0;
+	size_t in_w = 0;
+	Phase phase = HEAD;
+	uint64_t remaining = 0;
+	int status = 0;
+	bool close_after = false;
+};
+
+class Worker {
+public:
+	Worker(const Scenario &sc, const struct sockaddr_in &addr, const std::string &request,
+		   int nconns, double rate, uint64_t start, uint64_t measure_from, uint64_t end)
+		:sc_(sc), addr_(addr), request_(request), conns_(nconns), start_(start)
+		,measure_from_(measure_from), end_(end) {
+		interval_ = rate > 0 ? 1e9 / rate : 0;
+		head_only_ = sc.method == "HEAD";
+		depth_ = sc.keepalive ? (sc.pipeline > 0 ? sc.pipeline : 1) : 1;
+	}
+
+	void Run();
+
+	Result& GetResult() { return result_;}
+
+private:
+	void Connect(Conn *c);
+
+	void OnOpen(Conn *c);
+
+	void HandleEvent(Conn *c, uint32_t events);
+
+	void Issue(Conn *c, uint64_t due);
+
+	void Flush(Conn *c);
+
+	/// @brief parse what has been read, false when the connection went away
+	bool Parse(Conn *c);
+
+	bool ParseHead(Conn *c);
+
+	void Complete(Conn *c);
+
+	/// @brief give a connection with room the next waiting or newly due request
+	void Refill(Conn *c);
+
+	void Drop(Conn *c, bool failed);
+
+	bool Running() const { return now_ < end_;}
+
+	const Scenario &sc_;
+	struct sockaddr_in addr_;
+	const std::string &request_;
+	std::vector<Conn> conns_;
+	int epfd_ = -1;
+	int timer_fd_ = -1;
+	uint64_t now_ = 0;
+	uint64_t start_;
+	uint64_t measure_from_;
+	uint64_t end_;
+	double interval_ = 0;
+	/// @brief open loop: the next request falls due at start_ + issued_ * interval_
+	uint64_t issued_ = 0;
+	/// @brief open loop: due requests waiting for a connection slot
+	std::deque<uint64_t> backlog_;
+	size_t next_conn_ = 0;
+	int depth_;
+	bool head_only_;
+	Result result_;
+};
+
+void
+Worker::Connect(Conn *c)
+{
+	struct epoll_event ev;
+	int one = 1;
+
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c->fd < 0) {
+		c->retry_at = now_ + RETRY_NS;
+		++result_.errors;
+		return;
+	}
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	c->state = CONNECTING;
+	c->phase = HEAD;
+	c->in_r = c->in_w = 0;
+	c->out.clear();
+	c->out_off = 0;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = c;
+	epoll_ctl(epfd_, EPOLL_CTL_ADD, c->fd, &ev);
+	++result_.connects;
+	if (connect(c->fd, (struct sockaddr*) &addr_, sizeof(addr_)) == 0)
+		OnOpen(c);
+	else if (errno != EINPROGRESS)
+		Drop(c, true);
+}
+
+void
+Worker::OnOpen(Conn *c)
+{
+	c->state = OPEN;
+	Refill(c);
+}
+
+void
+Worker::Refill(Conn *c)
+{
+	while (c->state == OPEN && (int) c->sent.size() < depth_) {
+		if (!backlog_.empty()) {
+			Issue(c, backlog_.front());
+			backlog_.pop_front();
+		} else if (interval_ == 0 && Running()) {
+			Issue(c, now_);
+		} else {
+			break;
+		}
+	}
+	if (c->state == OPEN)
+		Flush(c);
+}
+
+void
+Worker::Issue(Conn *c, uint64_t due)
+{
+	c->out.append(request_);
+	c->sent.push_back(due);
+}
+
+void
+Worker::Flush(Conn *c)
+{
+	while (c->out_off < c->out.size()) {
+		ssize_t n = write(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off);
+		if (n > 0) {
+			c->out_off += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		Drop(c, true);
+		return;
+	}
+	c->out.clear();
+	c->out_off = 0;
+}
+
+void
+Worker::Drop(Conn *c, bool failed)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	c->state = CLOSED;
+	if (failed)
+		++result_.errors;
+	// what was in flight is lost; in the open loop it still counts as sent
+	if (failed && !c->sent.empty())
+		result_.errors += c->sent.size();
+	c->sent.clear();
+	c->retry_at = failed ? now_ + RETRY_NS : now_;
+}
+
+void
+Worker::HandleEvent(Conn *c, uint32_t events)
+{
+	if (c->state == CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+			Drop(c, true);
+			return;
+		}
+		if (!(events & (EPOLLOUT | EPOLLIN)))
+			return;
+		OnOpen(c);
+		if (c->state != OPEN)
+			return;
+	}
+	if (events & EPOLLOUT)
+		Flush(c);
+	if (c->state != OPEN || !(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+		return;
+	while (1) {
+		if (c->in.size() - c->in_w < READ_BUF / 4) {
+			// compact, then grow if a head does not fit
+			memmove(&c->in[0], &c->in[0] + c->in_r, c->in_w - c->in_r);
+			c->in_w -= c->in_r;
+			c->in_r = 0;
+			if (c->in.size() - c->in_w < READ_BUF / 4)
+				c->in.resize(c->in.size() + READ_BUF);
+		}
+		ssize_t n = read(c->fd, &c->in[c->in_w], c->in.size() - c->in_w);
+		if (n > 0) {
+			c->in_w += n;
+			result_.bytes += n;
+			if (!Parse(c))
+				return;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		// the end of a response delimited by the close
+		if (n == 0 && c->phase == UNTIL_CLOSE && !c->sent.empty()) {
+			c->close_after = true;
+			Complete(c);
+			return;
+		}
+		Drop(c, !c->sent.empty());
+		return;
+	}
+}
+
+bool
+Worker::ParseHead(Conn *c)
+{
+	const char *p = &c->in[c->in_r], *end = &c->in[c->in_w];
+	const char *eoh = (const char*) memmem(p, end - p, "\r\n\r\n", 4);
+	if (!eoh)
+		return false;
+	std::string head(p, eoh - p);
+	c->in_r += eoh + 4 - p;
+	c->status = head.size() > 12 ? atoi(head.c_str() + 9) : 0;
+	c->close_after = false;
+	c->remaining = 0;
+	c->phase = UNTIL_CLOSE;
+	bool has_length = false;
+	size_t pos = 0;
+	while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+		pos += 2;
+		size_t colon = head.find(':', pos);
+		size_t eol = head.find("\r\n", pos);
+		if (colon == std::string::npos || colon > eol)
+			continue;
+		std::string name = head.substr(pos, colon - pos);
+		std::string value = head.substr(colon + 1, (eol == std::string::npos ? head.size() : eol) - colon - 1);
+		while (!value.empty() && value[0] == ' ')
+			value.erase(0, 1);
+		if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+			c->remaining = strtoull(value.c_str(), 0, 10);
+			has_length = true;
+		} else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0 && strcasestr(value.c_str(), "chunked")) {
+			c->phase = CHUNK_SIZE;
+		} else if (strcasecmp(name.c_str(), "Connection") == 0 && strcasecmp(value.c_str(), "close") == 0) {
+			c->close_after = true;
+		}
+	}
+	if (head_only_ || c->status == 204 || c->status == 304 || (c->status >= 100 && c->status < 200)) {
+		c->phase = BODY;
+		c->remaining = 0;
+	} else if (c->phase != CHUNK_SIZE && has_length) {
+		c->phase = BODY;
+	}
+	return true;
+}
+
+bool
+Worker::Parse(Conn *c)
+{
+	while (c->state == OPEN) {
+		size_t avail = c->in_w - c->in_r;
+		switch (c->phase) {
+		case HEAD:
+			if (!ParseHead(c))
+				return true;
+			// an interim response is not the answer
+			if (c->status >= 100 && c->status < 200) {
+				c->phase = HEAD;
+				continue;
+			}
+			break;
+		case BODY:
+			if (avail < c->remaining) {
+				c->remaining -= avail;
+				c->in_r = c->in_w;
+				return true;
+			}
+			c->in_r += c->remaining;
+			Complete(c);
+			break;
+		case CHUNK_SIZE:
+		case CHUNK_END:
+		case TRAILER: {
+			const char *p = &c->in[c->in_r];
+			const char *eol = (const char*) memmem(p, avail, "\r\n", 2);
+			if (!eol)
+				return true;
+			c->in_r += eol + 2 - p;
+			if (c->phase == CHUNK_SIZE) {
+				c->remaining = strtoull(p, 0, 16);
+				c->phase = c->remaining ? CHUNK_DATA : TRAILER;
+			} else if (c->phase == CHUNK_END) {
+				c->phase = CHUNK_SIZE;
+			} else if (eol == p) {
+				Complete(c);
+			}
+			break;
+		}
+		case CHUNK_DATA:
+			if (avail < c->remaining) {
+				c->remaining -= avail;
+				c->in_r = c->in_w;
+				return true;
+			}
+			c->in_r += c->remaining;
+			c->phase = CHUNK_END;
+			break;
+		case UNTIL_CLOSE:
+			c->in_r = c->in_w;
+			return true;
+		}
+	}
+	return c->state == OPEN;
+}
+
+void
+Worker::Complete(Conn *c)
+{
+	uint64_t due = c->sent.front();
+	c->sent.pop_front();
+	c->phase = HEAD;
+	now_ = now_ns();
+	// only requests due in the window count, the warm-up and the tail are left out
+	if (due >= measure_from_ && due < end_) {
+		result_.latency.Record(now_ - due);
+		++result_.requests;
+		if (c->status < 200 || c->status >= 300)
+			++result_.non_2xx;
+	}
+	if (c->close_after || !sc_.keepalive) {
+		Drop(c, false);
+		return;
+	}
+	Refill(c);
+}
+
+void
+Worker::Run()
+{
+	struct epoll_event events[256];
+	struct itimerspec its;
+
+	epfd_ = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = 0;
+	epoll_ctl(epfd_, EPOLL_CTL_ADD, timer_fd_, &ev);
+	for (size_t i = 0; i < conns_.size(); ++i)
+		conns_[i].in.resize(READ_BUF);
+
+	now_ = now_ns();
+	while (now_ < end_) {
+		uint64_t wake = end_;
+		for (size_t i = 0; i < conns_.size(); ++i) {
+			Conn *c = &conns_[i];
+			if (c->state == CLOSED && c->retry_at <= now_)
+				Connect(c);
+			if (c->state == CLOSED && c->retry_at < wake)
+				wake = c->retry_at;
+		}
+		if (interval_ > 0) {
+			// every request due by now goes to a connection with room, or waits
+			uint64_t due;
+			while ((due = start_ + (uint64_t) (issued_ * interval_)) <= now_) {
+				++issued_;
+				backlog_.push_back(due);
+				for (size_t tries = 0; tries < conns_.size() && !backlog_.empty(); ++tries) {
+					Conn *c = &conns_[next_conn_];
+					next_conn_ = (next_conn_ + 1) % conns_.size();
+					if (c->state == OPEN && (int) c->sent.size() < depth_)
+						Refill(c);
+				}
+			}
+			if (due < wake)
+				wake = due;
+		}
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = wake / 1000000000ULL;
+		its.it_value.tv_nsec = wake % 1000000000ULL;
+		timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, 0);
+
+		int n = epoll_wait(epfd_, events, 256, -1);
+		now_ = now_ns();
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == 0) {
+				uint64_t expired;
+				if (read(timer_fd_, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+					perror("timerfd read error in Worker::Run");
+				continue;
+			}
+			HandleEvent((Conn*) events[i].data.ptr, events[i].events);
+		}
+	}
+	result_.unsent = backlog_.size();
+	for (size_t i = 0; i < conns_.size(); ++i) {
+		if (conns_[i].fd >= 0)
+			close(conns_[i].fd);
+	}
+	close(timer_fd_);
+	close(epfd_);
+}
+
+/// @brief the frame's server for a run, on loopback
+struct LocalServer {
+	std::unique_ptr<HttpServer> http;
+	std::unique_ptr<StaticFileHandler> files;
+	std::string dir;
+
+	~LocalServer() {
+		if (http)
+			http->Stop();
+		if (!dir.empty()) {
+			unlink((dir + "/4k.html").c_str());
+			rmdir(dir.c_str());
+		}
+	}
+};
+
+/// @return the port, -1 on error
+static int
+start_server(Scenario &sc, LocalServer &srv)
+{
+	srv.http.reset(new HttpServer("127.0.0.1", 0, sc.loops, sc.backend != "epoll"));
+	if (sc.accept == "sharded")
+		srv.http->SetAcceptMode(ACCEPT_SHARDED);
+	else if (sc.accept == "sharded_cpu")
+		srv.http->SetAcceptMode(ACCEPT_SHARDED_CPU);
+	if (sc.server == "hello") {
+		srv.http->SetHandler([](const HttpRequest&, HttpResponse &resp) {
+			resp.AddHeader("Content-Type", "text/plain");
+			resp.SetBody("Hello, world!");
+		});
+		if (sc.path.empty())
+			sc.path = "/";
+	} else if (sc.server == "static") {
+		char dir[] = "/tmp/http_load_XXXXXX";
+		if (!mkdtemp(dir))
+			return -1;
+		srv.dir = dir;
+		std::string page(4096, 'x');
+		std::ofstream(srv.dir + "/4k.html") << page;
+		srv.files.reset(new StaticFileHandler(srv.dir));
+		StaticFileHandler *files = srv.files.get();
+		srv.http->SetHandler([files](const HttpRequest &req, HttpResponse &resp) { files->Handle(req, resp);});
+		if (sc.path.empty())
+			sc.path = "/4k.html";
+	} else {
+		fprintf(stderr, "http_load: unknown server '%s'\n", sc.server.c_str());
+		return -1;
+	}
+	if (srv.http->Start() != 0)
+		return -1;
+	sc.backend = srv.http->GetServer().IsUring() ? "uring" : "epoll";
+	return srv.http->GetPort();
+}
+
+static std::string
+build_request(const Scenario &sc, const std::string &host)
+{
+	std::string req = sc.method + " " + sc.path + " HTTP/1.1\r\nHost: " + host + "\r\nUser-Agent: http_load\r\n";
+	for (size_t i = 0; i < sc.headers.size(); ++i)
+		req += sc.headers[i] + "\r\n";
+	if (!sc.keepalive)
+		req += "Connection: close\r\n";
+	if (!sc.body.empty())
+		req += "Content-Length: " + std::to_string(sc.body.size()) + "\r\n";
+	return req + "\r\n" + sc.body;
+}
+
+static void
+print_result(const Scenario &sc, const Result &r, double seconds, bool json, bool header)
+{
+	const Histogram &h = r.latency;
+	char line[2048];
+	double rps = r.requests / seconds;
+
+	if (json) {
+		snprintf(line, sizeof(line),
+			"{\"scenario\":\"%s\",\"server\":\"%s\",\"backend\":\"%s\",\"mode\":\"%s\",\"threads\":%d,"
+			"\"conns\":%d,\"pipeline\":%d,\"keepalive\":%s,\"rate\":%.0f,\"seconds\":%.3f,"
+			"\"requests\":%llu,\"rps\":%.1f,\"mb_per_s\":%.3f,\"non_2xx\":%llu,\"errors\":%llu,"
+			"\"connects\":%llu,\"unsent\":%llu,\"latency_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,"
+			"\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"p9999\":%.1f,\"max\":%.1f}}",
+			sc.name.c_str(), sc.server.c_str(), sc.backend.c_str(), sc.rate > 0 ? "open" : "closed",
+			sc.threads, sc.conns, sc.pipeline, sc.keepalive ? "true" : "false", sc.rate, seconds,
+			(unsigned long long) r.requests, rps, r.bytes / seconds / 1e6,
+			(unsigned long long) r.non_2xx, (unsigned long long) r.errors,
+			(unsigned long long) r.connects, (unsigned long long) r.unsent,
+			h.Min() / 1e3, h.Mean() / 1e3, h.Percentile(50) / 1e3, h.Percentile(90) / 1e3,
+			h.Percentile(99) / 1e3, h.Percentile(99.9) / 1e3, h.Percentile(99.99) / 1e3, h.Max() / 1e3);
+		printf("%s\n", line);
+		fflush(stdout);
+		return;
+	}
+	if (header)
+		printf("scenario\tserver\tbackend\tmode\tthreads\tconns\tpipeline\tkeepalive\trate\t"
+			"requests\trps\tMB_per_s\tnon_2xx\terrors\tconnects\tunsent\t"
+			"min_us\tmean_us\tp50_us\tp90_us\tp99_us\tp999_us\tp9999_us\tmax_us\n");
+	printf("%s\t%s\t%s\t%s\t%d\t%d\t%d\t%d\t%.0f\t%llu\t%.1f\t%.3f\t%llu\t%llu\t%llu\t%llu\t"
+		"%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+		sc.name.c_str(), sc.server.c_str(), sc.backend.c_str(), sc.rate > 0 ? "open" : "closed",
+		sc.threads, sc.conns, sc.pipeline, sc.keepalive ? 1 : 0, sc.rate,
+		(unsigned long long) r.requests, rps, r.bytes / seconds / 1e6,
+		(unsigned long long) r.non_2xx, (unsigned long long) r.errors,
+		(unsigned long long) r.connects, (unsigned long long) r.unsent,
+		h.Min() / 1e3, h.Mean() / 1e3, h.Percentile(50) / 1e3, h.Percentile(90) / 1e3,
+		h.Percentile(99) / 1e3, h.Percentile(99.9) / 1e3, h.Percentile(99.99) / 1e3, h.Max() / 1e3);
+	fflush(stdout);
+}
+
+/// @return 0 when the run completed
+static int
+run(Scenario sc, bool json, bool header)
+{
+	LocalServer srv;
+	struct sockaddr_in addr;
+	std::string host;
+	int port;
+
+	if (sc.server != "none") {
+		if ((port = start_server(sc, srv)) < 0) {
+			fprintf(stderr, "http_load: %s: server did not start\n", sc.name.c_str());
+			return -1;
+		}
+		host = "127.0.0.1";
+	} else {
+		size_t colon = sc.target.rfind(':');
+		host = sc.target.substr(0, colon);
+		port = colon == std::string::npos ? 80 : atoi(sc.target.c_str() + colon + 1);
+		if (sc.path.empty())
+			sc.path = "/";
+		sc.backend = "-";
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+		fprintf(stderr, "http_load: %s: bad address %s\n", sc.name.c_str(), host.c_str());
+		return -1;
+	}
+	if (sc.threads < 1)
+		sc.threads = 1;
+	if (sc.conns < sc.threads)
+		sc.conns = sc.threads;
+	std::string request = build_request(sc, host + ":" + std::to_string(port));
+
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::vector<std::thread> threads;
+	uint64_t start = now_ns();
+	uint64_t measure_from = start + (uint64_t) (sc.warmup * 1e9);
+	uint64_t end = measure_from + (uint64_t) (sc.duration * 1e9);
+	for (int t = 0; t < sc.threads; ++t) {
+		int nconns = sc.conns / sc.threads + (t < sc.conns % sc.threads);
+		// the threads' schedules are staggered so they do not send in step
+		double rate = sc.rate / sc.threads;
+		uint64_t offset = rate > 0 ? (uint64_t) (1e9 / rate * t / sc.threads) : 0;
+		workers.emplace_back(new Worker(sc, addr, request, nconns, rate, start + offset, measure_from, end));
+	}
+	for (int t = 0; t < sc.threads; ++t)
+		threads.emplace_back([&workers, t]() { workers[t]->Run();});
+	Result total;
+	for (int t = 0; t < sc.threads; ++t) {
+		threads[t].join();
+		total.Merge(workers[t]->GetResult());
+	}
+	print_result(sc, total, sc.duration, json, header);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	std::vector<Scenario> runs;
+	Scenario cli;
+	bool json = false, have_cli = false;
+	const char *script = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-o" && i + 1 < argc) {
+			json = strcmp(argv[++i], "json") == 0;
+		} else if (arg == "-f" && i + 1 < argc) {
+			script = argv[++i];
+		} else if (parse_setting(cli, arg)) {
+			have_cli = true;
+		} else {
+			fprintf(stderr, "usage: http_load [-o tsv|json] [-f script | key=value ...]\n");
+			return 2;
+		}
+	}
+	if (script) {
+		std::ifstream in(script);
+		if (!in || !parse_script(in, runs))
+			return 2;
+	} else if (have_cli) {
+		runs.push_back(cli);
+	} else {
+		std::istringstream in(s_builtin);
+		parse_script(in, runs);
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < runs.size(); ++i) {
+		if (run(runs[i], json, i == 0) != 0)
+			++failed;
+	}
+	return failed ? 1 : 0;
+}
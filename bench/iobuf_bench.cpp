@@ -0,0 +1,234 @@
+#include "iobuf.h"
+#include "buffer.h"
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// 1. response assembly: a head of ten headers plus a body that is already in
+//    memory (a cached file), built with std::string, std::stringstream and
+//    IOBuf, then written with one write/writev to /dev/null
+// 2. partial writes: 1MB responses through a socket with a small send buffer,
+//    the unsent rest kept as a std::string erased from the front, in a
+//    Buffer, or in an IOBuf
+// usage: iobuf_bench [seconds_per_case]
+
+using namespace ekko;
+
+static double
+now_s()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char *s_headers[][2] = {
+	{ "Server", "ekko" },
+	{ "Date", "Mon, 19 Oct 2026 10:00:00 GMT" },
+	{ "Content-Type", "text/html; charset=utf-8" },
+	{ "Cache-Control", "public, max-age=3600" },
+	{ "ETag", "\"5d8c72a5edda8d6a\"" },
+	{ "Last-Modified", "Tue, 14 May 2024 09:12:44 GMT" },
+	{ "Vary", "Accept-Encoding" },
+	{ "X-Request-Id", "3e0a3c54-7b7e-4f0b-9b6f-2b0c1f2f8a11" },
+	{ "X-Frame-Options", "DENY" },
+	{ "Connection", "keep-alive" },
+};
+
+static const int s_nheaders = sizeof(s_headers) / sizeof(s_headers[0]);
+
+static void
+report(const char *bench, const char *how, size_t body, uint64_t ops, double elapsed)
+{
+	printf("%s\t%s\t%zu\t%.0f\t%.1f\n", bench, how, body, ops / elapsed, elapsed * 1e9 / ops);
+}
+
+static void
+assemble_string(int fd, const std::string &body)
+{
+	std::string out;
+	out += "HTTP/1.1 200 OK\r\n";
+	for (int i = 0; i < s_nheaders; ++i) {
+		out += s_headers[i][0];
+		out += ": ";
+		out += s_headers[i][1];
+		out += "\r\n";
+	}
+	out += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+	out += body;
+	if (write(fd, out.data(), out.size()) < 0)
+		exit(1);
+}
+
+static void
+assemble_stream(int fd, const std::string &body)
+{
+	std::stringstream ss;
+	ss << "HTTP/1.1 200 OK\r\n";
+	for (int i = 0; i < s_nheaders; ++i)
+		ss << s_headers[i][0] << ": " << s_headers[i][1] << "\r\n";
+	ss << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+	std::string out = ss.str();
+	if (write(fd, out.data(), out.size()) < 0)
+		exit(1);
+}
+
+static void
+assemble_iobuf(int fd, const IOBuf &body)
+{
+	char line[64];
+	IOBuf out;
+	out.Append("HTTP/1.1 200 OK\r\n");
+	for (int i = 0; i < s_nheaders; ++i) {
+		out.Append(s_headers[i][0]);
+		out.Append(": ");
+		out.Append(s_headers[i][1]);
+		out.Append("\r\n");
+	}
+	int n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n\r\n", body.Size());
+	out.Append(line, n);
+	out.Append(body);
+	if (out.WriteTo(fd) < 0)
+		exit(1);
+}
+
+static void
+bench_assembly(size_t body_size, double seconds)
+{
+	int fd = open("/dev/null", O_WRONLY);
+	std::string body(body_size, 'b');
+	IOBuf shared;
+	shared.Append(body);
+	const char *names[] = { "string", "stringstream", "iobuf" };
+
+	for (int how = 0; how < 3; ++how) {
+		uint64_t ops = 0;
+		double start = now_s(), deadline = start + seconds;
+		while (now_s() < deadline) {
+			for (int i = 0; i < 1000; ++i) {
+				if (how == 0)
+					assemble_string(fd, body);
+				else if (how == 1)
+					assemble_stream(fd, body);
+				else
+					assemble_iobuf(fd, shared);
+			}
+			ops += 1000;
+		}
+		report("assembly", names[how], body_size, ops, now_s() - start);
+	}
+	close(fd);
+}
+
+// sends one response of len bytes through fd, waiting on nothing: EAGAIN
+// just retries, the reader thread drains the other end
+static void
+send_string(int fd, const std::string &resp, uint64_t &calls)
+{
+	std::string pending = resp;
+	while (!pending.empty()) {
+		ssize_t n = send(fd, pending.data(), pending.size(), MSG_NOSIGNAL);
+		++calls;
+		if (n > 0)
+			pending.erase(0, n);
+		else if (errno != EAGAIN)
+			exit(1);
+	}
+}
+
+static void
+send_buffer(int fd, const std::string &resp, uint64_t &calls)
+{
+	Buffer pending;
+	pending.Append(resp.data(), resp.size());
+	while (pending.ReadableBytes()) {
+		ssize_t n = send(fd, pending.Peek(), pending.ReadableBytes(), MSG_NOSIGNAL);
+		++calls;
+		if (n > 0)
+			pending.Retrieve(n);
+		else if (errno != EAGAIN)
+			exit(1);
+	}
+}
+
+static void
+send_iobuf(int fd, const IOBuf &resp, uint64_t &calls)
+{
+	IOBuf pending(resp);
+	while (!pending.Empty()) {
+		ssize_t n = pending.SendTo(fd);
+		++calls;
+		if (n < 0 && errno != EAGAIN)
+			exit(1);
+	}
+}
+
+static void
+bench_partial(size_t resp_size, double seconds)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		exit(1);
+	int sndbuf = 16384;
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	std::thread reader([&]() {
+		char buf[65536];
+		while (read(fds[1], buf, sizeof(buf)) > 0)
+			;
+	});
+
+	std::string resp(resp_size, 'r');
+	// a response chained the way a server builds it: head plus body slices
+	IOBuf chained;
+	chained.Append(resp.data(), 256);
+	for (size_t off = 256; off < resp_size; off += 65536) {
+		IOBuf piece;
+		piece.Append(resp.data() + off, resp_size - off < 65536 ? resp_size - off : 65536);
+		chained.Append(piece);
+	}
+	const char *names[] = { "string_erase", "buffer", "iobuf" };
+
+	for (int how = 0; how < 3; ++how) {
+		uint64_t ops = 0, calls = 0;
+		double start = now_s(), deadline = start + seconds;
+		while (now_s() < deadline) {
+			if (how == 0)
+				send_string(fds[0], resp, calls);
+			else if (how == 1)
+				send_buffer(fds[0], resp, calls);
+			else
+				send_iobuf(fds[0], chained, calls);
+			++ops;
+		}
+		double elapsed = now_s() - start;
+		printf("partial\t%s\t%zu\t%.0f\t%.1f\t%.1f\n", names[how], resp_size, ops / elapsed,
+			resp_size * ops / elapsed / 1e6, (double) calls / ops);
+	}
+	shutdown(fds[0], SHUT_WR);
+	reader.join();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(int argc, char **argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 1;
+
+	printf("bench\thow\tbody\tops_per_sec\tns_per_op\n");
+	size_t bodies[] = { 128, 4096, 65536, 1 << 20 };
+	for (int i = 0; i < 4; ++i)
+		bench_assembly(bodies[i], seconds);
+
+	printf("bench\thow\tbytes\tresp_per_sec\tMB_per_sec\tsends_per_resp\n");
+	bench_partial(1 << 20, seconds);
+	bench_partial(8 << 20, seconds);
+}
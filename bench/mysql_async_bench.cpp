@@ -0,0 +1,150 @@
+#include "histogram.h"
+#include "async_mysql.h"
+#include "mysql_pool.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Queries per second per thread, on a local mysqld: "SELECT 1" over and
+// over, first on the blocking MysqlPool, `threads` threads each holding a
+// connection for the whole round trip, then on AsyncMysql, one event loop
+// thread keeping `inflight` queries going over as many connections, with
+// the callbacks on a thread pool of 1 and of 2 workers; each callback
+// submits the next query. The blocking pool needs a thread per query in
+// flight, AsyncMysql a few threads whatever the number: qps_per_thread
+// counts every thread that works, the loop and the workers included.
+// Latency is from submitting a query to its callback.
+// usage: mysql_async_bench host user password database [inflight] [seconds]
+
+using namespace ekko;
+
+#define SQL "SELECT 1"
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+report(const char *name, int threads, int inflight, uint64_t done, uint64_t failed, double seconds, Histogram &h)
+{
+	printf("%s\t%d\t%d\t%.0f\t%.0f\t%.1f\t%.1f\t%lu\n", name, threads, inflight, done / seconds,
+		done / seconds / threads, h.Percentile(50) / 1e3, h.Percentile(99) / 1e3, (unsigned long) failed);
+}
+
+static void
+run_blocking(char **argv, int threads, int seconds)
+{
+	MysqlPool *pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, threads);
+	pool->setMaintenance(threads);
+	pool->start();
+	std::vector<Histogram> hists(threads);
+	std::vector<uint64_t> failed(threads);
+	std::vector<std::thread> workers;
+	uint64_t start = now_ns(), end = start + seconds * 1000000000ULL;
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			ResultSet rs;
+			uint64_t begin;
+			while ((begin = now_ns()) < end) {
+				if (!pool->query(SQL, rs))
+					++failed[t];
+				hists[t].Record(now_ns() - begin);
+			}
+		});
+	}
+	Histogram total;
+	uint64_t fails = 0;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total.Merge(hists[t]);
+		fails += failed[t];
+	}
+	report("blocking_pool", threads, threads, total.Count(), fails, (now_ns() - start) / 1e9, total);
+	delete pool;
+}
+
+struct async_run_t {
+	AsyncMysql *mysql;
+	std::atomic<bool> stop{false};
+	std::atomic<int> outstanding{0};
+	std::atomic<uint64_t> done{0};
+	std::atomic<uint64_t> failed{0};
+	std::mutex lock;
+	Histogram hist;
+
+	void Submit() {
+		uint64_t begin = now_ns();
+		++outstanding;
+		mysql->query(SQL, [this, begin](bool ok, ResultSet &) {
+			uint64_t ns = now_ns() - begin;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				hist.Record(ns);
+			}
+			++done;
+			if (!ok)
+				++failed;
+			if (!stop.load())
+				Submit();
+			--outstanding;
+		});
+	}
+};
+
+static void
+run_async(char **argv, int workers, int inflight, int seconds)
+{
+	EventLoop loop;
+	thread_pool_t pool;
+	thread_pool_init(&pool, workers);
+	AsyncMysql mysql(&loop, &pool);
+	if (!mysql.connect(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, inflight)) {
+		fprintf(stderr, "connect failed\n");
+		exit(1);
+	}
+	async_run_t run;
+	run.mysql = &mysql;
+	std::thread looper([&]() { loop.Loop(); });
+	uint64_t start = now_ns();
+	for (int i = 0; i < inflight; ++i)
+		run.Submit();
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	run.stop = true;
+	uint64_t done = run.done.load();
+	double elapsed = (now_ns() - start) / 1e9;
+	while (run.outstanding.load() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	loop.Stop();
+	looper.join();
+	thread_pool_destroy(&pool);
+	mysql.close();
+	char name[32];
+	snprintf(name, sizeof(name), "async_%d_workers", workers);
+	report(name, 1 + workers, inflight, done, run.failed.load(), elapsed, run.hist);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s host user password database [inflight] [seconds]\n", argv[0]);
+		return 1;
+	}
+	int inflight = argc > 5 ? atoi(argv[5]) : 64;
+	int seconds = argc > 6 ? atoi(argv[6]) : 5;
+
+	printf("mode\tthreads\tinflight\tqps\tqps_per_thread\tp50_us\tp99_us\tfailed\n");
+	run_blocking(argv, inflight, seconds);
+	run_async(argv, 1, inflight, seconds);
+	run_async(argv, 2, inflight, seconds);
+}
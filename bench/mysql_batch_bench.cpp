@@ -0,0 +1,140 @@
+#include "histogram.h"
+#include "insert_batcher.h"
+#include "mysql_pool.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Round trips saved by batching, on a local mysqld. First, what a handler
+// does: an audit row, a counter bumped, the counter read back, three
+// statements one after the other on a connection, then the same three in
+// one batch(). Then `threads` threads (64 by default) each inserting single
+// audit rows for `seconds`: one INSERT per row, and through an
+// InsertBatcher with windows of 0, 200us and 1ms, which coalesces the rows
+// of concurrent callers into multi-row INSERTs. Latency is per call, the
+// time one caller waits for its row; statements is what went to the
+// server, round_trips_saved rows minus statements.
+// usage: mysql_batch_bench host user password database [threads] [seconds]
+
+using namespace ekko;
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+run_group(MysqlPool *pool, bool batched, int seconds)
+{
+	PooledConnection conn = pool->acquire();
+	ResultSet rs;
+	std::vector<ResultSet> results;
+	Histogram h;
+	uint64_t failed = 0, end = now_ns() + seconds * 1000000000ULL, begin;
+	const char *sql[3] = {
+		"INSERT INTO batch_bench_audit (user_id, action) VALUES (1, 'view')",
+		"UPDATE batch_bench_counter SET hits = hits + 1 WHERE id = 1",
+		"SELECT hits FROM batch_bench_counter WHERE id = 1",
+	};
+	std::string joined = std::string(sql[0]) + ";" + sql[1] + ";" + sql[2];
+
+	while ((begin = now_ns()) < end) {
+		bool ok = true;
+		if (batched) {
+			ok = conn.batch(joined.c_str(), results) && results.size() == 3;
+		} else {
+			for (int i = 0; i < 3; ++i)
+				ok = conn.query(sql[i], rs) && ok;
+		}
+		h.Record(now_ns() - begin);
+		failed += !ok;
+	}
+	printf("%s\t3\t%d\t%lu\t%.1f\t%.1f\t%lu\n", batched ? "batch" : "one_by_one", batched ? 1 : 3,
+		(unsigned long) h.Count(), h.Percentile(50) / 1e3, h.Percentile(99) / 1e3, (unsigned long) failed);
+}
+
+static void
+run_inserts(const char *name, MysqlPool *pool, InsertBatcher *batcher, int threads, int seconds)
+{
+	std::vector<Histogram> hists(threads);
+	std::vector<uint64_t> failed(threads);
+	std::vector<std::thread> workers;
+	uint64_t start = now_ns(), end = start + seconds * 1000000000ULL;
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			ResultSet rs;
+			char sql[128];
+			uint64_t begin;
+			while ((begin = now_ns()) < end) {
+				bool ok;
+				if (batcher) {
+					ok = batcher->insertRow(t, "view");
+				} else {
+					snprintf(sql, sizeof(sql), "INSERT INTO batch_bench_audit (user_id, action) VALUES (%d, 'view')", t);
+					ok = pool->query(sql, rs);
+				}
+				hists[t].Record(now_ns() - begin);
+				failed[t] += !ok;
+			}
+		});
+	}
+	Histogram total;
+	uint64_t fails = 0;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total.Merge(hists[t]);
+		fails += failed[t];
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+	uint64_t rows = total.Count(), statements = rows;
+	if (batcher) {
+		InsertBatcherStats s = batcher->getStats();
+		statements = s.statements;
+	}
+	printf("%s\t%d\t%.0f\t%.1f\t%.1f\t%lu\t%lu\t%lu\n", name, threads, rows / elapsed, total.Percentile(50) / 1e3,
+		total.Percentile(99) / 1e3, (unsigned long) statements, (unsigned long) (rows - statements),
+		(unsigned long) fails);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s host user password database [threads] [seconds]\n", argv[0]);
+		return 1;
+	}
+	int threads = argc > 5 ? atoi(argv[5]) : 64;
+	int seconds = argc > 6 ? atoi(argv[6]) : 5;
+	MysqlPool *pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, CLIENT_MULTI_STATEMENTS, threads);
+	pool->setMaintenance(threads);
+	pool->start();
+	ResultSet rs;
+	pool->query("CREATE TABLE IF NOT EXISTS batch_bench_audit (id BIGINT AUTO_INCREMENT PRIMARY KEY, "
+		"user_id BIGINT, action VARCHAR(32))", rs);
+	pool->query("CREATE TABLE IF NOT EXISTS batch_bench_counter (id INT PRIMARY KEY, hits BIGINT)", rs);
+	pool->query("INSERT IGNORE INTO batch_bench_counter VALUES (1, 0)", rs);
+
+	printf("group\tstatements\tround_trips\tgroups\tp50_us\tp99_us\tfailed\n");
+	run_group(pool, false, seconds);
+	run_group(pool, true, seconds);
+
+	printf("\ninsert\tthreads\trows_per_sec\tp50_us\tp99_us\tstatements\tround_trips_saved\tfailed\n");
+	run_inserts("one_per_row", pool, NULL, threads, seconds);
+	unsigned int windows[] = { 0, 200, 1000 };
+	for (unsigned int w : windows) {
+		InsertBatcher batcher(pool, "INSERT INTO batch_bench_audit (user_id, action) VALUES", MYSQL_INSERT_BATCH_ROWS, w);
+		char name[32];
+		snprintf(name, sizeof(name), "batched_%uus", w);
+		run_inserts(name, pool, &batcher, threads, seconds);
+	}
+	pool->query("DROP TABLE batch_bench_audit", rs);
+	pool->query("DROP TABLE batch_bench_counter", rs);
+	delete pool;
+}
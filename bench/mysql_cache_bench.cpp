@@ -0,0 +1,118 @@
+#include "histogram.h"
+#include "query_cache.h"
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The result cache in front of the pool, on a local mysqld. A table of
+// 1000 rows; `threads` threads (32 by default) read rows by id, nine reads
+// in ten among the first 50 ids, for `seconds` each, straight through the
+// pool and through a QueryCache, with no writes, then 1 and 10 writes in
+// 1000 requests, UPDATEs of a random row, which through the cache drop
+// every cached result of the table. After that, the cost of a hit alone:
+// one thread asking for the same cached row over and over.
+// usage: mysql_cache_bench host user password database [threads] [seconds]
+
+using namespace ekko;
+
+#define ROWS 1000
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+run_case(const char *name, MysqlPool *pool, QueryCache *cache, int writes_per_mille, int threads, int seconds)
+{
+	std::vector<Histogram> hists(threads);
+	std::vector<uint64_t> failed(threads);
+	std::vector<std::thread> workers;
+	uint64_t start = now_ns(), end = start + seconds * 1000000000ULL;
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			std::mt19937 rng(t);
+			ResultSet rs;
+			char sql[128];
+			uint64_t begin;
+			while ((begin = now_ns()) < end) {
+				int id = rng() % 10 ? rng() % 50 : rng() % ROWS;
+				bool ok;
+				if ((int) (rng() % 1000) < writes_per_mille) {
+					snprintf(sql, sizeof(sql), "UPDATE cache_bench SET hits = hits + 1 WHERE id = %d", id);
+					ok = cache ? (bool) cache->query(sql) : pool->query(sql, rs);
+				} else {
+					snprintf(sql, sizeof(sql), "SELECT id, name, hits FROM cache_bench WHERE id = %d", id);
+					ok = cache ? (bool) cache->query(sql) : pool->query(sql, rs);
+				}
+				hists[t].Record(now_ns() - begin);
+				failed[t] += !ok;
+			}
+		});
+	}
+	Histogram total;
+	uint64_t fails = 0;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total.Merge(hists[t]);
+		fails += failed[t];
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+	QueryCacheStats s;
+	memset(&s, 0, sizeof(s));
+	if (cache)
+		s = cache->getStats();
+	printf("%s\t%d\t%.0f\t%.1f\t%.1f\t%.3f\t%lu\t%lu\t%lu\t%lu\t%lu\n", name, writes_per_mille,
+		total.Count() / elapsed, total.Percentile(50) / 1e3, total.Percentile(99) / 1e3,
+		s.hits + s.misses + s.shared ? (double) s.hits / (s.hits + s.misses + s.shared) : 0.0,
+		(unsigned long) s.misses, (unsigned long) s.shared, (unsigned long) s.invalidations,
+		(unsigned long) s.stale, (unsigned long) fails);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s host user password database [threads] [seconds]\n", argv[0]);
+		return 1;
+	}
+	int threads = argc > 5 ? atoi(argv[5]) : 32;
+	int seconds = argc > 6 ? atoi(argv[6]) : 5;
+	MysqlPool *pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, threads);
+	pool->setMaintenance(threads);
+	pool->start();
+	ResultSet rs;
+	pool->query("DROP TABLE IF EXISTS cache_bench", rs);
+	pool->query("CREATE TABLE cache_bench (id INT PRIMARY KEY, name VARCHAR(64), hits BIGINT)", rs);
+	std::string insert = "INSERT INTO cache_bench VALUES ";
+	for (int i = 0; i < ROWS; ++i)
+		insert += (i ? ",(" : "(") + std::to_string(i) + ",'name" + std::to_string(i) + "',0)";
+	pool->query(insert.c_str(), rs);
+
+	printf("mode\twrites_per_mille\tqps\tp50_us\tp99_us\thit_ratio\tmisses\tshared\tinvalidations\tstale\tfailed\n");
+	int writes[] = { 0, 1, 10 };
+	for (int w : writes) {
+		run_case("pool", pool, NULL, w, threads, seconds);
+		QueryCache cache(pool);
+		run_case("cache", pool, &cache, w, threads, seconds);
+	}
+
+	QueryCache cache(pool);
+	cache.query("SELECT id, name, hits FROM cache_bench WHERE id = 1");
+	size_t n = 1000000, sink = 0;
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < n; ++i)
+		sink += cache.query("SELECT id, name, hits FROM cache_bench WHERE id = 1")->rowCount();
+	printf("\nhit_ns\t%.1f\tsink\t%zu\n", (double) (now_ns() - start) / n, sink);
+	pool->query("DROP TABLE cache_bench", rs);
+	delete pool;
+}
@@ -0,0 +1,112 @@
+#include "histogram.h"
+#include "mysql_cluster.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Read/write splitting over several local mysqld instances on one host, a
+// primary and replicas on their own ports. `threads` threads (32 by
+// default) each serve 1000 sessions, picking one at random per request:
+// 1 request in 100 is a write ("DO 0" counts as one), the rest "SELECT 1"
+// reads, for `seconds` with each routing. A session that wrote reads from
+// the primary for MYSQL_STICKY_MS. Every second the requests each host took
+// and whether it is ejected are printed: stop a replica during a run to see
+// it ejected, its reads moved, and taken back once it is up again.
+// usage: mysql_cluster_bench host user password database primary_port replica_port[,replica_port...] [threads] [seconds]
+
+using namespace ekko;
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+run_case(const char *name, MysqlCluster &cluster, int threads, int seconds)
+{
+	std::vector<Histogram> hists(threads);
+	std::vector<uint64_t> failed(threads);
+	std::vector<std::thread> workers;
+	std::atomic<bool> stop(false);
+	uint64_t start = now_ns();
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			std::vector<MysqlSession> sessions(1000);
+			std::mt19937 rng(t);
+			ResultSet rs;
+			while (!stop.load(std::memory_order_relaxed)) {
+				MysqlSession *session = &sessions[rng() % sessions.size()];
+				bool write = rng() % 100 == 0;
+				uint64_t begin = now_ns();
+				bool ok = cluster.query(write ? "DO 0" : "SELECT 1", rs, session);
+				if (!write)
+					hists[t].Record(now_ns() - begin);
+				failed[t] += !ok;
+			}
+		});
+	}
+	std::vector<MysqlHostStats> last = cluster.getStats();
+	for (int s = 1; s <= seconds; ++s) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		std::vector<MysqlHostStats> now = cluster.getStats();
+		printf("%s\t%d", name, s);
+		for (size_t i = 0; i < now.size(); ++i)
+			printf("\t%u:%lu%s", now[i].port, (unsigned long) (now[i].queries - last[i].queries),
+				now[i].healthy ? "" : "(ejected)");
+		printf("\n");
+		fflush(stdout);
+		last = now;
+	}
+	stop = true;
+	Histogram total;
+	uint64_t fails = 0;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total.Merge(hists[t]);
+		fails += failed[t];
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+	printf("%s\ttotal\treads_per_sec %.0f\tread_p50_us %.1f\tread_p99_us %.1f\tfailed %lu\n", name,
+		total.Count() / elapsed, total.Percentile(50) / 1e3, total.Percentile(99) / 1e3, (unsigned long) fails);
+	std::vector<MysqlHostStats> stats = cluster.getStats();
+	for (size_t i = 0; i < stats.size(); ++i)
+		printf("%s\t%s:%u\t%s\tqueries %lu\tfailures %lu\tejections %lu\tlatency_us %.1f\n", name,
+			stats[i].host.c_str(), stats[i].port, stats[i].primary ? "primary" : "replica",
+			(unsigned long) stats[i].queries, (unsigned long) stats[i].failures,
+			(unsigned long) stats[i].ejections, stats[i].latency_us);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 7) {
+		fprintf(stderr, "usage: %s host user password database primary_port replica_port[,replica_port...] "
+			"[threads] [seconds]\n", argv[0]);
+		return 1;
+	}
+	int threads = argc > 7 ? atoi(argv[7]) : 32;
+	int seconds = argc > 8 ? atoi(argv[8]) : 10;
+	const char *routings[] = { "least_outstanding", "latency_weighted" };
+	std::vector<int> ports;
+	for (char *port = strtok(argv[6], ","); port; port = strtok(NULL, ","))
+		ports.push_back(atoi(port));
+
+	for (int r = 0; r < 2; ++r) {
+		MysqlCluster cluster;
+		cluster.setPrimary(argv[1], argv[2], argv[3], argv[4], atoi(argv[5]), NULL, 0, threads);
+		for (size_t i = 0; i < ports.size(); ++i)
+			cluster.addReplica(argv[1], argv[2], argv[3], argv[4], ports[i], NULL, 0, threads);
+		cluster.setRouting(r == 0 ? MYSQL_LEAST_OUTSTANDING : MYSQL_LATENCY_WEIGHTED);
+		cluster.start();
+		run_case(routings[r], cluster, threads, seconds);
+	}
+}
@@ -0,0 +1,152 @@
+#include "fake_mysql_driver.h"
+#include "histogram.h"
+#include "mysql_pool.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The pool on FakeMysqlDriver, no server needed. The fake server takes
+// 500us per query at the median, log-normal with sigma 0.6, one query in
+// a thousand 20ms slower, and runs at most 16 queries at once, the rest
+// queueing as on a busy mysqld.
+// First the pool size: `threads` threads (64 by default) query through
+// pools of 4 to 64 connections for `seconds` each, a second to wait for a
+// connection; past the server's 16 more connections only move the queue
+// from the pool into the server. Then an outage: a pool of 16 connections
+// with the maintenance thread pinging them every round, the server down
+// from the 1st to the 2nd second, and per 250ms how many queries worked,
+// how many failed and how many connections the pool counted, the ones
+// being opened included.
+// usage: mysql_fake_bench [threads] [seconds]
+
+using namespace ekko;
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+setup(FakeMysqlDriver &fake)
+{
+	ResultSet rs;
+	rs.setColumns({ { "id", MYSQL_TYPE_LONGLONG, 0 }, { "name", MYSQL_TYPE_VAR_STRING, 0 } });
+	const char *row[] = { "1", "name1" };
+	unsigned long lengths[] = { 1, 5 };
+	rs.appendRow(row, lengths);
+	fake.addResult("select", rs);
+	fake.setConnectLatency(FakeLatency::fixed(2000));
+	fake.setQueryLatency(FakeLatency::lognormal(500, 0.6).withTail(0.001, 20000));
+	fake.setPingLatency(FakeLatency::fixed(100));
+	fake.setCapacity(16);
+}
+
+static void
+run_size(unsigned int connections, int threads, int seconds)
+{
+	FakeMysqlDriver fake;
+	setup(fake);
+	MysqlPool pool;
+	pool.setDriver(&fake);
+	pool.setParameter("fake", "user", "pwd", "db", 0, NULL, 0, connections);
+	pool.setMaintenance(connections);
+	pool.start();
+
+	std::vector<Histogram> hists(threads);
+	std::vector<uint64_t> failed(threads);
+	std::vector<std::thread> workers;
+	uint64_t start = now_ns(), end = start + seconds * 1000000000ULL;
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			ResultSet rs;
+			uint64_t begin;
+			while ((begin = now_ns()) < end) {
+				bool ok = pool.query("select id, name from users where id = 1", rs);
+				hists[t].Record(now_ns() - begin);
+				failed[t] += !ok;
+			}
+		});
+	}
+	Histogram total;
+	uint64_t fails = 0;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total.Merge(hists[t]);
+		fails += failed[t];
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+	MysqlPoolStats ps = pool.getStats();
+	FakeMysqlStats fs = fake.getStats();
+	printf("%u\t%.0f\t%.0f\t%.0f\t%.0f\t%lu\t%lu\t%u\t%lu\n", connections, total.Count() / elapsed,
+		total.Percentile(50) / 1e3, total.Percentile(99) / 1e3, total.Percentile(99.9) / 1e3,
+		(unsigned long) ps.waitPercentile(99), (unsigned long) ps.timeouts, fs.max_running,
+		(unsigned long) fails);
+}
+
+static void
+run_outage(int threads)
+{
+	FakeMysqlDriver fake;
+	setup(fake);
+	MysqlPool pool;
+	pool.setDriver(&fake);
+	pool.setParameter("fake", "user", "pwd", "db", 0, NULL, 0, 16);
+	pool.setMaintenance(16, 0);
+	pool.setAcquireTimeout(100);
+	pool.start();
+
+	const int slots = 16, slot_ms = 250;
+	std::vector<std::atomic<uint64_t> > ok(slots), failed(slots);
+	std::vector<unsigned int> total(slots);
+	uint64_t start = now_ns();
+	std::atomic<bool> running(true);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&]() {
+			ResultSet rs;
+			while (running) {
+				bool good = pool.query("select id, name from users where id = 1", rs);
+				size_t slot = (now_ns() - start) / 1000000 / slot_ms;
+				if (slot < (size_t) slots)
+					(good ? ok : failed)[slot]++;
+				if (!good)
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		});
+	}
+	for (int i = 0; i < slots; ++i) {
+		std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+			std::chrono::nanoseconds(start + (i + 1) * slot_ms * 1000000ULL)));
+		if (i == 3)
+			fake.setDown(true);
+		if (i == 7)
+			fake.setDown(false);
+		total[i] = pool.getStats().total;
+	}
+	running = false;
+	for (std::thread &w : workers)
+		w.join();
+	printf("\nms\tok\tfailed\tpool_total\n");
+	for (int i = 0; i < slots; ++i)
+		printf("%d\t%lu\t%lu\t%u\n", (i + 1) * slot_ms, (unsigned long) ok[i], (unsigned long) failed[i], total[i]);
+	FakeMysqlStats fs = fake.getStats();
+	printf("lost\t%lu\tconnect_failed\t%lu\tping_failed\t%lu\n", (unsigned long) fs.lost,
+		(unsigned long) fs.connect_failed, (unsigned long) fs.ping_failed);
+}
+
+int
+main(int argc, char **argv)
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 64;
+	int seconds = argc > 2 ? atoi(argv[2]) : 3;
+	printf("connections\tqps\tp50_us\tp99_us\tp999_us\twait_p99_us\ttimeouts\tserver_max_running\tfailed\n");
+	unsigned int sizes[] = { 4, 8, 16, 32, 64 };
+	for (unsigned int n : sizes)
+		run_size(n, threads, seconds);
+	run_outage(threads);
+}
@@ -0,0 +1,119 @@
+#include "histogram.h"
+#include "mysql_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Acquire under contention, on a local mysqld. `threads` threads (64 by
+// default) share a pool of `connections`, each taking a connection with
+// acquire(), running "DO 0" on it, the cheapest round trip there is, and
+// handing it back, for `seconds`; the time to get the connection is what
+// is measured. Three ways first: a ping on every acquire (validate_ms 0, no
+// maintenance thread), as the pool used to, though no longer under its
+// lock; the default, a ping only for connections idle past
+// MYSQL_VALIDATE_IDLE_MS; and start(), with the connections made up front
+// and checked by the maintenance thread. Then more threads than
+// connections: a quarter as many connections, the threads waiting in line
+// for them, with a deadline of a second and with one short enough that
+// some give up. The pool's own wait histogram and counters are printed,
+// and the fewest and most calls any one thread made show how fair the
+// line is.
+// usage: mysql_pool_bench host user password database [threads] [connections] [seconds]
+
+using namespace ekko;
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+run_case(const char *name, MysqlPool *pool, int threads, int seconds, int timeout_ms)
+{
+	std::vector<Histogram> hists(threads);
+	std::vector<uint64_t> failed(threads);
+	std::vector<uint64_t> calls(threads);
+	std::vector<std::thread> workers;
+	uint64_t end = now_ns() + seconds * 1000000000ULL;
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			ResultSet rs;
+			for (;;) {
+				uint64_t start = now_ns();
+				if (start >= end)
+					break;
+				PooledConnection conn = pool->acquire(timeout_ms);
+				hists[t].Record(now_ns() - start);
+				if (!conn || !conn.query("DO 0", rs))
+					++failed[t];
+				++calls[t];
+			}
+		});
+	}
+	uint64_t fails = 0, fewest = UINT64_MAX, most = 0;
+	Histogram total;
+	for (int t = 0; t < threads; ++t) {
+		workers[t].join();
+		total.Merge(hists[t]);
+		fails += failed[t];
+		fewest = std::min(fewest, calls[t]);
+		most = std::max(most, calls[t]);
+	}
+	printf("%s\t%d\t%.0f\t%.1f\t%.1f\t%.1f\t%lu\t%lu\t%lu\n", name, threads, (double) total.Count() / seconds,
+		total.Percentile(50) / 1e3, total.Percentile(99) / 1e3, total.Percentile(99.9) / 1e3, (unsigned long) fails,
+		(unsigned long) fewest, (unsigned long) most);
+}
+
+static void
+print_stats(const char *name, const MysqlPoolStats &s)
+{
+	printf("%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", name, (unsigned long) s.acquired, (unsigned long) s.waited,
+		(unsigned long) s.timeouts, (unsigned long) s.rejected, (unsigned long) s.waitPercentile(50),
+		(unsigned long) s.waitPercentile(99), (unsigned long) s.waitPercentile(99.9));
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s host user password database [threads] [connections] [seconds]\n", argv[0]);
+		return 1;
+	}
+	int threads = argc > 5 ? atoi(argv[5]) : 64;
+	int connections = argc > 6 ? atoi(argv[6]) : 64;
+	int seconds = argc > 7 ? atoi(argv[7]) : 5;
+	MysqlPool *pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, connections);
+
+	printf("acquire\tthreads\tqps\tacquire_p50_us\tacquire_p99_us\tacquire_p999_us\tfailed\tfewest_calls\tmost_calls\n");
+	pool->setMaintenance(0, 0, 0);
+	run_case("ping_every_acquire", pool, threads, seconds, 0);
+	pool->setMaintenance(0);
+	run_case("ping_when_idle", pool, threads, seconds, 0);
+	pool->setMaintenance(connections);
+	pool->start();
+	run_case("maintenance_thread", pool, threads, seconds, 0);
+	delete pool;
+
+	// a fresh pool with fewer connections than threads
+	int few = connections / 4 > 0 ? connections / 4 : 1;
+	pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, few);
+	pool->setMaintenance(few);
+	pool->start();
+	run_case("wait_1000ms", pool, threads, seconds, 1000);
+	MysqlPoolStats patient = pool->getStats();
+	run_case("wait_1ms", pool, threads, seconds, 1);
+	MysqlPoolStats both = pool->getStats();
+	printf("\nstats\tacquired\twaited\ttimeouts\trejected\twait_p50_us\twait_p99_us\twait_p999_us\n");
+	print_stats("wait_1000ms", patient);
+	print_stats("both", both);
+	delete pool;
+}
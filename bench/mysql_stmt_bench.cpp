@@ -0,0 +1,128 @@
+#include "histogram.h"
+#include "mysql_pool.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The text protocol against prepared statements, on a local mysqld. A
+// table of `rows` rows is made in the given database; then, for `seconds`
+// each, `threads` threads run the same statements through MysqlPool both
+// ways: query() with the values printed into the SQL, execute() with them
+// bound as parameters, the statement prepared once per connection and
+// found in the connection's cache after that. The statements are a point
+// select by primary key, a range of 100 rows and a single-row insert.
+// usage: mysql_stmt_bench host user password database [threads] [seconds] [rows]
+
+using namespace ekko;
+
+static uint64_t
+now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef std::function<bool(int thread, uint64_t i, ResultSet &rs)> op_t;
+
+static void
+run_case(const char *name, const char *protocol, int threads, int seconds, const op_t &op)
+{
+	std::vector<Histogram> hists(threads);
+	std::vector<std::thread> workers;
+	std::atomic<uint64_t> failed(0);
+	uint64_t end = now_us() + seconds * 1000000ULL;
+
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			ResultSet rs;
+			for (uint64_t i = 0; ; ++i) {
+				uint64_t start = now_us();
+				if (start >= end)
+					break;
+				if (!op(t, i, rs))
+					++failed;
+				hists[t].Record(now_us() - start);
+			}
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+	Histogram total;
+	for (auto &h : hists)
+		total.Merge(h);
+	printf("%s\t%s\t%d\t%.0f\t%lu\t%lu\t%lu\n", name, protocol, threads, (double) total.Count() / seconds,
+		(unsigned long) total.Percentile(50), (unsigned long) total.Percentile(99), (unsigned long) failed.load());
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s host user password database [threads] [seconds] [rows]\n", argv[0]);
+		return 1;
+	}
+	int threads = argc > 5 ? atoi(argv[5]) : 4;
+	int seconds = argc > 6 ? atoi(argv[6]) : 5;
+	int rows = argc > 7 ? atoi(argv[7]) : 100000;
+	MysqlPool *pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, threads);
+	ResultSet rs;
+
+	pool->query("DROP TABLE IF EXISTS bench_stmt", rs);
+	pool->query("DROP TABLE IF EXISTS bench_stmt_log", rs);
+	if (!pool->query("CREATE TABLE bench_stmt (id INT PRIMARY KEY, name VARCHAR(64), score DOUBLE)", rs)
+			|| !pool->query("CREATE TABLE bench_stmt_log (id BIGINT AUTO_INCREMENT PRIMARY KEY, "
+				"user_id INT, note VARCHAR(64), amount DOUBLE)", rs))
+		return 1;
+	for (int i = 0; i < rows; i += 1000) {
+		std::string sql = "INSERT INTO bench_stmt VALUES ";
+		for (int j = i; j < i + 1000 && j < rows; ++j)
+			sql += (j > i ? ",(" : "(") + std::to_string(j) + ",'user" + std::to_string(j) + "'," + std::to_string(j % 997 * 1.5) + ")";
+		if (!pool->query(sql.c_str(), rs))
+			return 1;
+	}
+
+	printf("statement\tprotocol\tthreads\tqps\tp50_us\tp99_us\tfailed\n");
+	run_case("point_select", "text", threads, seconds, [&](int, uint64_t i, ResultSet &rs) {
+		char sql[128];
+		snprintf(sql, sizeof(sql), "SELECT id, name, score FROM bench_stmt WHERE id = %d", (int) (i * 7919 % rows));
+		return pool->query(sql, rs) && rs.rowCount() == 1;
+	});
+	run_case("point_select", "prepared", threads, seconds, [&](int, uint64_t i, ResultSet &rs) {
+		return pool->execute(rs, "SELECT id, name, score FROM bench_stmt WHERE id = ?", (int) (i * 7919 % rows))
+			&& rs.rowCount() == 1;
+	});
+	run_case("range_100", "text", threads, seconds, [&](int, uint64_t i, ResultSet &rs) {
+		char sql[128];
+		int from = i * 7919 % (rows - 100);
+		snprintf(sql, sizeof(sql), "SELECT id, name, score FROM bench_stmt WHERE id >= %d AND id < %d", from, from + 100);
+		return pool->query(sql, rs) && rs.rowCount() == 100;
+	});
+	run_case("range_100", "prepared", threads, seconds, [&](int, uint64_t i, ResultSet &rs) {
+		int from = i * 7919 % (rows - 100);
+		return pool->execute(rs, "SELECT id, name, score FROM bench_stmt WHERE id >= ? AND id < ?", from, from + 100)
+			&& rs.rowCount() == 100;
+	});
+	// the text path has to quote the string; these need no escaping
+	run_case("insert", "text", threads, seconds, [&](int t, uint64_t i, ResultSet &rs) {
+		char sql[160];
+		snprintf(sql, sizeof(sql), "INSERT INTO bench_stmt_log (user_id, note, amount) VALUES (%d, 'note-%d-%lu', %.2f)",
+			(int) (i % rows), t, (unsigned long) i, i * 0.25);
+		return pool->query(sql, rs) && rs.affectedRows() == 1;
+	});
+	run_case("insert", "prepared", threads, seconds, [&](int t, uint64_t i, ResultSet &rs) {
+		char note[32];
+		snprintf(note, sizeof(note), "note-%d-%lu", t, (unsigned long) i);
+		return pool->execute(rs, "INSERT INTO bench_stmt_log (user_id, note, amount) VALUES (?, ?, ?)",
+			(int) (i % rows), note, i * 0.25) && rs.affectedRows() == 1;
+	});
+
+	pool->query("DROP TABLE bench_stmt", rs);
+	pool->query("DROP TABLE bench_stmt_log", rs);
+	delete pool;
+}
@@ -0,0 +1,125 @@
+#include "mysql_pool.h"
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Reading a large table, on a local mysqld. A table of `rows` rows (two
+// million by default, about 150 bytes each) is made in the given
+// database, then read whole four ways, each in a process of its own so
+// that its peak RSS is its own: executeSql() (mysql_store_result, then the
+// map), query() (mysql_store_result, then one ResultSet), stream() in
+// batches of 1024 rows, and stream() cancelled after its first batch. The
+// time to the first row is when the caller can look at it: after the
+// whole result for the first two, after the first batch for the others.
+// usage: mysql_stream_bench host user password database [rows]
+
+using namespace ekko;
+
+static double
+now_ms()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static MysqlPool*
+open_pool(char **argv)
+{
+	MysqlPool *pool = MysqlPool::getMysqlPoolObject();
+	pool->setParameter(argv[1], argv[2], argv[3], argv[4], 0, NULL, 0, 4);
+	return pool;
+}
+
+static void
+read_table(const char *mode, char **argv)
+{
+	static const char sql[] = "SELECT id, name, payload, score FROM bench_stream";
+	MysqlPool *pool = open_pool(argv);
+	size_t rows = 0;
+	double sum = 0, first = 0, start = now_ms();
+
+	if (strcmp(mode, "executeSql") == 0) {
+		std::map<const std::string, std::vector<const char*> > m = pool->executeSql(sql);
+		first = now_ms();
+		std::vector<const char*> &scores = m["score"];
+		for (size_t i = 0; i < scores.size(); ++i)
+			sum += atof(scores[i]);
+		rows = scores.size();
+	} else if (strcmp(mode, "query") == 0) {
+		ResultSet rs;
+		pool->query(sql, rs);
+		first = now_ms();
+		int score = rs.columnIndex("score");
+		for (size_t i = 0; i < rs.rowCount(); ++i)
+			sum += rs.getDouble(i, score);
+		rows = rs.rowCount();
+	} else {
+		bool cancel = strcmp(mode, "stream_cancel") == 0;
+		pool->stream(sql, MYSQL_STREAM_BATCH_ROWS, [&](const ResultSet &batch) {
+			if (rows == 0)
+				first = now_ms();
+			int score = batch.columnIndex("score");
+			for (size_t i = 0; i < batch.rowCount(); ++i)
+				sum += batch.getDouble(i, score);
+			rows += batch.rowCount();
+			return !cancel;
+		});
+	}
+	double end = now_ms();
+	printf("%s\t%zu\t%.1f\t%.1f\t", mode, rows, first - start, end - start);
+	fflush(stdout);
+	delete pool;
+	if (sum < 0)
+		printf("!");
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s host user password database [rows]\n", argv[0]);
+		return 1;
+	}
+	long rows = argc > 5 ? atol(argv[5]) : 2000000;
+	MysqlPool *pool = open_pool(argv);
+	ResultSet rs;
+
+	pool->query("DROP TABLE IF EXISTS bench_stream", rs);
+	if (!pool->query("CREATE TABLE bench_stream (id BIGINT AUTO_INCREMENT PRIMARY KEY, name VARCHAR(32), "
+			"payload VARCHAR(100), score DOUBLE)", rs)
+			|| !pool->query("INSERT INTO bench_stream (name, payload, score) VALUES "
+				"('first', REPEAT('x', 100), 1.5)", rs))
+		return 1;
+	// doubling, then the rest
+	for (long n = 1; n < rows; n *= 2) {
+		char sql[256];
+		snprintf(sql, sizeof(sql), "INSERT INTO bench_stream (name, payload, score) "
+			"SELECT CONCAT('user', id), payload, score + id FROM bench_stream LIMIT %ld", std::min(n, rows - n));
+		if (!pool->query(sql, rs))
+			return 1;
+	}
+	delete pool;
+
+	printf("mode\trows\tfirst_row_ms\ttotal_ms\tpeak_rss_mb\n");
+	const char *modes[] = { "executeSql", "query", "stream", "stream_cancel" };
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0) {
+			read_table(modes[i], argv);
+			_exit(0);
+		}
+		int status;
+		struct rusage usage;
+		wait4(pid, &status, 0, &usage);
+		printf("%.1f\n", usage.ru_maxrss / 1024.0);
+	}
+
+	pool = open_pool(argv);
+	pool->query("DROP TABLE bench_stream", rs);
+	delete pool;
+}
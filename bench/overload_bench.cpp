@@ -0,0 +1,235 @@
+#include "histogram.h"
+#include "http_server.h"
+#include "overload.h"
+#include "socket_util.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Past saturation. Every request makes one query on a database that runs
+// `slots` of them at a time, `service_ms` each, so it serves at most
+// slots * 1000 / service_ms a second whatever the server does. Clients are
+// open-loop: requests go out on schedule, pipelined on their connections,
+// whether the earlier ones were answered or not, and latency counts from
+// when a request was due. Offered load goes from half to four times the
+// database's capacity, without a guard and with OverloadGuard on AIMD and
+// on the gradient limit. Goodput is the 200s answered within the SLO.
+// usage: overload_bench [seconds_per_case] [slots] [service_ms] [slo_ms]
+
+using namespace ekko;
+
+#define BENCH_CONNS 64
+#define BENCH_CLIENT_THREADS 2
+
+static uint64_t
+now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief the slow dependency: slots queries at a time, the others wait their turn
+class Database {
+public:
+	Database(int slots, int service_ms) :free_(slots), service_ms_(service_ms) {}
+
+	void Query() {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [this]() { return free_ > 0;});
+			--free_;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(service_ms_));
+		std::lock_guard<std::mutex> lock(mutex_);
+		++free_;
+		cond_.notify_one();
+	}
+
+private:
+	std::mutex mutex_;
+
+	std::condition_variable cond_;
+
+	int free_;
+
+	int service_ms_;
+};
+
+struct client_result_t {
+	Histogram ok;
+	Histogram all;
+	uint64_t sent = 0;
+	uint64_t good = 0;
+	uint64_t shed = 0;
+	uint64_t lost = 0;
+};
+
+struct client_conn_t {
+	int fd;
+	std::string in;
+	/// @brief when each request still unanswered was due
+	std::deque<uint64_t> due;
+};
+
+/// @return bytes of the first complete response in in, 0 if there is none yet
+static size_t
+parse_response(const std::string &in, int *status)
+{
+	size_t end = in.find("\r\n\r\n");
+	if (end == std::string::npos)
+		return 0;
+	size_t pos = in.find("Content-Length: ");
+	size_t len = pos < end ? atol(in.c_str() + pos + 16) : 0;
+	if (in.size() < end + 4 + len)
+		return 0;
+	*status = atoi(in.c_str() + 9);
+	return end + 4 + len;
+}
+
+static void
+client(int port, double rate, uint64_t seconds, uint64_t slo_us, client_result_t *result)
+{
+	static const char req[] = "GET /query HTTP/1.1\r\nHost: bench\r\n\r\n";
+	std::vector<client_conn_t> conns(BENCH_CONNS / BENCH_CLIENT_THREADS);
+	struct epoll_event events[64];
+	char buf[65536];
+	int epfd = epoll_create1(0);
+
+	for (size_t i = 0; i < conns.size(); ++i) {
+		conns[i].fd = ConnectTo("127.0.0.1", port);
+		if (conns[i].fd < 0)
+			exit(1);
+		SetNonBlock(conns[i].fd);
+		SetTcpNoDelay(conns[i].fd);
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+	}
+	uint64_t start = now_us(), end = start + seconds * 1000000, drain = end + 2 * slo_us + 1000000;
+	double interval = 1e6 / rate, next = start;
+	size_t rr = 0, outstanding = 0;
+
+	while (true) {
+		uint64_t now = now_us();
+		if (now >= drain || (now >= end && outstanding == 0))
+			break;
+		// whatever is due goes out, however far behind the answers are
+		while (next <= now && next < end) {
+			client_conn_t &c = conns[rr++ % conns.size()];
+			if (write(c.fd, req, sizeof(req) - 1) != (ssize_t) sizeof(req) - 1)
+				exit(1);
+			c.due.push_back((uint64_t) next);
+			++result->sent;
+			++outstanding;
+			next += interval;
+		}
+		int timeout = next < end ? (int) ((next - now) / 1000) : 10;
+		int n = epoll_wait(epfd, events, 64, timeout);
+		for (int i = 0; i < n; ++i) {
+			client_conn_t &c = conns[events[i].data.u32];
+			ssize_t r;
+			while ((r = read(c.fd, buf, sizeof(buf))) > 0)
+				c.in.append(buf, r);
+			size_t used;
+			int status;
+			while ((used = parse_response(c.in, &status)) > 0) {
+				uint64_t lat = now_us() - c.due.front();
+				c.due.pop_front();
+				c.in.erase(0, used);
+				--outstanding;
+				result->all.Record(lat);
+				if (status == 200) {
+					result->ok.Record(lat);
+					if (lat <= slo_us)
+						++result->good;
+				} else {
+					++result->shed;
+				}
+			}
+		}
+	}
+	result->lost += outstanding;
+	for (size_t i = 0; i < conns.size(); ++i)
+		close(conns[i].fd);
+	close(epfd);
+}
+
+static void
+run_case(const char *name, int algo, double capacity, double factor, int seconds, int slots,
+	int service_ms, uint64_t slo_us)
+{
+	Database db(slots, service_ms);
+	std::unique_ptr<OverloadGuard> guard;
+	HttpServer server("127.0.0.1", 0, 4);
+	// a loop each for a quarter of the connections
+	server.SetAcceptMode(ACCEPT_SHARDED);
+	HttpServer::Handler handler = [&db](const HttpRequest&, HttpResponse &resp) {
+		db.Query();
+		resp.SetBody("row");
+	};
+
+	if (algo >= 0) {
+		// start where the loops would be anyway, the limit finds its own level
+		guard.reset(new OverloadGuard((LimitAlgorithm) algo, 4));
+		guard->SetQueueBudget(slo_us / 1000 / 5);
+		guard->GetLimit().SetAimdThreshold(service_ms * 1500);
+		handler = guard->Wrap(handler);
+	}
+	server.SetHandler(handler);
+	if (server.Start() != 0)
+		exit(1);
+
+	double rate = capacity * factor;
+	std::vector<client_result_t> results(BENCH_CLIENT_THREADS);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < BENCH_CLIENT_THREADS; ++i)
+		threads.emplace_back(client, server.GetPort(), rate / BENCH_CLIENT_THREADS, seconds, slo_us, &results[i]);
+	for (auto &t : threads)
+		t.join();
+	int limit = guard ? guard->GetStats().limit : 0;
+	server.Stop();
+
+	client_result_t total;
+	for (auto &r : results) {
+		total.ok.Merge(r.ok);
+		total.all.Merge(r.all);
+		total.sent += r.sent;
+		total.good += r.good;
+		total.shed += r.shed;
+		total.lost += r.lost;
+	}
+	printf("%s\t%.0f\t%.0f\t%.0f\t%.0f\t%lu\t%.1f\t%.1f\t%.1f\t%d\n", name, rate,
+		(double) total.good / seconds, (double) total.ok.Count() / seconds,
+		(double) total.shed / seconds, (unsigned long) total.lost,
+		total.ok.Percentile(50) / 1e3, total.ok.Percentile(99) / 1e3, total.all.Percentile(99) / 1e3, limit);
+}
+
+int
+main(int argc, char **argv)
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	int slots = argc > 2 ? atoi(argv[2]) : 2;
+	int service_ms = argc > 3 ? atoi(argv[3]) : 2;
+	uint64_t slo_us = (argc > 4 ? atoi(argv[4]) : 100) * 1000;
+	double capacity = slots * 1000.0 / service_ms;
+	double factors[] = { 0.5, 1, 2, 4 };
+
+	printf("guard\toffered_rps\tgoodput_rps\tok_rps\tshed_rps\tunanswered\tok_p50_ms\tok_p99_ms\tall_p99_ms\tlimit\n");
+	for (size_t i = 0; i < sizeof(factors) / sizeof(factors[0]); ++i) {
+		run_case("none", -1, capacity, factors[i], seconds, slots, service_ms, slo_us);
+		run_case("aimd", LIMIT_AIMD, capacity, factors[i], seconds, slots, service_ms, slo_us);
+		run_case("gradient", LIMIT_GRADIENT, capacity, factors[i], seconds, slots, service_ms, slo_us);
+	}
+}
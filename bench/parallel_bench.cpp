@@ -0,0 +1,85 @@
+#include "thread_pool.h"
+#include "parallel.h"
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// scaling of the data-parallel primitives from 1 thread up to all cores,
+// the caller counts as one of the threads
+#define N_FOR (1 << 24)
+#define N_SORT (1 << 23)
+#define ROUNDS 5
+
+static double
+now_ms()
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class Kernel>
+static double
+best_of(Kernel kernel)
+{
+	double best = 1e300;
+	for (int r = 0; r < ROUNDS; ++r) {
+		double start = now_ms();
+		kernel();
+		best = std::min(best, now_ms() - start);
+	}
+	return best;
+}
+
+int
+main()
+{
+	int ncores = std::thread::hardware_concurrency();
+	std::vector<float> x(N_FOR, 1.5f), y(N_FOR, 2.0f);
+	std::vector<unsigned> keys(N_SORT), work(N_SORT);
+	unsigned seed = 7;
+	for (auto &k : keys)
+		k = seed = seed * 1103515245 + 12345;
+
+	double base[3] = {0, 0, 0};
+	printf("threads\tsaxpy_ms\tspeedup\tsum_sqrt_ms\tspeedup\tsort_ms\tspeedup\n");
+	for (int nthreads = 1; nthreads <= (ncores > 0 ? ncores : 1); ++nthreads) {
+		struct ekko::thread_pool_t pool;
+		if (nthreads > 1)
+			ekko::thread_pool_init(&pool, nthreads - 1);
+		else
+			memset(&pool, 0, sizeof(pool));
+
+		double t[3];
+		t[0] = best_of([&] {
+			ekko::parallel_for(&pool, 0, N_FOR, 0, [&](size_t lo, size_t hi) {
+				for (size_t i = lo; i < hi; ++i)
+					y[i] = 2.5f * x[i] + y[i];
+			});
+		});
+		double sink = 0;
+		t[1] = best_of([&] {
+			sink += ekko::parallel_reduce(&pool, 0, N_FOR, 0, 0.0,
+				[&](size_t lo, size_t hi, double acc) {
+					for (size_t i = lo; i < hi; ++i)
+						acc += std::sqrt((double) i);
+					return acc;
+				},
+				[](double a, double b) { return a + b; });
+		});
+		t[2] = best_of([&] {
+			work = keys;
+			ekko::parallel_sort(&pool, work.begin(), work.end());
+		});
+		if (nthreads == 1)
+			std::copy(t, t + 3, base);
+
+		printf("%d\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\n", nthreads,
+			t[0], base[0] / t[0], t[1], base[1] / t[1], t[2], base[2] / t[2]);
+		if (sink == 0)
+			printf("unexpected sum\n");
+		if (nthreads > 1)
+			ekko::thread_pool_destroy(&pool);
+	}
+}
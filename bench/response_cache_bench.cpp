@@ -0,0 +1,208 @@
+#include "histogram.h"
+#include "http_parser.h"
+#include "response_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A ResponseCache in front of a handler that renders a page: a body of
+// about 2KB and some CPU time per call. Requests pick among the keys on a
+// Zipf distribution (s = 0.99 by default, as for web pages), each thread
+// with its own generator, so the hot keys are shared and the tail is not.
+// Every budget is run with LRU alone and with TinyLFU admission, and once
+// without a cache. The last case has every thread ask for the same cold
+// keys at once on a slow backend, to count the calls coalescing saves.
+// usage: response_cache_bench [threads] [requests_per_thread] [keys] [zipf_s] [render_us]
+
+using namespace ekko;
+
+static double
+now_s()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief cumulative probabilities of ranks 1..n
+static std::vector<double>
+zipf_cdf(int n, double s)
+{
+	std::vector<double> cdf(n);
+	double sum = 0;
+
+	for (int i = 0; i < n; ++i) {
+		sum += 1.0 / pow(i + 1, s);
+		cdf[i] = sum;
+	}
+	for (int i = 0; i < n; ++i)
+		cdf[i] /= sum;
+	return cdf;
+}
+
+struct backend_t {
+	std::atomic<uint64_t> calls{0};
+	double render_us = 20;
+	int sleep_ms = 0;
+};
+
+static void
+render(backend_t *backend, const HttpRequest &req, HttpResponse &resp)
+{
+	std::string body;
+
+	backend->calls.fetch_add(1, std::memory_order_relaxed);
+	if (backend->sleep_ms) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(backend->sleep_ms));
+	} else {
+		double until = now_s() + backend->render_us / 1e6;
+		while (now_s() < until)
+			;
+	}
+	body.reserve(2048);
+	body.append("<html><body><h1>");
+	body.append(req.Target().data(), req.Target().size());
+	body.append("</h1>");
+	while (body.size() < 2000)
+		body.append("<p>lorem ipsum dolor sit amet</p>");
+	body.append("</body></html>");
+	resp.AddHeader("Content-Type", "text/html");
+	resp.SetBody(body);
+}
+
+struct result_t {
+	Histogram lat;
+	uint64_t served = 0;
+};
+
+static void
+worker(ResponseCache *cache, backend_t *backend, const std::vector<double> *cdf,
+	int requests, unsigned seed, result_t *result)
+{
+	ResponseCache::Handler handler = [backend](const HttpRequest &req, HttpResponse &resp) {
+		render(backend, req, resp);
+	};
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	HttpParser parser;
+	char wire[128];
+
+	for (int i = 0; i < requests; ++i) {
+		size_t key = std::lower_bound(cdf->begin(), cdf->end(), uniform(rng)) - cdf->begin();
+		int n = snprintf(wire, sizeof(wire), "GET /page?id=%zu&lang=en HTTP/1.1\r\nHost: bench\r\n\r\n", key);
+		uint64_t start = now_ns();
+		HttpResponse resp;
+		parser.Reset();
+		if (parser.Parse(wire, n) != HttpParser::DONE)
+			exit(1);
+		if (cache)
+			cache->Handle(parser.GetRequest(), resp, handler);
+		else
+			handler(parser.GetRequest(), resp);
+		result->served += resp.GetBody().Size();
+		result->lat.Record(now_ns() - start);
+	}
+}
+
+static void
+run_case(const char *name, size_t budget_mb, bool admission, int nthreads, int requests,
+	const std::vector<double> &cdf, double render_us)
+{
+	std::unique_ptr<ResponseCache> cache;
+	backend_t backend;
+	std::vector<result_t> results(nthreads);
+	std::vector<std::thread> threads;
+
+	backend.render_us = render_us;
+	if (budget_mb) {
+		cache.reset(new ResponseCache(budget_mb << 20));
+		cache->SetAdmission(admission);
+	}
+	double start = now_s();
+	for (int i = 0; i < nthreads; ++i)
+		threads.emplace_back(worker, cache.get(), &backend, &cdf, requests, 1000 + i, &results[i]);
+	for (auto &t : threads)
+		t.join();
+	double elapsed = now_s() - start;
+
+	Histogram lat;
+	for (int i = 0; i < nthreads; ++i)
+		lat.Merge(results[i].lat);
+	ResponseCacheStats stats = {};
+	if (cache)
+		stats = cache->GetStats();
+	printf("%s\t%zu\t%d\t%lu\t%.3f\t%lu\t%.0f\t%.1f\t%.1f\t%lu\t%.1f\n", name, budget_mb, nthreads,
+		(unsigned long) lat.Count(), stats.HitRatio(), (unsigned long) backend.calls.load(),
+		lat.Count() / elapsed, lat.Percentile(50) / 1e3, lat.Percentile(99) / 1e3,
+		(unsigned long) stats.entries, stats.bytes / 1048576.0);
+}
+
+/// @brief every thread asks for the same cold keys in the same order
+static void
+run_coalescing(int nthreads, int keys, int sleep_ms)
+{
+	ResponseCache cache;
+	backend_t backend;
+	std::vector<std::thread> threads;
+
+	backend.sleep_ms = sleep_ms;
+	ResponseCache::Handler handler = [&backend](const HttpRequest &req, HttpResponse &resp) {
+		render(&backend, req, resp);
+	};
+	double start = now_s();
+	for (int t = 0; t < nthreads; ++t) {
+		threads.emplace_back([&]() {
+			HttpParser parser;
+			char wire[128];
+			for (int i = 0; i < keys; ++i) {
+				int n = snprintf(wire, sizeof(wire), "GET /cold/%d HTTP/1.1\r\n\r\n", i);
+				HttpResponse resp;
+				parser.Reset();
+				if (parser.Parse(wire, n) != HttpParser::DONE)
+					exit(1);
+				cache.Handle(parser.GetRequest(), resp, handler);
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	double elapsed = now_s() - start;
+	ResponseCacheStats stats = cache.GetStats();
+	printf("\ncoalescing\tthreads\trequests\tbackend_calls\tcoalesced\thits\tmean_wait_ms\tseconds\n");
+	printf("cold_keys\t%d\t%d\t%lu\t%lu\t%lu\t%.2f\t%.2f\n", nthreads, nthreads * keys,
+		(unsigned long) backend.calls.load(), (unsigned long) stats.coalesced, (unsigned long) stats.hits,
+		stats.coalesced ? stats.coalesced_ns / 1e6 / stats.coalesced : 0, elapsed);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+	int requests = argc > 2 ? atoi(argv[2]) : 100000;
+	int keys = argc > 3 ? atoi(argv[3]) : 100000;
+	double s = argc > 4 ? atof(argv[4]) : 0.99;
+	double render_us = argc > 5 ? atof(argv[5]) : 20;
+	std::vector<double> cdf = zipf_cdf(keys, s);
+
+	printf("cache\tbudget_mb\tthreads\trequests\thit_ratio\tbackend_calls\treq_per_sec\tp50_us\tp99_us\tentries\tcached_mb\n");
+	run_case("none", 0, false, nthreads, requests, cdf, render_us);
+	size_t budgets[] = { 1, 8, 64 };
+	for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); ++i) {
+		run_case("lru", budgets[i], false, nthreads, requests, cdf, render_us);
+		run_case("tinylfu", budgets[i], true, nthreads, requests, cdf, render_us);
+	}
+	run_coalescing(nthreads * 4, 20, 10);
+}
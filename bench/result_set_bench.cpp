@@ -0,0 +1,225 @@
+#include "result_set.h"
+#include <chrono>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Materializing a large result set. The rows are made up front the way
+// mysql_store_result leaves them, NUL-terminated text cells with their
+// lengths, 8 columns of ints, doubles, short and longer strings and a NULL
+// now and then, so what is timed is the client side alone: what
+// executeSql used to build (a std::map from column name to a vector of
+// row pointers, which dangled once the MYSQL_RES was freed), the same map
+// holding std::string copies (what a caller had to do to keep the values),
+// and a ResultSet, sized with the lengths first and copied into one
+// arena. Each is then read back: two columns by name, summed, every row.
+// Allocations are counted through operator new.
+// usage: result_set_bench [rows] [rounds]
+
+using namespace ekko;
+
+#define BENCH_COLUMNS 8
+
+static size_t s_allocs, s_bytes;
+
+void*
+operator new(size_t n)
+{
+	++s_allocs;
+	s_bytes += n;
+	void *p = malloc(n);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+static double
+now_ns()
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char *s_names[BENCH_COLUMNS] = { "user_id", "name", "email", "score", "created", "status", "bio", "amount" };
+
+/// @brief what mysql_store_result holds: rows of cells, with their lengths
+struct fake_result_t {
+	std::vector<std::vector<char> > storage;
+	std::vector<std::vector<const char*> > rows;
+	std::vector<std::vector<unsigned long> > lengths;
+};
+
+static void
+make_rows(size_t nrows, fake_result_t &res)
+{
+	std::mt19937 rng(7);
+	char buf[256];
+
+	res.storage.resize(nrows);
+	res.rows.resize(nrows);
+	res.lengths.resize(nrows);
+	for (size_t r = 0; r < nrows; ++r) {
+		std::vector<std::string> cells(BENCH_COLUMNS);
+		cells[0] = std::to_string(r + 1);
+		cells[1] = "user" + std::to_string(rng() % 100000);
+		cells[2] = cells[1] + "@example.com";
+		snprintf(buf, sizeof(buf), "%.3f", (rng() % 100000) / 100.0);
+		cells[3] = buf;
+		cells[4] = "2024-01-01 12:00:00";
+		cells[5] = rng() % 2 ? "active" : "disabled";
+		cells[6] = std::string(20 + rng() % 100, 'x');
+		cells[7] = std::to_string(rng() % 1000000);
+		for (int c = 0; c < BENCH_COLUMNS; ++c)
+			res.storage[r].insert(res.storage[r].end(), cells[c].c_str(), cells[c].c_str() + cells[c].size() + 1);
+		size_t off = 0;
+		for (int c = 0; c < BENCH_COLUMNS; ++c) {
+			bool null = c == 6 && rng() % 10 == 0;
+			res.rows[r].push_back(null ? NULL : res.storage[r].data() + off);
+			res.lengths[r].push_back(null ? 0 : cells[c].size());
+			off += cells[c].size() + 1;
+		}
+	}
+}
+
+typedef std::map<const std::string, std::vector<const char*> > pointer_map_t;
+typedef std::map<const std::string, std::vector<std::string> > string_map_t;
+
+static void
+build_pointer_map(const fake_result_t &res, pointer_map_t &m)
+{
+	std::vector<std::vector<const char*>*> cols;
+	for (int c = 0; c < BENCH_COLUMNS; ++c)
+		cols.push_back(&m[s_names[c]]);
+	for (size_t r = 0; r < res.rows.size(); ++r) {
+		for (int c = 0; c < BENCH_COLUMNS; ++c)
+			cols[c]->push_back(res.rows[r][c]);
+	}
+}
+
+static void
+build_string_map(const fake_result_t &res, string_map_t &m)
+{
+	std::vector<std::vector<std::string>*> cols;
+	for (int c = 0; c < BENCH_COLUMNS; ++c)
+		cols.push_back(&m[s_names[c]]);
+	for (size_t r = 0; r < res.rows.size(); ++r) {
+		for (int c = 0; c < BENCH_COLUMNS; ++c)
+			cols[c]->push_back(res.rows[r][c] ? std::string(res.rows[r][c], res.lengths[r][c]) : std::string());
+	}
+}
+
+static void
+build_result_set(const fake_result_t &res, ResultSet &rs)
+{
+	std::vector<ResultSet::Column> columns(BENCH_COLUMNS);
+	for (int c = 0; c < BENCH_COLUMNS; ++c)
+		columns[c].name = s_names[c];
+	rs.setColumns(columns);
+	// the pass over mysql_fetch_lengths
+	size_t bytes = 0;
+	for (size_t r = 0; r < res.rows.size(); ++r) {
+		for (int c = 0; c < BENCH_COLUMNS; ++c)
+			bytes += res.lengths[r][c];
+	}
+	rs.reserve(res.rows.size(), bytes);
+	for (size_t r = 0; r < res.rows.size(); ++r)
+		rs.appendRow(res.rows[r].data(), res.lengths[r].data());
+}
+
+static void
+report(const char *how, size_t rows, int rounds, double build_ns, double read_ns, size_t allocs, size_t bytes,
+	double sum)
+{
+	printf("%s\t%zu\t%.2f\t%.2f\t%zu\t%.1f\t%.0f\n", how, rows, build_ns / rounds / 1e6, read_ns / rounds / 1e6,
+		allocs / rounds, (double) bytes / rounds / (1 << 20), sum);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t nrows = argc > 1 ? atol(argv[1]) : 1000000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 5;
+	fake_result_t res;
+	make_rows(nrows, res);
+
+	printf("result\trows\tbuild_ms\tread_ms\tallocs\talloc_mb\tsum\n");
+	double build = 0, read = 0, sum = 0;
+	size_t allocs = 0, bytes = 0;
+	for (int i = 0; i < rounds; ++i) {
+		s_allocs = s_bytes = 0;
+		double start = now_ns();
+		pointer_map_t m;
+		build_pointer_map(res, m);
+		build += now_ns() - start;
+		allocs += s_allocs;
+		bytes += s_bytes;
+		start = now_ns();
+		for (size_t r = 0; r < nrows; ++r)
+			sum += atoll(m["user_id"][r]) + atof(m["score"][r]);
+		read += now_ns() - start;
+	}
+	report("map_pointers", nrows, rounds, build, read, allocs, bytes, sum);
+
+	build = read = sum = 0;
+	allocs = bytes = 0;
+	for (int i = 0; i < rounds; ++i) {
+		s_allocs = s_bytes = 0;
+		double start = now_ns();
+		string_map_t m;
+		build_string_map(res, m);
+		build += now_ns() - start;
+		allocs += s_allocs;
+		bytes += s_bytes;
+		start = now_ns();
+		for (size_t r = 0; r < nrows; ++r)
+			sum += atoll(m["user_id"][r].c_str()) + atof(m["score"][r].c_str());
+		read += now_ns() - start;
+	}
+	report("map_strings", nrows, rounds, build, read, allocs, bytes, sum);
+
+	build = read = sum = 0;
+	allocs = bytes = 0;
+	for (int i = 0; i < rounds; ++i) {
+		s_allocs = s_bytes = 0;
+		double start = now_ns();
+		ResultSet rs;
+		build_result_set(res, rs);
+		build += now_ns() - start;
+		allocs += s_allocs;
+		bytes += s_bytes;
+		start = now_ns();
+		for (size_t r = 0; r < nrows; ++r)
+			sum += rs.getInt64(r, "user_id") + rs.getDouble(r, "score");
+		read += now_ns() - start;
+	}
+	report("result_set", nrows, rounds, build, read, allocs, bytes, sum);
+
+	// the column looked up once, outside the loop
+	read = sum = 0;
+	ResultSet rs;
+	build_result_set(res, rs);
+	for (int i = 0; i < rounds; ++i) {
+		double start = now_ns();
+		int id = rs.columnIndex("user_id"), score = rs.columnIndex("score");
+		for (size_t r = 0; r < nrows; ++r)
+			sum += rs.getInt64(r, id) + rs.getDouble(r, score);
+		read += now_ns() - start;
+	}
+	report("result_set_index", nrows, rounds, 0, read, 0, 0, sum);
+}
@@ -0,0 +1,214 @@
+#include "router.h"
+#include <chrono>
+#include <map>
+#include <random>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Lookups among a REST API's worth of routes: for each of 40 resources
+// and 3 versions, the collection, the item and 8 sub-collections with their
+// items, "/api/v2/orders/:id/events/:event_id" and the like, 2160 routes in
+// all. The same random concrete paths go through the Router, through a
+// linear scan comparing segment by segment, and through a linear scan of
+// std::regex (on fewer lookups, it is that slow). The collection paths are
+// static, known when the program is built: those are also looked up in a
+// StaticRouteTable, a std::unordered_map and a std::map.
+// usage: router_bench [lookups]
+
+using namespace ekko;
+
+#define RESOURCES(X) X(users) X(repos) X(orders) X(items) X(invoices) X(teams) X(projects) \
+	X(issues) X(comments) X(labels) X(events) X(hooks) X(keys) X(tokens) X(sessions) X(files) \
+	X(folders) X(images) X(videos) X(playlists) X(artists) X(albums) X(tracks) X(devices) X(alerts) \
+	X(metrics) X(logs) X(traces) X(jobs) X(queues) X(workers) X(builds) X(deploys) X(regions) \
+	X(zones) X(hosts) X(volumes) X(snapshots) X(networks) X(routes)
+
+static const char *s_resources[] = {
+#define X(r) #r,
+	RESOURCES(X)
+#undef X
+};
+
+static const char *s_subs[] = { "events", "members", "settings", "history", "tags", "notes", "links", "stats" };
+
+enum {
+#define X(r) ROUTE_##r,
+	RESOURCES(X)
+#undef X
+};
+
+static constexpr StaticRoute s_static[] = {
+#define X(r) {"/api/v1/" #r, ROUTE_##r},
+	RESOURCES(X)
+#undef X
+};
+static constexpr auto s_table = MakeStaticRoutes(s_static);
+
+static double
+now_ns()
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<std::string>
+split(const std::string &s)
+{
+	std::vector<std::string> out;
+	size_t pos = 1;
+	while (pos <= s.size()) {
+		size_t end = s.find('/', pos);
+		if (end == std::string::npos)
+			end = s.size();
+		out.push_back(s.substr(pos, end - pos));
+		pos = end + 1;
+	}
+	return out;
+}
+
+/// @brief what a hand-rolled router does: every route, segment by segment
+struct linear_router_t {
+	std::vector<std::vector<std::string> > routes;
+
+	int Find(std::string_view path, RouteParams &params) const {
+		std::vector<std::string_view> segs;
+		size_t pos = 1;
+		while (pos <= path.size()) {
+			size_t end = path.find('/', pos);
+			if (end == std::string_view::npos)
+				end = path.size();
+			segs.push_back(path.substr(pos, end - pos));
+			pos = end + 1;
+		}
+		for (size_t r = 0; r < routes.size(); ++r) {
+			const std::vector<std::string> &route = routes[r];
+			if (route.size() != segs.size())
+				continue;
+			size_t i;
+			params.size = 0;
+			for (i = 0; i < segs.size(); ++i) {
+				if (route[i][0] == ':')
+					params.values[params.size++] = segs[i];
+				else if (route[i] != segs[i])
+					break;
+			}
+			if (i == segs.size())
+				return r;
+		}
+		return -1;
+	}
+};
+
+static void
+report(const char *how, const char *paths, size_t routes, size_t lookups, double ns, size_t found)
+{
+	printf("%s\t%s\t%zu\t%zu\t%.1f\t%zu\n", how, paths, routes, lookups, ns / lookups, found);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t lookups = argc > 1 ? atol(argv[1]) : 1000000;
+	std::vector<std::string> patterns, paths, static_paths;
+	std::mt19937 rng(42);
+	Router router;
+	linear_router_t linear;
+	std::vector<std::regex> regexes;
+	size_t sink = 0;
+
+	for (int v = 1; v <= 3; ++v) {
+		for (const char *r : s_resources) {
+			std::string base = "/api/v" + std::to_string(v) + "/" + r;
+			patterns.push_back(base);
+			patterns.push_back(base + "/:id");
+			for (const char *sub : s_subs) {
+				patterns.push_back(base + "/:id/" + sub);
+				patterns.push_back(base + "/:id/" + sub + "/:sub_id");
+			}
+		}
+	}
+	for (size_t i = 0; i < patterns.size(); ++i) {
+		router.Get(patterns[i], [](const HttpRequest&, HttpResponse&, const RouteParams&) {});
+		linear.routes.push_back(split(patterns[i]));
+		std::string re = std::regex_replace(patterns[i], std::regex(":[a-z_]+"), "([^/]+)");
+		regexes.emplace_back("^" + re + "$");
+	}
+	router.Compile();
+	for (size_t i = 0; i < 4096; ++i) {
+		std::string p = patterns[rng() % patterns.size()];
+		size_t at;
+		while ((at = p.find(':')) != std::string::npos) {
+			size_t end = std::min(p.find('/', at), p.size());
+			p.replace(at, end - at, std::to_string(rng() % 100000));
+		}
+		paths.push_back(p);
+		static_paths.push_back(std::string("/api/v1/") + s_resources[rng() % (sizeof(s_resources) / sizeof(s_resources[0]))]);
+	}
+
+	printf("router\tpaths\troutes\tlookups\tns_per_lookup\tfound\n");
+	RouteParams params;
+	size_t found = 0;
+	double start = now_ns();
+	for (size_t i = 0; i < lookups; ++i)
+		found += router.Find(HTTP_GET, paths[i & 4095], params) != 0;
+	report("radix_trie", "mixed", patterns.size(), lookups, now_ns() - start, found);
+
+	size_t few = lookups / 100 ? lookups / 100 : 1;
+	found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < few; ++i)
+		found += linear.Find(paths[i & 4095], params) >= 0;
+	report("linear_segments", "mixed", patterns.size(), few, now_ns() - start, found);
+
+	size_t fewer = lookups / 10000 ? lookups / 10000 : 1;
+	found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < fewer; ++i) {
+		for (size_t r = 0; r < regexes.size(); ++r) {
+			if (std::regex_match(paths[i & 4095], regexes[r])) {
+				++found;
+				break;
+			}
+		}
+	}
+	report("linear_regex", "mixed", patterns.size(), fewer, now_ns() - start, found);
+
+	// the static paths alone
+	found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < lookups; ++i)
+		found += router.Find(HTTP_GET, static_paths[i & 4095], params) != 0;
+	report("radix_trie", "static", patterns.size(), lookups, now_ns() - start, found);
+
+	found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < lookups; ++i) {
+		int id = s_table.Find(static_paths[i & 4095]);
+		found += id >= 0;
+		sink += id;
+	}
+	report("constexpr_table", "static", s_table.Size(), lookups, now_ns() - start, found);
+
+	std::unordered_map<std::string_view, int> hash;
+	std::map<std::string, int> tree;
+	for (size_t i = 0; i < s_table.Size(); ++i) {
+		hash[s_static[i].path] = s_static[i].id;
+		tree[std::string(s_static[i].path)] = s_static[i].id;
+	}
+	found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < lookups; ++i)
+		found += hash.count(static_paths[i & 4095]);
+	report("unordered_map", "static", hash.size(), lookups, now_ns() - start, found);
+
+	found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < lookups; ++i)
+		found += tree.count(static_paths[i & 4095]);
+	report("std::map", "static", tree.size(), lookups, now_ns() - start, found);
+
+	printf("\nnodes\t%zu\tsink\t%zu\n", router.NodeCount(), sink);
+}
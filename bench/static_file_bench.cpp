@@ -0,0 +1,189 @@
+#include "http_server.h"
+#include "socket_util.h"
+#include "static_file.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// StaticFileHandler (cache, mmap, sendfile/splice) against a handler that
+// opens, reads and closes the file on every request and copies it into the
+// response. Clients run in a forked child so getrusage() in the parent is the
+// server's CPU alone.
+// usage: static_file_bench [seconds_per_case] [connections] [epoll]
+
+using namespace ekko;
+
+static double
+now_s()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double
+cpu_s()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void
+read_write_handler(const std::string &root, const HttpRequest &req, HttpResponse &resp)
+{
+	std::string path = root + std::string(req.Path());
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0)
+			close(fd);
+		resp.SetStatus(404);
+		return;
+	}
+	std::string body(st.st_size, '\0');
+	ssize_t done = 0, n;
+	while (done < st.st_size && (n = read(fd, &body[done], st.st_size - done)) > 0)
+		done += n;
+	close(fd);
+	resp.AddHeader("Content-Type", StaticFileHandler::ContentType(path));
+	resp.SetBody(std::move(body));
+}
+
+/// @brief keep-alive clients asking for path back to back
+/// @return responses
+static uint64_t
+run_clients(int port, const std::string &path, int conns, double seconds)
+{
+	std::atomic<uint64_t> total(0);
+	std::vector<std::thread> threads;
+	double deadline = now_s() + seconds;
+	std::string req = "GET " + path + " HTTP/1.1\r\nHost: bench\r\n\r\n";
+
+	for (int c = 0; c < conns; ++c) {
+		threads.push_back(std::thread([&]() {
+			std::vector<char> buf(1 << 20);
+			std::string pending;
+			uint64_t count = 0;
+			int fd = ConnectTo("127.0.0.1", port);
+			if (fd < 0)
+				exit(1);
+			while (now_s() < deadline) {
+				if (write(fd, req.data(), req.size()) != (ssize_t) req.size())
+					exit(1);
+				size_t end, len;
+				while ((end = pending.find("\r\n\r\n")) == std::string::npos) {
+					ssize_t n = read(fd, &buf[0], buf.size());
+					if (n <= 0)
+						exit(1);
+					pending.append(&buf[0], n);
+				}
+				size_t pos = pending.find("Content-Length: ");
+				len = pos < end ? atol(pending.c_str() + pos + 16) : 0;
+				// only the head is kept, the body is counted off
+				size_t need = end + 4 + len, have = pending.size();
+				while (have < need) {
+					ssize_t n = read(fd, &buf[0], need - have < buf.size() ? need - have : buf.size());
+					if (n <= 0)
+						exit(1);
+					have += n;
+				}
+				pending.clear();
+				++count;
+			}
+			close(fd);
+			total += count;
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	return total;
+}
+
+static void
+run_case(const char *mode, const std::string &root, const std::string &file, size_t size,
+		 int conns, double seconds, bool use_uring)
+{
+	int up[2], down[2];
+	if (pipe(up) < 0 || pipe(down) < 0)
+		exit(1);
+	pid_t pid = fork();
+	if (pid == 0) {
+		int port;
+		uint64_t count;
+		if (read(down[0], &port, sizeof(port)) != sizeof(port))
+			_exit(1);
+		count = run_clients(port, file, conns, seconds);
+		if (write(up[1], &count, sizeof(count)) != sizeof(count))
+			_exit(1);
+		_exit(0);
+	}
+
+	StaticFileHandler files(root);
+	HttpServer server("127.0.0.1", 0, 1, use_uring);
+	if (strcmp(mode, "static") == 0)
+		server.SetHandler([&](const HttpRequest &req, HttpResponse &resp) { files.Handle(req, resp); });
+	else
+		server.SetHandler([&](const HttpRequest &req, HttpResponse &resp) { read_write_handler(root, req, resp); });
+	if (server.Start() != 0)
+		exit(1);
+	int port = server.GetPort();
+	double cpu0 = cpu_s(), start = now_s();
+	if (write(down[1], &port, sizeof(port)) != sizeof(port))
+		exit(1);
+	uint64_t count = 0;
+	if (read(up[0], &count, sizeof(count)) != sizeof(count))
+		exit(1);
+	double elapsed = now_s() - start, cpu = cpu_s() - cpu0;
+	server.Stop();
+	waitpid(pid, 0, 0);
+	close(up[0]);
+	close(up[1]);
+	close(down[0]);
+	close(down[1]);
+
+	printf("%s\t%s\t%zu\t%.0f\t%.1f\t%.2f\n", mode, server.GetServer().IsUring() ? "uring" : "epoll",
+		size, count / elapsed, count * size / elapsed / 1e6, cpu * 1e6 / (count ? count : 1));
+}
+
+int
+main(int argc, char **argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 2;
+	int conns = argc > 2 ? atoi(argv[2]) : 16;
+	bool use_uring = !(argc > 3 && strcmp(argv[3], "epoll") == 0);
+	char dir[] = "/tmp/static_bench_XXXXXX";
+	if (!mkdtemp(dir))
+		return 1;
+	std::string root = dir;
+
+	// a cached read file, a cached mapped one, and one sent from disk
+	size_t sizes[] = { 1024, 65536, 8 << 20 };
+	const char *names[] = { "/small.css", "/mid.js", "/big.bin" };
+	for (int i = 0; i < 3; ++i) {
+		std::string data(sizes[i], 'x');
+		FILE *fp = fopen((root + names[i]).c_str(), "w");
+		if (!fp || fwrite(data.data(), 1, data.size(), fp) != data.size())
+			return 1;
+		fclose(fp);
+	}
+
+	printf("handler\tbackend\tbytes\treq_per_sec\tMB_per_sec\tserver_cpu_us_per_req\n");
+	for (int i = 0; i < 3; ++i) {
+		run_case("read_write", root, names[i], sizes[i], conns, seconds, use_uring);
+		run_case("static", root, names[i], sizes[i], conns, seconds, use_uring);
+	}
+	for (int i = 0; i < 3; ++i)
+		unlink((root + names[i]).c_str());
+	rmdir(dir);
+}
@@ -0,0 +1,74 @@
+#include "thread_pool.h"
+#include "task_graph.h"
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+
+// scheduling overhead per node: the tasks themselves are empty
+#define NNODES 10000
+#define NRUNS 20
+
+static double
+now_ns()
+{
+	return std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+report(const char *name, ekko::TaskGraph &graph, struct ekko::thread_pool_t *pool)
+{
+	double start = now_ns();
+	graph.Run(pool);
+	double first = (now_ns() - start) / graph.Size();
+
+	start = now_ns();
+	for (int r = 0; r < NRUNS; ++r)
+		graph.Run(pool);
+	double reused = (now_ns() - start) / NRUNS / graph.Size();
+	printf("%s\t%zu\t%.1f\t%.1f\n", name, graph.Size(), first, reused);
+}
+
+int
+main()
+{
+	int nworkers = std::thread::hardware_concurrency();
+	struct ekko::thread_pool_t pool;
+	ekko::thread_pool_init(&pool, nworkers > 1 ? nworkers - 1 : 1);
+	printf("shape\tnodes\tfirst_run_ns_per_node\treused_ns_per_node\n");
+
+	// a chain never leaves the thread that completed the previous node
+	ekko::TaskGraph chain;
+	for (int i = 0; i < NNODES; ++i) {
+		chain.AddTask([] {});
+		if (i)
+			chain.Precede(i - 1, i);
+	}
+	report("chain", chain, &pool);
+
+	// one source, NNODES independent nodes, one sink
+	ekko::TaskGraph fan;
+	int src = fan.AddTask([] {});
+	int sink = fan.AddTask([] {});
+	for (int i = 0; i < NNODES; ++i) {
+		int id = fan.AddTask([] {});
+		fan.Precede(src, id);
+		fan.Precede(id, sink);
+	}
+	report("fan", fan, &pool);
+
+	// 100 layers of 100, each node waits for two nodes of the previous layer
+	ekko::TaskGraph grid;
+	for (int layer = 0; layer < 100; ++layer) {
+		for (int k = 0; k < 100; ++k) {
+			int id = grid.AddTask([] {});
+			if (layer) {
+				grid.Precede((layer - 1) * 100 + k, id);
+				grid.Precede((layer - 1) * 100 + (k + 1) % 100, id);
+			}
+		}
+	}
+	report("grid", grid, &pool);
+
+	ekko::thread_pool_destroy(&pool);
+}
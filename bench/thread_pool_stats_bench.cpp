@@ -0,0 +1,65 @@
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+
+// cost of the instrumentation on a push/run round trip of empty tasks;
+// the _nostats build compiles the pool with -DTHREAD_POOL_NO_STATS
+#define NTASKS 1000000
+
+static std::atomic<long> s_done(0);
+
+static void
+empty_task(void*)
+{
+	++s_done;
+}
+
+static double
+now_ns()
+{
+	return std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double
+run(struct ekko::thread_pool_t *pool)
+{
+	s_done = 0;
+	double start = now_ns();
+	for (int i = 0; i < NTASKS; ++i)
+		ekko::thread_pool_push_task(pool, empty_task, 0);
+	while (s_done != NTASKS)
+		std::this_thread::yield();
+	return (now_ns() - start) / NTASKS;
+}
+
+int
+main()
+{
+	struct ekko::thread_pool_t pool;
+	int nworkers = std::thread::hardware_concurrency();
+	ekko::thread_pool_init(&pool, nworkers > 0 ? nworkers : 1);
+
+	run(&pool);
+	printf("stats_disabled_ns_per_task\t%.1f\n", run(&pool));
+	ekko::thread_pool_stats_enable(&pool, 1);
+	printf("stats_enabled_ns_per_task\t%.1f\n", run(&pool));
+
+	struct ekko::thread_pool_stats_t stats;
+	struct ekko::worker_stats_t workers[256];
+	int n = ekko::thread_pool_stats(&pool, &stats, workers, 256);
+	printf("queue_wait_p50_ns\t%llu\n", (unsigned long long) ekko::thread_pool_hist_percentile(&stats.total.queueWait, 50));
+	printf("queue_wait_p99_ns\t%llu\n", (unsigned long long) ekko::thread_pool_hist_percentile(&stats.total.queueWait, 99));
+	printf("run_p50_ns\t%llu\n", (unsigned long long) ekko::thread_pool_hist_percentile(&stats.total.run, 50));
+	printf("run_p99_ns\t%llu\n", (unsigned long long) ekko::thread_pool_hist_percentile(&stats.total.run, 99));
+	printf("max_queue_depth\t%d\n", stats.maxQueueDepth);
+	for (int i = 0; i < n && i < 256; ++i) {
+		uint64_t total = workers[i].busyNs + workers[i].idleNs;
+		printf("worker%d\ttasks=%llu\tbusy=%.1f%%\twakes=%llu\tsteals=%llu\n", i,
+			(unsigned long long) workers[i].tasks, total ? 100.0 * workers[i].busyNs / total : 0.0,
+			(unsigned long long) workers[i].wakes, (unsigned long long) workers[i].steals);
+	}
+	ekko::thread_pool_destroy(&pool);
+}
@@ -0,0 +1,185 @@
+#include "timing_wheel.h"
+#include <chrono>
+#include <map>
+#include <set>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// Idle timeouts of many connections, each pushed back whenever the
+// connection sees traffic: the reset is the hot path. Simulated time runs
+// in 1ms steps; every step resets the timeouts of random busy connections
+// and expires the due ones, while a tenth of the connections never see
+// traffic and time out. The same schedule is run on the wheel, on an
+// ordered std::set of (deadline, id) and on a std::multimap keeping an
+// iterator per connection. timerfd_settime, a kernel timer per connection,
+// is timed on as many descriptors as RLIMIT_NOFILE allows.
+// usage: timing_wheel_bench [connections] [resets_per_ms] [seconds_simulated]
+
+using namespace ekko;
+
+#define IDLE_TIMEOUT_MS 30000
+
+static double
+now_s()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief the connections reset at each step, the same for every structure
+static std::vector<uint32_t>
+make_schedule(int conns, int resets, int steps)
+{
+	std::vector<uint32_t> ids((size_t) resets * steps);
+	// the first tenth is idle
+	uint32_t busy = conns - conns / 10;
+	for (size_t i = 0; i < ids.size(); ++i)
+		ids[i] = conns / 10 + (uint32_t) (rand() % busy);
+	return ids;
+}
+
+static void
+report(const char *how, int conns, size_t resets, uint64_t fired, uint64_t moved, double elapsed)
+{
+	printf("%s\t%d\t%zu\t%.1f\t%lu\t%lu\n", how, conns, resets,
+		elapsed * 1e9 / resets, (unsigned long) fired, (unsigned long) moved);
+}
+
+static void
+run_wheel(int conns, int resets, int steps, const std::vector<uint32_t> &ids)
+{
+	TimingWheel wheel;
+	std::vector<TimingWheel::Timer> timers(conns);
+	uint64_t base = TimingWheel::NowMs() + 1000, closed = 0;
+
+	wheel.Advance(base);
+	for (int i = 0; i < conns; ++i) {
+		timers[i].SetCallback([&closed]() { ++closed;});
+		wheel.Add(&timers[i], IDLE_TIMEOUT_MS);
+	}
+	double start = now_s();
+	for (int step = 1; step <= steps; ++step) {
+		wheel.Update(base + step);
+		const uint32_t *p = &ids[(size_t) (step - 1) * resets];
+		for (int i = 0; i < resets; ++i)
+			wheel.Reset(&timers[p[i]], IDLE_TIMEOUT_MS);
+		wheel.Advance(base + step);
+	}
+	double elapsed = now_s() - start;
+	report("wheel", conns, ids.size(), closed, wheel.GetMoved(), elapsed);
+}
+
+static void
+run_set(int conns, int resets, int steps, const std::vector<uint32_t> &ids)
+{
+	std::set<std::pair<uint64_t, uint32_t> > timers;
+	std::vector<uint64_t> deadline(conns, IDLE_TIMEOUT_MS);
+	uint64_t closed = 0;
+
+	for (int i = 0; i < conns; ++i)
+		timers.insert(std::make_pair((uint64_t) IDLE_TIMEOUT_MS, (uint32_t) i));
+	double start = now_s();
+	for (int step = 1; step <= steps; ++step) {
+		const uint32_t *p = &ids[(size_t) (step - 1) * resets];
+		for (int i = 0; i < resets; ++i) {
+			uint32_t id = p[i];
+			if (deadline[id] == 0)
+				continue;
+			timers.erase(std::make_pair(deadline[id], id));
+			deadline[id] = step + IDLE_TIMEOUT_MS;
+			timers.insert(std::make_pair(deadline[id], id));
+		}
+		while (!timers.empty() && timers.begin()->first <= (uint64_t) step) {
+			deadline[timers.begin()->second] = 0;
+			timers.erase(timers.begin());
+			++closed;
+		}
+	}
+	double elapsed = now_s() - start;
+	report("std::set", conns, ids.size(), closed, 0, elapsed);
+}
+
+static void
+run_multimap(int conns, int resets, int steps, const std::vector<uint32_t> &ids)
+{
+	typedef std::multimap<uint64_t, uint32_t> Map;
+	Map timers;
+	std::vector<Map::iterator> where(conns);
+	std::vector<bool> open(conns, true);
+	uint64_t closed = 0;
+
+	for (int i = 0; i < conns; ++i)
+		where[i] = timers.insert(std::make_pair((uint64_t) IDLE_TIMEOUT_MS, (uint32_t) i));
+	double start = now_s();
+	for (int step = 1; step <= steps; ++step) {
+		const uint32_t *p = &ids[(size_t) (step - 1) * resets];
+		for (int i = 0; i < resets; ++i) {
+			uint32_t id = p[i];
+			if (!open[id])
+				continue;
+			timers.erase(where[id]);
+			where[id] = timers.insert(std::make_pair(step + IDLE_TIMEOUT_MS, id));
+		}
+		while (!timers.empty() && timers.begin()->first <= (uint64_t) step) {
+			open[timers.begin()->second] = false;
+			timers.erase(timers.begin());
+			++closed;
+		}
+	}
+	double elapsed = now_s() - start;
+	report("std::multimap", conns, ids.size(), closed, 0, elapsed);
+}
+
+/// @brief the syscall alone: one timerfd per connection, re-armed on each reset
+static void
+run_timerfd(int conns, const std::vector<uint32_t> &ids)
+{
+	struct rlimit rlim;
+	struct itimerspec its = {};
+	std::vector<int> fds;
+	size_t n = 0;
+
+	getrlimit(RLIMIT_NOFILE, &rlim);
+	if ((rlim_t) conns > rlim.rlim_cur - 64)
+		conns = rlim.rlim_cur - 64;
+	for (int i = 0; i < conns; ++i) {
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0)
+			break;
+		fds.push_back(fd);
+	}
+	if (fds.empty())
+		return;
+	its.it_value.tv_sec = IDLE_TIMEOUT_MS / 1000;
+	// a tenth of the schedule is plenty to time a syscall
+	size_t total = ids.size() / 10 ? ids.size() / 10 : ids.size();
+	double start = now_s();
+	for (size_t i = 0; i < total; ++i) {
+		if (timerfd_settime(fds[ids[i] % fds.size()], 0, &its, 0) == 0)
+			++n;
+	}
+	double elapsed = now_s() - start;
+	report("timerfd", fds.size(), n, 0, 0, elapsed);
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i]);
+}
+
+int
+main(int argc, char **argv)
+{
+	int conns = argc > 1 ? atoi(argv[1]) : 100000;
+	int resets = argc > 2 ? atoi(argv[2]) : 200;
+	int seconds = argc > 3 ? atoi(argv[3]) : 60;
+	int steps = seconds * 1000;
+	std::vector<uint32_t> ids = make_schedule(conns, resets, steps);
+
+	printf("timers\tconnections\tresets\tns_per_reset\tfired\tmoved\n");
+	run_wheel(conns, resets, steps, ids);
+	run_set(conns, resets, steps, ids);
+	run_multimap(conns, resets, steps, ids);
+	run_timerfd(conns, ids);
+}
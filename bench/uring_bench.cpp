@@ -0,0 +1,99 @@
+#include "uring_server.h"
+#include "socket_util.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// the echo_bench ping-pong against both backends of UringServer, with the
+// server side syscalls per request: epoll_wait/epoll_ctl/read/send/accept4
+// on epoll, io_uring_enter and eventfd reads on io_uring
+// usage: uring_bench [loops] [clients] [seconds] [msg_size]
+
+using namespace ekko;
+
+static double
+now_us()
+{
+	return std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+client(int port, int msg_size, double deadline, std::vector<double> *lat)
+{
+	std::vector<char> msg(msg_size, 'e'), buf(msg_size);
+	int fd = ConnectTo("127.0.0.1", port);
+	if (fd < 0)
+		return;
+	while (now_us() < deadline) {
+		double start = now_us();
+		if (write(fd, msg.data(), msg_size) != msg_size)
+			break;
+		int got = 0;
+		while (got < msg_size) {
+			ssize_t n = read(fd, buf.data() + got, msg_size - got);
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		if (got != msg_size)
+			break;
+		lat->push_back(now_us() - start);
+	}
+	close(fd);
+}
+
+static void
+run(bool use_uring, int nloops, int nclients, double seconds, int msg_size)
+{
+	UringServer server("127.0.0.1", 0, nloops, use_uring);
+	server.SetMessageCallback([](const Connection::ptr &conn, Buffer &buf) {
+		conn->Send(buf.Peek(), buf.ReadableBytes());
+		buf.RetrieveAll();
+	});
+	if (server.Start() != 0) {
+		fprintf(stderr, "server start failed\n");
+		return;
+	}
+
+	std::vector<std::vector<double> > lat(nclients);
+	std::vector<std::thread> threads;
+	uint64_t syscalls = server.GetSyscalls();
+	double start = now_us(), deadline = start + seconds * 1e6;
+	for (int i = 0; i < nclients; ++i)
+		threads.emplace_back(client, server.GetPort(), msg_size, deadline, &lat[i]);
+	for (auto &t : threads)
+		t.join();
+	double elapsed = (now_us() - start) / 1e6;
+	server.Stop();
+	syscalls = server.GetSyscalls() - syscalls;
+
+	std::vector<double> all;
+	for (auto &v : lat)
+		all.insert(all.end(), v.begin(), v.end());
+	std::sort(all.begin(), all.end());
+	if (all.empty())
+		return;
+	printf("%s\t%d\t%d\t%d\t%.0f\t%.1f\t%.1f\t%.2f\n", server.IsUring() ? "io_uring" : "epoll",
+		nloops, nclients, msg_size, all.size() / elapsed,
+		all[all.size() / 2], all[all.size() * 99 / 100], (double) syscalls / all.size());
+}
+
+int
+main(int argc, char **argv)
+{
+	int nloops = argc > 1 ? atoi(argv[1]) : 1;
+	int nclients = argc > 2 ? atoi(argv[2]) : 8;
+	double seconds = argc > 3 ? atof(argv[3]) : 3;
+	int msg_size = argc > 4 ? atoi(argv[4]) : 64;
+
+	if (!UringServer::IsSupported())
+		printf("io_uring not supported here, both runs use epoll\n");
+	printf("backend\tloops\tclients\tmsg_size\treq_per_sec\tp50_us\tp99_us\tsyscalls_per_req\n");
+	run(false, nloops, nclients, seconds, msg_size);
+	run(true, nloops, nclients, seconds, msg_size);
+}
@@ -0,0 +1,129 @@
+#include "fiber.h"
+#include "scheduler.h"
+#include "page_cache.h"
+#include <atomic>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ekko {
+
+static std::atomic<uint32_t> s_fiber_id(0);
+
+static thread_local fiber_worker_t t_worker = {};
+
+__attribute__((noinline)) fiber_worker_t*
+fiber_current_worker()
+{
+    fiber_worker_t *worker = &t_worker;
+    // keep the compiler from caching the address across a switch
+    asm volatile("" : "+r"(worker));
+    return worker;
+}
+
+Fiber::Fiber(Scheduler *scheduler, std::function<void()> cb, size_t stack_size)
+    :id_(++s_fiber_id)
+    ,cb_(std::move(cb))
+    ,scheduler_(scheduler) {
+    size_t npages = (stack_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (npages == 0)
+        npages = 1;
+    if (npages > NPAGES)
+        npages = NPAGES;
+    stack_span_ = PageCache::GetInstance()->Allocate(npages);
+    stack_size_ = stack_span_ ? stack_span_->npages << PAGE_SHIFT : 0;
+    if (stack_span_)
+        fiber_context_make(&ctx_, (void*) (stack_span_->pageid << PAGE_SHIFT), stack_size_, Main);
+}
+
+Fiber::~Fiber()
+{
+    if (stack_span_)
+        PageCache::GetInstance()->Deallocate(stack_span_);
+    pthread_mutex_destroy(&join_mutex_);
+    pthread_cond_destroy(&join_cond_);
+}
+
+Fiber*
+Fiber::GetThis()
+{
+    return fiber_current_worker()->current;
+}
+
+void
+Fiber::Main()
+{
+    Fiber *fiber = GetThis();
+    fiber->cb_();
+    fiber->cb_ = nullptr;
+    fiber->state_ = TERM;
+    fiber->SwitchOut();
+}
+
+void
+Fiber::SwitchOut()
+{
+    fiber_context_switch(&ctx_, &fiber_current_worker()->ctx);
+}
+
+void
+Fiber::Yield()
+{
+    Fiber *fiber = GetThis();
+    if (fiber == 0) {
+        sched_yield();
+        return;
+    }
+    fiber->state_ = READY;
+    fiber->SwitchOut();
+}
+
+void
+Fiber::Suspend(pthread_mutex_t *mutex)
+{
+    Fiber *fiber = GetThis();
+    fiber->state_ = SUSPENDED;
+    fiber_current_worker()->unlock_after = mutex;
+    fiber->SwitchOut();
+}
+
+void
+Fiber::SleepFor(uint64_t ms)
+{
+    Fiber *fiber = GetThis();
+    if (fiber == 0) {
+        usleep(ms * 1000);
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t deadline = ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + ms;
+
+    Scheduler *scheduler = fiber->scheduler_;
+    pthread_mutex_lock(&scheduler->mutex_);
+    scheduler->timers_.insert(std::make_pair(deadline, fiber));
+    // an idle worker may be waiting for a later deadline
+    pthread_cond_signal(&scheduler->cond_);
+    Suspend(&scheduler->mutex_);
+}
+
+void
+Fiber::Join()
+{
+    Fiber *cur = GetThis();
+    pthread_mutex_lock(&join_mutex_);
+    if (done_) {
+        pthread_mutex_unlock(&join_mutex_);
+        return;
+    }
+    if (cur) {
+        joiners_.push_back(cur);
+        Suspend(&join_mutex_);
+        return;
+    }
+    while (!done_)
+        pthread_cond_wait(&join_cond_, &join_mutex_);
+    pthread_mutex_unlock(&join_mutex_);
+}
+
+}
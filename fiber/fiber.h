@@ -0,0 +1,114 @@
+#ifndef __FIBER_H__
+#define __FIBER_H__
+
+#include <memory>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "fiber_context.h"
+
+#define FIBER_DEFAULT_STACK_SIZE 65536
+
+namespace ekko {
+
+struct Span;
+class Scheduler;
+
+class Fiber {
+friend class Scheduler;
+public:
+    typedef std::shared_ptr<Fiber> ptr;
+
+    enum State {
+        READY,
+        RUNNING,
+        SUSPENDED,
+        TERM
+    };
+
+    ~Fiber();
+
+    uint32_t GetId() const { return id_;}
+
+    State GetState() const { return state_;}
+
+    size_t GetStackSize() const { return stack_size_;}
+
+    Scheduler* GetScheduler() const { return scheduler_;}
+
+    /// @brief wait until the fiber has finished, only the calling fiber is
+    /// suspended when called from one, a plain thread blocks
+    void Join();
+
+    /// @brief the fiber running on this thread, 0 outside of fibers
+    static Fiber* GetThis();
+
+    /// @brief give the worker to the next ready fiber
+    static void Yield();
+
+    /// @brief suspend the calling fiber for at least ms milliseconds
+    static void SleepFor(uint64_t ms);
+
+    /// @brief switch out without being put back in the ready queue, someone
+    /// has to Scheduler::Schedule the fiber again
+    /// @param[in] mutex released by the worker once the fiber is off its stack,
+    /// so a waker holding it can never resume a fiber that is still running
+    static void Suspend(pthread_mutex_t *mutex);
+
+private:
+    Fiber(Scheduler *scheduler, std::function<void()> cb, size_t stack_size);
+
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+
+    static void Main();
+
+    /// @brief back to the worker that resumed this fiber
+    void SwitchOut();
+
+    uint32_t id_;
+
+    State state_ = READY;
+
+    struct fiber_context_t ctx_;
+
+    /// @brief stack pages come straight from the page cache
+    Span *stack_span_ = 0;
+
+    size_t stack_size_;
+
+    std::function<void()> cb_;
+
+    Scheduler *scheduler_;
+
+    /// @brief keeps a live fiber alive while it only sits in wait queues
+    Fiber::ptr self_;
+
+    pthread_mutex_t join_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+    /// @brief for joiners that are plain threads
+    pthread_cond_t join_cond_ = PTHREAD_COND_INITIALIZER;
+
+    std::vector<Fiber*> joiners_;
+
+    bool done_ = false;
+};
+
+/// @brief per worker thread state of the scheduler
+struct fiber_worker_t {
+    /// @brief context of the scheduler loop the fibers switch back to
+    struct fiber_context_t ctx;
+    Fiber *current;
+    Scheduler *scheduler;
+    /// @brief released right after the current fiber switched out
+    pthread_mutex_t *unlock_after;
+};
+
+/// @brief never inlined: a fiber may be resumed on another thread, so the
+/// thread local must be looked up again after every switch
+fiber_worker_t* fiber_current_worker();
+
+}
+
+#endif
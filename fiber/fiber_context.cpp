@@ -0,0 +1,95 @@
+#include "fiber_context.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef EKKO_FIBER_ASM
+// void ekko_fiber_switch(void **from_sp, void *to_sp)
+// pushes the callee-saved registers and the fpu control words, swaps the
+// stack pointer and pops the ones of the other context
+asm(R"(
+    .text
+    .globl ekko_fiber_switch
+    .type ekko_fiber_switch,@function
+ekko_fiber_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size ekko_fiber_switch,.-ekko_fiber_switch
+
+    .globl ekko_fiber_trampoline
+    .type ekko_fiber_trampoline,@function
+ekko_fiber_trampoline:
+    callq *%r13
+    ud2
+    .size ekko_fiber_trampoline,.-ekko_fiber_trampoline
+)");
+
+extern "C" void ekko_fiber_switch(void **from_sp, void *to_sp);
+extern "C" void ekko_fiber_trampoline();
+#endif
+
+namespace ekko {
+
+#ifdef EKKO_FIBER_ASM
+void
+fiber_context_make(struct fiber_context_t *ctx, void *stack, size_t size, void (*entry)())
+{
+    uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+    // fpu words, r15, r14, r13, r12, rbx, rbp, return address; the return
+    // address must land on 8 mod 16 so entry starts with an aligned stack
+    uint64_t *sp = (uint64_t*) (top - 80);
+    uint32_t mxcsr;
+    uint16_t fpucw;
+
+    asm volatile("stmxcsr %0" : "=m"(mxcsr));
+    asm volatile("fnstcw %0" : "=m"(fpucw));
+    memset(sp, 0, 80);
+    memcpy(sp, &mxcsr, 4);
+    memcpy((char*) sp + 4, &fpucw, 2);
+    sp[3] = (uint64_t) entry;
+    sp[7] = (uint64_t) ekko_fiber_trampoline;
+    ctx->sp = sp;
+}
+
+void
+fiber_context_switch(struct fiber_context_t *from, struct fiber_context_t *to)
+{
+    ekko_fiber_switch(&from->sp, to->sp);
+}
+#else
+void
+fiber_context_make(struct fiber_context_t *ctx, void *stack, size_t size, void (*entry)())
+{
+    getcontext(&ctx->uc);
+    ctx->uc.uc_link = 0;
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, entry, 0);
+}
+
+void
+fiber_context_switch(struct fiber_context_t *from, struct fiber_context_t *to)
+{
+    swapcontext(&from->uc, &to->uc);
+}
+#endif
+
+}
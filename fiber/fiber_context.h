@@ -0,0 +1,34 @@
+#ifndef __FIBER_CONTEXT_H__
+#define __FIBER_CONTEXT_H__
+
+#include <stddef.h>
+
+// x86_64 switches with a few instructions of assembly, everything else
+// (or -DEKKO_FIBER_UCONTEXT) falls back to ucontext
+#if defined(__x86_64__) && !defined(EKKO_FIBER_UCONTEXT)
+#define EKKO_FIBER_ASM 1
+#else
+#include <ucontext.h>
+#endif
+
+namespace ekko {
+
+struct fiber_context_t {
+#ifdef EKKO_FIBER_ASM
+    /// @brief saved stack pointer, the callee-saved registers sit on the stack
+    void *sp;
+#else
+    ucontext_t uc;
+#endif
+};
+
+/// @brief prepare ctx so that switching to it runs entry on the given stack
+/// @param[in] entry must never return
+void fiber_context_make(struct fiber_context_t *ctx, void *stack, size_t size, void (*entry)());
+
+/// @brief save the current context into from and continue in to
+void fiber_context_switch(struct fiber_context_t *from, struct fiber_context_t *to);
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+
+namespace ekko {
+
+FiberMutex::FiberMutex()
+{
+    pthread_mutex_init(&guard_, 0);
+}
+
+FiberMutex::~FiberMutex()
+{
+    pthread_mutex_destroy(&guard_);
+}
+
+void
+FiberMutex::lock()
+{
+    pthread_mutex_lock(&guard_);
+    if (!locked_) {
+        locked_ = true;
+        pthread_mutex_unlock(&guard_);
+        return;
+    }
+    Fiber *fiber = Fiber::GetThis();
+    waiters_.push_back(fiber);
+    // unlock() hands us the mutex before scheduling us again
+    Fiber::Suspend(&guard_);
+}
+
+bool
+FiberMutex::try_lock()
+{
+    bool ok;
+    pthread_mutex_lock(&guard_);
+    ok = !locked_;
+    locked_ = true;
+    pthread_mutex_unlock(&guard_);
+    return ok;
+}
+
+void
+FiberMutex::unlock()
+{
+    Fiber *next = 0;
+    pthread_mutex_lock(&guard_);
+    if (waiters_.empty()) {
+        locked_ = false;
+    } else {
+        next = waiters_.front();
+        waiters_.pop_front();
+    }
+    pthread_mutex_unlock(&guard_);
+    if (next)
+        next->GetScheduler()->Schedule(next);
+}
+
+FiberCondition::FiberCondition()
+{
+    pthread_mutex_init(&guard_, 0);
+}
+
+FiberCondition::~FiberCondition()
+{
+    pthread_mutex_destroy(&guard_);
+}
+
+void
+FiberCondition::wait(FiberMutex &mutex)
+{
+    pthread_mutex_lock(&guard_);
+    waiters_.push_back(Fiber::GetThis());
+    mutex.unlock();
+    Fiber::Suspend(&guard_);
+    mutex.lock();
+}
+
+void
+FiberCondition::notify_one()
+{
+    Fiber *next = 0;
+    pthread_mutex_lock(&guard_);
+    if (!waiters_.empty()) {
+        next = waiters_.front();
+        waiters_.pop_front();
+    }
+    pthread_mutex_unlock(&guard_);
+    if (next)
+        next->GetScheduler()->Schedule(next);
+}
+
+void
+FiberCondition::notify_all()
+{
+    std::deque<Fiber*> waiters;
+    pthread_mutex_lock(&guard_);
+    waiters.swap(waiters_);
+    pthread_mutex_unlock(&guard_);
+    for (size_t i = 0; i < waiters.size(); ++i)
+        waiters[i]->GetScheduler()->Schedule(waiters[i]);
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef __FIBER_SYNC_H__
+#define __FIBER_SYNC_H__
+
+#include <deque>
+#include <pthread.h>
+#include "fiber.h"
+#include "mutex.h"
+
+namespace ekko {
+
+/// @brief mutex that suspends the waiting fiber instead of its worker thread.
+/// unlock() hands the mutex straight to the longest waiter.
+/// Must be used from fibers only.
+class FiberMutex : Noncopyable {
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    FiberMutex();
+
+    ~FiberMutex();
+
+    void lock();
+
+    /// @return success with true
+    bool try_lock();
+
+    void unlock();
+
+private:
+    /// @brief guards the fields below, only ever held for a few instructions
+    pthread_mutex_t guard_;
+
+    bool locked_ = false;
+
+    std::deque<Fiber*> waiters_;
+};
+
+/// @brief condition variable for fibers, used together with FiberMutex
+class FiberCondition : Noncopyable {
+public:
+    FiberCondition();
+
+    ~FiberCondition();
+
+    /// @brief release mutex, suspend until notified and take mutex again
+    void wait(FiberMutex &mutex);
+
+    void notify_one();
+
+    void notify_all();
+
+private:
+    pthread_mutex_t guard_;
+
+    std::deque<Fiber*> waiters_;
+};
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include "scheduler.h"
+#include "util.h"
+#include <time.h>
+
+namespace ekko {
+
+static uint64_t
+monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Scheduler::Scheduler(struct thread_pool_t *threadPoolPtr, int nworkers, size_t stack_size)
+    :stack_size_(stack_size) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond_, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&stop_cond_, 0);
+    pthread_mutex_init(&mutex_, 0);
+
+    if (nworkers < 1)
+        nworkers = 1;
+    pthread_mutex_lock(&mutex_);
+    for (int i = 0; i < nworkers; ++i) {
+        if (thread_pool_push_task(threadPoolPtr, WorkerCallback, this) != 0)
+            break;
+        ++nworkers_;
+        ++running_workers_;
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+Scheduler::~Scheduler()
+{
+    Stop();
+    pthread_cond_destroy(&cond_);
+    pthread_cond_destroy(&stop_cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+Scheduler*
+Scheduler::GetThis()
+{
+    return fiber_current_worker()->scheduler;
+}
+
+Fiber::ptr
+Scheduler::Spawn(std::function<void()> cb, size_t stack_size)
+{
+    Fiber::ptr fiber(new Fiber(this, std::move(cb), stack_size ? stack_size : stack_size_));
+    if (fiber->stack_span_ == 0)
+        return 0;
+    fiber->self_ = fiber;
+
+    pthread_mutex_lock(&mutex_);
+    ++live_;
+    ready_.push_back(fiber.get());
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+    return fiber;
+}
+
+void
+Scheduler::Schedule(Fiber *fiber)
+{
+    fiber->state_ = Fiber::READY;
+    pthread_mutex_lock(&mutex_);
+    ready_.push_back(fiber);
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+size_t
+Scheduler::GetLiveFibers()
+{
+    pthread_mutex_lock(&mutex_);
+    size_t live = live_;
+    pthread_mutex_unlock(&mutex_);
+    return live;
+}
+
+void
+Scheduler::Stop()
+{
+    pthread_mutex_lock(&mutex_);
+    stopping_ = true;
+    pthread_cond_broadcast(&cond_);
+    while (running_workers_)
+        pthread_cond_wait(&stop_cond_, &mutex_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void
+Scheduler::WorkerCallback(void *arg)
+{
+    ((Scheduler*) arg)->Run();
+}
+
+void
+Scheduler::Resume(Fiber *fiber)
+{
+    fiber_worker_t *worker = fiber_current_worker();
+    worker->current = fiber;
+    worker->unlock_after = 0;
+    fiber->state_ = Fiber::RUNNING;
+    SetFiberId(fiber->id_);
+
+    fiber_context_switch(&worker->ctx, &fiber->ctx_);
+
+    SetFiberId(0);
+    worker->current = 0;
+    switch (fiber->state_) {
+        case Fiber::READY:
+            Schedule(fiber);
+            break;
+        case Fiber::SUSPENDED:
+            if (worker->unlock_after)
+                pthread_mutex_unlock(worker->unlock_after);
+            break;
+        case Fiber::TERM: {
+            pthread_mutex_lock(&fiber->join_mutex_);
+            fiber->done_ = true;
+            for (size_t i = 0; i < fiber->joiners_.size(); ++i)
+                Schedule(fiber->joiners_[i]);
+            fiber->joiners_.clear();
+            pthread_cond_broadcast(&fiber->join_cond_);
+            pthread_mutex_unlock(&fiber->join_mutex_);
+            // may free the fiber and give its stack back to the page cache
+            fiber->self_.reset();
+
+            pthread_mutex_lock(&mutex_);
+            if (--live_ == 0 && stopping_)
+                pthread_cond_broadcast(&cond_);
+            pthread_mutex_unlock(&mutex_);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void
+Scheduler::Run()
+{
+    fiber_worker_t *worker = fiber_current_worker();
+    Fiber *fiber;
+    struct timespec ts;
+    uint64_t now;
+
+    worker->scheduler = this;
+    pthread_mutex_lock(&mutex_);
+    while (1) {
+        if (!timers_.empty()) {
+            now = monotonic_ms();
+            while (!timers_.empty() && timers_.begin()->first <= now) {
+                timers_.begin()->second->state_ = Fiber::READY;
+                ready_.push_back(timers_.begin()->second);
+                timers_.erase(timers_.begin());
+            }
+        }
+
+        if (!ready_.empty()) {
+            fiber = ready_.front();
+            ready_.pop_front();
+            pthread_mutex_unlock(&mutex_);
+            Resume(fiber);
+            pthread_mutex_lock(&mutex_);
+            continue;
+        }
+
+        if (stopping_ && live_ == 0)
+            break;
+
+        if (timers_.empty()) {
+            pthread_cond_wait(&cond_, &mutex_);
+        } else {
+            ts.tv_sec = timers_.begin()->first / 1000;
+            ts.tv_nsec = (timers_.begin()->first % 1000) * 1000000;
+            pthread_cond_timedwait(&cond_, &mutex_, &ts);
+        }
+    }
+    --running_workers_;
+    pthread_cond_signal(&stop_cond_);
+    pthread_mutex_unlock(&mutex_);
+    worker->scheduler = 0;
+}
+
+}
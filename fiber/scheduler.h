@@ -0,0 +1,80 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <deque>
+#include <map>
+#include <functional>
+#include <pthread.h>
+#include "fiber.h"
+#include "thread_pool.h"
+
+namespace ekko {
+
+/// @brief M:N scheduler, multiplexes fibers onto workers of a thread_pool_t.
+/// Every worker given to the scheduler runs its loop until Stop(), so the pool
+/// needs spare threads for anything else pushed to it.
+class Scheduler {
+friend class Fiber;
+public:
+    /// @param[in] nworkers number of pool threads to occupy
+    /// @param[in] stack_size default stack of spawned fibers, capped at NPAGES pages
+    Scheduler(struct thread_pool_t *threadPoolPtr, int nworkers,
+              size_t stack_size = FIBER_DEFAULT_STACK_SIZE);
+
+    /// @brief Stop()s the scheduler
+    ~Scheduler();
+
+    /// @brief create a fiber and make it ready
+    /// @return 0 if no stack could be allocated
+    Fiber::ptr Spawn(std::function<void()> cb, size_t stack_size = 0);
+
+    /// @brief put a suspended fiber back in the ready queue
+    void Schedule(Fiber *fiber);
+
+    /// @brief wait for every fiber to finish, then give the workers back to the pool
+    void Stop();
+
+    /// @return number of workers running the scheduler loop
+    int GetWorkers() const { return nworkers_;}
+
+    /// @return fibers spawned and not finished yet
+    size_t GetLiveFibers();
+
+    static Scheduler* GetThis();
+
+private:
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    static void WorkerCallback(void *arg);
+
+    void Run();
+
+    /// @brief switch into fiber and handle the state it came back in
+    void Resume(Fiber *fiber);
+
+    pthread_mutex_t mutex_;
+
+    pthread_cond_t cond_;
+
+    pthread_cond_t stop_cond_;
+
+    std::deque<Fiber*> ready_;
+
+    /// @brief sleeping fibers by monotonic deadline in ms
+    std::multimap<uint64_t, Fiber*> timers_;
+
+    size_t live_ = 0;
+
+    size_t stack_size_;
+
+    int nworkers_ = 0;
+
+    int running_workers_ = 0;
+
+    bool stopping_ = false;
+};
+
+}
+
+#endif
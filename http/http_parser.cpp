@@ -0,0 +1,549 @@
+#include "http_parser.h"
+#include <immintrin.h>
+#include <string.h>
+#include <strings.h>
+
+namespace ekko {
+
+typedef const char* (*scan_func_t)(const char *p, const char *end);
+
+/// @brief header values run to the first CTL other than HT
+static inline bool
+is_value_stop(unsigned char c)
+{
+    return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+/// @brief the request target runs to the first SP or CTL
+static inline bool
+is_target_stop(unsigned char c)
+{
+    return c <= 0x20 || c == 0x7f;
+}
+
+template<bool TARGET>
+static const char*
+scan_scalar(const char *p, const char *end)
+{
+    for (; p < end; ++p) {
+        if (TARGET ? is_target_stop(*p) : is_value_stop(*p))
+            break;
+    }
+    return p;
+}
+
+/// @brief a load of n bytes at p cannot fault when it stays in p's page,
+/// whatever lies past the end of the buffer
+static inline bool
+load_in_page(const char *p, size_t n)
+{
+    return ((uintptr_t) p & 4095) <= 4096 - n;
+}
+
+// inclusive byte ranges to stop at, for pcmpestri
+alignas(16) static const char s_value_ranges[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+alignas(16) static const char s_target_ranges[16] = "\x00\x20\x7f\x7f";
+
+template<bool TARGET>
+__attribute__((target("sse4.2")))
+static const char*
+scan_sse42(const char *p, const char *end)
+{
+    __m128i ranges = _mm_load_si128((const __m128i*) (TARGET ? s_target_ranges : s_value_ranges));
+    int nranges = TARGET ? 4 : 6;
+    int idx;
+
+    while (p < end) {
+        // the tail is loaded whole when that stays within the page
+        if (end - p < 16 && !load_in_page(p, 16))
+            return scan_scalar<TARGET>(p, end);
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        idx = _mm_cmpestri(ranges, nranges, v, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16)
+            return p + idx < end ? p + idx : end;
+        p += 16;
+    }
+    return end;
+}
+
+template<bool TARGET>
+__attribute__((target("avx2")))
+static const char*
+scan_avx2(const char *p, const char *end)
+{
+    const __m256i ctl_max = _mm256_set1_epi8(TARGET ? 0x20 : 0x1f);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    unsigned mask;
+
+    while (p < end) {
+        if (end - p < 32 && !load_in_page(p, 32))
+            return scan_sse42<TARGET>(p, end);
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        // unsigned v <= ctl_max
+        __m256i stop = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl_max), v);
+        if (!TARGET)
+            stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), stop);
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, del));
+        mask = _mm256_movemask_epi8(stop);
+        if (mask)
+            return p + __builtin_ctz(mask) < end ? p + __builtin_ctz(mask) : end;
+        p += 32;
+    }
+    return end;
+}
+
+static scan_func_t s_scan_value = scan_scalar<false>;
+static scan_func_t s_scan_target = scan_scalar<true>;
+static HttpParser::SimdLevel s_simd_level = HttpParser::SIMD_SCALAR;
+static HttpParser::SimdLevel s_simd_init = HttpParser::SetSimdLevel(HttpParser::SIMD_AVX2);
+
+HttpParser::SimdLevel
+HttpParser::SetSimdLevel(SimdLevel level)
+{
+    __builtin_cpu_init();
+    if (level == SIMD_AVX2 && !__builtin_cpu_supports("avx2"))
+        level = SIMD_SSE42;
+    if (level == SIMD_SSE42 && !__builtin_cpu_supports("sse4.2"))
+        level = SIMD_SCALAR;
+    switch (level) {
+    case SIMD_AVX2:
+        s_scan_value = scan_avx2<false>;
+        s_scan_target = scan_avx2<true>;
+        break;
+    case SIMD_SSE42:
+        s_scan_value = scan_sse42<false>;
+        s_scan_target = scan_sse42<true>;
+        break;
+    default:
+        s_scan_value = scan_scalar<false>;
+        s_scan_target = scan_scalar<true>;
+        break;
+    }
+    s_simd_level = level;
+    return level;
+}
+
+HttpParser::SimdLevel
+HttpParser::GetSimdLevel()
+{
+    (void) s_simd_init;
+    return s_simd_level;
+}
+
+/// @brief tchar of RFC 9110, what header names and methods are made of
+static const bool s_token[256] = {
+    0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,
+    //   !  "  #  $  %  &  '  (  )  *  +  ,  -  .  /
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+    // 0-9                           :  ;  <  =  >  ?
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    // @  A-O
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // P-Z                     [  \  ]  ^  _
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    // `  a-o
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // p-z                     {  |  }  ~  DEL
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+};
+
+static inline bool
+name_equals(const char *p, size_t len, const char *lower, size_t lower_len)
+{
+    return len == lower_len && strncasecmp(p, lower, len) == 0;
+}
+
+static HttpMethod
+method_id(const char *p, size_t len)
+{
+    switch (len) {
+    case 3:
+        if (memcmp(p, "GET", 3) == 0)
+            return HTTP_GET;
+        if (memcmp(p, "PUT", 3) == 0)
+            return HTTP_PUT;
+        break;
+    case 4:
+        if (memcmp(p, "POST", 4) == 0)
+            return HTTP_POST;
+        if (memcmp(p, "HEAD", 4) == 0)
+            return HTTP_HEAD;
+        break;
+    case 5:
+        if (memcmp(p, "PATCH", 5) == 0)
+            return HTTP_PATCH;
+        break;
+    case 6:
+        if (memcmp(p, "DELETE", 6) == 0)
+            return HTTP_DELETE;
+        break;
+    case 7:
+        if (memcmp(p, "OPTIONS", 7) == 0)
+            return HTTP_OPTIONS;
+        break;
+    }
+    return HTTP_OTHER;
+}
+
+static inline bool
+is_ows(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/**
+ * @brief walk a comma separated list, func(token, len) per non-empty element
+ * with the surrounding whitespace trimmed
+*/
+template<class Func>
+static void
+for_each_token(const char *p, const char *end, Func func)
+{
+    while (p < end) {
+        const char *comma = (const char*) memchr(p, ',', end - p);
+        const char *e = comma ? comma : end;
+        const char *b = p;
+        while (b < e && is_ows(*b))
+            ++b;
+        const char *t = e;
+        while (t > b && is_ows(t[-1]))
+            --t;
+        if (t > b)
+            func(b, t - b);
+        p = comma ? comma + 1 : end;
+    }
+}
+
+std::string_view
+HttpRequest::GetHeader(std::string_view name) const
+{
+    for (int i = 0; i < nheaders_; ++i) {
+        if (name_equals(base_ + headers_[i].name.off, headers_[i].name.len, name.data(), name.size()))
+            return View(headers_[i].value);
+    }
+    return std::string_view();
+}
+
+bool
+HttpRequest::HasHeader(std::string_view name) const
+{
+    for (int i = 0; i < nheaders_; ++i) {
+        if (name_equals(base_ + headers_[i].name.off, headers_[i].name.len, name.data(), name.size()))
+            return true;
+    }
+    return false;
+}
+
+void
+HttpParser::Reset()
+{
+    req_.nheaders_ = 0;
+    req_.method_id_ = HTTP_OTHER;
+    req_.minor_version_ = 1;
+    req_.keep_alive_ = true;
+    req_.chunked_ = false;
+    req_.body_ = HttpSlice();
+    phase_ = HEAD;
+    scan_off_ = 0;
+    head_len_ = 0;
+    content_length_ = -1;
+    src_ = dst_ = 0;
+    chunk_left_ = 0;
+    chunk_digits_ = 0;
+    line_len_ = 0;
+    consumed_ = 0;
+    error_ = 0;
+}
+
+HttpParser::Status
+HttpParser::Parse(char *data, size_t len)
+{
+    Status status;
+
+    req_.base_ = data;
+    if (phase_ == HEAD) {
+        status = ParseHead(data, len);
+        if (status != DONE)
+            return status;
+    }
+    if (phase_ == BODY) {
+        if (len - head_len_ < (uint64_t) content_length_)
+            return AGAIN;
+        req_.body_.off = head_len_;
+        req_.body_.len = content_length_;
+        consumed_ = head_len_ + content_length_;
+        phase_ = COMPLETE;
+    } else if (phase_ != COMPLETE) {
+        return ParseChunked(data, len);
+    }
+    return DONE;
+}
+
+HttpParser::Status
+HttpParser::ParseHead(char *data, size_t len)
+{
+    const char *p, *q, *end, *nl;
+    size_t skip = 0, pos;
+
+    // empty lines ahead of the request line are to be ignored
+    while (skip < len && (data[skip] == '\r' || data[skip] == '\n'))
+        ++skip;
+    if (scan_off_ < skip)
+        scan_off_ = skip;
+
+    // the head ends at the first empty line; glibc's memchr is vectorized
+    while (1) {
+        nl = (const char*) memchr(data + scan_off_, '\n', len - scan_off_);
+        if (!nl) {
+            scan_off_ = len;
+            return len - skip > HTTP_MAX_HEAD_BYTES ? Fail(431) : AGAIN;
+        }
+        pos = nl - data;
+        scan_off_ = pos + 1;
+        if (pos - skip > HTTP_MAX_HEAD_BYTES)
+            return Fail(431);
+        if (pos > skip && (data[pos - 1] == '\n'
+                || (data[pos - 1] == '\r' && pos - 1 > skip && data[pos - 2] == '\n')))
+            break;
+    }
+    head_len_ = pos + 1;
+    end = data + head_len_;
+
+    // method SP request-target SP HTTP-version CRLF
+    p = data + skip;
+    for (q = p; s_token[(unsigned char) *q]; ++q)
+        ;
+    if (q == p || *q != ' ')
+        return Fail(400);
+    req_.method_.off = p - data;
+    req_.method_.len = q - p;
+    req_.method_id_ = method_id(p, q - p);
+
+    p = q + 1;
+    q = s_scan_target(p, end);
+    if (q == p || *q != ' ')
+        return Fail(400);
+    req_.target_.off = p - data;
+    req_.target_.len = q - p;
+    nl = (const char*) memchr(p, '?', q - p);
+    req_.path_.off = p - data;
+    req_.path_.len = (nl ? nl : q) - p;
+    req_.query_.off = nl ? nl + 1 - data : q - data;
+    req_.query_.len = nl ? q - nl - 1 : 0;
+
+    p = q + 1;
+    if (end - p < 9 || memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1'))
+        return Fail(400);
+    req_.minor_version_ = p[7] - '0';
+    p += 8;
+    if (*p == '\r')
+        ++p;
+    if (*p != '\n')
+        return Fail(400);
+    return ParseHeaderFields(p + 1, end);
+}
+
+HttpParser::Status
+HttpParser::ParseHeaderFields(const char *p, const char *end)
+{
+    const char *base = req_.base_;
+    const char *q, *v, *ve, *next;
+    bool conn_close = false, conn_keep_alive = false;
+    int64_t n;
+
+    while (1) {
+        if (*p == '\r' || *p == '\n') {
+            // a stray CR at the start of a line is not the end of the head
+            if (p + (*p == '\r' ? 2 : 1) != end)
+                return Fail(400);
+            break;
+        }
+        // obsolete line folding is rejected rather than unfolded
+        if (is_ows(*p))
+            return Fail(400);
+        for (q = p; s_token[(unsigned char) *q]; ++q)
+            ;
+        if (q == p || *q != ':')
+            return Fail(400);
+        if (req_.nheaders_ == HTTP_MAX_HEADERS)
+            return Fail(431);
+
+        for (v = q + 1; is_ows(*v); ++v)
+            ;
+        ve = s_scan_value(v, end);
+        if (*ve == '\r' && ve[1] == '\n')
+            next = ve + 2;
+        else if (*ve == '\n')
+            next = ve + 1;
+        else
+            return Fail(400);
+        while (ve > v && is_ows(ve[-1]))
+            --ve;
+
+        HttpHeader &h = req_.headers_[req_.nheaders_++];
+        h.name.off = p - base;
+        h.name.len = q - p;
+        h.value.off = v - base;
+        h.value.len = ve - v;
+
+        // the few headers the parser itself needs
+        if (name_equals(p, q - p, "content-length", 14)) {
+            if (v == ve || ve - v > 18)
+                return Fail(400);
+            n = 0;
+            for (const char *c = v; c < ve; ++c) {
+                if (*c < '0' || *c > '9')
+                    return Fail(400);
+                n = n * 10 + (*c - '0');
+            }
+            if (content_length_ >= 0 && content_length_ != n)
+                return Fail(400);
+            content_length_ = n;
+        } else if (name_equals(p, q - p, "transfer-encoding", 17)) {
+            // only chunked is ours to undo, and it has to come last
+            int status = 0;
+            for_each_token(v, ve, [&](const char *t, size_t len) {
+                if (req_.chunked_)
+                    status = 400;
+                else if (name_equals(t, len, "chunked", 7))
+                    req_.chunked_ = true;
+                else
+                    status = 501;
+            });
+            if (status == 400 || !req_.chunked_)
+                return Fail(status ? status : 400);
+        } else if (name_equals(p, q - p, "connection", 10)) {
+            for_each_token(v, ve, [&](const char *t, size_t len) {
+                if (name_equals(t, len, "close", 5))
+                    conn_close = true;
+                else if (name_equals(t, len, "keep-alive", 10))
+                    conn_keep_alive = true;
+            });
+        }
+        p = next;
+    }
+
+    // both framings at once is how requests get smuggled
+    if (req_.chunked_ && content_length_ >= 0)
+        return Fail(400);
+    if (content_length_ > 0 && (uint64_t) content_length_ > max_body_)
+        return Fail(413);
+    req_.keep_alive_ = req_.minor_version_ == 1 ? !conn_close : conn_keep_alive && !conn_close;
+
+    if (req_.chunked_) {
+        src_ = dst_ = head_len_;
+        phase_ = CHUNK_SIZE;
+    } else if (content_length_ > 0) {
+        phase_ = BODY;
+    } else {
+        req_.body_.off = head_len_;
+        req_.body_.len = 0;
+        consumed_ = head_len_;
+        phase_ = COMPLETE;
+    }
+    return DONE;
+}
+
+static inline int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+HttpParser::Status
+HttpParser::ParseChunked(char *data, size_t len)
+{
+    uint64_t n;
+    int h;
+    char c;
+
+    // decoded data is moved down over the framing, dst_ never passes src_
+    while (src_ < len) {
+        c = data[src_];
+        switch (phase_) {
+        case CHUNK_SIZE:
+            h = hex_value(c);
+            if (h >= 0) {
+                if (++chunk_digits_ > 15)
+                    return Fail(413);
+                chunk_left_ = chunk_left_ * 16 + h;
+                ++src_;
+                break;
+            }
+            if (chunk_digits_ == 0)
+                return Fail(400);
+            phase_ = CHUNK_EXT;
+            break;
+        case CHUNK_EXT:
+            // extensions are skipped, up to the end of the line
+            ++src_;
+            if (c != '\n')
+                break;
+            if (chunk_left_ == 0) {
+                line_len_ = 0;
+                phase_ = TRAILER;
+                break;
+            }
+            if (dst_ - head_len_ + chunk_left_ > max_body_)
+                return Fail(413);
+            phase_ = CHUNK_DATA;
+            break;
+        case CHUNK_DATA:
+            n = len - src_;
+            if (n > chunk_left_)
+                n = chunk_left_;
+            if (dst_ != src_)
+                memmove(data + dst_, data + src_, n);
+            dst_ += n;
+            src_ += n;
+            chunk_left_ -= n;
+            if (chunk_left_ == 0)
+                phase_ = CHUNK_DATA_CR;
+            break;
+        case CHUNK_DATA_CR:
+            if (c == '\r') {
+                ++src_;
+                phase_ = CHUNK_DATA_LF;
+                break;
+            }
+            // fall through, a bare LF is tolerated
+        case CHUNK_DATA_LF:
+            if (c != '\n')
+                return Fail(400);
+            ++src_;
+            chunk_digits_ = 0;
+            phase_ = CHUNK_SIZE;
+            break;
+        case TRAILER:
+            ++src_;
+            if (c == '\n') {
+                if (line_len_ == 0) {
+                    req_.body_.off = head_len_;
+                    req_.body_.len = dst_ - head_len_;
+                    consumed_ = src_;
+                    phase_ = COMPLETE;
+                    return DONE;
+                }
+                line_len_ = 0;
+            } else if (c != '\r') {
+                ++line_len_;
+            }
+            if (line_len_ > HTTP_MAX_HEAD_BYTES)
+                return Fail(431);
+            break;
+        default:
+            return Fail(400);
+        }
+    }
+    return AGAIN;
+}
+
+}
@@ -0,0 +1,218 @@
+#ifndef __HTTP_PARSER_H__
+#define __HTTP_PARSER_H__
+
+#include <string_view>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 64
+#define HTTP_MAX_HEAD_BYTES 65536
+#define HTTP_DEFAULT_MAX_BODY (8 << 20)
+
+namespace ekko {
+
+/// @brief a range of the request, as an offset from its first byte
+struct HttpSlice {
+    uint32_t off = 0;
+    uint32_t len = 0;
+};
+
+struct HttpHeader {
+    HttpSlice name;
+    HttpSlice value;
+};
+
+enum HttpMethod {
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_DELETE,
+    HTTP_OPTIONS,
+    HTTP_PATCH,
+    HTTP_OTHER
+};
+
+/// @brief a parsed request. Nothing is copied: the views point into the
+/// receive buffer and stay valid until it is consumed or grows.
+class HttpRequest {
+friend class HttpParser;
+public:
+    HttpMethod GetMethod() const { return method_id_;}
+
+    std::string_view Method() const { return View(method_);}
+
+    /// @brief the request target as sent, path and query
+    std::string_view Target() const { return View(target_);}
+
+    std::string_view Path() const { return View(path_);}
+
+    /// @brief after the '?', empty if there is none
+    std::string_view Query() const { return View(query_);}
+
+    /// @return 0 for HTTP/1.0, 1 for HTTP/1.1
+    int GetMinorVersion() const { return minor_version_;}
+
+    bool IsKeepAlive() const { return keep_alive_;}
+
+    bool IsChunked() const { return chunked_;}
+
+    /// @brief the body, chunked bodies already decoded
+    std::string_view Body() const { return View(body_);}
+
+    int HeaderCount() const { return nheaders_;}
+
+    std::string_view HeaderName(int idx) const { return View(headers_[idx].name);}
+
+    std::string_view HeaderValue(int idx) const { return View(headers_[idx].value);}
+
+    /// @brief first header called name, case-insensitive
+    /// @return empty if it is not there
+    std::string_view GetHeader(std::string_view name) const;
+
+    bool HasHeader(std::string_view name) const;
+
+    const char* GetBase() const { return base_;}
+
+    /// @brief when the loop woke up to its last bytes, CLOCK_MONOTONIC ms, 0 if unknown
+    uint64_t GetReceiveMs() const { return recv_ms_;}
+
+private:
+    std::string_view View(HttpSlice s) const { return std::string_view(base_ + s.off, s.len);}
+
+    const char *base_ = 0;
+
+    HttpMethod method_id_ = HTTP_OTHER;
+
+    HttpSlice method_;
+
+    HttpSlice target_;
+
+    HttpSlice path_;
+
+    HttpSlice query_;
+
+    int minor_version_ = 1;
+
+    bool keep_alive_ = true;
+
+    bool chunked_ = false;
+
+    HttpSlice body_;
+
+    int nheaders_ = 0;
+
+    HttpHeader headers_[HTTP_MAX_HEADERS];
+
+    uint64_t recv_ms_ = 0;
+};
+
+/**
+ * @brief incremental HTTP/1.1 request parser, no allocation.
+ *
+ * Call Parse() with the buffered bytes from the start of a request; on
+ * AGAIN call it again with the same start once more has arrived, the work
+ * already done is not repeated. On DONE the request takes GetConsumed()
+ * bytes, anything after it is the next pipelined request: consume, Reset()
+ * and parse again.
+*/
+class HttpParser {
+public:
+    enum Status {
+        DONE,
+        AGAIN,
+        ERROR
+    };
+
+    enum SimdLevel {
+        SIMD_SCALAR,
+        SIMD_SSE42,
+        SIMD_AVX2
+    };
+
+    HttpParser() { Reset();}
+
+    /// @brief chunked bodies are decoded in place, hence the non-const data
+    Status Parse(char *data, size_t len);
+
+    void Reset();
+
+    const HttpRequest& GetRequest() const { return req_;}
+
+    /// @brief stamp the request with when its bytes arrived, see HttpRequest::GetReceiveMs()
+    void SetReceiveMs(uint64_t ms) { req_.recv_ms_ = ms;}
+
+    /// @return wire bytes of the request just parsed
+    size_t GetConsumed() const { return consumed_;}
+
+    /// @return the status code to answer an ERROR with: 400, 413, 431 or 501
+    int GetError() const { return error_;}
+
+    void SetMaxBodySize(size_t n) { max_body_ = n;}
+
+    /**
+     * @brief choose the header scanner for every parser in the process,
+     * clamped to what the CPU has; the best one is picked at start-up
+     * @return the level in use
+    */
+    static SimdLevel SetSimdLevel(SimdLevel level);
+
+    static SimdLevel GetSimdLevel();
+
+private:
+    enum Phase {
+        HEAD,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_EXT,
+        CHUNK_DATA,
+        CHUNK_DATA_CR,
+        CHUNK_DATA_LF,
+        TRAILER,
+        COMPLETE
+    };
+
+    Status Fail(int code) {
+        error_ = code;
+        return ERROR;
+    }
+
+    Status ParseHead(char *data, size_t len);
+
+    Status ParseHeaderFields(const char *p, const char *end);
+
+    Status ParseChunked(char *data, size_t len);
+
+    HttpRequest req_;
+
+    Phase phase_;
+
+    /// @brief where the search for the end of the head resumes
+    size_t scan_off_;
+
+    size_t head_len_;
+
+    int64_t content_length_;
+
+    size_t max_body_ = HTTP_DEFAULT_MAX_BODY;
+
+    /// @brief chunked: next raw byte to read and where decoded bytes go
+    size_t src_;
+
+    size_t dst_;
+
+    uint64_t chunk_left_;
+
+    int chunk_digits_;
+
+    /// @brief bytes on the current trailer line
+    size_t line_len_;
+
+    size_t consumed_;
+
+    int error_;
+};
+
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include "http_server.h"
+#include <memory>
+#include <stdio.h>
+
+namespace ekko {
+
+const char*
+HttpResponse::StatusText(int code)
+{
+    switch (code) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Content Too Large";
+    case 416: return "Range Not Satisfiable";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+void
+HttpResponse::AppendTo(IOBuf &out, bool head_only) const
+{
+    char line[64];
+    int n;
+
+    n = snprintf(line, sizeof(line), "HTTP/1.1 %d ", status_);
+    out.Append(line, n);
+    out.Append(StatusText(status_));
+    out.Append("\r\n");
+    for (size_t i = 0; i < headers_.size(); ++i) {
+        out.Append(headers_[i].first);
+        out.Append(": ");
+        out.Append(headers_[i].second);
+        out.Append("\r\n");
+    }
+    out.Append(raw_headers_);
+    // never a body on these, so no length either
+    if (status_ != 204 && status_ != 304) {
+        n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", body_.Size() + file_len_);
+        out.Append(line, n);
+    }
+    if (!keep_alive_)
+        out.Append("Connection: close\r\n");
+    out.Append("\r\n");
+    if (head_only)
+        return;
+    // small bodies are copied next to the head, so a batch of pipelined
+    // responses packs into a few blocks instead of two per response
+    if (body_.Size() > HTTP_SHARE_BODY_MIN) {
+        out.Append(body_);
+        return;
+    }
+    for (size_t i = 0; i < body_.SliceCount(); ++i)
+        out.Append(body_.SliceView(i));
+}
+
+HttpServer::HttpServer(const char *ip, int port, int nloops, bool use_uring)
+    :server_(ip, port, nloops, use_uring) {
+    server_.SetConnectionCallback([this](const Connection::ptr &conn) {
+        std::shared_ptr<HttpParser> parser(new HttpParser);
+        parser->SetMaxBodySize(max_body_);
+        conn->SetContext(parser);
+    });
+    server_.SetMessageCallback([this](const Connection::ptr &conn, Buffer &buf) {
+        OnMessage(conn, buf);
+    });
+}
+
+void
+HttpServer::OnMessage(const Connection::ptr &conn, Buffer &buf)
+{
+    HttpParser *parser = (HttpParser*) conn->GetContext().get();
+    HttpParser::Status status;
+    IOBuf out;
+    bool close = false;
+    uint64_t recv_ms = conn->GetReceiveMs();
+
+    // everything complete in the buffer is answered, in order
+    while (buf.ReadableBytes() > 0) {
+        status = parser->Parse(buf.Peek(), buf.ReadableBytes());
+        if (status == HttpParser::AGAIN)
+            break;
+        if (status == HttpParser::ERROR) {
+            HttpResponse resp;
+            resp.SetStatus(parser->GetError());
+            resp.SetKeepAlive(false);
+            resp.AppendTo(out, false);
+            close = true;
+            break;
+        }
+
+        parser->SetReceiveMs(recv_ms);
+        const HttpRequest &req = parser->GetRequest();
+        HttpResponse resp;
+        resp.SetKeepAlive(req.IsKeepAlive());
+        if (handler_)
+            handler_(req, resp);
+        else
+            resp.SetStatus(404);
+        // 1.0 clients only keep the connection when told so
+        if (req.GetMinorVersion() == 0 && resp.IsKeepAlive())
+            resp.AddHeader("Connection", "keep-alive");
+        resp.AppendTo(out, req.GetMethod() == HTTP_HEAD);
+        if (resp.GetFile() && req.GetMethod() != HTTP_HEAD) {
+            // what is in out goes first, the file queues behind it
+            conn->Send(std::move(out));
+            conn->SendFile(resp.GetFile(), resp.GetFileOffset(), resp.GetFileLength());
+            out.Clear();
+        }
+        requests_.fetch_add(1, std::memory_order_relaxed);
+
+        buf.Retrieve(parser->GetConsumed());
+        parser->Reset();
+        if (!resp.IsKeepAlive()) {
+            close = true;
+            break;
+        }
+    }
+    if (!out.Empty())
+        conn->Send(std::move(out));
+    if (close) {
+        buf.RetrieveAll();
+        conn->Shutdown();
+    }
+}
+
+}
@@ -0,0 +1,144 @@
+#ifndef __HTTP_SERVER_H__
+#define __HTTP_SERVER_H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "http_parser.h"
+#include "iobuf.h"
+#include "noncopyable.h"
+#include "uring_server.h"
+
+/// @brief bodies up to this size are copied into the response rather than shared
+#define HTTP_SHARE_BODY_MIN 1024
+
+namespace ekko {
+
+class HttpResponse {
+public:
+    void SetStatus(int code) { status_ = code;}
+
+    int GetStatus() const { return status_;}
+
+    /// @brief added as given, Content-Length and Connection are filled in
+    void AddHeader(const std::string &name, const std::string &value) {
+        headers_.push_back(std::make_pair(name, value));
+    }
+
+    /// @brief copies body
+    void SetBody(std::string_view body) { body_.Clear(); body_.Append(body);}
+
+    /// @brief shares the blocks of body, external ones included
+    void SetBody(IOBuf &&body) { body_ = std::move(body);}
+
+    IOBuf& GetBody() { return body_;}
+
+    const IOBuf& GetBody() const { return body_;}
+
+    /// @brief the body is len bytes of file from offset, sent with sendfile/splice
+    void SetFile(const FileRef::ptr &file, off_t offset, size_t len) {
+        body_.Clear();
+        file_ = file;
+        file_offset_ = offset;
+        file_len_ = len;
+    }
+
+    const FileRef::ptr& GetFile() const { return file_;}
+
+    off_t GetFileOffset() const { return file_offset_;}
+
+    size_t GetFileLength() const { return file_len_;}
+
+    /// @brief header lines that are ready to go, each ending in CRLF
+    void AddRawHeaders(std::string_view lines) { raw_headers_.append(lines.data(), lines.size());}
+
+    const std::vector<std::pair<std::string, std::string> >& GetHeaders() const { return headers_;}
+
+    const std::string& GetRawHeaders() const { return raw_headers_;}
+
+    void SetKeepAlive(bool on) { keep_alive_ = on;}
+
+    bool IsKeepAlive() const { return keep_alive_;}
+
+    /**
+     * @brief the head is copied into out, the body is shared; a file body is
+     * left to the caller
+     * @param[in] head_only a response to HEAD, everything but the body
+    */
+    void AppendTo(IOBuf &out, bool head_only) const;
+
+    /// @return the reason phrase, "Unknown" for codes we do not send
+    static const char* StatusText(int code);
+
+private:
+    int status_ = 200;
+
+    bool keep_alive_ = true;
+
+    std::vector<std::pair<std::string, std::string> > headers_;
+
+    std::string raw_headers_;
+
+    IOBuf body_;
+
+    FileRef::ptr file_;
+
+    off_t file_offset_ = 0;
+
+    size_t file_len_ = 0;
+};
+
+/**
+ * @brief HTTP/1.1 on top of UringServer, so on io_uring or epoll. Each
+ * connection keeps its parser in the connection context; every request
+ * that is complete in the input buffer is answered in order and the
+ * responses to one batch of pipelined requests are chained into one IOBuf
+ * and go out in a single send.
+*/
+class HttpServer : Noncopyable {
+public:
+    typedef std::function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+    HttpServer(const char *ip, int port, int nloops, bool use_uring = true);
+
+    /// @return success with 0, fail with -1
+    int Start() { return server_.Start();}
+
+    void Stop() { server_.Stop();}
+
+    int GetPort() const { return server_.GetPort();}
+
+    /// @brief called on the connection's loop; the request's views are only
+    /// valid during the call
+    void SetHandler(const Handler &handler) { handler_ = handler;}
+
+    void SetMaxBodySize(size_t n) { max_body_ = n;}
+
+    /// @brief close keep-alive connections quiet for ms, 0 for never; before Start()
+    void SetIdleTimeout(uint64_t ms) { server_.SetIdleTimeout(ms);}
+
+    /// @brief see AcceptMode; before Start()
+    void SetAcceptMode(AcceptMode mode) { server_.SetAcceptMode(mode);}
+
+    UringServer& GetServer() { return server_;}
+
+    uint64_t GetRequests() const { return requests_.load(std::memory_order_relaxed);}
+
+private:
+    void OnMessage(const Connection::ptr &conn, Buffer &buf);
+
+    UringServer server_;
+
+    Handler handler_;
+
+    size_t max_body_ = HTTP_DEFAULT_MAX_BODY;
+
+    std::atomic<uint64_t> requests_{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include "overload.h"
+#include <algorithm>
+#include <math.h>
+#include <time.h>
+
+namespace ekko {
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+ConcurrencyLimit::ConcurrencyLimit(LimitAlgorithm algo, int initial, int min_limit, int max_limit)
+    :algo_(algo)
+    ,min_limit_(min_limit > 0 ? min_limit : 1)
+    ,max_limit_(max_limit > min_limit_ ? max_limit : min_limit_)
+    ,limit_(std::min(std::max(initial, min_limit_), max_limit_))
+    ,estimate_(limit_.load()) {
+}
+
+bool
+ConcurrencyLimit::TryAcquire()
+{
+    if (inflight_.fetch_add(1, std::memory_order_relaxed) >= limit_.load(std::memory_order_relaxed)) {
+        inflight_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void
+ConcurrencyLimit::Release(uint64_t rtt_us, bool dropped)
+{
+    // what was in when this one left, itself included
+    int inflight = inflight_.fetch_sub(1, std::memory_order_relaxed);
+
+    if (algo_ == LIMIT_FIXED)
+        return;
+    Spinlock::Lock lock(mutex_);
+    window_sum_us_ += rtt_us;
+    window_max_inflight_ = std::max(window_max_inflight_, inflight);
+    window_dropped_ |= dropped;
+    if (++window_samples_ < std::max(OVERLOAD_WINDOW, limit_.load(std::memory_order_relaxed)))
+        return;
+    Adjust((double) window_sum_us_ / window_samples_, window_dropped_);
+    window_sum_us_ = 0;
+    window_samples_ = 0;
+    window_max_inflight_ = 0;
+    window_dropped_ = false;
+}
+
+void
+ConcurrencyLimit::Adjust(double rtt_us, bool dropped)
+{
+    double limit = estimate_;
+    // a window that never came near the limit says nothing about a higher one
+    bool app_limited = window_max_inflight_ * 2 < limit;
+
+    if (algo_ == LIMIT_AIMD) {
+        if (dropped || rtt_us > aimd_threshold_us_)
+            limit *= 0.9;
+        else if (!app_limited)
+            limit += 1;
+    } else {
+        if (long_rtt_us_ == 0)
+            long_rtt_us_ = rtt_us;
+        else
+            long_rtt_us_ = long_rtt_us_ * 0.95 + rtt_us * 0.05;
+        // after a slow spell the average is inflated: bring it down faster,
+        // or the limit would keep growing on a latency it thinks is low
+        if (long_rtt_us_ > 2 * rtt_us)
+            long_rtt_us_ = long_rtt_us_ * 0.9 + rtt_us * 0.1;
+        double gradient = dropped ? 0.5 : std::max(0.5, std::min(1.0, tolerance_ * long_rtt_us_ / rtt_us));
+        double target = limit * gradient + sqrt(limit);
+        if (app_limited && target > limit)
+            target = limit;
+        limit = limit * 0.8 + target * 0.2;
+    }
+    estimate_ = std::max((double) min_limit_, std::min((double) max_limit_, limit));
+    limit_.store(std::max(min_limit_, (int) lround(estimate_)), std::memory_order_relaxed);
+}
+
+TokenBucket::TokenBucket(double rate, double burst)
+    :rate_(rate)
+    ,burst_(burst >= 1 ? burst : 1)
+    ,tokens_(burst_)
+    ,last_ns_(now_ns()) {
+}
+
+bool
+TokenBucket::Take(double n)
+{
+    uint64_t now = now_ns();
+    Spinlock::Lock lock(mutex_);
+
+    if (now > last_ns_) {
+        tokens_ = std::min(burst_, tokens_ + (now - last_ns_) * rate_ / 1e9);
+        last_ns_ = now;
+    }
+    if (tokens_ < n)
+        return false;
+    tokens_ -= n;
+    return true;
+}
+
+OverloadGuard::OverloadGuard(LimitAlgorithm algo, int initial_limit)
+    :limit_(algo, initial_limit) {
+}
+
+void
+OverloadGuard::AddRoute(const std::string &prefix, double rate, double burst)
+{
+    std::unique_ptr<Route> route(new Route);
+    route->prefix = prefix;
+    route->bucket.reset(new TokenBucket(rate, burst));
+    routes_.push_back(std::move(route));
+    std::stable_sort(routes_.begin(), routes_.end(),
+        [](const std::unique_ptr<Route> &a, const std::unique_ptr<Route> &b) {
+            return a->prefix.size() > b->prefix.size();
+        });
+}
+
+uint64_t
+OverloadGuard::GetRouteShed(const std::string &prefix) const
+{
+    for (size_t i = 0; i < routes_.size(); ++i) {
+        if (routes_[i]->prefix == prefix)
+            return routes_[i]->shed.load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+static void
+reject(HttpResponse &resp, int status)
+{
+    resp.SetStatus(status);
+    resp.AddRawHeaders("Retry-After: 1\r\n");
+}
+
+void
+OverloadGuard::Handle(const HttpRequest &req, HttpResponse &resp, const Handler &handler)
+{
+    uint64_t start = now_ns();
+
+    // answered late it would be answered in vain: the client has likely
+    // given up, and the time would be taken from requests still in time
+    if (queue_budget_ms_ && req.GetReceiveMs() && start / 1000000 > req.GetReceiveMs() + queue_budget_ms_) {
+        shed_queue_.fetch_add(1, std::memory_order_relaxed);
+        reject(resp, 503);
+        return;
+    }
+    std::string_view path = req.Path();
+    for (size_t i = 0; i < routes_.size(); ++i) {
+        Route &route = *routes_[i];
+        if (path.substr(0, route.prefix.size()) != route.prefix)
+            continue;
+        if (!route.bucket->Take()) {
+            route.shed.fetch_add(1, std::memory_order_relaxed);
+            shed_rate_.fetch_add(1, std::memory_order_relaxed);
+            reject(resp, 429);
+            return;
+        }
+        break;
+    }
+    if (!limit_.TryAcquire()) {
+        shed_limit_.fetch_add(1, std::memory_order_relaxed);
+        reject(resp, 503);
+        return;
+    }
+    admitted_.fetch_add(1, std::memory_order_relaxed);
+    try {
+        handler(req, resp);
+    } catch (...) {
+        limit_.Release((now_ns() - start) / 1000, true);
+        throw;
+    }
+    // a 5xx is the backend failing, the sign to back off
+    limit_.Release((now_ns() - start) / 1000, resp.GetStatus() >= 500);
+}
+
+OverloadGuard::Handler
+OverloadGuard::Wrap(const Handler &handler)
+{
+    return [this, handler](const HttpRequest &req, HttpResponse &resp) {
+        Handle(req, resp, handler);
+    };
+}
+
+OverloadStats
+OverloadGuard::GetStats() const
+{
+    OverloadStats stats;
+
+    stats.admitted = admitted_.load(std::memory_order_relaxed);
+    stats.shed_queue = shed_queue_.load(std::memory_order_relaxed);
+    stats.shed_limit = shed_limit_.load(std::memory_order_relaxed);
+    stats.shed_rate = shed_rate_.load(std::memory_order_relaxed);
+    stats.limit = limit_.GetLimit();
+    stats.inflight = limit_.GetInflight();
+    return stats;
+}
+
+}
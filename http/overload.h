@@ -0,0 +1,199 @@
+#ifndef __OVERLOAD_H__
+#define __OVERLOAD_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "http_server.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+/// @brief requests that waited longer than this in their loop are turned away
+#define OVERLOAD_QUEUE_BUDGET_MS 50
+#define OVERLOAD_INITIAL_LIMIT 16
+#define OVERLOAD_MIN_LIMIT 1
+#define OVERLOAD_MAX_LIMIT 1000
+/// @brief the limit moves once per window of this many samples, or of limit samples if more
+#define OVERLOAD_WINDOW 20
+/// @brief gradient: a window may be this much slower than the long-term average before the limit drops
+#define OVERLOAD_TOLERANCE 1.5
+/// @brief AIMD: a window slower than this on average, in us, backs the limit off
+#define OVERLOAD_AIMD_THRESHOLD_US 20000
+
+namespace ekko {
+
+enum LimitAlgorithm {
+    /// @brief the initial limit, never moved
+    LIMIT_FIXED,
+    /// @brief +1 per window under the latency threshold, *0.9 per window above it or with a drop
+    LIMIT_AIMD,
+    /**
+     * @brief limit * min(1, tolerance * long-term RTT / window RTT) + sqrt(limit),
+     * smoothed: shrinks as soon as latency rises above its usual, grows by a
+     * queue's worth while it does not
+    */
+    LIMIT_GRADIENT
+};
+
+/**
+ * @brief how many requests may be in the handler at once, moved by the
+ * latency they see. Acquire and release are atomics; the adjustment, once
+ * per window of samples, takes a lock. Thread-safe.
+*/
+class ConcurrencyLimit : Noncopyable {
+public:
+    explicit ConcurrencyLimit(LimitAlgorithm algo = LIMIT_GRADIENT, int initial = OVERLOAD_INITIAL_LIMIT,
+                              int min_limit = OVERLOAD_MIN_LIMIT, int max_limit = OVERLOAD_MAX_LIMIT);
+
+    /// @return false when limit requests are already in
+    bool TryAcquire();
+
+    /**
+     * @param[in] rtt_us how long the request held its place
+     * @param[in] dropped it failed in a way that says the backend is struggling
+    */
+    void Release(uint64_t rtt_us, bool dropped = false);
+
+    int GetLimit() const { return limit_.load(std::memory_order_relaxed);}
+
+    int GetInflight() const { return inflight_.load(std::memory_order_relaxed);}
+
+    LimitAlgorithm GetAlgorithm() const { return algo_;}
+
+    void SetAimdThreshold(uint64_t us) { aimd_threshold_us_ = us;}
+
+    void SetTolerance(double tolerance) { tolerance_ = tolerance;}
+
+private:
+    /// @brief under mutex_, at the end of a window
+    void Adjust(double rtt_us, bool dropped);
+
+    LimitAlgorithm algo_;
+
+    int min_limit_;
+
+    int max_limit_;
+
+    uint64_t aimd_threshold_us_ = OVERLOAD_AIMD_THRESHOLD_US;
+
+    double tolerance_ = OVERLOAD_TOLERANCE;
+
+    std::atomic<int> limit_;
+
+    std::atomic<int> inflight_{0};
+
+    Spinlock mutex_;
+
+    /// @brief the limit with its fraction, limit_ is its rounding
+    double estimate_;
+
+    /// @brief average window RTT, moving slowly
+    double long_rtt_us_ = 0;
+
+    uint64_t window_sum_us_ = 0;
+
+    int window_samples_ = 0;
+
+    int window_max_inflight_ = 0;
+
+    bool window_dropped_ = false;
+};
+
+/// @brief rate tokens a second, up to burst saved; thread-safe
+class TokenBucket : Noncopyable {
+public:
+    TokenBucket(double rate, double burst);
+
+    bool Take(double n = 1);
+
+private:
+    double rate_;
+
+    double burst_;
+
+    double tokens_;
+
+    uint64_t last_ns_;
+
+    Spinlock mutex_;
+};
+
+struct OverloadStats {
+    uint64_t admitted;
+    /// @brief waited longer than the queue budget
+    uint64_t shed_queue;
+    /// @brief found the concurrency limit reached
+    uint64_t shed_limit;
+    /// @brief found their route's bucket empty
+    uint64_t shed_rate;
+    int limit;
+    int inflight;
+};
+
+/**
+ * @brief load shedding in front of a handler, for when the backend slows
+ * down: rather than every loop piling up behind MySQL and every request
+ * getting slow, the ones that cannot be served in time are told so at once.
+ *
+ * In order, a request is turned away with 503 and Retry-After if it
+ * already waited longer than the queue budget in its loop, measured from
+ * the loop's wake-up (HttpRequest::GetReceiveMs()); with 429 if the token
+ * bucket of the longest route prefix it matches is empty; and with 503 if
+ * the concurrency limit is reached. Otherwise it runs, and the time it
+ * takes feeds the limit; a 5xx or an exception counts as a drop. Routes
+ * are set up before use; thread-safe after.
+*/
+class OverloadGuard : Noncopyable {
+public:
+    typedef std::function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+    explicit OverloadGuard(LimitAlgorithm algo = LIMIT_GRADIENT, int initial_limit = OVERLOAD_INITIAL_LIMIT);
+
+    void Handle(const HttpRequest &req, HttpResponse &resp, const Handler &handler);
+
+    /// @brief handler with the guard in front, for HttpServer::SetHandler()
+    Handler Wrap(const Handler &handler);
+
+    /// @brief 0 turns the check off
+    void SetQueueBudget(uint64_t ms) { queue_budget_ms_ = ms;}
+
+    /// @brief requests whose path starts with prefix get rate a second, burst at once
+    void AddRoute(const std::string &prefix, double rate, double burst);
+
+    /// @brief requests shed by the bucket of prefix
+    uint64_t GetRouteShed(const std::string &prefix) const;
+
+    ConcurrencyLimit& GetLimit() { return limit_;}
+
+    OverloadStats GetStats() const;
+
+private:
+    struct Route {
+        std::string prefix;
+
+        std::unique_ptr<TokenBucket> bucket;
+
+        std::atomic<uint64_t> shed{0};
+    };
+
+    ConcurrencyLimit limit_;
+
+    uint64_t queue_budget_ms_ = OVERLOAD_QUEUE_BUDGET_MS;
+
+    /// @brief longest prefix first
+    std::vector<std::unique_ptr<Route> > routes_;
+
+    std::atomic<uint64_t> admitted_{0};
+
+    std::atomic<uint64_t> shed_queue_{0};
+
+    std::atomic<uint64_t> shed_limit_{0};
+
+    std::atomic<uint64_t> shed_rate_{0};
+};
+
+}
+
+#endif
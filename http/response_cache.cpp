@@ -0,0 +1,553 @@
+#include "response_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <stdlib.h>
+#include <strings.h>
+#include "mutex.h"
+
+namespace ekko {
+
+struct ResponseCache::Entry {
+    std::string key;
+
+    uint64_t hash = 0;
+
+    int status = 200;
+
+    /// @brief every header of the response, one CRLF-terminated line each
+    std::string headers;
+
+    /// @brief in blocks of its own, shared with each response served from it
+    IOBuf body;
+
+    /// @brief counted against the shard's budget
+    size_t bytes = 0;
+
+    uint64_t expire_ms = 0;
+
+    std::list<EntryPtr>::iterator lru;
+};
+
+/// @brief a miss being answered; identical requests wait for it
+struct ResponseCache::Flight {
+    std::mutex mutex;
+
+    std::condition_variable cond;
+
+    bool done = false;
+
+    /// @brief what the handler said, stored or not; 0 if it threw or sent a file
+    EntryPtr result;
+
+    /// @brief requests waiting, under the shard's lock
+    int waiters = 0;
+};
+
+struct ResponseCache::Shard {
+    Spinlock mutex;
+
+    std::unordered_map<std::string, EntryPtr> map;
+
+    /// @brief most recently used first
+    std::list<EntryPtr> lru;
+
+    std::unordered_map<std::string, std::shared_ptr<Flight> > inflight;
+
+    /// @brief count-min sketch of lookups, 4 rows of width saturating counters
+    std::vector<uint8_t> sketch;
+
+    size_t width_mask = 0;
+
+    size_t samples = 0;
+
+    size_t bytes = 0;
+
+    uint64_t hits = 0;
+
+    uint64_t misses = 0;
+
+    uint64_t coalesced = 0;
+
+    uint64_t stores = 0;
+
+    uint64_t rejected = 0;
+
+    uint64_t evictions = 0;
+
+    uint64_t expired = 0;
+
+    size_t Slot(uint64_t hash, int row) const {
+        static const uint64_t seeds[4] = {
+            0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xff51afd7ed558ccdULL
+        };
+        uint64_t h = (hash + seeds[row]) * seeds[3 - row];
+        return (size_t) row * (width_mask + 1) + ((h >> 32) & width_mask);
+    }
+
+    /// @brief one more lookup of hash; every 10 * width of them all counts are halved
+    void Increment(uint64_t hash) {
+        for (int row = 0; row < 4; ++row) {
+            uint8_t &c = sketch[Slot(hash, row)];
+            if (c < RESPONSE_CACHE_MAX_FREQ)
+                ++c;
+        }
+        if (++samples >= 10 * (width_mask + 1)) {
+            for (size_t i = 0; i < sketch.size(); ++i)
+                sketch[i] >>= 1;
+            samples /= 2;
+        }
+    }
+
+    int Frequency(uint64_t hash) const {
+        int freq = RESPONSE_CACHE_MAX_FREQ;
+        for (int row = 0; row < 4; ++row)
+            freq = std::min(freq, (int) sketch[Slot(hash, row)]);
+        return freq;
+    }
+};
+
+static uint64_t
+now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t
+now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline bool
+iequals(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+static inline std::string_view
+trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+/**
+ * @brief look for a Cache-Control directive, case-insensitive
+ * @param[out] arg what follows "name=", if anything
+*/
+static bool
+has_directive(std::string_view value, std::string_view name, long *arg = 0)
+{
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = trim(value.substr(0, comma));
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        size_t eq = item.find('=');
+        if (!iequals(trim(item.substr(0, eq)), name))
+            continue;
+        if (arg && eq != std::string_view::npos) {
+            std::string num(trim(item.substr(eq + 1)));
+            *arg = atol(num.c_str() + (num[0] == '"'));
+        }
+        return true;
+    }
+    return false;
+}
+
+static inline int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static inline bool
+unreserved(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+ResponseCache::ResponseCache(size_t budget_bytes, uint64_t ttl_ms, int nshards)
+    :shard_budget_(budget_bytes / (nshards > 0 ? nshards : 1)), ttl_ms_(ttl_ms) {
+    if (nshards <= 0)
+        nshards = 1;
+    // a row wider than the entries that fit, so the keys that do not fit
+    // are not all rated as popular as the ones that do
+    size_t width = 1024;
+    while (width < shard_budget_ / 256)
+        width <<= 1;
+    for (int i = 0; i < nshards; ++i) {
+        shards_.emplace_back(new Shard);
+        shards_.back()->sketch.assign(4 * width, 0);
+        shards_.back()->width_mask = width - 1;
+    }
+}
+
+ResponseCache::~ResponseCache()
+{
+}
+
+std::string
+ResponseCache::NormalizeQuery(std::string_view query)
+{
+    std::vector<std::string> params;
+    std::string out;
+
+    while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view param = query.substr(0, amp);
+        query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+        if (param.empty())
+            continue;
+        std::string p;
+        p.reserve(param.size());
+        for (size_t i = 0; i < param.size(); ++i) {
+            int hi, lo;
+            if (param[i] != '%' || i + 2 >= param.size() || (hi = hex_value(param[i + 1])) < 0
+                || (lo = hex_value(param[i + 2])) < 0) {
+                p.push_back(param[i]);
+                continue;
+            }
+            unsigned char c = hi * 16 + lo;
+            if (unreserved(c)) {
+                p.push_back(c);
+            } else {
+                static const char digits[] = "0123456789ABCDEF";
+                p.push_back('%');
+                p.push_back(digits[hi]);
+                p.push_back(digits[lo]);
+            }
+            i += 2;
+        }
+        params.push_back(std::move(p));
+    }
+    std::sort(params.begin(), params.end());
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (i)
+            out.push_back('&');
+        out.append(params[i]);
+    }
+    return out;
+}
+
+std::string
+ResponseCache::MakeKey(const HttpRequest &req) const
+{
+    std::string key;
+    std::string_view method = req.Method(), path = req.Path();
+
+    key.reserve(method.size() + path.size() + req.Query().size() + 8);
+    key.append(method.data(), method.size());
+    key.push_back('\0');
+    key.append(path.data(), path.size());
+    key.push_back('\0');
+    key.append(NormalizeQuery(req.Query()));
+    for (size_t i = 0; i < vary_.size(); ++i) {
+        std::string_view value = req.GetHeader(vary_[i]);
+        key.push_back('\0');
+        key.append(value.data(), value.size());
+    }
+    return key;
+}
+
+bool
+ResponseCache::Storable(const HttpResponse &resp, uint64_t *ttl_ms) const
+{
+    const std::vector<std::pair<std::string, std::string> > &headers = resp.GetHeaders();
+    const std::string &raw = resp.GetRawHeaders();
+    long max_age = -1, s_maxage = -1;
+    bool store = true;
+
+    int status = resp.GetStatus();
+    if (status != 200 && status != 203 && status != 301 && status != 404 && status != 410)
+        return false;
+    if (resp.GetFile() || resp.GetBody().Size() > RESPONSE_CACHE_MAX_BODY)
+        return false;
+
+    auto check = [&](std::string_view name, std::string_view value) {
+        if (iequals(name, "Set-Cookie")) {
+            store = false;
+        } else if (iequals(name, "Vary")) {
+            // a header the key leaves out would hand this variant to every
+            // client; "*" is never in vary_
+            for (size_t pos = 0; pos <= value.size(); ) {
+                size_t comma = value.find(',', pos);
+                if (comma == std::string_view::npos)
+                    comma = value.size();
+                std::string_view field = trim(value.substr(pos, comma - pos));
+                bool keyed = field.empty();
+                for (size_t i = 0; i < vary_.size() && !keyed; ++i)
+                    keyed = iequals(field, vary_[i]);
+                if (!keyed)
+                    store = false;
+                pos = comma + 1;
+            }
+        } else if (iequals(name, "Cache-Control")) {
+            if (has_directive(value, "no-store") || has_directive(value, "no-cache")
+                || has_directive(value, "private"))
+                store = false;
+            has_directive(value, "max-age", &max_age);
+            has_directive(value, "s-maxage", &s_maxage);
+        }
+    };
+    for (size_t i = 0; i < headers.size(); ++i)
+        check(headers[i].first, headers[i].second);
+    for (size_t pos = 0; pos < raw.size(); ) {
+        size_t end = raw.find("\r\n", pos);
+        if (end == std::string::npos)
+            end = raw.size();
+        std::string_view line(raw.data() + pos, end - pos);
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos)
+            check(trim(line.substr(0, colon)), trim(line.substr(colon + 1)));
+        pos = end + 2;
+    }
+    // max-age is in seconds, for a shared cache s-maxage wins
+    if (s_maxage >= 0)
+        max_age = s_maxage;
+    if (max_age == 0)
+        return false;
+    *ttl_ms = max_age > 0 ? (uint64_t) max_age * 1000 : ttl_ms_;
+    return store;
+}
+
+ResponseCache::EntryPtr
+ResponseCache::MakeEntry(const HttpResponse &resp, uint64_t ttl_ms)
+{
+    const std::vector<std::pair<std::string, std::string> > &headers = resp.GetHeaders();
+    EntryPtr entry(new Entry);
+
+    entry->status = resp.GetStatus();
+    for (size_t i = 0; i < headers.size(); ++i) {
+        entry->headers.append(headers[i].first);
+        entry->headers.append(": ");
+        entry->headers.append(headers[i].second);
+        entry->headers.append("\r\n");
+    }
+    entry->headers.append(resp.GetRawHeaders());
+    // the body the handler built is in whatever blocks it got, often half
+    // empty; what is kept is copied to fit and counted as the pool sees it
+    entry->bytes = sizeof(Entry) + entry->headers.capacity() + entry->body.AppendCompact(resp.GetBody());
+    entry->expire_ms = now_ms() + ttl_ms;
+    return entry;
+}
+
+void
+ResponseCache::Fill(const Entry &entry, HttpResponse &resp)
+{
+    IOBuf body(entry.body);
+
+    resp.SetStatus(entry.status);
+    resp.AddRawHeaders(entry.headers);
+    resp.SetBody(std::move(body));
+}
+
+void
+ResponseCache::Evict(Shard &shard, const EntryPtr &entry)
+{
+    shard.lru.erase(entry->lru);
+    shard.bytes -= entry->bytes;
+    shard.map.erase(entry->key);
+}
+
+void
+ResponseCache::Insert(Shard &shard, const std::string &key, uint64_t hash, const EntryPtr &entry)
+{
+    if (entry->bytes + key.capacity() > shard_budget_)
+        return;
+    auto it = shard.map.find(key);
+    if (it != shard.map.end())
+        Evict(shard, it->second);
+    entry->key = key;
+    entry->hash = hash;
+    entry->bytes += entry->key.capacity();
+    // a newcomer only pushes out an entry looked up less often than itself
+    if (admission_ && shard.bytes + entry->bytes > shard_budget_ && !shard.lru.empty()
+        && shard.Frequency(hash) <= shard.Frequency(shard.lru.back()->hash)) {
+        ++shard.rejected;
+        return;
+    }
+    while (shard.bytes + entry->bytes > shard_budget_ && !shard.lru.empty()) {
+        Evict(shard, shard.lru.back());
+        ++shard.evictions;
+    }
+    shard.lru.push_front(entry);
+    entry->lru = shard.lru.begin();
+    shard.bytes += entry->bytes;
+    shard.map.emplace(entry->key, entry);
+    ++shard.stores;
+}
+
+void
+ResponseCache::Handle(const HttpRequest &req, HttpResponse &resp, const Handler &handler)
+{
+    uint64_t start = now_ns();
+    std::string_view cc = req.GetHeader("Cache-Control");
+
+    if (req.GetMethod() != HTTP_GET || req.HasHeader("Authorization")
+        || (!cc.empty() && (has_directive(cc, "no-cache") || has_directive(cc, "no-store")))) {
+        bypassed_.fetch_add(1, std::memory_order_relaxed);
+        handler(req, resp);
+        return;
+    }
+
+    std::string key = MakeKey(req);
+    uint64_t hash = std::hash<std::string>()(key);
+    Shard &shard = *shards_[hash % shards_.size()];
+    std::shared_ptr<Flight> flight;
+    EntryPtr entry;
+    bool leader = false;
+    {
+        Spinlock::Lock lock(shard.mutex);
+        shard.Increment(hash);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            if (it->second->expire_ms > now_ms()) {
+                entry = it->second;
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry->lru);
+                ++shard.hits;
+            } else {
+                Evict(shard, it->second);
+                ++shard.expired;
+            }
+        }
+        if (!entry) {
+            auto fit = shard.inflight.find(key);
+            if (fit != shard.inflight.end()) {
+                flight = fit->second;
+                ++flight->waiters;
+                ++shard.coalesced;
+            } else {
+                flight.reset(new Flight);
+                shard.inflight.emplace(key, flight);
+                leader = true;
+                ++shard.misses;
+            }
+        }
+    }
+
+    if (entry) {
+        Fill(*entry, resp);
+        hit_ns_.fetch_add(now_ns() - start, std::memory_order_relaxed);
+        return;
+    }
+
+    if (!leader) {
+        EntryPtr result;
+        {
+            std::unique_lock<std::mutex> lock(flight->mutex);
+            flight->cond.wait(lock, [&flight]() { return flight->done;});
+            result = flight->result;
+        }
+        // the leader threw or sent a file: nothing to share, ask ourselves
+        if (!result) {
+            handler(req, resp);
+            return;
+        }
+        Fill(*result, resp);
+        coalesced_ns_.fetch_add(now_ns() - start, std::memory_order_relaxed);
+        return;
+    }
+
+    auto finish = [&flight](const EntryPtr &result) {
+        std::lock_guard<std::mutex> lock(flight->mutex);
+        flight->result = result;
+        flight->done = true;
+        flight->cond.notify_all();
+    };
+    try {
+        handler(req, resp);
+    } catch (...) {
+        {
+            Spinlock::Lock lock(shard.mutex);
+            shard.inflight.erase(key);
+        }
+        finish(EntryPtr());
+        throw;
+    }
+
+    uint64_t ttl_ms = ttl_ms_;
+    EntryPtr result;
+    if (Storable(resp, &ttl_ms)) {
+        result = MakeEntry(resp, ttl_ms);
+        Spinlock::Lock lock(shard.mutex);
+        shard.inflight.erase(key);
+        Insert(shard, key, hash, result);
+    } else {
+        int waiters;
+        {
+            Spinlock::Lock lock(shard.mutex);
+            shard.inflight.erase(key);
+            waiters = flight->waiters;
+        }
+        // not kept, only copied for those waiting on it
+        if (waiters > 0 && !resp.GetFile())
+            result = MakeEntry(resp, 0);
+    }
+    finish(result);
+    miss_ns_.fetch_add(now_ns() - start, std::memory_order_relaxed);
+}
+
+ResponseCache::Handler
+ResponseCache::Wrap(const Handler &handler)
+{
+    return [this, handler](const HttpRequest &req, HttpResponse &resp) {
+        Handle(req, resp, handler);
+    };
+}
+
+void
+ResponseCache::Clear()
+{
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        Spinlock::Lock lock(shard.mutex);
+        shard.map.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+        std::fill(shard.sketch.begin(), shard.sketch.end(), 0);
+        shard.samples = 0;
+    }
+}
+
+ResponseCacheStats
+ResponseCache::GetStats() const
+{
+    ResponseCacheStats stats = {};
+
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        Spinlock::Lock lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.coalesced += shard.coalesced;
+        stats.stores += shard.stores;
+        stats.rejected += shard.rejected;
+        stats.evictions += shard.evictions;
+        stats.expired += shard.expired;
+        stats.entries += shard.map.size();
+        stats.bytes += shard.bytes;
+    }
+    stats.bypassed = bypassed_.load(std::memory_order_relaxed);
+    stats.hit_ns = hit_ns_.load(std::memory_order_relaxed);
+    stats.miss_ns = miss_ns_.load(std::memory_order_relaxed);
+    stats.coalesced_ns = coalesced_ns_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}
@@ -0,0 +1,152 @@
+#ifndef __RESPONSE_CACHE_H__
+#define __RESPONSE_CACHE_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "http_server.h"
+#include "noncopyable.h"
+
+/// @brief bytes the cache may hold, split evenly between the shards
+#define RESPONSE_CACHE_BYTES (64 << 20)
+/// @brief shards, each with its own lock, LRU list and frequency sketch
+#define RESPONSE_CACHE_SHARDS 16
+/// @brief how long a response is kept when it does not say itself with max-age
+#define RESPONSE_CACHE_TTL_MS 10000
+/// @brief bodies above this are never stored
+#define RESPONSE_CACHE_MAX_BODY (256 << 10)
+/// @brief TinyLFU counters saturate here and are halved every 10 * width increments
+#define RESPONSE_CACHE_MAX_FREQ 15
+
+namespace ekko {
+
+/// @brief counters summed over the shards
+struct ResponseCacheStats {
+    /// @brief answered from the cache
+    uint64_t hits;
+    /// @brief handler called, by the first of a set of identical requests
+    uint64_t misses;
+    /// @brief waited for an identical request in flight and got its answer
+    uint64_t coalesced;
+    /// @brief not cacheable requests, straight to the handler
+    uint64_t bypassed;
+    /// @brief stored responses
+    uint64_t stores;
+    /// @brief new responses turned away by TinyLFU, less popular than the victim
+    uint64_t rejected;
+    uint64_t evictions;
+    uint64_t expired;
+    uint64_t entries;
+    /// @brief accounted bytes: pool blocks of the bodies, headers, keys and entries
+    uint64_t bytes;
+    /// @brief time spent answering hits, calling the handler on misses and waiting when coalesced
+    uint64_t hit_ns;
+    uint64_t miss_ns;
+    uint64_t coalesced_ns;
+
+    /// @brief requests served without calling the handler, of the cacheable ones
+    double HitRatio() const {
+        uint64_t n = hits + misses + coalesced;
+        return n ? (double) (hits + coalesced) / n : 0;
+    }
+};
+
+/**
+ * @brief an in-process cache of whole responses, in front of a handler.
+ *
+ * The key is the method, the path, the query with its parameters sorted and
+ * its percent-encoding normalized, and the values of the request headers set
+ * with SetVary(). Only GET is cached, and only what the response allows:
+ * 200, 203, 301, 404 or 410, no Set-Cookie, no Vary on a header missing
+ * from SetVary(), no Cache-Control no-store, no-cache or private; max-age
+ * or s-maxage there sets its TTL. A request with Cache-Control no-cache or
+ * no-store, or Authorization, goes straight to the handler.
+ *
+ * The cache is split in shards by key hash, each with its own lock and a
+ * share of the byte budget. Bodies are copied into pool blocks sized to fit
+ * and accounted by the bytes the pool handed out; a hit shares them with the
+ * response instead of copying. Entries leave on TTL or by LRU, and a new one
+ * that needs room only gets in when a TinyLFU sketch of recent lookups rates
+ * it above the LRU victim, so a scan of one-off keys does not flush the hot set.
+ *
+ * Identical requests that miss together are coalesced: the first calls the
+ * handler, the others block until it returns and all get its response,
+ * whether it was stored or not. Handlers here block their loop anyway, on
+ * MysqlPool::executeSql for one, so waiting for the one call in flight
+ * costs a loop no more than making its own. Safe to call from every loop.
+*/
+class ResponseCache : Noncopyable {
+public:
+    typedef std::function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+    ResponseCache(size_t budget_bytes = RESPONSE_CACHE_BYTES, uint64_t ttl_ms = RESPONSE_CACHE_TTL_MS,
+                  int nshards = RESPONSE_CACHE_SHARDS);
+
+    ~ResponseCache();
+
+    /// @brief answer req from the cache, or with handler and store what it says
+    void Handle(const HttpRequest &req, HttpResponse &resp, const Handler &handler);
+
+    /// @brief handler with the cache in front, for HttpServer::SetHandler()
+    Handler Wrap(const Handler &handler);
+
+    /// @brief request headers whose values are part of the key; set before use
+    void SetVary(const std::vector<std::string> &headers) { vary_ = headers;}
+
+    /// @brief false stores every response, evicting by LRU alone
+    void SetAdmission(bool on) { admission_ = on;}
+
+    void Clear();
+
+    ResponseCacheStats GetStats() const;
+
+    /// @brief the cache key of req, for tests
+    std::string MakeKey(const HttpRequest &req) const;
+
+    /// @brief parameters sorted, unreserved characters decoded, other escapes upper-cased
+    static std::string NormalizeQuery(std::string_view query);
+
+private:
+    struct Entry;
+    struct Flight;
+    struct Shard;
+    typedef std::shared_ptr<Entry> EntryPtr;
+
+    /// @brief whether the status and headers of resp let it be stored, and for how long
+    bool Storable(const HttpResponse &resp, uint64_t *ttl_ms) const;
+
+    /// @brief a copy of resp, the body in blocks of its own
+    static EntryPtr MakeEntry(const HttpResponse &resp, uint64_t ttl_ms);
+
+    static void Fill(const Entry &entry, HttpResponse &resp);
+
+    /// @brief under the shard's lock
+    void Insert(Shard &shard, const std::string &key, uint64_t hash, const EntryPtr &entry);
+
+    void Evict(Shard &shard, const EntryPtr &entry);
+
+    size_t shard_budget_;
+
+    uint64_t ttl_ms_;
+
+    bool admission_ = true;
+
+    std::vector<std::string> vary_;
+
+    std::vector<std::unique_ptr<Shard> > shards_;
+
+    std::atomic<uint64_t> bypassed_{0};
+
+    std::atomic<uint64_t> hit_ns_{0};
+
+    std::atomic<uint64_t> miss_ns_{0};
+
+    std::atomic<uint64_t> coalesced_ns_{0};
+};
+
+}
+
+#endif
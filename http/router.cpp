@@ -0,0 +1,276 @@
+#include "router.h"
+#include <algorithm>
+#include <string.h>
+
+namespace ekko {
+
+struct Router::BuildNode {
+    std::string label;
+
+    std::vector<std::unique_ptr<BuildNode> > children;
+
+    std::unique_ptr<BuildNode> param;
+
+    std::unique_ptr<BuildNode> wildcard;
+
+    int32_t route = -1;
+
+    /// @return the node s ends at, below this one, splitting an edge if s ends inside it
+    BuildNode* Insert(std::string_view s) {
+        BuildNode *n = this;
+
+        while (!s.empty()) {
+            BuildNode *child = 0;
+            size_t i;
+            for (i = 0; i < n->children.size(); ++i) {
+                if (n->children[i]->label[0] == s[0]) {
+                    child = n->children[i].get();
+                    break;
+                }
+            }
+            if (!child) {
+                n->children.emplace_back(new BuildNode);
+                n->children.back()->label.assign(s.data(), s.size());
+                return n->children.back().get();
+            }
+            size_t common = 0;
+            while (common < child->label.size() && common < s.size() && child->label[common] == s[common])
+                ++common;
+            if (common < child->label.size()) {
+                // the edge forks here: the shared part becomes a node of its own
+                std::unique_ptr<BuildNode> mid(new BuildNode);
+                mid->label = child->label.substr(0, common);
+                child->label.erase(0, common);
+                mid->children.push_back(std::move(n->children[i]));
+                n->children[i] = std::move(mid);
+                child = n->children[i].get();
+            }
+            n = child;
+            s.remove_prefix(common);
+        }
+        return n;
+    }
+};
+
+/// @brief check pattern, and collect the names of its parameters
+/// @return false if it is malformed
+static bool
+parse_pattern(std::string_view pattern, std::vector<std::string_view> *names)
+{
+    if (pattern.empty() || pattern[0] != '/' || pattern.size() > UINT16_MAX)
+        return false;
+    for (size_t pos = 0; pos < pattern.size(); ++pos) {
+        char c = pattern[pos];
+        if (c != ':' && c != '*')
+            continue;
+        if (pattern[pos - 1] != '/')
+            return false;
+        size_t end = c == '*' ? pattern.size() : std::min(pattern.find('/', pos), pattern.size());
+        std::string_view name = pattern.substr(pos + 1, end - pos - 1);
+        if (name.empty() || name.find_first_of(":*/") != std::string_view::npos)
+            return false;
+        if (names)
+            names->push_back(name);
+        pos = end;
+    }
+    return true;
+}
+
+Router::Router()
+    :root_(new BuildNode) {
+}
+
+Router::~Router()
+{
+}
+
+int
+Router::Add(HttpMethod method, std::string_view pattern, const Handler &handler)
+{
+    std::vector<std::string_view> names;
+
+    if (!handler || !parse_pattern(pattern, &names) || names.size() > ROUTER_MAX_PARAMS)
+        return -1;
+    BuildNode *n = root_.get();
+    for (size_t pos = 0; pos < pattern.size(); ) {
+        char c = pattern[pos];
+        if (c == ':' || c == '*') {
+            std::unique_ptr<BuildNode> &child = c == ':' ? n->param : n->wildcard;
+            if (!child)
+                child.reset(new BuildNode);
+            n = child.get();
+            pos = c == '*' ? pattern.size() : std::min(pattern.find('/', pos), pattern.size());
+            continue;
+        }
+        size_t end = std::min(pattern.find_first_of(":*", pos), pattern.size());
+        n = n->Insert(pattern.substr(pos, end - pos));
+        pos = end;
+    }
+    if (n->route < 0) {
+        n->route = routes_.size();
+        routes_.emplace_back();
+        routes_.back().pattern.assign(pattern.data(), pattern.size());
+    }
+    Route &route = routes_[n->route];
+    if (route.handlers[method])
+        return -1;
+    route.handlers[method] = handler;
+    return 0;
+}
+
+void
+Router::Emit(BuildNode *b, uint32_t idx)
+{
+    Node node;
+
+    std::sort(b->children.begin(), b->children.end(),
+        [](const std::unique_ptr<BuildNode> &x, const std::unique_ptr<BuildNode> &y) {
+            return (unsigned char) x->label[0] < (unsigned char) y->label[0];
+        });
+    node.label = labels_.size();
+    node.label_len = b->label.size();
+    node.lead = b->label.empty() ? 0 : b->label[0];
+    node.nstatic = b->children.size();
+    node.children = nodes_.size();
+    node.param = -1;
+    node.wildcard = -1;
+    node.route = b->route;
+    labels_.append(b->label);
+    // the static children are placed side by side before going down any of them
+    nodes_.resize(nodes_.size() + b->children.size());
+    nodes_[idx] = node;
+    for (size_t i = 0; i < b->children.size(); ++i)
+        Emit(b->children[i].get(), node.children + i);
+    if (b->param) {
+        nodes_[idx].param = nodes_.size();
+        nodes_.emplace_back();
+        Emit(b->param.get(), nodes_[idx].param);
+    }
+    if (b->wildcard) {
+        nodes_[idx].wildcard = nodes_.size();
+        nodes_.emplace_back();
+        Emit(b->wildcard.get(), nodes_[idx].wildcard);
+    }
+}
+
+void
+Router::Compile()
+{
+    nodes_.clear();
+    labels_.clear();
+    names_.clear();
+    nodes_.emplace_back();
+    Emit(root_.get(), 0);
+    nodes_.shrink_to_fit();
+    for (size_t i = 0; i < routes_.size(); ++i) {
+        std::vector<std::string_view> names;
+        parse_pattern(routes_[i].pattern, &names);
+        routes_[i].names = names_.size();
+        routes_[i].nparams = names.size();
+        names_.insert(names_.end(), names.begin(), names.end());
+    }
+}
+
+bool
+Router::Match(int32_t idx, std::string_view path, size_t pos, RouteParams &params, int32_t *route) const
+{
+    const Node *n;
+
+    for (;;) {
+        n = &nodes_[idx];
+        if (pos == path.size()) {
+            if (n->route >= 0) {
+                *route = n->route;
+                return true;
+            }
+            break;
+        }
+        // at most one static child can start with the next byte
+        const Node *first = nodes_.data() + n->children, *child = 0;
+        char c = path[pos];
+        if (n->nstatic <= ROUTER_LINEAR_CHILDREN) {
+            for (int i = 0; i < n->nstatic; ++i) {
+                if (first[i].lead == c) {
+                    child = &first[i];
+                    break;
+                }
+            }
+        } else {
+            const Node *it = std::lower_bound(first, first + n->nstatic, c, [](const Node &x, char v) {
+                return (unsigned char) x.lead < (unsigned char) v;
+            });
+            if (it != first + n->nstatic && it->lead == c)
+                child = it;
+        }
+        if (child && path.size() - pos >= child->label_len
+                && memcmp(path.data() + pos, labels_.data() + child->label, child->label_len) == 0) {
+            // nothing to fall back on here: go down without keeping the way back
+            if (n->param < 0 && n->wildcard < 0) {
+                idx = child - nodes_.data();
+                pos += child->label_len;
+                continue;
+            }
+            if (Match(child - nodes_.data(), path, pos + child->label_len, params, route))
+                return true;
+        }
+        if (n->param >= 0 && params.size < ROUTER_MAX_PARAMS) {
+            size_t end = std::min(path.find('/', pos), path.size());
+            if (end > pos) {
+                params.values[params.size++] = path.substr(pos, end - pos);
+                if (Match(n->param, path, end, params, route))
+                    return true;
+                --params.size;
+            }
+        }
+        break;
+    }
+    // the rest of the path, possibly nothing
+    if (n->wildcard >= 0 && nodes_[n->wildcard].route >= 0 && params.size < ROUTER_MAX_PARAMS) {
+        params.values[params.size++] = path.substr(pos);
+        *route = nodes_[n->wildcard].route;
+        return true;
+    }
+    return false;
+}
+
+const Router::Handler*
+Router::Find(HttpMethod method, std::string_view path, RouteParams &params, bool *path_found) const
+{
+    int32_t idx = -1;
+
+    params.size = 0;
+    if (path_found)
+        *path_found = false;
+    if (nodes_.empty() || !Match(0, path, 0, params, &idx))
+        return 0;
+    const Route &route = routes_[idx];
+    for (int i = 0; i < params.size && i < route.nparams; ++i)
+        params.names[i] = names_[route.names + i];
+    if (path_found)
+        *path_found = true;
+    const Handler *handler = &route.handlers[method];
+    if (!*handler && method == HTTP_HEAD)
+        handler = &route.handlers[HTTP_GET];
+    return *handler ? handler : 0;
+}
+
+void
+Router::Dispatch(const HttpRequest &req, HttpResponse &resp) const
+{
+    RouteParams params;
+    bool found;
+
+    const Handler *handler = Find(req.GetMethod(), req.Path(), params, &found);
+    if (handler)
+        (*handler)(req, resp, params);
+    else
+        resp.SetStatus(found ? 405 : 404);
+}
+
+HttpServer::Handler
+Router::Bind() const
+{
+    return [this](const HttpRequest &req, HttpResponse &resp) { Dispatch(req, resp);};
+}
+
+}
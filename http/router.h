@@ -0,0 +1,227 @@
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "http_server.h"
+#include "noncopyable.h"
+
+/// @brief parameters and wildcards one route may capture
+#define ROUTER_MAX_PARAMS 16
+/// @brief static children above this are binary searched instead of scanned
+#define ROUTER_LINEAR_CHILDREN 8
+
+namespace ekko {
+
+/// @brief what a match captured, views into the path and the router; no allocation
+struct RouteParams {
+    int size = 0;
+
+    std::string_view names[ROUTER_MAX_PARAMS];
+
+    std::string_view values[ROUTER_MAX_PARAMS];
+
+    /// @return empty if the route has no such parameter
+    std::string_view Get(std::string_view name) const {
+        for (int i = 0; i < size; ++i) {
+            if (names[i] == name)
+                return values[i];
+        }
+        return std::string_view();
+    }
+};
+
+/**
+ * @brief request routing on a radix trie.
+ *
+ * Patterns are made of static text, ":name" for one path segment and
+ * "*name" for the rest of the path, both right after a '/': for instance
+ * "/repos/:owner/:repo/issues", or "/static/" then a wildcard named file.
+ * At a node, static children are tried first, then the parameter, then
+ * the wildcard, going back up when a branch leads nowhere, so "/users/new"
+ * wins over "/users/:id" whatever the order they were added in.
+ *
+ * Routes are added to a tree of heap nodes, then Compile() lays it out
+ * flat: every node's static children side by side in one array, sorted by
+ * their first byte, and every label in one string. A lookup walks the array
+ * comparing bytes in place; the captures are views into the path. Add()
+ * and Compile() are for start-up, Find() and Dispatch() are thread-safe
+ * after.
+*/
+class Router : Noncopyable {
+public:
+    typedef std::function<void(const HttpRequest&, HttpResponse&, const RouteParams&)> Handler;
+
+    Router();
+
+    ~Router();
+
+    /// @return success with 0, fail with -1: a malformed pattern, or one already there for method
+    int Add(HttpMethod method, std::string_view pattern, const Handler &handler);
+
+    int Get(std::string_view pattern, const Handler &handler) { return Add(HTTP_GET, pattern, handler);}
+
+    int Post(std::string_view pattern, const Handler &handler) { return Add(HTTP_POST, pattern, handler);}
+
+    /// @brief lay the routes out for lookups; again after more Add()
+    void Compile();
+
+    /**
+     * @param[out] path_found set when the path matched a route, even one
+     * without a handler for method
+     * @return the handler, 0 if none; HEAD falls back to GET
+    */
+    const Handler* Find(HttpMethod method, std::string_view path, RouteParams &params,
+                        bool *path_found = 0) const;
+
+    /// @brief call the route's handler, or answer 404 or 405
+    void Dispatch(const HttpRequest &req, HttpResponse &resp) const;
+
+    /// @brief Dispatch() as a handler, for HttpServer::SetHandler()
+    HttpServer::Handler Bind() const;
+
+    size_t RouteCount() const { return routes_.size();}
+
+    size_t NodeCount() const { return nodes_.size();}
+
+private:
+    struct BuildNode;
+
+    /// @brief a node of the compiled trie
+    struct Node {
+        /// @brief offset of its label in labels_
+        uint32_t label;
+
+        uint16_t label_len;
+
+        /// @brief static children, at children .. children + nstatic - 1
+        uint16_t nstatic;
+
+        uint32_t children;
+
+        /// @brief index of the parameter and wildcard children, -1 if none
+        int32_t param;
+
+        int32_t wildcard;
+
+        /// @brief index in routes_ of the route ending here, -1 if none
+        int32_t route;
+
+        /// @brief first byte of the label, what a lookup picks a child by
+        char lead;
+    };
+
+    struct Route {
+        std::string pattern;
+
+        /// @brief per HttpMethod, unset for methods the route does not take
+        Handler handlers[HTTP_OTHER + 1];
+
+        /// @brief its parameter names, in names_
+        uint32_t names;
+
+        int nparams;
+    };
+
+    bool Match(int32_t idx, std::string_view path, size_t pos, RouteParams &params, int32_t *route) const;
+
+    /// @brief copy b and everything under it to nodes_[idx]
+    void Emit(BuildNode *b, uint32_t idx);
+
+    std::unique_ptr<BuildNode> root_;
+
+    std::vector<Route> routes_;
+
+    std::vector<Node> nodes_;
+
+    std::string labels_;
+
+    /// @brief the parameter names of every route, back to back, views into their patterns
+    std::vector<std::string_view> names_;
+};
+
+struct StaticRoute {
+    std::string_view path;
+
+    int id;
+};
+
+/**
+ * @brief exact paths known when the program is compiled, hashed and
+ * sorted by the compiler: a lookup hashes the path and binary searches the
+ * table, with no node to follow. Paths with parameters belong in a Router.
+ *
+ *     static constexpr StaticRoute kRoutes[] = {{"/health", 0}, {"/metrics", 1}};
+ *     static constexpr auto kTable = MakeStaticRoutes(kRoutes);
+ *     static_assert(kTable.Find("/metrics") == 1);
+*/
+template <size_t N>
+class StaticRouteTable {
+public:
+    constexpr explicit StaticRouteTable(const StaticRoute (&routes)[N]) {
+        for (size_t i = 0; i < N; ++i) {
+            Entry e = { Hash(routes[i].path), routes[i].path, routes[i].id };
+            size_t j = i;
+            for (; j > 0 && entries_[j - 1].hash > e.hash; --j)
+                entries_[j] = entries_[j - 1];
+            entries_[j] = e;
+        }
+    }
+
+    /// @return the route's id, -1 if the path is not in the table
+    constexpr int Find(std::string_view path) const {
+        uint64_t h = Hash(path);
+        size_t lo = 0, hi = N;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (entries_[mid].hash < h)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; lo < N && entries_[lo].hash == h; ++lo) {
+            if (entries_[lo].path == path)
+                return entries_[lo].id;
+        }
+        return -1;
+    }
+
+    constexpr size_t Size() const { return N;}
+
+    /// @brief FNV-1a
+    static constexpr uint64_t Hash(std::string_view s) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < s.size(); ++i) {
+            h ^= (unsigned char) s[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+private:
+    struct Entry {
+        uint64_t hash = 0;
+
+        std::string_view path;
+
+        int id = -1;
+    };
+
+    Entry entries_[N] = {};
+};
+
+template <size_t N>
+constexpr StaticRouteTable<N>
+MakeStaticRoutes(const StaticRoute (&routes)[N])
+{
+    return StaticRouteTable<N>(routes);
+}
+
+}
+
+#endif
@@ -0,0 +1,547 @@
+#include "static_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INOTIFY_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+namespace ekko {
+
+struct StaticFileHandler::Entry {
+    std::string path;
+
+    off_t size;
+
+    struct timespec mtime;
+
+    ino_t ino;
+
+    std::string etag;
+
+    std::string last_modified;
+
+    /// @brief Content-Type, ETag, Last-Modified and Accept-Ranges lines
+    std::string headers;
+
+    /// @brief the content when it is cached
+    IOBuf body;
+
+    /// @brief the open file when it is sent from disk
+    FileRef::ptr file;
+
+    /// @brief content bytes counted against the budget
+    size_t bytes = 0;
+
+    int wd = -1;
+
+    std::atomic<int64_t> checked_ms{0};
+
+    bool cached = false;
+
+    std::list<EntryPtr>::iterator lru;
+};
+
+struct mapping_t {
+    void *addr;
+    size_t len;
+};
+
+static void
+unmap_release(void *arg)
+{
+    mapping_t *m = (mapping_t*) arg;
+    munmap(m->addr, m->len);
+    delete m;
+}
+
+static int64_t
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline bool
+same_file(const struct stat &st, off_t size, const struct timespec &mtime, ino_t ino)
+{
+    return st.st_size == size && st.st_ino == ino
+        && st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec;
+}
+
+static inline std::string_view
+trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+/// @brief If-None-Match: a list of tags or "*", weak tags compare by their opaque part
+static bool
+etag_match(std::string_view header, const std::string &etag)
+{
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view tag = trim(header.substr(0, comma));
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+        if (tag == "*")
+            return true;
+        if (tag.size() > 2 && tag[0] == 'W' && tag[1] == '/')
+            tag.remove_prefix(2);
+        if (tag == etag)
+            return true;
+    }
+    return false;
+}
+
+/// @brief IMF-fixdate, the only format we send; others are ignored
+static bool
+parse_http_date(std::string_view s, time_t &t)
+{
+    char buf[64];
+    struct tm tm;
+
+    if (s.size() >= sizeof(buf))
+        return false;
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end)
+        return false;
+    t = timegm(&tm);
+    return true;
+}
+
+static bool
+parse_offset(std::string_view s, off_t &v)
+{
+    if (s.empty() || s.size() > 18)
+        return false;
+    v = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+        v = v * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief a single "bytes=" range
+ * @return 1 with start and len set, 0 to send the whole file (malformed or
+ * several ranges), -1 when it cannot be satisfied
+*/
+static int
+parse_range(std::string_view header, off_t size, off_t &start, off_t &len)
+{
+    off_t first, last;
+
+    header = trim(header);
+    if (header.substr(0, 6) != "bytes=")
+        return 0;
+    header = trim(header.substr(6));
+    if (header.find(',') != std::string_view::npos)
+        return 0;
+    size_t dash = header.find('-');
+    if (dash == std::string_view::npos)
+        return 0;
+    std::string_view a = trim(header.substr(0, dash)), b = trim(header.substr(dash + 1));
+    if (a.empty()) {
+        // the last b bytes
+        if (!parse_offset(b, last))
+            return 0;
+        if (last == 0 || size == 0)
+            return -1;
+        start = last < size ? size - last : 0;
+        len = size - start;
+        return 1;
+    }
+    if (!parse_offset(a, first))
+        return 0;
+    if (b.empty())
+        last = size - 1;
+    else if (!parse_offset(b, last) || last < first)
+        return 0;
+    if (first >= size)
+        return -1;
+    if (last >= size)
+        last = size - 1;
+    start = first;
+    len = last - first + 1;
+    return 1;
+}
+
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+const char*
+StaticFileHandler::ContentType(std::string_view path)
+{
+    static const char *types[][2] = {
+        { "html", "text/html; charset=utf-8" },
+        { "htm", "text/html; charset=utf-8" },
+        { "css", "text/css; charset=utf-8" },
+        { "js", "text/javascript; charset=utf-8" },
+        { "mjs", "text/javascript; charset=utf-8" },
+        { "json", "application/json" },
+        { "txt", "text/plain; charset=utf-8" },
+        { "xml", "application/xml" },
+        { "svg", "image/svg+xml" },
+        { "png", "image/png" },
+        { "jpg", "image/jpeg" },
+        { "jpeg", "image/jpeg" },
+        { "gif", "image/gif" },
+        { "webp", "image/webp" },
+        { "ico", "image/x-icon" },
+        { "wasm", "application/wasm" },
+        { "woff", "font/woff" },
+        { "woff2", "font/woff2" },
+        { "pdf", "application/pdf" },
+        { "mp4", "video/mp4" },
+    };
+    size_t dot = path.rfind('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos)
+        return "application/octet-stream";
+    std::string_view ext = path.substr(dot + 1);
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        if (ext == types[i][0])
+            return types[i][1];
+    }
+    return "application/octet-stream";
+}
+
+StaticFileHandler::StaticFileHandler(const std::string &root, size_t cache_bytes)
+    :root_(root)
+    ,cache_bytes_(cache_bytes) {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+StaticFileHandler::~StaticFileHandler()
+{
+    if (inotify_fd_ >= 0)
+        close(inotify_fd_);
+}
+
+void
+StaticFileHandler::DisableInotify()
+{
+    Spinlock::Lock lock(mutex_);
+    while (!lru_.empty())
+        Evict(lru_.back());
+    if (inotify_fd_ >= 0)
+        close(inotify_fd_);
+    inotify_fd_ = -1;
+}
+
+bool
+StaticFileHandler::Resolve(std::string_view target, std::string &path) const
+{
+    std::string rel;
+    int hi, lo;
+
+    if (target.empty() || target[0] != '/')
+        return false;
+    for (size_t i = 0; i < target.size(); ++i) {
+        if (target[i] != '%') {
+            rel += target[i];
+            continue;
+        }
+        if (i + 2 >= target.size() || (hi = hex_value(target[i + 1])) < 0
+                || (lo = hex_value(target[i + 2])) < 0)
+            return false;
+        rel += (char) (hi * 16 + lo);
+        i += 2;
+    }
+    if (rel.find('\0') != std::string::npos)
+        return false;
+    // no way out of the root, however it is spelt
+    for (size_t pos = 0; pos < rel.size(); ) {
+        size_t end = rel.find('/', pos + 1);
+        if (end == std::string::npos)
+            end = rel.size();
+        if (rel.compare(pos, end - pos, "/..") == 0)
+            return false;
+        pos = end;
+    }
+    if (rel.back() == '/')
+        rel += "index.html";
+    path = root_ + rel;
+    return true;
+}
+
+StaticFileHandler::EntryPtr
+StaticFileHandler::Load(const std::string &path)
+{
+    struct stat st;
+    struct tm tm;
+    char buf[128];
+    size_t done = 0;
+    ssize_t n;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return EntryPtr();
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return EntryPtr();
+    }
+
+    EntryPtr entry(new Entry);
+    entry->path = path;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->ino = st.st_ino;
+    snprintf(buf, sizeof(buf), "\"%lx.%lx-%lx\"", (long) st.st_mtim.tv_sec,
+             (long) st.st_mtim.tv_nsec, (long) st.st_size);
+    entry->etag = buf;
+    gmtime_r(&st.st_mtim.tv_sec, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    entry->last_modified = buf;
+    entry->headers = std::string("Content-Type: ") + ContentType(path) + "\r\n"
+        + "ETag: " + entry->etag + "\r\n"
+        + "Last-Modified: " + entry->last_modified + "\r\n"
+        + "Accept-Ranges: bytes\r\n";
+
+    if ((size_t) st.st_size > max_cached_file_) {
+        entry->file.reset(new FileRef(fd));
+        return entry;
+    }
+    if (st.st_size >= STATIC_MMAP_MIN) {
+        // files are replaced by rename when they change; one truncated in
+        // place while mapped would fault the copy of a small range
+        void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return EntryPtr();
+        mapping_t *m = new mapping_t;
+        m->addr = addr;
+        m->len = st.st_size;
+        entry->body.AppendExternal((const char*) addr, st.st_size, unmap_release, m);
+    } else if (st.st_size > 0) {
+        char *p = entry->body.Reserve(st.st_size);
+        while (done < (size_t) st.st_size) {
+            n = pread(fd, p + done, st.st_size - done, done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        close(fd);
+        // changed under us, the next request tries again
+        if (done != (size_t) st.st_size)
+            return EntryPtr();
+        entry->body.Commit(done);
+    } else {
+        close(fd);
+    }
+    entry->bytes = st.st_size;
+    return entry;
+}
+
+bool
+StaticFileHandler::IsFresh(const EntryPtr &entry)
+{
+    struct stat st;
+
+    if (inotify_fd_ >= 0)
+        return true;
+    int64_t now = now_ms();
+    if (now < entry->checked_ms.load(std::memory_order_relaxed) + STATIC_REVALIDATE_MS)
+        return true;
+    if (stat(entry->path.c_str(), &st) != 0 || !same_file(st, entry->size, entry->mtime, entry->ino))
+        return false;
+    entry->checked_ms.store(now, std::memory_order_relaxed);
+    return true;
+}
+
+void
+StaticFileHandler::Evict(EntryPtr entry)
+{
+    // under mutex_; entry by value, the map or the list may hold the last reference
+    if (!entry->cached)
+        return;
+    entry->cached = false;
+    entries_.erase(entry->path);
+    lru_.erase(entry->lru);
+    cached_bytes_ -= entry->bytes;
+    if (entry->wd >= 0) {
+        std::unordered_map<int, EntryPtr>::iterator it = watches_.find(entry->wd);
+        if (it != watches_.end() && it->second == entry) {
+            watches_.erase(it);
+            inotify_rm_watch(inotify_fd_, entry->wd);
+        }
+    }
+}
+
+void
+StaticFileHandler::Insert(const EntryPtr &entry)
+{
+    struct stat st;
+
+    if (entry->bytes > cache_bytes_)
+        return;
+    Spinlock::Lock lock(mutex_);
+    std::unordered_map<std::string, EntryPtr>::iterator it = entries_.find(entry->path);
+    if (it != entries_.end())
+        Evict(it->second);
+    while (!lru_.empty() && (cached_bytes_ + entry->bytes > cache_bytes_
+            || entries_.size() >= STATIC_MAX_ENTRIES))
+        Evict(lru_.back());
+    if (inotify_fd_ >= 0) {
+        entry->wd = inotify_add_watch(inotify_fd_, entry->path.c_str(), INOTIFY_MASK);
+        if (entry->wd < 0)
+            return;
+        // a change between Load() and the watch would go unnoticed
+        if (stat(entry->path.c_str(), &st) != 0 || !same_file(st, entry->size, entry->mtime, entry->ino)) {
+            if (watches_.find(entry->wd) == watches_.end())
+                inotify_rm_watch(inotify_fd_, entry->wd);
+            return;
+        }
+        watches_[entry->wd] = entry;
+    }
+    entry->checked_ms.store(now_ms(), std::memory_order_relaxed);
+    entry->cached = true;
+    lru_.push_front(entry);
+    entry->lru = lru_.begin();
+    entries_[entry->path] = entry;
+    cached_bytes_ += entry->bytes;
+}
+
+void
+StaticFileHandler::PollInotify()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    if (inotify_fd_ < 0)
+        return;
+    // one thread reads the events every STATIC_INOTIFY_POLL_MS
+    int64_t now = now_ms(), next = next_poll_ms_.load(std::memory_order_relaxed);
+    if (now < next || !next_poll_ms_.compare_exchange_strong(next, now + STATIC_INOTIFY_POLL_MS))
+        return;
+    while ((n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+        Spinlock::Lock lock(mutex_);
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + ev->len;
+            std::unordered_map<int, EntryPtr>::iterator it = watches_.find(ev->wd);
+            if (it == watches_.end())
+                continue;
+            EntryPtr entry = it->second;
+            Evict(entry);
+            invalidations_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+StaticFileHandler::EntryPtr
+StaticFileHandler::Lookup(const std::string &path)
+{
+    EntryPtr entry;
+    {
+        Spinlock::Lock lock(mutex_);
+        std::unordered_map<std::string, EntryPtr>::iterator it = entries_.find(path);
+        if (it != entries_.end()) {
+            entry = it->second;
+            lru_.splice(lru_.begin(), lru_, entry->lru);
+        }
+    }
+    if (entry && IsFresh(entry)) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return entry;
+    }
+    if (entry) {
+        invalidations_.fetch_add(1, std::memory_order_relaxed);
+        Spinlock::Lock lock(mutex_);
+        Evict(entry);
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    entry = Load(path);
+    if (entry)
+        Insert(entry);
+    return entry;
+}
+
+void
+StaticFileHandler::Handle(const HttpRequest &req, HttpResponse &resp)
+{
+    std::string path;
+    off_t start = 0, len;
+    time_t since;
+    char line[128];
+
+    if (req.GetMethod() != HTTP_GET && req.GetMethod() != HTTP_HEAD) {
+        resp.SetStatus(405);
+        resp.AddHeader("Allow", "GET, HEAD");
+        return;
+    }
+    if (!Resolve(req.Path(), path)) {
+        resp.SetStatus(404);
+        return;
+    }
+    PollInotify();
+    EntryPtr entry = Lookup(path);
+    if (!entry) {
+        resp.SetStatus(404);
+        return;
+    }
+    resp.AddRawHeaders(entry->headers);
+
+    std::string_view inm = req.GetHeader("If-None-Match");
+    std::string_view ims = req.GetHeader("If-Modified-Since");
+    if (!inm.empty() ? etag_match(inm, entry->etag)
+            : !ims.empty() && parse_http_date(ims, since) && entry->mtime.tv_sec <= since) {
+        resp.SetStatus(304);
+        return;
+    }
+
+    len = entry->size;
+    std::string_view range = req.GetHeader("Range");
+    std::string_view if_range = trim(req.GetHeader("If-Range"));
+    if (!range.empty() && (if_range.empty() || if_range == entry->etag || if_range == entry->last_modified)) {
+        int rc = parse_range(range, entry->size, start, len);
+        if (rc < 0) {
+            resp.SetStatus(416);
+            snprintf(line, sizeof(line), "bytes */%lld", (long long) entry->size);
+            resp.AddHeader("Content-Range", line);
+            return;
+        }
+        if (rc > 0) {
+            resp.SetStatus(206);
+            snprintf(line, sizeof(line), "bytes %lld-%lld/%lld", (long long) start,
+                     (long long) (start + len - 1), (long long) entry->size);
+            resp.AddHeader("Content-Range", line);
+        }
+    }
+
+    if (entry->file) {
+        resp.SetFile(entry->file, start, len);
+        return;
+    }
+    IOBuf body(entry->body);
+    body.PopFront(start);
+    body.PopBack(entry->size - start - len);
+    resp.SetBody(std::move(body));
+}
+
+}
@@ -0,0 +1,132 @@
+#ifndef __STATIC_FILE_H__
+#define __STATIC_FILE_H__
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <sys/types.h>
+#include "http_server.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+/// @brief bytes of file content the cache may hold
+#define STATIC_CACHE_BYTES (64 << 20)
+/// @brief files above this are not cached but sent with sendfile/splice
+#define STATIC_MAX_CACHED_FILE (1 << 20)
+/// @brief files from this size on are mapped, smaller ones read into pool blocks
+#define STATIC_MMAP_MIN 16384
+/// @brief cached entries, each big file among them keeps a descriptor open
+#define STATIC_MAX_ENTRIES 4096
+/// @brief how often a cached entry is checked against the file without inotify
+#define STATIC_REVALIDATE_MS 1000
+/// @brief how often pending inotify events are read
+#define STATIC_INOTIFY_POLL_MS 50
+
+namespace ekko {
+
+/**
+ * @brief serves GET and HEAD for the files under a root directory.
+ *
+ * Small hot files are kept in a bounded LRU cache: up to STATIC_MMAP_MIN
+ * they are read into IOBuf blocks, above it they are mapped and referenced
+ * from the IOBuf, so a response shares the content instead of copying it and
+ * an evicted mapping lives on until the last send using it is done. Bigger
+ * files are sent with sendfile (epoll) or splice (io_uring) from a descriptor
+ * kept in the cache. Every entry carries its header lines (Content-Type,
+ * ETag, Last-Modified, Accept-Ranges) preformatted.
+ *
+ * If-None-Match and If-Modified-Since are answered with 304, a single byte
+ * range with 206 (If-Range honoured), an unsatisfiable one with 416; several
+ * ranges get the whole file. Entries are dropped on inotify events for their
+ * file, or, where inotify is unavailable, rechecked with stat at most every
+ * STATIC_REVALIDATE_MS. Safe to call from every loop at once.
+*/
+class StaticFileHandler : Noncopyable {
+public:
+    /**
+     * @param[in] root directory served, without a trailing '/'
+     * @param[in] cache_bytes budget for cached content
+    */
+    StaticFileHandler(const std::string &root, size_t cache_bytes = STATIC_CACHE_BYTES);
+
+    ~StaticFileHandler();
+
+    void Handle(const HttpRequest &req, HttpResponse &resp);
+
+    /// @brief files bigger than n are never cached, 0 sends every file from disk
+    void SetMaxCachedFile(size_t n) { max_cached_file_ = n;}
+
+    /// @brief rechecks use stat even if inotify works, for tests
+    void DisableInotify();
+
+    bool UsesInotify() const { return inotify_fd_ >= 0;}
+
+    uint64_t GetHits() const { return hits_.load(std::memory_order_relaxed);}
+
+    uint64_t GetMisses() const { return misses_.load(std::memory_order_relaxed);}
+
+    uint64_t GetInvalidations() const { return invalidations_.load(std::memory_order_relaxed);}
+
+    size_t GetCachedBytes() const { return cached_bytes_;}
+
+    size_t GetCachedEntries() const { return entries_.size();}
+
+    /// @brief MIME type by extension, application/octet-stream when unknown
+    static const char* ContentType(std::string_view path);
+
+private:
+    struct Entry;
+    typedef std::shared_ptr<Entry> EntryPtr;
+
+    /// @return the file's entry, cached or not; 0 when there is no such file
+    EntryPtr Lookup(const std::string &path);
+
+    /// @brief open and stat path, read or map it when it is small enough
+    EntryPtr Load(const std::string &path);
+
+    /// @brief whether a cached entry still matches the file
+    bool IsFresh(const EntryPtr &entry);
+
+    void Insert(const EntryPtr &entry);
+
+    void Evict(EntryPtr entry);
+
+    void PollInotify();
+
+    /// @brief root-relative target to a file name, false if it leaves the root
+    bool Resolve(std::string_view target, std::string &path) const;
+
+    std::string root_;
+
+    size_t cache_bytes_;
+
+    size_t max_cached_file_ = STATIC_MAX_CACHED_FILE;
+
+    int inotify_fd_ = -1;
+
+    std::atomic<int64_t> next_poll_ms_{0};
+
+    Spinlock mutex_;
+
+    std::unordered_map<std::string, EntryPtr> entries_;
+
+    /// @brief most recently used first
+    std::list<EntryPtr> lru_;
+
+    std::unordered_map<int, EntryPtr> watches_;
+
+    size_t cached_bytes_ = 0;
+
+    std::atomic<uint64_t> hits_{0};
+
+    std::atomic<uint64_t> misses_{0};
+
+    std::atomic<uint64_t> invalidations_{0};
+};
+
+}
+
+#endif
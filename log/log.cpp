@@ -207,7 +207,7 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
     ,line_(line)
     ,elapse_(elapse)
     ,thread_id_(thread_id)
-    ,fiber_id_(fiber_id_)
+    ,fiber_id_(fiber_id)
     ,time_(time)
     ,thread_name_(thread_name)
     ,logger_(logger)
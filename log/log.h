@@ -12,7 +12,23 @@
 #include <map>
 #include <pthread.h>
 #include <functional>
+#include <time.h>
 #include "mutex.h"
+#include "util.h"
+
+/// @brief stream a log event, thread id and fiber id are filled in
+/// e.g. EKKO_LOG_INFO(logger) << "accepted " << fd;
+#define EKKO_LOG_LEVEL(logger, level) \
+    if (logger->GetLevel() <= level) \
+        ekko::LogEventWrap(ekko::LogEvent::ptr(new ekko::LogEvent(logger, level, \
+                __FILE__, __LINE__, 0, ekko::GetThreadId(), \
+                ekko::GetFiberId(), time(0), ""))).GetStrStream()
+
+#define EKKO_LOG_DEBUG(logger) EKKO_LOG_LEVEL(logger, ekko::LogLevel::DEBUG)
+#define EKKO_LOG_INFO(logger) EKKO_LOG_LEVEL(logger, ekko::LogLevel::INFO)
+#define EKKO_LOG_WARN(logger) EKKO_LOG_LEVEL(logger, ekko::LogLevel::WARN)
+#define EKKO_LOG_ERROR(logger) EKKO_LOG_LEVEL(logger, ekko::LogLevel::ERROR)
+#define EKKO_LOG_FATAL(logger) EKKO_LOG_LEVEL(logger, ekko::LogLevel::FATAL)
 
 namespace ekko {
 
@@ -1,6 +1,25 @@
 #include "util.h"
+#include <sys/syscall.h>
 
 namespace ekko{
+
+static thread_local uint32_t t_fiber_id = 0;
+
+uint32_t GetThreadId()
+{
+    return syscall(SYS_gettid);
+}
+
+uint32_t GetFiberId()
+{
+    return t_fiber_id;
+}
+
+void SetFiberId(uint32_t fiber_id)
+{
+    t_fiber_id = fiber_id;
+}
+
 bool FSUtil::OpenForWrite(std::ofstream& ofs, const std::string& filename
                     ,std::ios_base::openmode mode)
 {
@@ -12,6 +12,16 @@
 namespace ekko {
 
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
+
+/// @brief kernel id of the calling thread
+uint32_t GetThreadId();
+
+/// @brief id of the fiber running on the calling thread, 0 outside of fibers
+uint32_t GetFiberId();
+
+/// @brief set by the fiber scheduler whenever it switches a fiber in or out
+void SetFiberId(uint32_t fiber_id);
+
 class FSUtil {
 public:
     static bool OpenForWrite(std::ofstream& ofs, const std::string& filename
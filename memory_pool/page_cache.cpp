@@ -27,12 +27,18 @@ PageCache::Refill()
 {
     Span *span_ptr;
     void *memPtr;
+    size_t pad;
     page_id_t pID;
 
-    if ( (memPtr = sbrk(REFILL_SIZE)) == (void*) -1) {
+    // the break need not sit on a page boundary and the span must not reach
+    // below it into the heap: take a page more and round up, malloc may
+    // move the break between two sbrk calls
+    if ( (memPtr = sbrk(REFILL_SIZE + PAGE_SIZE)) == (void*) -1) {
         //perror("sbrk error: %s", strerror(errno));
         return;
     }
+    pad = (PAGE_SIZE - (size_t) memPtr % PAGE_SIZE) % PAGE_SIZE;
+    memPtr = (char*) memPtr + pad;
 
     span_ptr = new Span;
     span_ptr->pageid = (page_id_t) memPtr >> PAGE_SHIFT;
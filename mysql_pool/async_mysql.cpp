@@ -0,0 +1,311 @@
+#include "async_mysql.h"
+#include "mysql_pool.h"
+#include <iostream>
+#include <string.h>
+namespace ekko {
+
+/*
+ * 交给线程池的回调
+ */
+struct AsyncDelivery {
+  bool ok;
+  ResultSet result;
+  AsyncMysql::Callback callback;
+};
+
+static void runDelivery(void* arg) {
+  AsyncDelivery* d = (AsyncDelivery*)arg;
+  d->callback(d->ok, d->result);
+  delete d;
+}
+
+AsyncMysql::AsyncMysql(EventLoop* _loop, struct thread_pool_t* _pool)
+  : loop(_loop),
+    pool(_pool),
+    port(0),
+    client_flag(0),
+    closed(std::make_shared<bool>(false)),
+    reconnecting(0) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+AsyncMysql::~AsyncMysql() {
+  close();
+}
+
+/*
+ * 阻塞地建立一个连接，失败返回NULL
+ */
+static MYSQL* openMysql(const std::string& host, const std::string& user, const std::string& pwd,
+                        const std::string& database, unsigned int port, const std::string& unix_socket,
+                        unsigned long client_flag) {
+  MYSQL* mysql = mysql_init(NULL);
+  if (mysql == NULL) {
+    std::cerr << "init failed" << std::endl;
+    return NULL;
+  }
+  if (!mysql_real_connect(mysql, host.c_str(), user.c_str(), pwd.c_str(), database.c_str(), port,
+                          unix_socket.empty() ? NULL : unix_socket.c_str(), client_flag)) {
+    std::cerr << mysql_error(mysql) << std::endl;
+    mysql_close(mysql);
+    return NULL;
+  }
+  return mysql;
+}
+
+bool AsyncMysql::connect(const char*   mysqlhost,
+                         const char*   mysqluser,
+                         const char*   mysqlpwd,
+                         const char*   databasename,
+                         unsigned int  _port,
+                         const char*   socket,
+                         unsigned long _client_flag,
+                         unsigned int  count) {
+  host = mysqlhost ? mysqlhost : "";
+  user = mysqluser ? mysqluser : "";
+  pwd = mysqlpwd ? mysqlpwd : "";
+  database = databasename ? databasename : "";
+  port = _port;
+  unix_socket = socket ? socket : "";
+  client_flag = _client_flag;
+  bool ok = true;
+  for (unsigned int i = 0; i < count; i++) {
+    Connection* conn = newConnection();
+    if (conn == NULL) {
+      ok = false;
+      break;
+    }
+    connections.push_back(conn);
+    idle.push_back(conn);
+  }
+  stats.connections = connections.size();
+  return ok;
+}
+
+AsyncMysql::Connection* AsyncMysql::newConnection() {
+  MYSQL* mysql = openMysql(host, user, pwd, database, port, unix_socket, client_flag);
+  if (mysql == NULL)
+    return NULL;
+  Connection* conn = new Connection;
+  conn->owner = this;
+  conn->mysql = mysql;
+  conn->fd = -1;
+  conn->state = IDLE;
+  if (!watch(conn)) {
+    mysql_close(mysql);
+    delete conn;
+    return NULL;
+  }
+  return conn;
+}
+
+/*
+ * 连接的socket在MYSQL结构的net.fd中。读写两个方向都注册(边沿触发)，
+ * 非阻塞接口不告诉我们它在等哪个方向，有事件就推进一次。
+ */
+bool AsyncMysql::watch(Connection* conn) {
+  conn->fd = conn->mysql->net.fd;
+  if (loop->AddFd(conn->fd, EPOLLIN | EPOLLOUT, conn) != 0) {
+    conn->fd = -1;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * 先让还没跑的重连定时器和回调作废，等线程池里正在重连的做完，才能删连接。
+ * 执行到一半的查询和排队的一样以失败回调，回调在连接都删掉以后调用。
+ */
+void AsyncMysql::close() {
+  *closed = true;
+  closed = std::make_shared<bool>(false);         //close以后还可以再connect
+  {
+    std::unique_lock<std::mutex> guard(reconnect_lock);
+    reconnect_cond.wait(guard, [this]() { return reconnecting == 0; });
+  }
+  std::vector<Callback> callbacks;
+  for (size_t i = 0; i < connections.size(); i++) {
+    Connection* conn = connections[i];
+    if (conn->state == QUERYING || conn->state == STORING)
+      callbacks.push_back(std::move(conn->callback));
+    if (conn->fd >= 0)
+      loop->DelFd(conn->fd);
+    if (conn->mysql)
+      mysql_close(conn->mysql);
+    delete conn;
+  }
+  connections.clear();
+  idle.clear();
+  stats.connections = 0;
+  stats.busy = 0;
+  while (!queue.empty()) {
+    callbacks.push_back(std::move(queue.front().callback));
+    queue.pop_front();
+  }
+  stats.queued = 0;
+  stats.failed += callbacks.size();
+  for (size_t i = 0; i < callbacks.size(); i++) {
+    ResultSet empty;
+    callbacks[i](false, empty);
+  }
+}
+
+/*
+ * 可以在任何线程调用，查询交给事件循环线程
+ */
+void AsyncMysql::query(const std::string& sql, const Callback& callback) {
+  Pending pending;
+  pending.sql = sql;
+  pending.callback = callback;
+  loop->RunInLoop([this, pending]() mutable { submit(pending); });
+}
+
+void AsyncMysql::submit(Pending& pending) {
+  stats.submitted++;
+  if (connections.empty()) {
+    stats.failed++;
+    ResultSet empty;
+    pending.callback(false, empty);
+    return;
+  }
+  queue.push_back(std::move(pending));
+  stats.queued = queue.size();
+  if (!idle.empty()) {
+    Connection* conn = idle.back();
+    idle.pop_back();
+    start(conn);
+  }
+}
+
+/*
+ * 连接空下来了：有排队的查询就开始执行，没有就放回空闲列表
+ */
+void AsyncMysql::start(Connection* conn) {
+  if (queue.empty()) {
+    conn->state = IDLE;
+    idle.push_back(conn);
+    return;
+  }
+  conn->sql = std::move(queue.front().sql);
+  conn->callback = std::move(queue.front().callback);
+  queue.pop_front();
+  stats.queued = queue.size();
+  stats.busy++;
+  conn->state = QUERYING;
+  advance(conn);
+}
+
+void AsyncMysql::Connection::HandleEvent(uint32_t) {
+  owner->advance(this);
+}
+
+/*
+ * 调到返回NET_ASYNC_NOT_READY为止，说明socket上暂时没有可读写的了，等下一次事件。
+ * 发完查询接着读结果，中间不用等事件。
+ */
+void AsyncMysql::advance(Connection* conn) {
+  if (conn->state == QUERYING) {
+    net_async_status status = mysql_real_query_nonblocking(conn->mysql, conn->sql.data(), conn->sql.size());
+    if (status == NET_ASYNC_NOT_READY)
+      return;
+    if (status == NET_ASYNC_ERROR) {
+      fail(conn);
+      return;
+    }
+    conn->state = STORING;
+  }
+  if (conn->state == STORING) {
+    MYSQL_RES* res = NULL;
+    net_async_status status = mysql_store_result_nonblocking(conn->mysql, &res);
+    if (status == NET_ASYNC_NOT_READY)
+      return;
+    if (status == NET_ASYNC_ERROR || (res == NULL && mysql_field_count(conn->mysql) != 0)) {
+      fail(conn);
+      return;
+    }
+    complete(conn, res, true);
+  }
+}
+
+/*
+ * 结果在事件循环线程上拷贝到ResultSet并释放，MYSQL_RES不离开连接所在的线程；
+ * 连接马上接着跑下一个查询，回调交给线程池。
+ */
+void AsyncMysql::complete(Connection* conn, MYSQL_RES* res, bool ok) {
+  AsyncDelivery* d = new AsyncDelivery;
+  d->ok = ok;
+  d->callback = std::move(conn->callback);
+  if (res != NULL) {
+    d->ok = MysqlPool::storeResult(res, d->result);
+    mysql_free_result(res);
+  } else if (ok) {
+    d->result.setAffectedRows(mysql_affected_rows(conn->mysql));
+    d->result.setInsertId(mysql_insert_id(conn->mysql));
+  }
+  if (d->ok)
+    stats.completed++;
+  else
+    stats.failed++;
+  stats.busy--;
+  if (conn->state != CONNECTING)
+    start(conn);
+  if (pool == NULL || thread_pool_push_task(pool, runDelivery, d) != 0)
+    runDelivery(d);
+}
+
+/*
+ * 查询失败以失败回调。连接断了的话在线程池里重连(没有线程池就在这里阻塞地重连)，
+ * 重连失败过一秒再试；重连期间这个连接不接查询，排队的查询由别的连接跑。
+ */
+void AsyncMysql::fail(Connection* conn) {
+  unsigned int err = mysql_errno(conn->mysql);
+  std::cerr << mysql_error(conn->mysql) << std::endl;
+  bool lost = err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+  if (lost)
+    conn->state = CONNECTING;                     //complete不会在它上面开始下一个查询
+  complete(conn, NULL, false);
+  if (lost)
+    reconnect(conn);
+}
+
+void AsyncMysql::reconnect(Connection* conn) {
+  conn->state = CONNECTING;
+  if (conn->fd >= 0) {
+    loop->DelFd(conn->fd);
+    conn->fd = -1;
+  }
+  if (conn->mysql) {
+    mysql_close(conn->mysql);
+    conn->mysql = NULL;
+  }
+  std::shared_ptr<bool> token = closed;
+  EventLoop::Task work = [this, conn]() {
+    MYSQL* mysql = openMysql(host, user, pwd, database, port, unix_socket, client_flag);
+    std::lock_guard<std::mutex> guard(reconnect_lock);
+    conn->mysql = mysql;
+    reconnecting--;
+    reconnect_cond.notify_all();
+  };
+  EventLoop::Task resume = [this, conn, token]() {
+    if (*token)
+      return;                                     //已经close了，conn已经删掉
+    if (conn->mysql == NULL || !watch(conn)) {
+      loop->RunAfter(1000, [this, conn, token]() {
+        if (!*token)
+          reconnect(conn);
+      });
+      return;
+    }
+    stats.reconnects++;
+    start(conn);
+  };
+  reconnect_lock.lock();
+  reconnecting++;
+  reconnect_lock.unlock();
+  if (pool == NULL || loop->Offload(pool, work, resume) != 0) {
+    work();
+    resume();
+  }
+}
+
+}
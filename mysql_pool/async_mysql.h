@@ -0,0 +1,116 @@
+#ifndef ASYNCMYSQL_H
+#define ASYNCMYSQL_H
+
+#include <mysql/mysql.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "event_loop.h"
+#include "result_set.h"
+#include "thread_pool.h"
+
+namespace ekko{
+
+/*
+ * AsyncMysql的统计，都是在事件循环线程上更新的
+ */
+struct AsyncMysqlStats {
+  uint64_t submitted;                             //提交的查询数
+  uint64_t completed;                             //成功的查询数
+  uint64_t failed;                                //失败的查询数
+  uint64_t reconnects;                            //断线后重连的次数
+  unsigned int connections;                       //连接数
+  unsigned int busy;                              //正在执行查询的连接数
+  size_t queued;                                  //等空闲连接的查询数
+};
+
+/*
+ * 非阻塞的MySQL查询，用MySQL 8.0.16以后客户端的非阻塞接口
+ * (mysql_real_query_nonblocking、mysql_store_result_nonblocking)，
+ * 连接的socket注册在一个EventLoop里，一个线程同时推进所有连接上的查询。
+ * 一个连接同一时间只能跑一个查询，连接都忙时查询在队列里排队，
+ * 所以同时在跑的查询数就是连接数，和线程数无关。
+ * 结果拷贝到ResultSet、调用回调都在线程池里做，没有线程池时在事件循环线程上做。
+ * query可以在任何线程调用；connect、close要在事件循环开始前、结束后调用。
+ */
+class AsyncMysql {
+  public:
+    typedef std::function<void(bool ok, ResultSet& result)> Callback; //失败时result为空
+
+    AsyncMysql(EventLoop* loop, struct thread_pool_t* pool = NULL);
+    ~AsyncMysql();
+    AsyncMysql(const AsyncMysql&) = delete;
+    AsyncMysql& operator=(const AsyncMysql&) = delete;
+
+    bool connect(const char*   mysqlhost,
+                 const char*   mysqluser,
+                 const char*   mysqlpwd,
+                 const char*   databasename,
+                 unsigned int  port,
+                 const char*   socket,
+                 unsigned long client_flag,
+                 unsigned int  connections);      //建好connections个连接(阻塞)，全部成功返回true
+    void close();                                 //关掉所有连接，执行中的和排队的查询以失败回调
+    void query(const std::string& sql, const Callback& callback); //提交查询，完成时回调
+    AsyncMysqlStats getStats() const { return stats; } //在事件循环线程上调用
+
+  private:
+    enum State {
+      IDLE,
+      QUERYING,                                   //发送查询、等待结果的状态
+      STORING,                                    //读取结果集
+      CONNECTING,                                 //断线后在线程池里重连
+    };
+
+    struct Connection : public IoHandler {
+      AsyncMysql* owner;
+      MYSQL* mysql;
+      int fd;
+      State state;
+      std::string sql;                            //正在执行的查询
+      Callback callback;
+
+      void HandleEvent(uint32_t events) override;
+    };
+
+    struct Pending {
+      std::string sql;
+      Callback callback;
+    };
+
+    Connection* newConnection();                  //阻塞地建一个连接
+    bool watch(Connection* conn);                 //把连接的socket注册到事件循环
+    void submit(Pending& pending);                //事件循环线程上
+    void start(Connection* conn);                 //在空闲连接上开始下一个查询
+    void advance(Connection* conn);               //socket可读写时推进查询
+    void complete(Connection* conn, MYSQL_RES* res, bool ok); //查询结束，交出结果
+    void fail(Connection* conn);                  //查询出错，断线的话重连
+    void reconnect(Connection* conn);             //在线程池里重连，好了再接查询
+
+  private:
+    EventLoop* loop;
+    struct thread_pool_t* pool;
+    std::string host;
+    std::string user;
+    std::string pwd;
+    std::string database;
+    unsigned int port;
+    std::string unix_socket;
+    unsigned long client_flag;
+    std::vector<Connection*> connections;
+    std::vector<Connection*> idle;                //空闲的连接
+    std::deque<Pending> queue;                    //等空闲连接的查询
+    AsyncMysqlStats stats;
+    std::shared_ptr<bool> closed;                 //重连的定时器和回调拿着它，close以后为true，什么都不做
+    std::mutex reconnect_lock;                    //保护下面的，和线程池里重连写的conn->mysql
+    std::condition_variable reconnect_cond;
+    unsigned int reconnecting;                    //在线程池里重连的连接数，close等它们做完
+};
+
+}
+#endif
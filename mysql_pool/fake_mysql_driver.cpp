@@ -0,0 +1,262 @@
+#include "fake_mysql_driver.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <ctype.h>
+#include <string.h>
+namespace ekko {
+
+/*
+ * 每个线程一个随机数发生器，取样不加锁
+ */
+static std::mt19937_64& threadRng() {
+  static thread_local std::mt19937_64 rng(std::random_device{}());
+  return rng;
+}
+
+static bool chance(double rate) {
+  return rate > 0 && std::uniform_real_distribution<double>(0, 1)(threadRng()) < rate;
+}
+
+FakeLatency FakeLatency::fixed(uint64_t us) {
+  FakeLatency l;
+  l.a = us;
+  return l;
+}
+
+FakeLatency FakeLatency::uniform(uint64_t min_us, uint64_t max_us) {
+  FakeLatency l;
+  l.kind = UNIFORM;
+  l.a = min_us;
+  l.b = max_us;
+  return l;
+}
+
+FakeLatency FakeLatency::exponential(uint64_t mean_us) {
+  FakeLatency l;
+  l.kind = EXPONENTIAL;
+  l.a = mean_us;
+  return l;
+}
+
+FakeLatency FakeLatency::lognormal(uint64_t median_us, double sigma) {
+  FakeLatency l;
+  l.kind = LOGNORMAL;
+  l.a = median_us;
+  l.b = sigma;
+  return l;
+}
+
+FakeLatency FakeLatency::withTail(double rate, uint64_t us) const {
+  FakeLatency l = *this;
+  l.tail_rate = rate;
+  l.tail_us = us;
+  return l;
+}
+
+uint64_t FakeLatency::sample(std::mt19937_64& rng) const {
+  double us = a;
+  switch (kind) {
+    case FIXED:
+      break;
+    case UNIFORM:
+      us = b > a ? std::uniform_real_distribution<double>(a, b)(rng) : a;
+      break;
+    case EXPONENTIAL:
+      us = a > 0 ? std::exponential_distribution<double>(1 / a)(rng) : 0;
+      break;
+    case LOGNORMAL:
+      us = a > 0 ? std::lognormal_distribution<double>(std::log(a), b)(rng) : 0;
+      break;
+  }
+  if (tail_rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < tail_rate)
+    us += tail_us;
+  return (uint64_t)us;
+}
+
+/*
+ * 模拟的一个连接。断掉以后(执行中断掉，或者驱动setDown过)所有操作都失败。
+ */
+class FakeMysqlConnection : public MysqlDriverConnection {
+  public:
+    FakeMysqlConnection(FakeMysqlDriver* _driver, unsigned long _thread_id)
+      : driver(_driver), epoch(_driver->epoch), thread_id(_thread_id), lost(false), error(0), message("") {}
+    ~FakeMysqlConnection() { driver->closed(); }
+
+    bool query(const char* sql, ResultSet& result) override;
+    bool ping() override;
+    unsigned int errorCode() override { return error; }
+    const char* errorMessage() override { return message; }
+    unsigned long threadId() override { return thread_id; }
+
+  private:
+    bool alive();                                 //断了的话设好错误
+
+  private:
+    FakeMysqlDriver* driver;
+    uint64_t epoch;
+    unsigned long thread_id;
+    bool lost;
+    unsigned int error;
+    const char* message;
+};
+
+bool FakeMysqlConnection::alive() {
+  error = 0;
+  message = "";
+  if (!lost && epoch == driver->epoch)
+    return true;
+  error = CR_SERVER_GONE_ERROR;
+  message = "MySQL server has gone away";
+  return false;
+}
+
+bool FakeMysqlConnection::query(const char* sql, ResultSet& result) {
+  result.clear();
+  if (!alive())
+    return false;
+  const FakeMysqlRule* rule = driver->match(sql);
+  driver->enter();
+  driver->delay(rule && rule->has_latency ? rule->latency : driver->query_latency);
+  driver->leave();
+  bool ok = false;
+  if (chance(driver->lost_rate) || epoch != driver->epoch) {
+    lost = true;
+    error = CR_SERVER_LOST;
+    message = "Lost connection to MySQL server during query";
+  } else if (rule && chance(rule->error_rate)) {
+    error = rule->error;
+    message = "injected error";
+  } else {
+    if (rule)
+      result = rule->result;
+    ok = true;
+  }
+  std::lock_guard<std::mutex> guard(driver->lock);
+  driver->stats.queries++;
+  if (lost)
+    driver->stats.lost++;
+  else if (!ok)
+    driver->stats.errors++;
+  return ok;
+}
+
+bool FakeMysqlConnection::ping() {
+  bool ok = alive();
+  if (ok)
+    driver->delay(driver->ping_latency);
+  std::lock_guard<std::mutex> guard(driver->lock);
+  driver->stats.pings++;
+  if (!ok)
+    driver->stats.ping_failed++;
+  return ok;
+}
+
+FakeMysqlDriver::FakeMysqlDriver()
+  : max_connections(0),
+    connect_fail_rate(0),
+    lost_rate(0),
+    down(false),
+    epoch(0),
+    next_thread_id(1),
+    capacity(0) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+MysqlDriverConnection* FakeMysqlDriver::connect(const char*, const char*, const char*, const char*, unsigned int,
+                                                const char*, unsigned long) {
+  delay(connect_latency);
+  std::lock_guard<std::mutex> guard(lock);
+  if (down || chance(connect_fail_rate) || (max_connections > 0 && stats.open >= max_connections)) {
+    stats.connect_failed++;
+    return NULL;
+  }
+  stats.connects++;
+  stats.open++;
+  stats.max_open = std::max(stats.max_open, stats.open);
+  return new FakeMysqlConnection(this, next_thread_id++);
+}
+
+void FakeMysqlDriver::addResult(const std::string& prefix, const ResultSet& result) {
+  FakeMysqlRule rule;
+  rule.prefix = prefix;
+  rule.result = result;
+  rules.push_back(rule);
+}
+
+const FakeMysqlRule* FakeMysqlDriver::match(const char* sql) const {
+  while (isspace((unsigned char)*sql))
+    sql++;
+  for (size_t i = 0; i < rules.size(); i++) {
+    if (strncasecmp(sql, rules[i].prefix.c_str(), rules[i].prefix.size()) == 0)
+      return &rules[i];
+  }
+  return NULL;
+}
+
+void FakeMysqlDriver::delay(const FakeLatency& latency) {
+  uint64_t us = latency.sample(threadRng());
+  if (us > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+/*
+ * 有空的名额并且没有人排队就直接执行，否则排到队尾，由leave按先后交给名额
+ */
+void FakeMysqlDriver::enter() {
+  std::unique_lock<std::mutex> guard(lock);
+  if (queue.empty() && (capacity == 0 || stats.running < capacity)) {
+    stats.running++;
+  } else {
+    Waiter w;
+    w.admitted = false;
+    queue.push_back(&w);
+    while (!w.admitted)
+      w.cond.wait(guard);
+  }
+  stats.max_running = std::max(stats.max_running, stats.running);
+}
+
+void FakeMysqlDriver::leave() {
+  std::lock_guard<std::mutex> guard(lock);
+  stats.running--;
+  admit();
+}
+
+void FakeMysqlDriver::admit() {
+  while (!queue.empty() && (capacity == 0 || stats.running < capacity)) {
+    Waiter* w = queue.front();
+    queue.pop_front();
+    w->admitted = true;
+    stats.running++;
+    w->cond.notify_one();
+  }
+}
+
+void FakeMysqlDriver::closed() {
+  std::lock_guard<std::mutex> guard(lock);
+  stats.open--;
+}
+/*
+ * 宕机时已有的连接全部作废，恢复以后也不会再好，和真的服务端重启一样
+ */
+void FakeMysqlDriver::setDown(bool _down) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (_down && !down)
+    epoch++;
+  down = _down;
+}
+
+void FakeMysqlDriver::setCapacity(unsigned int n) {
+  std::lock_guard<std::mutex> guard(lock);
+  capacity = n;
+  admit();
+}
+
+FakeMysqlStats FakeMysqlDriver::getStats() {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
+}
+
+}
@@ -0,0 +1,141 @@
+#ifndef FAKEMYSQLDRIVER_H
+#define FAKEMYSQLDRIVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include "mysql_driver.h"
+
+namespace ekko{
+
+/*
+ * 模拟的延迟分布，单位微秒。sample在调用者的线程上取一个值。
+ * 例如：FakeLatency::lognormal(300, 0.5).withTail(0.001, 50000)
+ * 是中位数300us的对数正态分布，另有千分之一的请求多等50ms。
+ */
+struct FakeLatency {
+  enum Kind { FIXED, UNIFORM, EXPONENTIAL, LOGNORMAL };
+
+  Kind kind;
+  double a, b;                                    //FIXED: a；UNIFORM: [a, b)；EXPONENTIAL: 均值a；LOGNORMAL: 中位数a，sigma为b
+  double tail_rate;                               //多等tail_us的请求的比例
+  uint64_t tail_us;
+
+  FakeLatency() : kind(FIXED), a(0), b(0), tail_rate(0), tail_us(0) {}
+  static FakeLatency fixed(uint64_t us);
+  static FakeLatency uniform(uint64_t min_us, uint64_t max_us);
+  static FakeLatency exponential(uint64_t mean_us);
+  static FakeLatency lognormal(uint64_t median_us, double sigma);
+  FakeLatency withTail(double rate, uint64_t us) const;
+  uint64_t sample(std::mt19937_64& rng) const;
+};
+
+/*
+ * SQL以prefix开头的语句的返回，按加入的顺序匹配第一条，空串匹配所有语句。
+ * 没有匹配的语句返回没有列的结果，affectedRows为0。
+ */
+struct FakeMysqlRule {
+  std::string prefix;                             //不区分大小写，开头的空白不算
+  ResultSet result;                               //返回的结果；没有列时为写语句的结果
+  bool has_latency;                               //用latency，不然用驱动的query延迟
+  FakeLatency latency;
+  double error_rate;                              //返回服务端错误的比例，连接还能用
+  unsigned int error;                             //返回的错误码
+
+  FakeMysqlRule() : has_latency(false), error_rate(0), error(ER_LOCK_DEADLOCK) {}
+};
+
+/*
+ * FakeMysqlDriver的统计，getStats时的快照
+ */
+struct FakeMysqlStats {
+  uint64_t connects;                              //连上的次数
+  uint64_t connect_failed;                        //连接失败的次数
+  uint64_t queries;                               //执行的语句数，包括失败的
+  uint64_t errors;                                //注入的服务端错误数
+  uint64_t lost;                                  //执行中断掉的连接数
+  uint64_t pings;
+  uint64_t ping_failed;
+  unsigned int open;                              //当前的连接数
+  unsigned int max_open;                          //同时最多的连接数
+  unsigned int running;                           //当前正在执行的语句数
+  unsigned int max_running;                       //同时最多执行的语句数
+};
+
+/*
+ * 进程内模拟的MySQL，没有网络，也不解析SQL，用来在任何机器上压测和测试连接池本身：
+ * 排队、等待、健康检查、缓存。
+ * 连接、语句、ping的耗时按给定的分布sleep；语句的结果按规则返回事先准备好的ResultSet。
+ * 可以注入的故障：
+ *   连接失败的比例；超过最大连接数拒绝连接(ER_CON_COUNT_ERROR)；
+ *   语句返回服务端错误的比例(按规则)；语句执行中连接断掉的比例(CR_SERVER_LOST，之后这个连接一直不能用)；
+ *   setDown(true)模拟服务端宕机：已有的连接全部断掉，新的连不上，直到setDown(false)。
+ * setCapacity模拟服务端的并发能力：同时执行的语句超过这么多时后来的按先后排队，0为不限。
+ * 规则和延迟要在连接池开始用之前设置好；故障比例、setDown、setCapacity可以随时改。
+ * 例如：
+ *   FakeMysqlDriver fake;
+ *   fake.setQueryLatency(FakeLatency::lognormal(300, 0.5));
+ *   fake.addResult("select", rows);
+ *   pool->setDriver(&fake);
+ */
+class FakeMysqlDriver : public MysqlDriver {
+  public:
+    FakeMysqlDriver();                            //要比用它的连接池活得久
+    FakeMysqlDriver(const FakeMysqlDriver&) = delete;
+    FakeMysqlDriver& operator=(const FakeMysqlDriver&) = delete;
+
+    MysqlDriverConnection* connect(const char* host, const char* user, const char* pwd, const char* databasename,
+                                   unsigned int port, const char* socket, unsigned long client_flag) override;
+
+    void setConnectLatency(const FakeLatency& latency) { connect_latency = latency; }
+    void setQueryLatency(const FakeLatency& latency) { query_latency = latency; }
+    void setPingLatency(const FakeLatency& latency) { ping_latency = latency; }
+    void addRule(const FakeMysqlRule& rule) { rules.push_back(rule); }
+    void addResult(const std::string& prefix, const ResultSet& result); //以prefix开头的语句返回result
+    void setMaxConnections(unsigned int n) { max_connections = n; } //0为不限
+    void setConnectFailRate(double rate) { connect_fail_rate = rate; }
+    void setLostRate(double rate) { lost_rate = rate; }
+    void setDown(bool down);
+    void setCapacity(unsigned int n);
+    FakeMysqlStats getStats();
+
+  private:
+    friend class FakeMysqlConnection;
+    struct Waiter {
+      std::condition_variable cond;
+      bool admitted;                              //名额已经交过来了
+    };
+
+    const FakeMysqlRule* match(const char* sql) const;
+    void delay(const FakeLatency& latency);       //按分布sleep
+    void enter();                                 //占一个执行的名额，满了就等
+    void leave();
+    void admit();                                 //空出来的名额交给排在前面的；要持有lock
+    void closed();                                //一个连接关掉了
+
+  private:
+    FakeLatency connect_latency;
+    FakeLatency query_latency;
+    FakeLatency ping_latency;
+    std::vector<FakeMysqlRule> rules;
+    unsigned int max_connections;
+    std::atomic<double> connect_fail_rate;
+    std::atomic<double> lost_rate;
+    std::atomic<bool> down;
+    std::atomic<uint64_t> epoch;                  //setDown(true)一次加一，之前的连接都断了
+    std::atomic<unsigned long> next_thread_id;
+    std::mutex lock;                              //保护下面的
+    unsigned int capacity;
+    std::deque<Waiter*> queue;                    //排队等执行的语句，队头来得最早
+    FakeMysqlStats stats;
+};
+
+}
+#endif
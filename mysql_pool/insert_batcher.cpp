@@ -0,0 +1,129 @@
+#include "insert_batcher.h"
+#include <chrono>
+#include <string.h>
+namespace ekko {
+
+InsertBatcher::InsertBatcher(MysqlPool* _pool, const std::string& insert, unsigned int _max_rows,
+                             unsigned int _window_us)
+  : pool(_pool),
+    insert_sql(insert),
+    max_rows(_max_rows > 0 ? _max_rows : 1),
+    window_us(_window_us),
+    open(NULL) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ * 没有正在凑行的批就开一批，自己当头；否则加到那一批里，等头执行完。
+ * 凑满了马上叫醒头，不用等到窗口结束。
+ */
+bool InsertBatcher::insert(const SqlParam* values, size_t count, uint64_t* insert_id) {
+  std::unique_lock<std::mutex> guard(lock);
+  Batch* batch = open;
+  bool leader = batch == NULL;
+  if (leader) {
+    batch = open = new Batch;
+    batch->refs = 0;
+    batch->done = false;
+  }
+  size_t index = batch->rows.size();
+  batch->rows.push_back(std::make_pair(values, count));
+  batch->refs++;
+  if (batch->rows.size() >= max_rows) {
+    open = NULL;
+    batch->cond.notify_all();
+  }
+  if (leader) {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(window_us);
+    batch->cond.wait_until(guard, deadline, [&]() { return open != batch; });
+    if (open == batch)
+      open = NULL;
+    stats.batches++;
+    stats.rows += batch->rows.size();
+    guard.unlock();
+    flush(batch);
+    guard.lock();
+    batch->done = true;
+    batch->cond.notify_all();
+  } else {
+    batch->cond.wait(guard, [&]() { return batch->done; });
+  }
+  bool ok = batch->ok[index];
+  if (insert_id)
+    *insert_id = batch->ids[index];
+  if (--batch->refs == 0)
+    delete batch;
+  return ok;
+}
+
+void InsertBatcher::appendRow(MYSQL* mysql, const std::pair<const SqlParam*, size_t>& row, std::string& sql) {
+  sql += '(';
+  for (size_t i = 0; i < row.second; i++) {
+    if (i > 0)
+      sql += ',';
+    row.first[i].appendLiteral(mysql, sql);
+  }
+  sql += ')';
+}
+
+/*
+ * 行拼成一条或几条(超过MYSQL_INSERT_BATCH_BYTES时)多行INSERT，在同一个连接上执行。
+ * 每行的自增id按语句第一行的id加行号算，
+ * 要求服务端给一条语句的行分配连续的id(innodb_autoinc_lock_mode为0或1，auto_increment_increment为1)。
+ */
+void InsertBatcher::flush(Batch* batch) {
+  size_t n = batch->rows.size();
+  batch->ok.assign(n, 0);
+  batch->ids.assign(n, 0);
+  PooledConnection conn = pool->acquire();
+  if (!conn)
+    return;
+  std::string sql;
+  ResultSet result;
+  uint64_t statements = 0, fallback = 0;
+  for (size_t i = 0; i < n; ) {
+    size_t begin = i;
+    sql.assign(insert_sql);
+    sql += ' ';
+    do {
+      if (i > begin)
+        sql += ',';
+      appendRow(conn.mysql(), batch->rows[i], sql);
+      i++;
+    } while (i < n && sql.size() < MYSQL_INSERT_BATCH_BYTES);
+    statements++;
+    if (conn.query(sql.c_str(), result)) {
+      for (size_t j = begin; j < i; j++) {
+        batch->ok[j] = 1;
+        batch->ids[j] = result.insertId() ? result.insertId() + (j - begin) : 0;
+      }
+      continue;
+    }
+    unsigned int err = conn.errorCode();
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+      break;
+    //整条没有写进去，逐行重试，让每行拿到自己的结果
+    for (size_t j = begin; j < i && i - begin > 1; j++) {
+      sql.assign(insert_sql);
+      sql += ' ';
+      appendRow(conn.mysql(), batch->rows[j], sql);
+      statements++;
+      fallback++;
+      if (conn.query(sql.c_str(), result)) {
+        batch->ok[j] = 1;
+        batch->ids[j] = result.insertId();
+      }
+    }
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  stats.statements += statements;
+  stats.fallback_rows += fallback;
+}
+
+InsertBatcherStats InsertBatcher::getStats() {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
+}
+
+}
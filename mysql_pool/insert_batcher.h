@@ -0,0 +1,80 @@
+#ifndef INSERTBATCHER_H
+#define INSERTBATCHER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "mysql_pool.h"
+
+#define MYSQL_INSERT_BATCH_ROWS 256               //一条多行INSERT最多的行数
+#define MYSQL_INSERT_BATCH_WINDOW_US 500          //第一行到了以后最多再等这么久凑行
+#define MYSQL_INSERT_BATCH_BYTES (1 << 20)        //一条语句超过这么长就分成几条，要小于max_allowed_packet
+
+namespace ekko{
+
+/*
+ * InsertBatcher的统计，getStats时的快照。省掉的往返次数是rows - statements。
+ */
+struct InsertBatcherStats {
+  uint64_t rows;                                  //插入的行数
+  uint64_t statements;                            //实际执行的语句数
+  uint64_t batches;                               //凑成的批数
+  uint64_t fallback_rows;                         //多行INSERT失败后逐行重试的行数
+};
+
+/*
+ * 把多个线程同时插入的单行，凑成一条多行INSERT执行，往返次数从行数降到批数。
+ * 一批中第一个到的线程当头：等到凑满max_rows行或者过了window_us，
+ * 把这一批的行拼成 "INSERT ... VALUES (...),(...)" 在一个连接上执行，
+ * 其他线程等它执行完各自拿结果。insert阻塞到自己的行写完为止，参数只需要在这期间有效。
+ * 代价是每行最多多等window_us；没有并发时只有一行，和直接执行一样，但多等了这个窗口。
+ * 多行INSERT整条失败(比如其中一行主键重复)时，对InnoDB来说一行也没有写进去，
+ * 于是逐行重试，每个线程拿到自己那一行的结果；连接断掉的不重试，不知道有没有写进去。
+ * 例如：
+ *   InsertBatcher audit(pool, "INSERT INTO audit (user_id, action) VALUES");
+ *   audit.insertRow(42, "login");
+ */
+class InsertBatcher {
+  public:
+    InsertBatcher(MysqlPool* pool, const std::string& insert,
+                  unsigned int max_rows = MYSQL_INSERT_BATCH_ROWS,
+                  unsigned int window_us = MYSQL_INSERT_BATCH_WINDOW_US); //insert为到VALUES为止的语句
+    InsertBatcher(const InsertBatcher&) = delete;
+    InsertBatcher& operator=(const InsertBatcher&) = delete;
+
+    bool insert(const SqlParam* values, size_t count, uint64_t* insert_id = NULL); //插入一行，等它写完
+    template <typename... Args>
+    bool insertRow(const Args&... args) {         //例如：insertRow(42, "login")
+      SqlParam values[sizeof...(Args) + 1] = { SqlParam(args)... };
+      return insert(values, sizeof...(Args));
+    }
+    InsertBatcherStats getStats();
+
+  private:
+    struct Batch {
+      std::condition_variable cond;
+      std::vector<std::pair<const SqlParam*, size_t> > rows;
+      std::vector<char> ok;                       //每行的结果
+      std::vector<uint64_t> ids;                  //每行的自增id
+      size_t refs;                                //还没拿走结果的线程数
+      bool done;                                  //头已经执行完了
+    };
+
+    void flush(Batch* batch);                     //执行一批，不持有锁
+    void appendRow(MYSQL* mysql, const std::pair<const SqlParam*, size_t>& row, std::string& sql);
+
+  private:
+    MysqlPool* pool;
+    std::string insert_sql;
+    unsigned int max_rows;
+    unsigned int window_us;
+    std::mutex lock;
+    Batch* open;                                  //正在凑行的一批，没有为NULL
+    InsertBatcherStats stats;                     //要持有lock
+};
+
+}
+#endif
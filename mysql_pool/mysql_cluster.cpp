@@ -0,0 +1,396 @@
+#include "mysql_cluster.h"
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+namespace ekko {
+
+static uint64_t steadyUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MysqlCluster::MysqlCluster()
+  : primary(NULL),
+    routing(MYSQL_LEAST_OUTSTANDING),
+    sticky_ms(MYSQL_STICKY_MS),
+    eject_failures(MYSQL_EJECT_FAILURES),
+    eject_base_ms(MYSQL_EJECT_BASE_MS),
+    eject_max_ms(MYSQL_EJECT_MAX_MS),
+    next(0) {}
+
+MysqlCluster::~MysqlCluster() {
+  stop();
+  if (primary) {
+    delete primary->pool;
+    delete primary;
+  }
+  for (size_t i = 0; i < replicas.size(); i++) {
+    delete replicas[i]->pool;
+    delete replicas[i];
+  }
+}
+
+MysqlCluster::Host* MysqlCluster::newHost(bool is_primary, const char* host, const char* user, const char* pwd,
+                                          const char* databasename, unsigned int port, const char* socket,
+                                          unsigned long client_flag, unsigned int max_connect) {
+  Host* h = new Host;
+  h->host = host ? host : "";
+  h->user = user ? user : "";
+  h->pwd = pwd ? pwd : "";
+  h->database = databasename ? databasename : "";
+  h->socket = socket ? socket : "";
+  h->port = port;
+  h->primary = is_primary;
+  h->outstanding = 0;
+  h->queries = 0;
+  h->failures = 0;
+  h->ejections = 0;
+  h->latency_us = 0;
+  h->consecutive_failures = 0;
+  h->ejected_until_ms = 0;
+  h->backoff_ms = eject_base_ms;
+  h->probing = false;
+  h->pool = new MysqlPool();
+  h->pool->setParameter(h->host.c_str(), h->user.c_str(), h->pwd.c_str(), h->database.c_str(), port,
+                        socket ? h->socket.c_str() : NULL, client_flag, max_connect);
+  return h;
+}
+/*
+ * 主机和参数在start之前设置好，之后不再改
+ */
+void MysqlCluster::setPrimary(const char* host, const char* user, const char* pwd, const char* databasename,
+                              unsigned int port, const char* socket, unsigned long client_flag,
+                              unsigned int max_connect) {
+  if (primary) {
+    delete primary->pool;
+    delete primary;
+  }
+  primary = newHost(true, host, user, pwd, databasename, port, socket, client_flag, max_connect);
+}
+
+void MysqlCluster::addReplica(const char* host, const char* user, const char* pwd, const char* databasename,
+                              unsigned int port, const char* socket, unsigned long client_flag,
+                              unsigned int max_connect) {
+  replicas.push_back(newHost(false, host, user, pwd, databasename, port, socket, client_flag, max_connect));
+}
+
+void MysqlCluster::setRouting(MysqlRouting _routing) {
+  std::lock_guard<std::mutex> guard(lock);
+  routing = _routing;
+}
+
+void MysqlCluster::setStickiness(uint64_t ms) {
+  std::lock_guard<std::mutex> guard(lock);
+  sticky_ms = ms;
+}
+
+/*
+ * 已经加进来的主机下次摘掉的时间也改过来，正被摘掉的限制在新的范围里
+ */
+void MysqlCluster::setEjection(unsigned int failures, uint64_t base_ms, uint64_t max_ms) {
+  std::lock_guard<std::mutex> guard(lock);
+  eject_failures = failures > 0 ? failures : 1;
+  eject_base_ms = base_ms;
+  eject_max_ms = max_ms > base_ms ? max_ms : base_ms;
+  std::vector<Host*> hosts(replicas);
+  if (primary)
+    hosts.push_back(primary);
+  for (size_t i = 0; i < hosts.size(); i++) {
+    Host* host = hosts[i];
+    if (host->consecutive_failures < eject_failures)
+      host->backoff_ms = eject_base_ms;
+    else
+      host->backoff_ms = std::min(std::max(host->backoff_ms, eject_base_ms), eject_max_ms);
+  }
+}
+/*
+ * 连不上的主机不影响别的主机启动，请求来了按失败算，够了就摘掉
+ */
+bool MysqlCluster::start() {
+  bool ok = true;
+  std::vector<Host*> hosts(replicas);
+  if (primary)
+    hosts.insert(hosts.begin(), primary);
+  for (size_t i = 0; i < hosts.size(); i++) {
+    if (!hosts[i]->pool->start())
+      ok = false;
+  }
+  return ok;
+}
+
+void MysqlCluster::stop() {
+  if (primary)
+    primary->pool->stop();
+  for (size_t i = 0; i < replicas.size(); i++)
+    replicas[i]->pool->stop();
+}
+
+MysqlSession& MysqlCluster::sessionOf(MysqlSession* session) {
+  static thread_local MysqlSession local;
+  return session ? *session : local;
+}
+/*
+ * 把语句切成词：标识符和关键字转成小写，字符串换成一个引号，别的标点一个字符一个。
+ * 空白和注释跳过；执行的注释(斜杠星号叹号加版本号)里面是要执行的，照常切。
+ * 注释没有结束的返回false。
+ */
+static bool tokenize(const char* p, std::vector<std::string>& tokens) {
+  while (*p) {
+    unsigned char c = *p;
+    if (isspace(c)) {
+      p++;
+    } else if (c == '\'' || c == '"' || c == '`') {
+      for (p++; *p && *p != (char)c; p++) {
+        if (*p == '\\' && c != '`' && p[1])
+          p++;
+      }
+      if (*p)
+        p++;
+      tokens.push_back(std::string(1, c));
+    } else if (p[0] == '/' && p[1] == '*' && p[2] == '!') {
+      for (p += 3; isdigit((unsigned char)*p); p++) {}
+    } else if (p[0] == '/' && p[1] == '*') {
+      p = strstr(p + 2, "*/");
+      if (p == NULL)
+        return false;
+      p += 2;
+    } else if (p[0] == '*' && p[1] == '/') {
+      p += 2;                                     //执行的注释的结尾
+    } else if (c == '#' || (p[0] == '-' && p[1] == '-' && (p[2] == 0 || isspace((unsigned char)p[2])))) {
+      p = strchr(p, '\n');
+      if (p == NULL)
+        return true;
+    } else if (isalnum(c) || c == '_' || c == '$' || c >= 0x80) {
+      std::string word;
+      for (; isalnum((unsigned char)*p) || *p == '_' || *p == '$' || (unsigned char)*p >= 0x80; p++)
+        word += tolower((unsigned char)*p);
+      tokens.push_back(word);
+    } else {
+      tokens.push_back(std::string(1, c));
+      p++;
+    }
+  }
+  return true;
+}
+/*
+ * 跳过开头的左括号，第一个词是SELECT、SHOW、DESCRIBE、DESC、EXPLAIN的是读，
+ * 但是SELECT ... FOR UPDATE、FOR SHARE、LOCK IN SHARE MODE要加锁，算写。
+ * 字符串、注释以外有分号的都不算读：后面可能跟着写，只能发给主库。
+ */
+bool MysqlCluster::isRead(const char* sql) {
+  std::vector<std::string> tokens;
+  if (!tokenize(sql, tokens))
+    return false;
+  size_t first = 0;
+  while (first < tokens.size() && tokens[first] == "(")
+    first++;
+  if (first == tokens.size() || std::find(tokens.begin(), tokens.end(), ";") != tokens.end())
+    return false;
+  const std::string& verb = tokens[first];
+  if (verb == "show" || verb == "desc" || verb == "describe" || verb == "explain")
+    return true;
+  if (verb != "select")
+    return false;
+  for (size_t i = first + 1; i < tokens.size(); i++) {
+    if (tokens[i] == "for" && i + 1 < tokens.size() && (tokens[i + 1] == "update" || tokens[i + 1] == "share"))
+      return false;
+    if (tokens[i] == "lock" && i + 3 < tokens.size() && tokens[i + 1] == "in" && tokens[i + 2] == "share" &&
+        tokens[i + 3] == "mode")
+      return false;
+  }
+  return true;
+}
+/*
+ * 没被摘掉的可以用；摘掉的时间过了，一次只放一个请求去试
+ */
+bool MysqlCluster::usable(Host* host, uint64_t now) {
+  if (host->consecutive_failures < eject_failures)
+    return true;
+  return now >= host->ejected_until_ms && !host->probing;
+}
+
+/*
+ * 摘掉的时间过了放进去试探的请求，probe置为true，只有它结束时才能放下一个
+ */
+MysqlCluster::Host* MysqlCluster::pickReplica(Host* exclude, bool* probe) {
+  *probe = false;
+  uint64_t now = steadyUs() / 1000;
+  std::lock_guard<std::mutex> guard(lock);
+  size_t n = replicas.size();
+  if (n == 0)
+    return NULL;
+  Host* best = NULL;
+  double best_score = 0;
+  size_t start = next++;
+  for (size_t i = 0; i < n; i++) {
+    Host* host = replicas[(start + i) % n];
+    if (host == exclude || !usable(host, now))
+      continue;
+    double score = host->outstanding;
+    if (routing == MYSQL_LATENCY_WEIGHTED)
+      score = (host->outstanding + 1) * (host->latency_us > 1 ? host->latency_us : 1);
+    if (best == NULL || score < best_score) {
+      best = host;
+      best_score = score;
+    }
+  }
+  if (best) {
+    best->outstanding++;
+    if (best->consecutive_failures >= eject_failures) {
+      best->probing = true;
+      *probe = true;
+    }
+  }
+  return best;
+}
+
+MysqlCluster::Host* MysqlCluster::pickPrimary() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (primary == NULL)
+    return NULL;
+  primary->outstanding++;
+  return primary;
+}
+/*
+ * 拿不到连接时，连接池里一个连接也没有才算主机的问题；有连接只是都忙，不算。
+ * 客户端错误(CR_*，连不上、断线、超时)算主机的问题，服务端返回的SQL错误不算。
+ */
+bool MysqlCluster::run(Host* host, const Operation& op, bool probe, bool* host_failed) {
+  uint64_t begin = steadyUs();
+  bool ok = false, failed = false;
+  {
+    PooledConnection conn = host->pool->acquire();
+    if (!conn) {
+      failed = host->pool->getStats().total == 0;
+    } else {
+      ok = op(conn);
+      if (!ok) {
+        unsigned int err = conn.errorCode();
+        failed = err >= CR_MIN_ERROR && err <= CR_MAX_ERROR;
+      }
+    }
+  }
+  uint64_t us = steadyUs() - begin;
+  std::lock_guard<std::mutex> guard(lock);
+  host->outstanding--;
+  host->queries++;
+  if (probe)
+    host->probing = false;                        //摘掉之前就在执行的请求结束了不算
+  if (failed) {
+    //摘掉以后还在执行的请求失败不算，只有刚到次数或者试探的请求失败才摘掉(再摘掉)
+    uint64_t now = (begin + us) / 1000;
+    host->failures++;
+    host->consecutive_failures++;
+    if (host->consecutive_failures == eject_failures ||
+        (host->consecutive_failures > eject_failures && now >= host->ejected_until_ms)) {
+      host->ejected_until_ms = now + host->backoff_ms;
+      host->backoff_ms = std::min(host->backoff_ms * 2, eject_max_ms);
+      host->ejections++;
+    }
+  } else {
+    host->consecutive_failures = 0;
+    host->backoff_ms = eject_base_ms;
+    if (ok)
+      host->latency_us = host->latency_us == 0 ? us : host->latency_us * 0.8 + us * 0.2;
+  }
+  if (host_failed)
+    *host_failed = failed;
+  return ok;
+}
+/*
+ * 刚写过的会话读主库；从库都不可用也读主库。主机的问题导致的失败换一个主机重试一次。
+ */
+bool MysqlCluster::runRead(const Operation& op, MysqlSession* session) {
+  MysqlSession& s = sessionOf(session);
+  uint64_t sticky;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    sticky = sticky_ms;
+  }
+  Host* host = NULL;
+  bool probe = false;
+  if (s.last_write_ms == 0 || steadyUs() / 1000 >= s.last_write_ms + sticky)
+    host = pickReplica(NULL, &probe);
+  if (host == NULL)
+    host = pickPrimary();
+  if (host == NULL)
+    return false;
+  bool failed = false;
+  if (run(host, op, probe, &failed))
+    return true;
+  if (!failed)
+    return false;
+  Host* other = host->primary ? NULL : pickReplica(host, &probe);
+  if (other == NULL && !host->primary)
+    other = pickPrimary();
+  if (other == NULL)
+    return false;
+  return run(other, op, probe, NULL);
+}
+/*
+ * 写只走主库，不重试：断线时不知道写进去没有
+ */
+bool MysqlCluster::runWrite(const Operation& op, MysqlSession* session) {
+  Host* host = pickPrimary();
+  if (host == NULL)
+    return false;
+  bool ok = run(host, op, false, NULL);
+  sessionOf(session).last_write_ms = steadyUs() / 1000;
+  return ok;
+}
+
+bool MysqlCluster::read(const char* sql, ResultSet& result, MysqlSession* session) {
+  result.clear();
+  return runRead([&](PooledConnection& conn) { return conn.query(sql, result); }, session);
+}
+
+bool MysqlCluster::write(const char* sql, ResultSet& result, MysqlSession* session) {
+  result.clear();
+  return runWrite([&](PooledConnection& conn) { return conn.query(sql, result); }, session);
+}
+
+bool MysqlCluster::query(const char* sql, ResultSet& result, MysqlSession* session) {
+  return isRead(sql) ? read(sql, result, session) : write(sql, result, session);
+}
+
+bool MysqlCluster::execute(const char* sql, const SqlParam* params, size_t count, ResultSet& result,
+                           MysqlSession* session) {
+  result.clear();
+  Operation op = [&](PooledConnection& conn) { return conn.execute(sql, params, count, result); };
+  return isRead(sql) ? runRead(op, session) : runWrite(op, session);
+}
+/*
+ * 连接直接从主库的连接池借，不经过健康检查和计数
+ */
+PooledConnection MysqlCluster::acquirePrimary(MysqlSession* session) {
+  if (primary == NULL)
+    return PooledConnection();
+  sessionOf(session).last_write_ms = steadyUs() / 1000;
+  return primary->pool->acquire();
+}
+
+std::vector<MysqlHostStats> MysqlCluster::getStats() {
+  std::vector<Host*> hosts(replicas);
+  if (primary)
+    hosts.insert(hosts.begin(), primary);
+  uint64_t now = steadyUs() / 1000;
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<MysqlHostStats> stats(hosts.size());
+  for (size_t i = 0; i < hosts.size(); i++) {
+    Host* host = hosts[i];
+    stats[i].host = host->host;
+    stats[i].port = host->port;
+    stats[i].primary = host->primary;
+    stats[i].healthy = host->consecutive_failures < eject_failures || now >= host->ejected_until_ms;
+    stats[i].outstanding = host->outstanding;
+    stats[i].queries = host->queries;
+    stats[i].failures = host->failures;
+    stats[i].ejections = host->ejections;
+    stats[i].latency_us = host->latency_us;
+  }
+  return stats;
+}
+
+}
@@ -0,0 +1,150 @@
+#ifndef MYSQLCLUSTER_H
+#define MYSQLCLUSTER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "mysql_pool.h"
+
+#define MYSQL_STICKY_MS 1000                      //写过以后这么久内的读还走主库，躲开复制延迟
+#define MYSQL_EJECT_FAILURES 3                    //连续失败这么多次把主机摘掉
+#define MYSQL_EJECT_BASE_MS 1000                  //第一次摘掉的时间，之后每次翻倍
+#define MYSQL_EJECT_MAX_MS 30000                  //摘掉的时间最长这么久
+
+namespace ekko{
+
+/*
+ * 读请求选从库的方式
+ */
+enum MysqlRouting {
+  MYSQL_LEAST_OUTSTANDING,                        //正在执行的请求最少的
+  MYSQL_LATENCY_WEIGHTED,                         //(正在执行的请求数+1)×平均延迟最小的
+};
+
+/*
+ * 一个调用方的会话(比如一个用户、一个请求)，记着它上次写的时间。
+ * 写过之后的一段时间里，它的读也走主库，读得到自己刚写的东西。
+ */
+struct MysqlSession {
+  uint64_t last_write_ms;
+
+  MysqlSession() : last_write_ms(0) {}
+};
+
+/*
+ * 一个主机的统计，getStats时的快照
+ */
+struct MysqlHostStats {
+  std::string host;
+  unsigned int port;
+  bool primary;
+  bool healthy;                                   //没有被摘掉
+  unsigned int outstanding;                       //正在执行的请求数
+  uint64_t queries;                               //执行过的请求数
+  uint64_t failures;                              //主机的问题(连不上、断线)导致的失败数，SQL本身的错误不算
+  uint64_t ejections;                             //被摘掉的次数
+  double latency_us;                              //成功请求的平均延迟(指数加权)
+};
+
+/*
+ * 一个主库加几个从库，每个主机一个MysqlPool。
+ * 写和事务走主库；读按MysqlRouting选一个健康的从库，没有可用的从库就走主库。
+ * query、execute按语句的第一个词分读写：SELECT(不带FOR UPDATE等锁)、SHOW、DESCRIBE、EXPLAIN是读。
+ * 一个主机连续失败MYSQL_EJECT_FAILURES次就摘掉，过一段时间放一个请求去试，
+ * 成功就恢复，失败就再摘掉、时间翻倍。读请求因为主机的问题失败时，换一个主机重试一次。
+ * 例如：
+ *   MysqlCluster cluster;
+ *   cluster.setPrimary("10.0.0.1", "app", "pwd", "db", 3306);
+ *   cluster.addReplica("10.0.0.2", "app", "pwd", "db", 3306);
+ *   cluster.start();
+ *   cluster.query("select * from t where id = 1", rs, &session);
+ */
+class MysqlCluster {
+  public:
+    MysqlCluster();
+    ~MysqlCluster();
+    MysqlCluster(const MysqlCluster&) = delete;
+    MysqlCluster& operator=(const MysqlCluster&) = delete;
+
+    void setPrimary(const char*   host,
+                    const char*   user,
+                    const char*   pwd,
+                    const char*   databasename,
+                    unsigned int  port = 0,
+                    const char*   socket = NULL,
+                    unsigned long client_flag = 0,
+                    unsigned int  max_connect = 50);
+    void addReplica(const char*   host,
+                    const char*   user,
+                    const char*   pwd,
+                    const char*   databasename,
+                    unsigned int  port = 0,
+                    const char*   socket = NULL,
+                    unsigned long client_flag = 0,
+                    unsigned int  max_connect = 50);
+    MysqlPool* primaryPool() { return primary ? primary->pool : NULL; } //设置连接池的其他参数用
+    MysqlPool* replicaPool(size_t i) { return replicas[i]->pool; }
+    size_t replicaCount() const { return replicas.size(); }
+    void setRouting(MysqlRouting routing);
+    void setStickiness(uint64_t ms);              //0为写过以后不粘在主库
+    void setEjection(unsigned int failures, uint64_t base_ms, uint64_t max_ms);
+    bool start();                                 //每个连接池start，全部成功返回true
+    void stop();
+
+    bool query(const char* sql, ResultSet& result, MysqlSession* session = NULL); //按语句分读写
+    bool execute(const char* sql, const SqlParam* params, size_t count, ResultSet& result,
+                 MysqlSession* session = NULL);
+    bool read(const char* sql, ResultSet& result, MysqlSession* session = NULL);  //当作读
+    bool write(const char* sql, ResultSet& result, MysqlSession* session = NULL); //当作写，走主库
+    PooledConnection acquirePrimary(MysqlSession* session = NULL); //事务用，算作写
+    std::vector<MysqlHostStats> getStats();
+    static bool isRead(const char* sql);          //语句是不是只读的
+
+  private:
+    struct Host {
+      MysqlPool* pool;
+      std::string host;                           //MysqlPool只存指针，参数放在这里
+      std::string user;
+      std::string pwd;
+      std::string database;
+      std::string socket;
+      unsigned int port;
+      bool primary;
+      unsigned int outstanding;
+      uint64_t queries;
+      uint64_t failures;
+      uint64_t ejections;
+      double latency_us;
+      unsigned int consecutive_failures;
+      uint64_t ejected_until_ms;                  //在这之前不用它
+      uint64_t backoff_ms;                        //下次摘掉多久
+      bool probing;                               //摘掉的时间过了，正放一个请求去试
+    };
+    typedef std::function<bool(PooledConnection& conn)> Operation;
+
+    Host* newHost(bool primary, const char* host, const char* user, const char* pwd, const char* databasename,
+                  unsigned int port, const char* socket, unsigned long client_flag, unsigned int max_connect);
+    bool usable(Host* host, uint64_t now);        //要持有lock
+    Host* pickReplica(Host* exclude, bool* probe); //选一个从库，计入outstanding；没有可用的返回NULL；probe为是不是试探的请求
+    Host* pickPrimary();
+    bool run(Host* host, const Operation& op, bool probe, bool* host_failed); //在host上执行，更新它的健康状态
+    bool runRead(const Operation& op, MysqlSession* session);
+    bool runWrite(const Operation& op, MysqlSession* session);
+    static MysqlSession& sessionOf(MysqlSession* session); //NULL用本线程的会话
+
+  private:
+    Host* primary;
+    std::vector<Host*> replicas;
+    MysqlRouting routing;
+    uint64_t sticky_ms;
+    unsigned int eject_failures;
+    uint64_t eject_base_ms;
+    uint64_t eject_max_ms;
+    size_t next;                                  //轮转选择的起点，打散平局
+    std::mutex lock;                              //保护各个Host的状态
+};
+
+}
+#endif
@@ -0,0 +1,66 @@
+#include "mysql_driver.h"
+#include "mysql_pool.h"
+namespace ekko {
+
+/*
+ * libmysqlclient的一个连接，就是原来连接池里直接用MYSQL*做的那些事
+ */
+class LibMysqlConnection : public MysqlDriverConnection {
+  public:
+    explicit LibMysqlConnection(MYSQL* _mysql) : conn(_mysql) {}
+    ~LibMysqlConnection() { mysql_close(conn); }
+
+    bool query(const char* sql, ResultSet& result) override;
+    bool ping() override { return mysql_ping(conn) == 0; }
+    unsigned int errorCode() override { return mysql_errno(conn); }
+    const char* errorMessage() override { return mysql_error(conn); }
+    unsigned long threadId() override { return mysql_thread_id(conn); }
+    MYSQL* mysql() override { return conn; }
+
+  private:
+    MYSQL* conn;
+};
+
+bool LibMysqlConnection::query(const char* sql, ResultSet& result) {
+  result.clear();
+  if (mysql_query(conn, sql) != 0) {
+    std::cerr << mysql_error(conn) << std::endl;
+    return false;
+  }
+  MYSQL_RES* res = mysql_store_result(conn);
+  if (res) {
+    bool ok = MysqlPool::storeResult(res, result);
+    mysql_free_result(res);
+    return ok;
+  }
+  if (mysql_field_count(conn) != 0) {
+    std::cerr << mysql_error(conn) << std::endl;
+    return false;
+  }
+  result.setAffectedRows(mysql_affected_rows(conn));
+  result.setInsertId(mysql_insert_id(conn));
+  return true;
+}
+
+MysqlDriverConnection* LibMysqlDriver::connect(const char* host, const char* user, const char* pwd,
+                                               const char* databasename, unsigned int port, const char* socket,
+                                               unsigned long client_flag) {
+  MYSQL* conn = mysql_init(NULL);
+  if (conn == NULL) {
+    std::cerr << "init failed" << std::endl;
+    return NULL;
+  }
+  if (!mysql_real_connect(conn, host, user, pwd, databasename, port, socket, client_flag)) {
+    std::cout << mysql_error(conn) << std::endl;
+    mysql_close(conn);
+    return NULL;
+  }
+  return new LibMysqlConnection(conn);
+}
+
+LibMysqlDriver* LibMysqlDriver::instance() {
+  static LibMysqlDriver driver;
+  return &driver;
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef MYSQLDRIVER_H
+#define MYSQLDRIVER_H
+
+#include <mysql/mysql.h>
+#include "result_set.h"
+
+namespace ekko{
+
+/*
+ * 驱动建立的一个数据库连接。连接池只通过它连接、检查、执行SQL文本，
+ * 所以换一个驱动(比如FakeMysqlDriver)就能在没有MySQL的机器上跑连接池。
+ * 预处理语句在没有MYSQL句柄的连接上拼成SQL文本执行；batch、流式读取要用libmysqlclient的连接。
+ * 一个连接同一时间只在一个线程上用。
+ */
+class MysqlDriverConnection {
+  public:
+    virtual ~MysqlDriverConnection() {}           //关掉连接
+
+    virtual bool query(const char* sql, ResultSet& result) = 0; //同PooledConnection::query；失败后errorCode不为0
+    virtual bool ping() = 0;                      //连接还能用返回true
+    virtual unsigned int errorCode() = 0;         //上一次操作的错误码，同mysql_errno，CR_SERVER_LOST等表示连接断了
+    virtual const char* errorMessage() = 0;
+    virtual unsigned long threadId() = 0;         //服务端的连接号，KILL用
+    virtual MYSQL* mysql() { return NULL; }       //libmysqlclient的句柄，别的驱动为NULL
+};
+
+/*
+ * 建立连接的驱动，一个驱动可以给多个连接池用，要能在多个线程上同时connect
+ */
+class MysqlDriver {
+  public:
+    virtual ~MysqlDriver() {}
+
+    virtual MysqlDriverConnection* connect(const char*   host,
+                                           const char*   user,
+                                           const char*   pwd,
+                                           const char*   databasename,
+                                           unsigned int  port,
+                                           const char*   socket,
+                                           unsigned long client_flag) = 0; //失败返回NULL
+};
+
+/*
+ * libmysqlclient的驱动，连接池默认用它
+ */
+class LibMysqlDriver : public MysqlDriver {
+  public:
+    MysqlDriverConnection* connect(const char* host, const char* user, const char* pwd, const char* databasename,
+                                   unsigned int port, const char* socket, unsigned long client_flag) override;
+    static LibMysqlDriver* instance();            //全局的那一个
+};
+
+}
+#endif
@@ -1,11 +1,36 @@
 #include "mysql_pool.h"
+#include <stdio.h>
+#include <string.h>
 namespace ekko {
 
 MysqlPool* MysqlPool::mysqlpool_object = NULL;
 std::mutex MysqlPool::objectlock;
-std::mutex MysqlPool::poollock;
 
-MysqlPool::MysqlPool() {}
+MysqlPool::MysqlPool()
+  : connect_count(0),
+    stmt_cache_size(MYSQL_STMT_CACHE_SIZE),
+    min_idle(0),
+    validate_ms(MYSQL_VALIDATE_IDLE_MS),
+    idle_timeout_ms(MYSQL_IDLE_TIMEOUT_MS),
+    running(false),
+    max_waiters(MYSQL_MAX_WAITERS),
+    acquire_timeout_ms(MYSQL_ACQUIRE_TIMEOUT_MS),
+    driver(LibMysqlDriver::instance()) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ *单调时钟的毫秒数，用来算连接空闲了多久
+ */
+uint64_t MysqlPool::nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t MysqlPool::nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 /*
  *配置数据库参数
@@ -27,6 +52,67 @@ void MysqlPool::setParameter( const char*   mysqlhost,
   _client_flag  = client_flag;
   MAX_CONNECT   = max_connect;
 }
+
+/*
+ *设置后台维护的参数：
+ *空闲连接至少保留min_idle个；空闲超过validate_ms的连接由后台线程ping一下；
+ *空闲超过idle_timeout_ms的连接在多于min_idle时关掉，0为不关。
+ */
+void MysqlPool::setMaintenance(unsigned int _min_idle, uint64_t _validate_ms, uint64_t _idle_timeout_ms) {
+  poollock.lock();
+  min_idle = _min_idle;
+  validate_ms = _validate_ms;
+  idle_timeout_ms = _idle_timeout_ms;
+  poollock.unlock();
+}
+
+/*
+ *预先建好min_idle个连接，然后启动后台维护线程。
+ *启动之后取连接不再ping，失效的连接由后台线程发现并补上。
+ *没能建好全部min_idle个连接时返回false，后台线程照样启动，之后会继续补。
+ */
+bool MysqlPool::start() {
+  unsigned int created = 0;
+  for (unsigned int i = 0; i < min_idle; i++) {
+    poollock.lock();
+    bool full = connect_count >= MAX_CONNECT;
+    if (!full)
+      connect_count++;
+    poollock.unlock();
+    if (full)
+      break;
+    MysqlConnection* conn = createOneConnect();
+    if (conn == NULL) {
+      poollock.lock();
+      stats.connect_failed++;
+      releaseSlot();
+      poollock.unlock();
+      break;
+    }
+    close(conn);
+    created++;
+  }
+  std::lock_guard<std::mutex> lock(poollock);
+  if (!running) {
+    running = true;
+    maintainer = std::thread(&MysqlPool::maintain, this);
+  }
+  return created == min_idle;
+}
+
+/*
+ *停掉后台维护线程
+ */
+void MysqlPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(poollock);
+    if (!running)
+      return;
+    running = false;
+  }
+  maintain_cond.notify_all();
+  maintainer.join();
+}
   
 /*
  *有参的单例函数，用于第一次获取连接池对象，初始化数据库信息。
@@ -45,28 +131,23 @@ MysqlPool* MysqlPool::getMysqlPoolObject() {
 /*
  *创建一个连接对象
  */
-MYSQL* MysqlPool::createOneConnect() {
-  MYSQL* conn = NULL;
-  conn = mysql_init(conn);
-  if (conn != NULL) {
-    if (mysql_real_connect(conn,
-                          _mysqlhost,
-                          _mysqluser,
-                          _mysqlpwd,
-                          _databasename,
-                          _port,
-                          _socket,
-                          _client_flag)) {
-      connect_count++;
-      return conn;   
-    } else {
-      std::cout << mysql_error(conn) << std::endl;
-      return NULL;
-    }
-  } else {
-    std::cerr << "init failed" << std::endl;
+MysqlConnection* MysqlPool::createOneConnect() {
+  MysqlDriverConnection* link = driver->connect(_mysqlhost,
+                                                _mysqluser,
+                                                _mysqlpwd,
+                                                _databasename,
+                                                _port,
+                                                _socket,
+                                                _client_flag);
+  if (link == NULL)
     return NULL;
-  }
+  MysqlConnection* c = new MysqlConnection;
+  c->link = link;
+  c->mysql = link->mysql();
+  c->statements.setCapacity(stmt_cache_size);
+  c->last_used_ms = c->checked_ms = nowMs();
+  c->multi_statements = (_client_flag & CLIENT_MULTI_STATEMENTS) != 0;
+  return c;
 }
 
 /*
@@ -78,7 +159,7 @@ bool MysqlPool::isEmpty() {
 /*
  *获取当前连接池队列的队头
  */
-MYSQL* MysqlPool::poolFront() {
+MysqlConnection* MysqlPool::poolFront() {
   return mysqlpool.front();
 }
 /*
@@ -91,7 +172,7 @@ unsigned int MysqlPool::poolSize() {
  *弹出当前连接池队列的队头
  */
 void MysqlPool::poolPop() {
-  mysqlpool.pop();
+  mysqlpool.pop_front();
 }
 /*
  *获取连接对象，如果连接池中有连接，就取用;没有，就重新创建一个连接对象。
@@ -99,81 +180,663 @@ void MysqlPool::poolPop() {
  *MySQL会自动关闭连接，当然还有其他原因，比如：网络不稳定，带来的连接中断。
  *所以在获取连接对象前，需要先判断连接池中连接对象是否有效。
  *考虑到数据库同时建立的连接数量有限制，在创建新连接需提前判断当前开启的连接数不超过设定值。
+ *
+ *锁里只做出队和计数：取队尾最近用过的连接，队头的留给后台线程检查。
+ *后台线程没有启动时，空闲超过validate_ms的连接在锁外ping一次；
+ *需要新建连接时先在锁里占一个名额，再在锁外连接。
+ *连接数已满时排队，最多等到timeout_ms；还回来的连接和空出来的名额按先来后到
+ *直接交给排得最久的线程，后来的线程插不了队。排队的线程超过max_waiters时直接失败。
  */
-MYSQL* MysqlPool::getOneConnect() {
-  poollock.lock();
-  MYSQL *conn = NULL;
-  if (!isEmpty()) {
-    while (!isEmpty() && mysql_ping(poolFront())) {
-      mysql_close(poolFront());
-      poolPop();
-      connect_count--;
-    }
+PooledConnection MysqlPool::acquire(int timeout_ms) {
+  uint64_t start = nowUs();
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms > 0 ? timeout_ms : 0);
+  std::unique_lock<std::mutex> lock(poollock);
+  for (;;) {
+    MysqlConnection* conn = NULL;
+    bool create = false;
     if (!isEmpty()) {
-      conn = poolFront();
-      poolPop();
+      conn = mysqlpool.back();
+      mysqlpool.pop_back();
+    } else if (connect_count < MAX_CONNECT) {
+      connect_count++;
+      create = true;
+    } else if (timeout_ms <= 0 || waiters.size() >= max_waiters) {
+      stats.rejected++;
+      return PooledConnection();
     } else {
-      if (connect_count < MAX_CONNECT)
-        conn = createOneConnect(); 
-      else 
-        std::cerr << "the number of mysql connections is too much!" << std::endl;
+      Waiter w;
+      w.conn = NULL;
+      w.create = false;
+      waiters.push_back(&w);
+      stats.waited++;
+      while (w.conn == NULL && !w.create) {
+        if (w.cond.wait_until(lock, deadline) == std::cv_status::timeout)
+          break;
+      }
+      if (w.conn == NULL && !w.create) {
+        waiters.erase(std::find(waiters.begin(), waiters.end(), &w));
+        stats.timeouts++;
+        return PooledConnection();
+      }
+      conn = w.conn;
+      create = w.create;
     }
+    bool check = conn != NULL && !running
+                 && nowMs() - std::max(conn->last_used_ms, conn->checked_ms) >= validate_ms;
+    if (!create && !check) {
+      recordWait(nowUs() - start);
+      return PooledConnection(this, conn);
+    }
+    lock.unlock();
+    if (create) {
+      conn = createOneConnect();
+      lock.lock();
+      if (conn == NULL) {
+        stats.connect_failed++;
+        releaseSlot();
+        return PooledConnection();
+      }
+      recordWait(nowUs() - start);
+      return PooledConnection(this, conn);
+    }
+    if (conn->link->ping()) {
+      lock.lock();
+      recordWait(nowUs() - start);
+      return PooledConnection(this, conn);
+    }
+    deleteConnect(conn);
+    lock.lock();
+    releaseSlot();
+  }
+}
+/*
+ *等待时间按2的幂分桶，只记拿到连接的，包括新建连接和ping的时间
+ */
+void MysqlPool::recordWait(uint64_t us) {
+  int bucket = 0;
+  while (us > 0 && bucket < MYSQL_WAIT_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  stats.wait_us[bucket]++;
+  stats.acquired++;
+}
+
+uint64_t MysqlPoolStats::waitPercentile(double p) const {
+  uint64_t count = 0;
+  for (int i = 0; i < MYSQL_WAIT_BUCKETS; i++)
+    count += wait_us[i];
+  if (count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(count * p / 100);
+  uint64_t seen = 0;
+  for (int i = 0; i < MYSQL_WAIT_BUCKETS; i++) {
+    seen += wait_us[i];
+    if (seen > rank)
+      return i == 0 ? 0 : (1ULL << i) - 1;
+  }
+  return (1ULL << (MYSQL_WAIT_BUCKETS - 1)) - 1;
+}
+
+MysqlPoolStats MysqlPool::getStats() {
+  std::lock_guard<std::mutex> lock(poollock);
+  MysqlPoolStats s = stats;
+  s.total = connect_count;
+  s.idle = mysqlpool.size();
+  s.waiting = waiters.size();
+  return s;
+}
+
+void MysqlPool::setAcquireTimeout(int timeout_ms) {
+  std::lock_guard<std::mutex> lock(poollock);
+  acquire_timeout_ms = timeout_ms;
+}
+
+void MysqlPool::setMaxWaiters(unsigned int n) {
+  std::lock_guard<std::mutex> lock(poollock);
+  max_waiters = n;
+}
+/*
+ *有线程在排队就把连接直接交给排得最久的，否则放回队列，
+ *front为true时放在队头(空闲最久的一端)
+ */
+void MysqlPool::giveBack(MysqlConnection* conn, bool front) {
+  if (!waiters.empty()) {
+    Waiter* w = waiters.front();
+    waiters.pop_front();
+    w->conn = conn;
+    w->cond.notify_one();
+  } else if (front) {
+    mysqlpool.push_front(conn);
   } else {
-    if (connect_count < MAX_CONNECT)
-      conn = createOneConnect(); 
-    else 
-      std::cerr << "the number of mysql connections is too much!" << std::endl;
+    mysqlpool.push_back(conn);
+  }
+}
+/*
+ *关掉了一个连接，或者占了名额却没连上：有线程在排队就让排得最久的去新建连接
+ */
+void MysqlPool::releaseSlot() {
+  if (!waiters.empty()) {
+    Waiter* w = waiters.front();
+    waiters.pop_front();
+    w->create = true;
+    w->cond.notify_one();
+  } else {
+    connect_count--;
   }
-  poollock.unlock();
-  return conn;
 }
 /*
  *将有效的链接对象放回链接池队列中，以待下次的取用。
  */
-void MysqlPool::close(MYSQL* conn) {
+void MysqlPool::close(MysqlConnection* conn) {
   if (conn != NULL) {
+    conn->last_used_ms = nowMs();
     poollock.lock();
-    mysqlpool.push(conn);
+    giveBack(conn, false);
     poollock.unlock();
   }
 }
+/*
+ *后台维护线程，每MYSQL_MAINTAIN_INTERVAL_MS毫秒一轮：
+ *从队头(空闲最久的一端)取出空闲超过validate_ms的连接，
+ *多于min_idle的部分里空闲超过idle_timeout_ms的直接关掉，其余在锁外ping，
+ *好的放回队头，坏的关掉；最后把空闲连接补足min_idle个。
+ *ping和连接都在锁外做，取连接的线程不用等。
+ */
+void MysqlPool::maintain() {
+  std::unique_lock<std::mutex> lock(poollock);
+  while (running) {
+    maintain_cond.wait_for(lock, std::chrono::milliseconds(MYSQL_MAINTAIN_INTERVAL_MS));
+    if (!running)
+      break;
+    uint64_t now = nowMs();
+    std::vector<MysqlConnection*> checking;
+    std::vector<MysqlConnection*> closing;
+    size_t idle = mysqlpool.size();
+    while (!isEmpty() && now - std::max(poolFront()->last_used_ms, poolFront()->checked_ms) >= validate_ms) {
+      MysqlConnection* conn = poolFront();
+      poolPop();
+      if (idle_timeout_ms > 0 && now - conn->last_used_ms >= idle_timeout_ms && idle > min_idle) {
+        closing.push_back(conn);
+        idle--;
+      } else {
+        checking.push_back(conn);
+      }
+    }
+    lock.unlock();
+
+    for (size_t i = 0; i < checking.size(); i++) {
+      if (checking[i]->link->ping()) {
+        checking[i]->checked_ms = nowMs();
+      } else {
+        closing.push_back(checking[i]);
+        checking[i] = NULL;
+      }
+    }
+    for (size_t i = 0; i < closing.size(); i++)
+      deleteConnect(closing[i]);
+
+    lock.lock();
+    for (size_t i = 0; i < closing.size(); i++)
+      releaseSlot();
+    for (size_t i = checking.size(); i > 0; i--) {
+      if (checking[i - 1] != NULL)
+        giveBack(checking[i - 1], true);
+    }
+    unsigned int need = 0;
+    while (mysqlpool.size() + need < min_idle && connect_count < MAX_CONNECT) {
+      connect_count++;
+      need++;
+    }
+    lock.unlock();
+
+    std::vector<MysqlConnection*> created;
+    for (unsigned int i = 0; i < need; i++) {
+      MysqlConnection* conn = createOneConnect();
+      if (conn != NULL)
+        created.push_back(conn);
+    }
+
+    lock.lock();
+    for (size_t i = created.size(); i < need; i++) {
+      stats.connect_failed++;
+      releaseSlot();
+    }
+    for (size_t i = 0; i < created.size(); i++)
+      giveBack(created[i], true);
+  }
+}
+/*
+ * 把 mysql_store_result 得到的结果拷贝到 result 中。
+ * 先用 mysql_fetch_lengths 算出所有数据的长度，一次分配好，
+ * 再回到第一行逐行拷贝，列按字段的顺序保存。
+ */
+bool MysqlPool::storeResult(MYSQL_RES* res, ResultSet& result) {
+  unsigned int num_fields = mysql_num_fields(res);
+  MYSQL_FIELD* fields = mysql_fetch_fields(res);
+  std::vector<ResultSet::Column> columns(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    columns[i].name.assign(fields[i].name, fields[i].name_length);
+    columns[i].type = fields[i].type;
+    columns[i].flags = fields[i].flags;
+  }
+  result.setColumns(std::move(columns));
+  size_t rows = mysql_num_rows(res);
+  size_t bytes = 0;
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(res))) {
+    unsigned long* lengths = mysql_fetch_lengths(res);
+    for (unsigned int i = 0; i < num_fields; i++)
+      bytes += lengths[i] + 1;
+  }
+  if (bytes >= ResultSet::NULL_LENGTH) {
+    std::cerr << "the result set is too large!" << std::endl;
+    result.clear();
+    return false;
+  }
+  result.reserve(rows, bytes - rows * num_fields);
+  mysql_data_seek(res, 0);
+  while ((row = mysql_fetch_row(res)))
+    result.appendRow(row, mysql_fetch_lengths(res));
+  return true;
+}
+/*
+ * sql语句执行函数，结果拷贝到result中，result原有的内容会被清掉。
+ * 没有结果集的语句(INSERT、UPDATE等)result没有列，只有affectedRows和insertId。
+ * 结果自己持有数据，连接放回连接池后仍然有效。
+ */
+bool MysqlPool::query(const char* sql, ResultSet& result) {
+  result.clear();
+  PooledConnection conn = acquire();
+  if (!conn)
+    return false;
+  return conn.query(sql, result);
+}
+/*
+ * 连接已经断开，关掉它，不再放回连接池
+ */
+void MysqlPool::destroyConnect(MysqlConnection* conn) {
+  deleteConnect(conn);
+  poollock.lock();
+  releaseSlot();
+  poollock.unlock();
+}
+/*
+ * 设置每个连接缓存的预处理语句数，对之后新建的连接生效
+ */
+void MysqlPool::setStatementCacheSize(size_t n) {
+  poollock.lock();
+  stmt_cache_size = n;
+  poollock.unlock();
+}
+/*
+ * 不加锁，要在开始用连接池之前设置
+ */
+void MysqlPool::setExecuteHook(const ExecuteHook& hook) {
+  execute_hook = hook;
+}
+
+void MysqlPool::setCloseHook(const CloseHook& hook) {
+  close_hook = hook;
+}
+
+void MysqlPool::deleteConnect(MysqlConnection* conn) {
+  if (close_hook)
+    close_hook(conn);
+  delete conn;
+}
+/*
+ * 已经建好的连接不变，关掉以后新建的才用新的驱动
+ */
+void MysqlPool::setDriver(MysqlDriver* _driver) {
+  poollock.lock();
+  driver = _driver;
+  poollock.unlock();
+}
+/*
+ * 预处理语句执行函数，sql中的参数用?占位，params按顺序绑定。
+ * 语句在连接上prepare一次，以后按SQL文本从这个连接的缓存中取，服务端不再解析。
+ * 语句肯定没有执行过的失败(见PooledConnection::execute)换一个连接再执行一次。
+ */
+bool MysqlPool::execute(const char* sql, const SqlParam* params, size_t count, ResultSet& result) {
+  result.clear();
+  for (int attempt = 0; attempt < 2; attempt++) {
+    PooledConnection conn = acquire();
+    if (!conn)
+      return false;
+    bool retry = false;
+    if (conn.execute(sql, params, count, result, &retry))
+      return true;
+    if (!retry)
+      return false;
+  }
+  return false;
+}
+
+PooledConnection::PooledConnection(PooledConnection&& other)
+  : pool(other.pool),
+    conn(other.conn),
+    broken(other.broken) {
+  other.conn = NULL;
+}
+
+PooledConnection& PooledConnection::operator=(PooledConnection&& other) {
+  if (this != &other) {
+    release();
+    pool = other.pool;
+    conn = other.conn;
+    broken = other.broken;
+    other.conn = NULL;
+  }
+  return *this;
+}
+/*
+ * 还回连接池，断掉的连接直接关掉
+ */
+void PooledConnection::release() {
+  if (conn == NULL)
+    return;
+  if (broken)
+    pool->destroyConnect(conn);
+  else
+    pool->close(conn);
+  conn = NULL;
+  broken = false;
+}
+
+bool PooledConnection::query(const char* sql, ResultSet& result) {
+  bool ok = conn->link->query(sql, result);
+  unsigned int err = conn->link->errorCode();
+  if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+    broken = true;                                //断掉的连接不放回去
+  if (ok && pool->execute_hook)
+    pool->execute_hook(conn, sql);
+  return ok;
+}
+/*
+ * prepare时连接断了，或者服务端已经不认识这个语句(重连过，或者语句被服务端关掉)，
+ * 语句肯定没有执行过，retry置为true：前者连接作废，后者丢掉这个语句。
+ * 执行中途断开的不算，不知道服务端有没有执行完。
+ */
+bool PooledConnection::execute(const char* sql, const SqlParam* params, size_t count, ResultSet& result,
+                               bool* retry) {
+  if (retry)
+    *retry = false;
+  if (conn->mysql == NULL) {
+    //驱动没有预处理语句，参数写成字面量拼进SQL
+    std::string text;
+    if (!SqlParam::render(NULL, sql, params, count, text)) {
+      std::cerr << "wrong number of parameters: " << sql << std::endl;
+      return false;
+    }
+    if (!conn->link->query(text.c_str(), result)) {
+      unsigned int err = conn->link->errorCode();
+      if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+        broken = true;
+      return false;
+    }
+    if (pool->execute_hook)
+      pool->execute_hook(conn, sql);
+    return true;
+  }
+  unsigned int err = 0;
+  MYSQL_STMT* stmt = conn->statements.get(conn->mysql, sql, &err);
+  if (stmt == NULL) {
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+      broken = true;
+      if (retry)
+        *retry = true;
+    }
+    return false;
+  }
+  if (executeStatement(stmt, params, count, result)) {
+    if (pool->execute_hook)
+      pool->execute_hook(conn, sql);
+    return true;
+  }
+  err = mysql_stmt_errno(stmt);
+  if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+    broken = true;
+  } else if (err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE) {
+    conn->statements.remove(sql);
+    if (retry)
+      *retry = true;
+  }
+  return false;
+}
+/*
+ * 多条语句一次执行，只有一次往返。
+ * 中间某条出错时后面的不再执行，results中只有出错之前的结果，返回false。
+ * 语句之间没有事务，要原子的话自己在开头结尾加BEGIN、COMMIT。
+ */
+bool MysqlPool::batch(const char* sql, std::vector<ResultSet>& results) {
+  results.clear();
+  PooledConnection conn = acquire();
+  if (!conn)
+    return false;
+  return conn.batch(sql, results);
+}
+
+bool MysqlPool::batch(const std::vector<std::string>& statements, std::vector<ResultSet>& results) {
+  std::string sql;
+  for (size_t i = 0; i < statements.size(); i++) {
+    if (i > 0)
+      sql += ";\n";
+    sql += statements[i];
+  }
+  return batch(sql.c_str(), results);
+}
+/*
+ * 连接建立时没有带CLIENT_MULTI_STATEMENTS的，batch前打开，结果读完后马上关掉，多两次往返：
+ * 连接还回连接池以后，别的query、executeSql、InsertBatcher在上面不能一次执行多条语句，
+ * 拼出来的SQL里被注入"; DROP ..."也不会执行。关不掉的连接作废。
+ * 每个结果都要读完，连接才能接着用；读到一半出错的连接不知道还剩什么没读，作废。
+ */
+bool PooledConnection::batch(const char* sql, std::vector<ResultSet>& results) {
+  results.clear();
+  MYSQL* mysql = conn->mysql;
+  if (mysql == NULL) {
+    std::cerr << "batch needs a libmysqlclient connection" << std::endl;
+    return false;
+  }
+  bool enabled = false;                           //这次打开的，用完要关掉
+  if (!conn->multi_statements) {
+    if (mysql_set_server_option(mysql, MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0) {
+      std::cerr << mysql_error(mysql) << std::endl;
+      unsigned int err = mysql_errno(mysql);
+      if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+        broken = true;
+      return false;
+    }
+    enabled = true;
+  }
+  bool ok = true;
+  int status = mysql_query(mysql, sql);
+  while (status == 0) {
+    results.emplace_back();
+    ResultSet& result = results.back();
+    MYSQL_RES* res = mysql_store_result(mysql);
+    if (res) {
+      if (!MysqlPool::storeResult(res, result))
+        ok = false;
+      mysql_free_result(res);
+    } else if (mysql_field_count(mysql) == 0) {
+      result.setAffectedRows(mysql_affected_rows(mysql));
+      result.setInsertId(mysql_insert_id(mysql));
+    } else {
+      results.pop_back();
+      broken = true;
+      break;
+    }
+    status = mysql_next_result(mysql);            //0为还有结果，-1为没有了，大于0为出错
+  }
+  if (status != -1) {
+    std::cerr << mysql_error(mysql) << std::endl;
+    ok = false;
+  }
+  unsigned int err = mysql_errno(mysql);
+  if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+    broken = true;
+  if (enabled && !broken && mysql_set_server_option(mysql, MYSQL_OPTION_MULTI_STATEMENTS_OFF) != 0) {
+    std::cerr << mysql_error(mysql) << std::endl;
+    broken = true;                                //还开着多条语句的连接不能放回去
+  }
+  if (!results.empty() && pool->execute_hook)
+    pool->execute_hook(conn, sql);                //出错之前的语句已经执行了
+  return ok;
+}
+/*
+ * 用mysql_use_result执行查询，结果不在客户端缓存，由stream一批批读取。
+ * stream原来没读完的会先取消。没有结果集的语句直接结束，stream里没有行。
+ */
+bool MysqlPool::stream(const char* sql, RowStream& stream) {
+  stream.cancel();
+  stream.error = false;
+  stream.columns.clear();
+  PooledConnection conn = acquire();
+  if (!conn)
+    return false;
+  MYSQL* mysql = conn.mysql();
+  if (mysql == NULL) {
+    std::cerr << "stream needs a libmysqlclient connection" << std::endl;
+    return false;
+  }
+  if (mysql_query(mysql, sql) != 0) {
+    std::cerr << mysql_error(mysql) << std::endl;
+    unsigned int err = mysql_errno(mysql);
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+      conn.discard();
+    return false;
+  }
+  MYSQL_RES* res = mysql_use_result(mysql);
+  if (res == NULL) {
+    if (mysql_field_count(mysql) != 0) {
+      std::cerr << mysql_error(mysql) << std::endl;
+      return false;
+    }
+    if (execute_hook)
+      execute_hook(conn.conn, sql);
+    return true;
+  }
+  unsigned int num_fields = mysql_num_fields(res);
+  MYSQL_FIELD* fields = mysql_fetch_fields(res);
+  stream.columns.resize(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    stream.columns[i].name.assign(fields[i].name, fields[i].name_length);
+    stream.columns[i].type = fields[i].type;
+    stream.columns[i].flags = fields[i].flags;
+  }
+  stream.pool = this;
+  stream.conn = std::move(conn);
+  stream.res = res;
+  return true;
+}
+/*
+ * 回调形式的流式查询，每批最多batch_rows行。
+ * 全部读完返回true；callback返回false时取消，也返回true；出错返回false。
+ */
+bool MysqlPool::stream(const char* sql, size_t batch_rows,
+                       const std::function<bool(const ResultSet& batch)>& callback) {
+  RowStream rows;
+  if (!stream(sql, rows))
+    return false;
+  ResultSet batch;
+  while (rows.next(batch, batch_rows)) {
+    if (!callback(batch)) {
+      rows.cancel();
+      return true;
+    }
+  }
+  return !rows.failed();
+}
+/*
+ * 读下一批。batch的列和这个结果的不一样时先设置列，否则只清掉上一批的行，
+ * 内存留着给这一批用。行不到max_rows个说明读完了(或者出错了)，连接随即还回去。
+ * 出错时已经读到的行照样返回，下一次返回false，failed()为true。
+ */
+bool RowStream::next(ResultSet& batch, size_t max_rows) {
+  if (res == NULL)
+    return false;
+  bool same = batch.columnCount() == (int)columns.size();
+  for (size_t i = 0; same && i < columns.size(); i++)
+    same = batch.column(i).name == columns[i].name;
+  if (same)
+    batch.clearRows();
+  else
+    batch.setColumns(columns);
+  if (max_rows == 0)
+    max_rows = 1;
+  MYSQL_ROW row;
+  while (batch.rowCount() < max_rows && (row = mysql_fetch_row(res)))
+    batch.appendRow(row, mysql_fetch_lengths(res));
+  if (batch.rowCount() < max_rows)
+    finish();
+  return batch.rowCount() > 0;
+}
+
+void RowStream::finish() {
+  MYSQL* mysql = conn.mysql();
+  unsigned int err = mysql_errno(mysql);
+  if (err != 0) {
+    std::cerr << mysql_error(mysql) << std::endl;
+    error = true;
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+      conn.discard();
+  }
+  mysql_free_result(res);
+  res = NULL;
+  conn.release();
+}
+/*
+ * mysql_free_result会把没读的行全部从网络上读完再丢掉，行很多时要很久。
+ * 所以先从连接池另借一个连接(不等待)，KILL QUERY让服务端停止发送，
+ * 剩下的只有已经在路上的一点数据。借不到连接时只能读完。
+ * 连接还在我们手里，KILL不会误杀别的语句。
+ */
+void RowStream::cancel() {
+  if (res == NULL)
+    return;
+  MYSQL* mysql = conn.mysql();
+  {
+    PooledConnection killer = pool->acquire(0);
+    if (killer) {
+      char sql[64];
+      snprintf(sql, sizeof(sql), "KILL QUERY %lu", mysql_thread_id(mysql));
+      ResultSet ignored;
+      killer.query(sql, ignored);
+    }
+  }
+  mysql_free_result(res);
+  res = NULL;
+  unsigned int err = mysql_errno(mysql);
+  if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+    conn.discard();
+  conn.release();
+}
 /*
  * sql语句执行函数，并返回结果，没有结果的SQL语句返回空结果，
  * 每次执行SQL语句都会先去连接队列中去一个连接对象，
  * 执行完SQL语句，就把连接对象放回连接池队列中。
  * 返回对象用map主要考虑，用户可以通过数据库字段，直接获得查询的字。
  * 例如：m["字段"][index]。
+ * 返回的指针指向本线程最近一次executeSql的结果，在本线程下一次调用executeSql前有效；
+ * 新代码请用query，结果自己持有数据，也没有map的开销。
  */
 std::map<const std::string,std::vector<const char*> >  MysqlPool::executeSql(const char* sql) {
-  MYSQL* conn = getOneConnect();
+  static thread_local ResultSet last;
   std::map<const std::string,std::vector<const char*> > results;
-  if (conn) {
-    if (mysql_query(conn,sql) == 0) {
-      MYSQL_RES *res = mysql_store_result(conn);
-      if (res) {
-        MYSQL_FIELD *field;
-        while ((field = mysql_fetch_field(res))) {
-          results.insert(make_pair(field->name,std::vector<const char*>()));
-        }
-        MYSQL_ROW row;
-        while ((row = mysql_fetch_row(res))) {
-          unsigned int i = 0;
-          for (std::map<const std::string,std::vector<const char*> >::iterator it = results.begin();
-              it != results.end(); ++it) {
-            (it->second).push_back(row[i++]);
-          }
-        }
-        mysql_free_result(res);
-      } else {
-        if (mysql_field_count(conn) != 0)
-          std::cerr << mysql_error(conn) << std::endl;
-      }
-    } else {
-      std::cerr << mysql_error(conn) <<std::endl;
-    }
-    close(conn);
-  } else {
-    std::cerr << mysql_error(conn) << std::endl;
+  if (!query(sql, last))
+    return results;
+  size_t rows = last.rowCount();
+  for (int i = 0; i < last.columnCount(); i++) {
+    //按字段的顺序取列，不是map的顺序
+    std::vector<const char*>& values = results[last.column(i).name];
+    if (!values.empty())
+      continue;
+    values.reserve(rows);
+    for (size_t r = 0; r < rows; r++)
+      values.push_back(last.getCString(r, i));
   }
   return results;
 }
@@ -181,8 +844,13 @@ std::map<const std::string,std::vector<const char*> >  MysqlPool::executeSql(con
  * 析构函数，将连接池队列中的连接全部关闭
  */
 MysqlPool::~MysqlPool() {
+  stop();
+  objectlock.lock();
+  if (mysqlpool_object == this)
+    mysqlpool_object = NULL;                      //之后getMysqlPoolObject重新创建
+  objectlock.unlock();
   while (poolSize() != 0) {
-    mysql_close(poolFront());
+    deleteConnect(poolFront());
     poolPop();
     connect_count--;
   }
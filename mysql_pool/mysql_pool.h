@@ -3,19 +3,180 @@
 
 #include <iostream>
 #include <mysql/mysql.h>
-#include <queue>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <algorithm>
+#include <deque>
+#include <condition_variable>
+#include <stdint.h>
 #include <map>
 #include <vector>
 #include <utility>
 #include <string>
 #include <mutex>
+#include <functional>
 #include <thread>
+#include "result_set.h"
+#include "statement.h"
+#include "mysql_driver.h"
+
+#define MYSQL_VALIDATE_IDLE_MS 5000               //空闲超过这么久的连接用之前要ping
+#define MYSQL_IDLE_TIMEOUT_MS 600000              //空闲超过这么久、多于min_idle的连接关掉
+#define MYSQL_MAINTAIN_INTERVAL_MS 1000           //后台维护线程的周期
+#define MYSQL_ACQUIRE_TIMEOUT_MS 1000             //query、execute等连接最多等这么久
+#define MYSQL_MAX_WAITERS 1024                    //最多这么多线程排队等连接，再多的直接失败
+#define MYSQL_WAIT_BUCKETS 32                     //等待时间直方图的桶数
+#define MYSQL_STREAM_BATCH_ROWS 1024              //流式读取时每批的行数
 
 namespace ekko{
+/*
+ * 连接池中的一个连接，带着它上面预处理过的语句
+ */
+struct MysqlConnection {
+  MysqlDriverConnection* link;                    //驱动建立的连接
+  MYSQL* mysql;                                   //link->mysql()，不是libmysqlclient的驱动为NULL
+  StatementCache statements;
+  uint64_t last_used_ms;                          //上次放回连接池的时间
+  uint64_t checked_ms;                            //上次确认连接有效的时间
+  bool multi_statements;                          //建立时带了CLIENT_MULTI_STATEMENTS，一直可以一次发多条语句
+
+  ~MysqlConnection() {
+    statements.clear();                           //语句要在连接关掉之前关掉
+    delete link;
+  }
+};
+
+/*
+ * 连接池的统计，getStats时的快照
+ */
+struct MysqlPoolStats {
+  uint64_t acquired;                              //拿到连接的次数
+  uint64_t waited;                                //其中排过队的次数
+  uint64_t timeouts;                              //排队等到超时的次数
+  uint64_t rejected;                              //排队的线程已满，或者不愿等，直接失败的次数
+  uint64_t connect_failed;                        //新建连接失败的次数
+  unsigned int total;                             //当前的连接数
+  unsigned int idle;                              //当前空闲的连接数
+  unsigned int waiting;                           //当前排队的线程数
+  uint64_t wait_us[MYSQL_WAIT_BUCKETS];           //拿到连接前等待的时间，第0个桶为0，第i个桶为[2^(i-1), 2^i)微秒
+
+  uint64_t waitPercentile(double p) const;        //p分位的等待时间所在桶的上界，微秒
+};
+
+class MysqlPool;
+
+/*
+ * 从连接池借出的一个连接，析构时自动还回去。只能移动，不能复制。
+ * 需要在同一个连接上执行多条语句时(比如事务)用它，
+ * 一次性的语句直接用MysqlPool::query、MysqlPool::execute就行。
+ */
+class PooledConnection {
+  public:
+    PooledConnection() : pool(NULL), conn(NULL), broken(false) {}
+    PooledConnection(PooledConnection&& other);
+    PooledConnection& operator=(PooledConnection&& other);
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+    ~PooledConnection() { release(); }
+
+    explicit operator bool() const { return conn != NULL; }
+    MYSQL* mysql() const { return conn->mysql; }   //不是libmysqlclient的驱动为NULL
+    unsigned int errorCode() const { return conn->link->errorCode(); } //上一条语句的错误码，同mysql_errno
+    void release();                               //提前还回连接池
+    void discard() { broken = true; }             //连接不能再用了，还回时关掉
+
+    bool query(const char* sql, ResultSet& result); //同MysqlPool::query，在这个连接上执行
+    bool execute(const char* sql, const SqlParam* params, size_t count, ResultSet& result,
+                 bool* retry = NULL);             //同MysqlPool::execute；retry表示语句没有执行，可以换个连接再试
+    template <typename... Args>
+    bool execute(ResultSet& result, const char* sql, const Args&... args) {
+      SqlParam params[sizeof...(Args) + 1] = { SqlParam(args)... };
+      return execute(sql, params, sizeof...(Args), result);
+    }
+    bool batch(const char* sql, std::vector<ResultSet>& results); //同MysqlPool::batch，在这个连接上执行
+
+  private:
+    friend class MysqlPool;
+    PooledConnection(MysqlPool* _pool, MysqlConnection* _conn) : pool(_pool), conn(_conn), broken(false) {}
+
+  private:
+    MysqlPool* pool;
+    MysqlConnection* conn;
+    bool broken;                                  //还回时关掉，不放回连接池
+};
+
+/*
+ * 流式读取的结果，基于mysql_use_result：行边从服务端读边交给调用者，
+ * 一批最多几行，每批都复用同一个ResultSet的内存，内存占用和结果集的大小无关。
+ * 读的过程中一直占着连接，读完、取消或者析构时才还回连接池。
+ * 例如：
+ *   RowStream stream;
+ *   ResultSet batch;
+ *   if (pool->stream("select * from big", stream))
+ *     while (stream.next(batch)) { ... }
+ */
+class RowStream {
+  public:
+    RowStream() : pool(NULL), res(NULL), error(false) {}
+    RowStream(const RowStream&) = delete;
+    RowStream& operator=(const RowStream&) = delete;
+    ~RowStream() { cancel(); }
+
+    bool next(ResultSet& batch, size_t max_rows = MYSQL_STREAM_BATCH_ROWS); //读下一批到batch中，没有更多的行返回false
+    void cancel();                                //不读了：让服务端停下，剩下的行丢掉，连接还回去
+    bool active() const { return res != NULL; }   //还有没读完的行
+    bool failed() const { return error; }         //读到一半出错，已经读到的行不完整
+    const std::vector<ResultSet::Column>& getColumns() const { return columns; }
+
+  private:
+    friend class MysqlPool;
+    void finish();                                //读完了，释放结果，还回连接
+
+  private:
+    MysqlPool* pool;
+    PooledConnection conn;
+    MYSQL_RES* res;
+    std::vector<ResultSet::Column> columns;
+    bool error;
+};
+
+/*
+ * 一个MySQL主机的连接池。一般用getMysqlPoolObject取全局的那一个；
+ * 连多个主机时(见MysqlCluster)每个主机new一个。
+ */
 class MysqlPool {
   public:
+    MysqlPool();
     ~MysqlPool();
     std::map<const std::string,std::vector<const char* > > executeSql(const char* sql);//sql语句的执行函数
+    bool query(const char* sql, ResultSet& result);  //执行sql语句，结果按列序拷贝到result中，失败返回false
+    bool execute(const char* sql, const SqlParam* params, size_t count, ResultSet& result); //用预处理语句执行，参数按二进制发送
+    template <typename... Args>
+    bool execute(ResultSet& result, const char* sql, const Args&... args) {  //例如：execute(rs, "select * from t where id=?", 42)
+      SqlParam params[sizeof...(Args) + 1] = { SqlParam(args)... };
+      return execute(sql, params, sizeof...(Args), result);
+    }
+    bool batch(const char* sql, std::vector<ResultSet>& results); //分号隔开的多条语句一次发送，每条的结果按顺序放在results中
+    bool batch(const std::vector<std::string>& statements, std::vector<ResultSet>& results);
+    bool stream(const char* sql, RowStream& stream); //流式执行查询，行从stream中一批批读
+    bool stream(const char* sql, size_t batch_rows,
+                const std::function<bool(const ResultSet& batch)>& callback); //每批调一次callback，返回false为取消
+    PooledConnection acquire(int timeout_ms);     //借一个连接，最多等timeout_ms毫秒，0为不等；失败返回空的
+    PooledConnection acquire() { return acquire(acquire_timeout_ms); }
+    void setAcquireTimeout(int timeout_ms);       //query、execute等连接的时间
+    void setMaxWaiters(unsigned int n);           //最多排队的线程数
+    MysqlPoolStats getStats();
+    void setStatementCacheSize(size_t n);         //之后新建的连接每个缓存的预处理语句数
+    typedef std::function<void(MysqlConnection* conn, const char* sql)> ExecuteHook;
+    void setExecuteHook(const ExecuteHook& hook); //每条语句(batch为整串)在连接上执行完后调用，用之前设置好
+    typedef std::function<void(MysqlConnection* conn)> CloseHook;
+    void setCloseHook(const CloseHook& hook);     //连接池关掉一个连接之前调用，用之前设置好
+    void setDriver(MysqlDriver* driver);          //之后新建的连接用这个驱动，默认LibMysqlDriver；driver要比连接池活得久
+    void setMaintenance(unsigned int min_idle,
+                        uint64_t validate_ms = MYSQL_VALIDATE_IDLE_MS,
+                        uint64_t idle_timeout_ms = MYSQL_IDLE_TIMEOUT_MS); //设置后台维护的参数
+    bool start();                                 //预先建好min_idle个连接，启动后台维护线程
+    void stop();                                  //停掉后台维护线程
     static MysqlPool* getMysqlPoolObject();              //单列模式获取本类的对象
     void setParameter( const char*   _mysqlhost,
                        const char*   _mysqluser,
@@ -26,16 +187,32 @@ class MysqlPool {
                        unsigned long _client_flag = 0,
                        unsigned int  MAX_CONNECT = 50 );              //设置数据库参数
   private:
-    MysqlPool();
-    MYSQL* createOneConnect();                    //创建一个新的连接对象
-    MYSQL* getOneConnect();                       //获取一个连接对象
-    void close(MYSQL* conn);                      //关闭连接对象
+    friend class PooledConnection;
+    friend class AsyncMysql;                      //用storeResult拷贝结果
+    friend class LibMysqlConnection;
+    struct Waiter {
+      std::condition_variable cond;
+      MysqlConnection* conn;                      //直接交过来的连接
+      bool create;                                //交过来的是新建连接的名额
+    };
+
+    MysqlConnection* createOneConnect();          //创建一个新的连接对象
+    void close(MysqlConnection* conn);            //关闭连接对象
+    void destroyConnect(MysqlConnection* conn);   //断掉的连接，不放回连接池
+    void deleteConnect(MysqlConnection* conn);    //调用close_hook后删掉，不还名额
+    void giveBack(MysqlConnection* conn, bool front); //有人排队就直接交给排得最久的，否则放回队列；要持有poollock
+    void releaseSlot();                           //少了一个连接，名额交给排得最久的；要持有poollock
+    void recordWait(uint64_t us);                 //要持有poollock
     bool isEmpty();                               //连接池队列池是否为空
-    MYSQL* poolFront();                           //连接池队列的队头
+    MysqlConnection* poolFront();                 //连接池队列的队头
     unsigned int poolSize();                      //获取连接池的大小
     void poolPop();                               //弹出连接池队列的队头
+    void maintain();                              //后台维护线程
+    static uint64_t nowMs();
+    static uint64_t nowUs();
+    static bool storeResult(MYSQL_RES* res, ResultSet& result); //把结果一次拷贝到result中
   private:
-    std::queue<MYSQL*> mysqlpool;                 //连接池队列
+    std::deque<MysqlConnection*> mysqlpool;       //连接池队列，队尾是最近放回的
     const char*   _mysqlhost;                     //mysql主机地址
     const char*   _mysqluser;                     //mysql用户名
     const char*   _mysqlpwd;                      //mysql密码
@@ -45,8 +222,22 @@ class MysqlPool {
     unsigned long _client_flag;                   //设置为0
     unsigned int  MAX_CONNECT;                    //同时允许最大连接对象数量
     unsigned int  connect_count;                  //目前连接池的连接对象数量
+    size_t        stmt_cache_size;                //每个连接缓存的预处理语句数
+    unsigned int  min_idle;                       //至少保留的空闲连接数
+    uint64_t      validate_ms;                    //空闲超过这么久要ping
+    uint64_t      idle_timeout_ms;                //空闲超过这么久关掉，0为不关
+    bool          running;                        //后台维护线程是否在运行
+    std::thread   maintainer;                     //后台维护线程
+    std::condition_variable maintain_cond;        //用来叫停后台维护线程
+    std::deque<Waiter*> waiters;                  //排队等连接的线程，队头排得最久
+    unsigned int  max_waiters;                    //最多排队的线程数
+    int           acquire_timeout_ms;             //query、execute等连接的时间
+    MysqlPoolStats stats;                         //统计，要持有poollock
+    ExecuteHook   execute_hook;                   //比如QueryCache用它在写了以后失效缓存
+    CloseHook     close_hook;                     //比如QueryCache用它丢掉连接上没结束的事务
+    MysqlDriver*  driver;                         //新建连接用的驱动
     static std::mutex objectlock;                 //对象锁
-    static std::mutex poollock;                   //连接池锁
+    std::mutex    poollock;                       //连接池锁
     static MysqlPool* mysqlpool_object;           //类的对象
 };
 }
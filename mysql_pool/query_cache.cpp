@@ -0,0 +1,523 @@
+#include "query_cache.h"
+#include "mysql_cluster.h"
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <string.h>
+namespace ekko {
+
+static uint64_t steadyMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool isIdentChar(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+/*
+ * pos指向引号，返回配对的引号之后的位置。反斜杠转义和两个引号连写都算字符串里的
+ */
+static size_t skipQuoted(std::string_view sql, size_t pos) {
+  char quote = sql[pos++];
+  while (pos < sql.size()) {
+    char c = sql[pos++];
+    if (c == '\\' && quote != '`') {
+      pos++;
+    } else if (c == quote) {
+      if (pos < sql.size() && sql[pos] == quote)
+        pos++;
+      else
+        return pos;
+    }
+  }
+  return sql.size();
+}
+/*
+ * pos处是注释的话返回注释之后的位置，不是返回pos。斜杠星号叹号开头的里面是要执行的语句，不算注释
+ */
+static size_t skipComment(std::string_view sql, size_t pos) {
+  size_t n = sql.size();
+  if (sql[pos] == '#' || (sql[pos] == '-' && pos + 1 < n && sql[pos + 1] == '-' &&
+                          (pos + 2 == n || isspace((unsigned char)sql[pos + 2])))) {
+    size_t end = sql.find('\n', pos);
+    return end == std::string_view::npos ? n : end + 1;
+  }
+  if (sql[pos] == '/' && pos + 2 < n && sql[pos + 1] == '*' && sql[pos + 2] != '!') {
+    size_t end = sql.find("*/", pos + 2);
+    return end == std::string_view::npos ? n : end + 2;
+  }
+  return pos;
+}
+/*
+ * 取下一个词：标识符或关键字(反引号去掉，db.t连成一个，转成小写)，或者一个标点。
+ * 空白、字符串、注释跳过。没有了返回false。
+ */
+static bool nextToken(std::string_view sql, size_t& pos, std::string& word) {
+  while (pos < sql.size()) {
+    char c = sql[pos];
+    if (isspace((unsigned char)c)) {
+      pos++;
+      continue;
+    }
+    if (c == '\'' || c == '"') {
+      pos = skipQuoted(sql, pos);
+      continue;
+    }
+    size_t end = skipComment(sql, pos);
+    if (end != pos) {
+      pos = end;
+      continue;
+    }
+    word.clear();
+    if (!isIdentChar(c) && c != '`') {
+      word += c;
+      pos++;
+      return true;
+    }
+    for (;;) {
+      if (sql[pos] == '`') {
+        size_t close = skipQuoted(sql, pos);
+        for (size_t i = pos + 1; i + 1 < close; i++) {
+          if (sql[i] != '`' || sql[i - 1] != '`')
+            word += tolower((unsigned char)sql[i]);
+        }
+        pos = close;
+      } else {
+        while (pos < sql.size() && isIdentChar(sql[pos]))
+          word += tolower((unsigned char)sql[pos++]);
+      }
+      if (pos + 1 < sql.size() && sql[pos] == '.' && (isIdentChar(sql[pos + 1]) || sql[pos + 1] == '`')) {
+        word += '.';
+        pos++;
+        continue;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isOneOf(const std::string& word, const char* const* list) {
+  for (; *list; list++) {
+    if (word == *list)
+      return true;
+  }
+  return false;
+}
+
+static const char* const table_keywords[] = {
+  "from", "join", "straight_join", "update", "into", "table", "truncate", "to", NULL
+};
+//紧跟在上面的关键字后面、表名前面的词
+static const char* const table_modifiers[] = {
+  "table", "if", "not", "exists", "low_priority", "high_priority", "delayed", "ignore", "only", "quick", NULL
+};
+//表名后面不是别名的词
+static const char* const not_alias[] = {
+  "where", "on", "using", "set", "values", "value", "select", "inner", "left", "right", "outer", "cross",
+  "natural", "group", "order", "limit", "having", "window", "union", "except", "intersect", "for", "lock",
+  "partition", "use", "force", "ignore", "into", "from", "returning", "duplicate", "read", "write", "rename",
+  "add", "drop", "modify", "change", "alter", "engine", "auto_increment", "character", "default", "comment",
+  "lines", "fields", "columns", "as", NULL
+};
+
+void QueryCache::tables(std::string_view sql, std::vector<std::string>& out) {
+  enum { NONE, EXPECT, AFTER } state = NONE;
+  bool list = false;                              //逗号后面还是表
+  size_t pos = 0;
+  std::string word, prev;
+  while (nextToken(sql, pos, word)) {
+    bool name = isIdentChar(word[0]);
+    if (state == EXPECT) {
+      if (isOneOf(word, table_modifiers))
+        continue;
+      if (name && !isOneOf(word, not_alias) && !isOneOf(word, table_keywords)) {
+        size_t dot = word.rfind('.');
+        std::string table = dot == std::string::npos ? word : word.substr(dot + 1);
+        bool seen = false;
+        for (size_t i = 0; i < out.size() && !seen; i++)
+          seen = out[i] == table;
+        if (!seen)
+          out.push_back(table);
+        state = AFTER;
+        continue;
+      }
+      state = NONE;
+    } else if (state == AFTER) {
+      if (word == "," && list) {
+        state = EXPECT;
+        continue;
+      }
+      if (word == "as" || (name && !isOneOf(word, not_alias) && !isOneOf(word, table_keywords)))
+        continue;                                 //别名
+      state = NONE;
+    }
+    //ON DUPLICATE KEY UPDATE、FOR UPDATE后面不是表
+    if (isOneOf(word, table_keywords) && !(word == "update" && (prev == "key" || prev == "for"))) {
+      state = EXPECT;
+      list = word != "into" && word != "to";
+    }
+    prev.swap(word);
+  }
+}
+
+std::string QueryCache::normalize(std::string_view sql) {
+  std::string out;
+  out.reserve(sql.size());
+  bool space = false;
+  size_t pos = 0;
+  while (pos < sql.size()) {
+    char c = sql[pos];
+    if (isspace((unsigned char)c)) {
+      space = true;
+      pos++;
+      continue;
+    }
+    if (space && !out.empty())
+      out += ' ';
+    space = false;
+    if (c == '\'' || c == '"' || c == '`') {
+      size_t end = skipQuoted(sql, pos);
+      out.append(sql.data() + pos, end - pos);
+      pos = end;
+    } else {
+      out += c;
+      pos++;
+    }
+  }
+  while (!out.empty() && (out.back() == ';' || out.back() == ' '))
+    out.pop_back();
+  return out;
+}
+/*
+ * 按分号分开多条语句，字符串、注释里的分号不算
+ */
+static void splitStatements(std::string_view sql, std::vector<std::string_view>& out) {
+  size_t begin = 0, pos = 0;
+  while (pos < sql.size()) {
+    char c = sql[pos];
+    if (c == '\'' || c == '"' || c == '`') {
+      pos = skipQuoted(sql, pos);
+      continue;
+    }
+    size_t end = skipComment(sql, pos);
+    if (end != pos) {
+      pos = end;
+      continue;
+    }
+    if (c == ';') {
+      out.push_back(sql.substr(begin, pos - begin));
+      begin = pos + 1;
+    }
+    pos++;
+  }
+  if (begin < sql.size())
+    out.push_back(sql.substr(begin));
+}
+
+//每次执行结果可能不一样、和会话有关或者有副作用的函数，后面跟着左括号才算
+static const char* const volatile_functions[] = {
+  "now", "sysdate", "curdate", "curtime", "unix_timestamp", "utc_date", "utc_time", "utc_timestamp",
+  "current_date", "current_time", "current_timestamp", "localtime", "localtimestamp", "rand", "random_bytes",
+  "uuid", "uuid_short", "last_insert_id", "found_rows", "row_count", "connection_id", "database", "schema",
+  "user", "current_user", "session_user", "system_user", "current_role", "get_lock", "release_lock",
+  "release_all_locks", "is_free_lock", "is_used_lock", "sleep", "benchmark", "load_file", "master_pos_wait",
+  "source_pos_wait", "wait_for_executed_gtid_set", "nextval", "lastval", NULL
+};
+//不带括号也是取当前值的关键字
+static const char* const volatile_keywords[] = {
+  "current_date", "current_time", "current_timestamp", "localtime", "localtimestamp", "utc_date", "utc_time",
+  "utc_timestamp", "current_user", "current_role", "sql_no_cache", NULL
+};
+/*
+ * 能不能缓存：要读到表(写了才知道失效)，不读@变量、@@系统变量，
+ * 不调用上面的函数，不读information_schema、performance_schema(一直在变)。
+ */
+bool QueryCache::cacheable(std::string_view sql) {
+  std::vector<std::string> names;
+  tables(sql, names);
+  if (names.empty())
+    return false;
+  size_t pos = 0;
+  std::string word, next;
+  bool more = nextToken(sql, pos, word);
+  while (more) {
+    more = nextToken(sql, pos, next);
+    if (word == "@" || isOneOf(word, volatile_keywords) ||
+        (more && next == "(" && isOneOf(word, volatile_functions)) ||
+        word.compare(0, 18, "information_schema") == 0 || word.compare(0, 18, "performance_schema") == 0)
+      return false;
+    word.swap(next);
+  }
+  return true;
+}
+
+QueryCache::QueryCache(MysqlPool* _pool, size_t _max_bytes, uint64_t _ttl_ms)
+  : pool(_pool),
+    max_bytes(_max_bytes),
+    ttl_ms(_ttl_ms),
+    clear_generation(0),
+    used_bytes(0) {
+  memset(&stats, 0, sizeof(stats));
+  pool->setExecuteHook([this](MysqlConnection* conn, const char* sql) { onExecute(conn, sql); });
+  pool->setCloseHook([this](MysqlConnection* conn) { onClose(conn); });
+}
+
+QueryCache::~QueryCache() {
+  pool->setExecuteHook(MysqlPool::ExecuteHook());
+  pool->setCloseHook(MysqlPool::CloseHook());
+}
+
+QueryCache::Result QueryCache::query(const char* sql, uint64_t ttl) {
+  if (!MysqlCluster::isRead(sql)) {
+    std::shared_ptr<ResultSet> result = std::make_shared<ResultSet>();
+    return pool->query(sql, *result) ? result : Result();
+  }
+  return get(normalize(sql), sql, ttl, [&](ResultSet& result) { return pool->query(sql, result); });
+}
+
+QueryCache::Result QueryCache::execute(const char* sql, const SqlParam* params, size_t count, uint64_t ttl) {
+  if (!MysqlCluster::isRead(sql)) {
+    std::shared_ptr<ResultSet> result = std::make_shared<ResultSet>();
+    return pool->execute(sql, params, count, *result) ? result : Result();
+  }
+  std::string key = normalize(sql);
+  key += '\0';
+  for (size_t i = 0; i < count; i++)
+    params[i].appendKey(key);
+  return get(key, sql, ttl, [&](ResultSet& result) { return pool->execute(sql, params, count, result); });
+}
+/*
+ * 命中直接返回；同一个键正在查就等它；否则自己查。命中时不用解析语句，表只在没命中时找。
+ * 不能缓存的语句从来不放进来，总是走到没命中这里，直接执行，也不和别的线程合并。
+ * 查之前记下各个表被写的次数，查完还一样才放进缓存，不然结果可能是写之前的。
+ * 失败的结果不缓存，等着的线程也拿到失败。
+ */
+QueryCache::Result QueryCache::get(const std::string& key, std::string_view sql, uint64_t ttl,
+                                   const std::function<bool(ResultSet& result)>& load) {
+  std::unique_lock<std::mutex> guard(lock);
+  std::unordered_map<std::string_view, List::iterator>::iterator it = index.find(key);
+  if (it != index.end()) {
+    List::iterator entry = it->second;
+    if (steadyMs() < entry->expires_ms) {
+      lru.splice(lru.begin(), lru, entry);
+      stats.hits++;
+      return entry->result;
+    }
+    erase(entry);
+    stats.expirations++;
+  }
+  std::unordered_map<std::string, std::shared_ptr<Flight> >::iterator f = flights.find(key);
+  if (f != flights.end()) {
+    std::shared_ptr<Flight> flight = f->second;
+    stats.shared++;
+    flight->cond.wait(guard, [&]() { return flight->done; });
+    return flight->result;
+  }
+  if (!cacheable(sql)) {
+    stats.bypassed++;
+    guard.unlock();
+    std::shared_ptr<ResultSet> result = std::make_shared<ResultSet>();
+    return load(*result) ? result : Result();
+  }
+  stats.misses++;
+  std::shared_ptr<Flight> flight = std::make_shared<Flight>();
+  tables(sql, flight->tables);
+  const std::vector<std::string>& names = flight->tables;
+  flights.emplace(key, flight);
+  std::vector<uint64_t> before, after;
+  generationsOf(names, before);
+  uint64_t cleared = clear_generation;
+  guard.unlock();
+
+  std::shared_ptr<ResultSet> result = std::make_shared<ResultSet>();
+  bool ok = load(*result);
+
+  guard.lock();
+  f = flights.find(key);
+  if (f != flights.end() && f->second == flight)
+    flights.erase(f);
+  if (ok) {
+    flight->result = result;
+    generationsOf(names, after);
+    if (cleared == clear_generation && before == after)
+      store(key, names, flight->result, steadyMs() + (ttl ? ttl : ttl_ms));
+    else
+      stats.stale++;
+  }
+  flight->done = true;
+  flight->cond.notify_all();
+  return flight->result;
+}
+
+void QueryCache::generationsOf(const std::vector<std::string>& names, std::vector<uint64_t>& out) {
+  out.resize(names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    std::unordered_map<std::string, uint64_t>::iterator it = generations.find(names[i]);
+    out[i] = it == generations.end() ? 0 : it->second;
+  }
+}
+/*
+ * 一个结果超过预算的四分之一就不缓存，免得为它挤掉一大片
+ */
+void QueryCache::store(const std::string& key, const std::vector<std::string>& names, const Result& result,
+                       uint64_t expires_ms) {
+  size_t bytes = sizeof(Entry) + result->memoryUsage() + key.size() * 2;
+  for (size_t i = 0; i < names.size(); i++)
+    bytes += names[i].size() + key.size();
+  if (bytes > max_bytes / 4)
+    return;
+  std::unordered_map<std::string_view, List::iterator>::iterator it = index.find(key);
+  if (it != index.end())
+    erase(it->second);
+  while (!lru.empty() && used_bytes + bytes > max_bytes) {
+    erase(std::prev(lru.end()));
+    stats.evictions++;
+  }
+  lru.emplace_front();
+  Entry& entry = lru.front();
+  entry.key = key;
+  entry.result = result;
+  entry.expires_ms = expires_ms;
+  entry.bytes = bytes;
+  entry.tables = names;
+  std::string_view view(entry.key);
+  index.emplace(view, lru.begin());
+  for (size_t i = 0; i < names.size(); i++)
+    by_table[names[i]].insert(view);
+  used_bytes += bytes;
+}
+
+void QueryCache::erase(List::iterator entry) {
+  std::string_view view(entry->key);
+  for (size_t i = 0; i < entry->tables.size(); i++) {
+    std::unordered_map<std::string, std::unordered_set<std::string_view> >::iterator t =
+        by_table.find(entry->tables[i]);
+    if (t != by_table.end()) {
+      t->second.erase(view);
+      if (t->second.empty())
+        by_table.erase(t);
+    }
+  }
+  index.erase(view);
+  used_bytes -= entry->bytes;
+  lru.erase(entry);
+}
+/*
+ * 正在查这个表的查询也不让新来的等了，它们查完的结果不会放进缓存
+ */
+void QueryCache::invalidateLocked(const std::string& table) {
+  generations[table]++;
+  std::unordered_map<std::string, std::unordered_set<std::string_view> >::iterator t = by_table.find(table);
+  if (t != by_table.end()) {
+    std::vector<std::string_view> keys(t->second.begin(), t->second.end());
+    for (size_t i = 0; i < keys.size(); i++)
+      erase(index[keys[i]]);
+    stats.invalidations += keys.size();
+  }
+  for (std::unordered_map<std::string, std::shared_ptr<Flight> >::iterator f = flights.begin(); f != flights.end(); ) {
+    const std::vector<std::string>& names = f->second->tables;
+    if (std::find(names.begin(), names.end(), table) != names.end())
+      f = flights.erase(f);
+    else
+      ++f;
+  }
+}
+
+void QueryCache::clearLocked() {
+  stats.invalidations += lru.size();
+  index.clear();
+  by_table.clear();
+  lru.clear();
+  used_bytes = 0;
+  clear_generation++;
+  flights.clear();
+}
+
+void QueryCache::invalidate(std::string_view table) {
+  std::string name;
+  for (size_t i = 0; i < table.size(); i++)
+    name += tolower((unsigned char)table[i]);
+  std::lock_guard<std::mutex> guard(lock);
+  invalidateLocked(name);
+}
+
+void QueryCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  clearLocked();
+}
+/*
+ * 连接池每执行完一条语句调用一次，在执行语句的线程上。
+ * 只读和不改数据的语句直接返回，不加锁。
+ */
+void QueryCache::onExecute(MysqlConnection* conn, const char* sql) {
+  static const char* const harmless[] = {
+    "select", "show", "desc", "describe", "explain", "set", "use", "do", "savepoint", "release", "lock",
+    "unlock", "help", NULL
+  };
+  std::vector<std::string_view> statements;
+  splitStatements(sql, statements);
+  std::vector<std::string> written;
+  bool all = false, begin = false, end = false;
+  std::string first;
+  for (size_t i = 0; i < statements.size(); i++) {
+    size_t pos = 0;
+    if (!nextToken(statements[i], pos, first) || isOneOf(first, harmless))
+      continue;
+    if (first == "begin" || first == "start") {
+      begin = true;
+    } else if (first == "commit" || first == "rollback") {
+      end = true;
+    } else if (first == "call") {
+      all = true;
+    } else {
+      size_t n = written.size();
+      tables(statements[i], written);
+      if (written.size() == n)
+        all = true;                               //不知道写了哪个表
+    }
+  }
+  if (!all && !begin && !end && written.empty())
+    return;
+  std::lock_guard<std::mutex> guard(lock);
+  if (all)
+    clearLocked();
+  for (size_t i = 0; i < written.size() && !all; i++)
+    invalidateLocked(written[i]);
+  if (begin)
+    transactions[conn];
+  std::unordered_map<MysqlConnection*, std::vector<std::string> >::iterator t = transactions.find(conn);
+  if (t == transactions.end())
+    return;
+  if (end) {
+    //事务中间别的连接可能又把提交之前的结果读进来了
+    for (size_t i = 0; i < t->second.size(); i++)
+      invalidateLocked(t->second[i]);
+    transactions.erase(t);
+  } else {
+    t->second.insert(t->second.end(), written.begin(), written.end());
+  }
+}
+/*
+ * 事务没结束连接就关掉了：一般是回滚了，但断在COMMIT上时不知道提交了没有，写过的表都失效。
+ * 不删掉的话，同一个地址上新建的连接会接着用这条记录。
+ */
+void QueryCache::onClose(MysqlConnection* conn) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::unordered_map<MysqlConnection*, std::vector<std::string> >::iterator t = transactions.find(conn);
+  if (t == transactions.end())
+    return;
+  for (size_t i = 0; i < t->second.size(); i++)
+    invalidateLocked(t->second[i]);
+  transactions.erase(t);
+}
+
+QueryCacheStats QueryCache::getStats() {
+  std::lock_guard<std::mutex> guard(lock);
+  QueryCacheStats s = stats;
+  s.entries = lru.size();
+  s.bytes = used_bytes;
+  return s;
+}
+
+}
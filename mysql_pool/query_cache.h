@@ -0,0 +1,120 @@
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+#include "mysql_pool.h"
+
+#define MYSQL_CACHE_BYTES (64 << 20)              //缓存的结果最多占这么多内存
+#define MYSQL_CACHE_TTL_MS 60000                  //缓存的结果默认的有效期
+
+namespace ekko{
+
+/*
+ * QueryCache的统计，getStats时的快照
+ */
+struct QueryCacheStats {
+  uint64_t hits;                                  //直接从缓存拿到的次数
+  uint64_t misses;                                //去数据库查的次数
+  uint64_t bypassed;                              //不能缓存(比如NOW()、@变量、没有表)直接执行的次数
+  uint64_t shared;                                //同一个查询正在查，等它的结果的次数
+  uint64_t evictions;                             //内存不够挤掉的结果数
+  uint64_t expirations;                           //过期丢掉的结果数
+  uint64_t invalidations;                         //写了表以后丢掉的结果数
+  uint64_t stale;                                 //查的过程中表被写了，没有放进缓存的结果数
+  size_t entries;                                 //当前缓存的结果数
+  size_t bytes;                                   //当前缓存占的内存
+};
+
+/*
+ * 查询结果的缓存，放在MysqlPool前面。
+ * 读语句(见MysqlCluster::isRead)的结果按规范化的SQL文本(预处理语句再加上参数)缓存，
+ * 但是调用NOW()、RAND()、GET_LOCK()之类的函数、读@变量、没有读表的语句每次都执行(见cacheable)。
+ * 结果是只读的ResultSet，命中时只是一次哈希查找加一次引用计数。
+ * 内存按LRU控制在max_bytes以内，每个结果有有效期。
+ * 同一个查询同时没有命中时只有一个线程去查，其他的等它的结果。
+ * 每个结果记着语句里读到的表(FROM、JOIN后面的)，经过这个连接池的写语句执行完后，
+ * 写到的表上的结果全部丢掉；事务里的写在COMMIT、ROLLBACK时再丢一次，事务中间被读进来的旧结果也清掉。
+ * 不经过这个连接池的写(别的程序、存储过程里的写)看不到，只能靠有效期，或者调用invalidate。
+ * 找不出写了哪个表的语句(比如CALL)清空整个缓存。
+ * 一个连接池只能有一个QueryCache，它占用了连接池的ExecuteHook和CloseHook。
+ * 例如：
+ *   QueryCache cache(pool);
+ *   QueryCache::Result rs = cache.query("select name from city where id = 1");
+ *   if (rs) std::cout << rs->getString(0, 0);
+ */
+class QueryCache {
+  public:
+    typedef std::shared_ptr<const ResultSet> Result;
+
+    QueryCache(MysqlPool* pool, size_t max_bytes = MYSQL_CACHE_BYTES, uint64_t ttl_ms = MYSQL_CACHE_TTL_MS);
+    ~QueryCache();
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    Result query(const char* sql, uint64_t ttl_ms = 0);  //失败返回空的；ttl_ms为0用默认的有效期；写语句直接执行
+    Result execute(const char* sql, const SqlParam* params, size_t count, uint64_t ttl_ms = 0); //预处理语句
+    void invalidate(std::string_view table);      //丢掉读了这个表的结果
+    void clear();                                 //丢掉所有结果
+    QueryCacheStats getStats();
+
+    static std::string normalize(std::string_view sql);  //去掉多余的空白和结尾的分号，字符串里的不动
+    static void tables(std::string_view sql, std::vector<std::string>& out); //语句用到的表，小写，去掉库名
+    static bool cacheable(std::string_view sql);  //读语句的结果能不能缓存
+
+  private:
+    struct Entry {
+      std::string key;
+      Result result;
+      uint64_t expires_ms;
+      size_t bytes;
+      std::vector<std::string> tables;
+    };
+    typedef std::list<Entry> List;
+
+    struct Flight {                               //正在查的一个查询
+      std::condition_variable cond;
+      bool done;
+      Result result;
+      std::vector<std::string> tables;
+
+      Flight() : done(false) {}
+    };
+
+    Result get(const std::string& key, std::string_view sql, uint64_t ttl_ms,
+               const std::function<bool(ResultSet& result)>& load);
+    void onExecute(MysqlConnection* conn, const char* sql); //连接池执行完一条语句
+    void onClose(MysqlConnection* conn);          //连接池关掉一个连接
+    void store(const std::string& key, const std::vector<std::string>& tables, const Result& result,
+               uint64_t expires_ms);              //以下要持有lock
+    void erase(List::iterator it);
+    void invalidateLocked(const std::string& table);
+    void clearLocked();
+    void generationsOf(const std::vector<std::string>& tables, std::vector<uint64_t>& out);
+
+  private:
+    MysqlPool* pool;
+    size_t max_bytes;
+    uint64_t ttl_ms;
+    std::mutex lock;
+    List lru;                                     //队头是最近用过的
+    std::unordered_map<std::string_view, List::iterator> index;    //键指向Entry里的key
+    std::unordered_map<std::string, std::unordered_set<std::string_view> > by_table; //表上的结果
+    std::unordered_map<std::string, uint64_t> generations; //表被写的次数，判断查的过程中有没有被写
+    uint64_t clear_generation;                    //clear的次数
+    std::unordered_map<std::string, std::shared_ptr<Flight> > flights;
+    std::unordered_map<MysqlConnection*, std::vector<std::string> > transactions; //事务里写过的表
+    size_t used_bytes;
+    QueryCacheStats stats;
+};
+
+}
+#endif
@@ -0,0 +1,194 @@
+#include "result_set.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+namespace ekko {
+
+/*
+ * 列名的哈希，FNV-1a
+ */
+static size_t hashName(std::string_view name) {
+  size_t h = 2166136261u;
+  for (size_t i = 0; i < name.size(); i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+ResultSet::ResultSet()
+  : column_count(0),
+    affected_rows(0),
+    insert_id(0) {}
+
+void ResultSet::clear() {
+  columns.clear();
+  column_count = 0;
+  arena.clear();
+  cells.clear();
+  name_slots.clear();
+  affected_rows = 0;
+  insert_id = 0;
+}
+
+void ResultSet::clearRows() {
+  arena.clear();
+  cells.clear();
+  affected_rows = 0;
+  insert_id = 0;
+}
+
+void ResultSet::setColumns(std::vector<Column> cols) {
+  columns = std::move(cols);
+  column_count = columns.size();
+  arena.clear();
+  cells.clear();
+  buildIndex();
+}
+
+/*
+ * bytes 为所有单元格数据的总长度，即各行 mysql_fetch_lengths 之和，
+ * 每个单元格的 '\0' 在这里另算。
+ */
+void ResultSet::reserve(size_t rows, size_t bytes) {
+  cells.reserve(rows * column_count);
+  arena.reserve(bytes + rows * column_count);
+}
+
+/*
+ * 把一行拷贝到 arena 的末尾。lengths 为 NULL 时用 strlen 求长度。
+ * arena 的偏移是 32 位的，一个结果集最多 4GB。
+ */
+void ResultSet::appendRow(const char* const* row, const unsigned long* lengths) {
+  for (int i = 0; i < column_count; i++) {
+    Cell c;
+    c.offset = arena.size();
+    if (row[i] == NULL) {
+      c.length = NULL_LENGTH;
+    } else {
+      size_t len = lengths ? lengths[i] : strlen(row[i]);
+      c.length = len;
+      arena.insert(arena.end(), row[i], row[i] + len);
+      arena.push_back('\0');
+    }
+    cells.push_back(c);
+  }
+}
+
+/*
+ * 开放寻址，槽数为列数两倍以上的 2 的幂，线性探测。
+ * 重名的列只记第一个，和 SQL 里按名字取值的习惯一致。
+ */
+void ResultSet::buildIndex() {
+  size_t size = 8;
+  while (size < (size_t)column_count * 2)
+    size <<= 1;
+  name_slots.assign(size, -1);
+  for (int i = 0; i < column_count; i++) {
+    size_t slot = hashName(columns[i].name) & (size - 1);
+    while (name_slots[slot] >= 0 && columns[name_slots[slot]].name != columns[i].name)
+      slot = (slot + 1) & (size - 1);
+    if (name_slots[slot] < 0)
+      name_slots[slot] = i;
+  }
+}
+
+int ResultSet::columnIndex(std::string_view name) const {
+  if (name_slots.empty())
+    return -1;
+  size_t mask = name_slots.size() - 1;
+  size_t slot = hashName(name) & mask;
+  while (name_slots[slot] >= 0) {
+    if (columns[name_slots[slot]].name == name)
+      return name_slots[slot];
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+
+size_t ResultSet::memoryUsage() const {
+  size_t bytes = arena.capacity() + cells.capacity() * sizeof(Cell)
+               + name_slots.capacity() * sizeof(int) + columns.capacity() * sizeof(Column);
+  for (size_t i = 0; i < columns.size(); i++)
+    bytes += columns[i].name.capacity();
+  return bytes;
+}
+
+std::string_view ResultSet::getString(size_t row, int col) const {
+  const Cell& c = cell(row, col);
+  if (c.length == NULL_LENGTH)
+    return std::string_view();
+  return std::string_view(arena.data() + c.offset, c.length);
+}
+
+const char* ResultSet::getCString(size_t row, int col) const {
+  const Cell& c = cell(row, col);
+  if (c.length == NULL_LENGTH)
+    return NULL;
+  return arena.data() + c.offset;
+}
+
+/*
+ * 文本协议下数值也是字符串，整个单元格都要是数字才算转换成功。
+ */
+int64_t ResultSet::getInt64(size_t row, int col, int64_t def) const {
+  const char* s = getCString(row, col);
+  if (s == NULL || *s == '\0')
+    return def;
+  char* end;
+  errno = 0;
+  long long v = strtoll(s, &end, 10);
+  if (*end != '\0' || errno == ERANGE)
+    return def;
+  return v;
+}
+
+uint64_t ResultSet::getUint64(size_t row, int col, uint64_t def) const {
+  const char* s = getCString(row, col);
+  if (s == NULL || *s == '\0' || *s == '-')
+    return def;
+  char* end;
+  errno = 0;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (*end != '\0' || errno == ERANGE)
+    return def;
+  return v;
+}
+
+double ResultSet::getDouble(size_t row, int col, double def) const {
+  const char* s = getCString(row, col);
+  if (s == NULL || *s == '\0')
+    return def;
+  char* end;
+  double v = strtod(s, &end);
+  if (*end != '\0')
+    return def;
+  return v;
+}
+
+bool ResultSet::isNull(size_t row, std::string_view name) const {
+  int col = columnIndex(name);
+  return col < 0 || isNull(row, col);
+}
+
+std::string_view ResultSet::getString(size_t row, std::string_view name) const {
+  int col = columnIndex(name);
+  return col < 0 ? std::string_view() : getString(row, col);
+}
+
+int64_t ResultSet::getInt64(size_t row, std::string_view name, int64_t def) const {
+  int col = columnIndex(name);
+  return col < 0 ? def : getInt64(row, col, def);
+}
+
+uint64_t ResultSet::getUint64(size_t row, std::string_view name, uint64_t def) const {
+  int col = columnIndex(name);
+  return col < 0 ? def : getUint64(row, col, def);
+}
+
+double ResultSet::getDouble(size_t row, std::string_view name, double def) const {
+  int col = columnIndex(name);
+  return col < 0 ? def : getDouble(row, col, def);
+}
+
+}
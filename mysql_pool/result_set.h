@@ -0,0 +1,86 @@
+#ifndef RESULTSET_H
+#define RESULTSET_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ekko{
+
+/*
+ * 查询结果，按列序保存，自己持有数据。
+ * 所有单元格的内容连续拷贝在一块内存(arena)里，每个单元格以 '\0' 结尾，
+ * 另有一个 (偏移, 长度) 的下标数组，长度为 NULL_LENGTH 表示 SQL NULL。
+ * 预先 reserve 好行数和字节数时，追加行不会再分配内存。
+ * 列名到列号的查找用一个开放寻址的小哈希表，O(1)。
+ * 构建之后只读，可以在多个线程间共享。
+ */
+class ResultSet {
+  public:
+    struct Column {
+      std::string name;
+      int type;                                   //enum_field_types
+      unsigned int flags;                         //NOT_NULL_FLAG 等
+    };
+
+    static const uint32_t NULL_LENGTH = 0xffffffffu;
+
+    ResultSet();
+    ResultSet(ResultSet&&) = default;
+    ResultSet& operator=(ResultSet&&) = default;
+    ResultSet(const ResultSet&) = default;
+    ResultSet& operator=(const ResultSet&) = default;
+
+    void clear();                                 //清空，保留已分配的内存
+    void clearRows();                             //只清掉行，列不变，保留已分配的内存
+    void setColumns(std::vector<Column> columns); //设置列，清空已有的行
+    void reserve(size_t rows, size_t bytes);      //预留行数和数据字节数(不含结尾的 '\0')
+    void appendRow(const char* const* row, const unsigned long* lengths); //row[i] 为 NULL 表示 SQL NULL
+    void setAffectedRows(uint64_t n) { affected_rows = n; }
+    void setInsertId(uint64_t id) { insert_id = id; }
+
+    size_t rowCount() const { return column_count ? cells.size() / column_count : 0; }
+    int columnCount() const { return column_count; }
+    bool empty() const { return cells.empty(); }
+    const Column& column(int col) const { return columns[col]; }
+    int columnIndex(std::string_view name) const; //没有这一列返回 -1
+    uint64_t affectedRows() const { return affected_rows; }
+    uint64_t insertId() const { return insert_id; }
+    size_t memoryUsage() const;                   //arena、下标和列信息占用的字节数
+
+    bool isNull(size_t row, int col) const { return cell(row, col).length == NULL_LENGTH; }
+    std::string_view getString(size_t row, int col) const; //NULL 返回空串
+    const char* getCString(size_t row, int col) const;     //NULL 返回 NULL，否则以 '\0' 结尾
+    int64_t getInt64(size_t row, int col, int64_t def = 0) const;    //NULL 或不是整数时返回 def
+    uint64_t getUint64(size_t row, int col, uint64_t def = 0) const;
+    double getDouble(size_t row, int col, double def = 0) const;
+
+    //按列名取值，列不存在时同 NULL
+    bool isNull(size_t row, std::string_view name) const;
+    std::string_view getString(size_t row, std::string_view name) const;
+    int64_t getInt64(size_t row, std::string_view name, int64_t def = 0) const;
+    uint64_t getUint64(size_t row, std::string_view name, uint64_t def = 0) const;
+    double getDouble(size_t row, std::string_view name, double def = 0) const;
+
+  private:
+    struct Cell {
+      uint32_t offset;                            //在 arena 中的偏移
+      uint32_t length;                            //NULL_LENGTH 为 SQL NULL
+    };
+
+    const Cell& cell(size_t row, int col) const { return cells[row * column_count + col]; }
+    void buildIndex();                            //建列名哈希表
+
+  private:
+    std::vector<Column> columns;
+    int column_count;
+    std::vector<char> arena;                      //所有单元格的数据
+    std::vector<Cell> cells;                      //按行、再按列
+    std::vector<int> name_slots;                  //列名哈希表，-1 为空位，大小为 2 的幂
+    uint64_t affected_rows;
+    uint64_t insert_id;
+};
+
+}
+#endif
@@ -0,0 +1,324 @@
+#include "statement.h"
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+namespace ekko {
+
+SqlParam SqlParam::blob(const void* data, size_t len) {
+  SqlParam p(std::string_view((const char*)data, len));
+  p.type = MYSQL_TYPE_BLOB;
+  return p;
+}
+
+/*
+ * 输入参数的缓冲区 libmysql 只读不写，去掉 const 没有问题。
+ */
+void SqlParam::bind(MYSQL_BIND& b) const {
+  memset(&b, 0, sizeof(b));
+  b.buffer_type = type;
+  b.is_unsigned = is_unsigned;
+  switch (type) {
+    case MYSQL_TYPE_NULL:
+      break;
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_DOUBLE:
+      b.buffer = (void*)&value;
+      break;
+    default:
+      b.buffer = (void*)str;
+      b.buffer_length = length;
+      b.length = (unsigned long*)&length;
+      break;
+  }
+}
+
+/*
+ * 没有连接时的转义，和 mysql_escape_string 一样只适用于单字节兼容的字符集(utf8、latin1等)
+ */
+static unsigned long escapeString(char* to, const char* from, unsigned long length) {
+  char* out = to;
+  for (unsigned long i = 0; i < length; i++) {
+    char c = from[i], escaped = 0;
+    switch (c) {
+      case 0: escaped = '0'; break;
+      case '\n': escaped = 'n'; break;
+      case '\r': escaped = 'r'; break;
+      case '\032': escaped = 'Z'; break;
+      case '\\': case '\'': case '"': escaped = c; break;
+    }
+    if (escaped) {
+      *out++ = '\\';
+      *out++ = escaped;
+    } else {
+      *out++ = c;
+    }
+  }
+  return out - to;
+}
+
+/*
+ * 拼多行 INSERT 时用。浮点数用 %.17g，读回来是同一个值；
+ * NaN、无穷在 SQL 里没有对应的字面量，写成 NULL。
+ */
+void SqlParam::appendLiteral(MYSQL* conn, std::string& sql) const {
+  char buf[32];
+  switch (type) {
+    case MYSQL_TYPE_NULL:
+      sql += "NULL";
+      break;
+    case MYSQL_TYPE_LONGLONG:
+      if (is_unsigned)
+        snprintf(buf, sizeof(buf), "%llu", value.u);
+      else
+        snprintf(buf, sizeof(buf), "%lld", value.i);
+      sql += buf;
+      break;
+    case MYSQL_TYPE_DOUBLE:
+      if (value.d != value.d || value.d - value.d != 0) {
+        sql += "NULL";
+      } else {
+        snprintf(buf, sizeof(buf), "%.17g", value.d);
+        sql += buf;
+      }
+      break;
+    default: {
+      size_t at = sql.size();
+      sql.resize(at + length * 2 + 3);            //转义最多把长度翻倍；带引号的版本在 NO_BACKSLASH_ESCAPES 下也能用
+      sql[at] = '\'';
+      unsigned long n = conn ? mysql_real_escape_string_quote(conn, &sql[at + 1], str, length, '\'')
+                             : escapeString(&sql[at + 1], str, length);
+      sql[at + 1 + n] = '\'';
+      sql.resize(at + n + 2);
+      break;
+    }
+  }
+}
+
+/*
+ * 驱动没有预处理语句时用。引号里和注释里的 ? 不是参数
+ */
+bool SqlParam::render(MYSQL* conn, std::string_view sql, const SqlParam* params, size_t count, std::string& out) {
+  out.clear();
+  out.reserve(sql.size() + count * 16);
+  size_t used = 0, pos = 0;
+  while (pos < sql.size()) {
+    char c = sql[pos];
+    size_t end = pos + 1;
+    if (c == '\'' || c == '"' || c == '`') {
+      while (end < sql.size() && sql[end] != c)
+        end += sql[end] == '\\' && c != '`' ? 2 : 1;
+      end = std::min(end + 1, sql.size());
+    } else if (c == '#' || (c == '-' && sql.substr(pos, 3) == "-- ")) {
+      end = std::min(sql.find('\n', pos), sql.size());
+    } else if (c == '/' && sql.substr(pos, 2) == "/*") {
+      end = sql.find("*/", pos + 2);
+      end = end == std::string_view::npos ? sql.size() : end + 2;
+    } else if (c == '?') {
+      if (used == count)
+        return false;
+      params[used++].appendLiteral(conn, out);
+      pos = end;
+      continue;
+    }
+    out.append(sql.data() + pos, end - pos);
+    pos = end;
+  }
+  return used == count;
+}
+
+/*
+ * 类型一个字节，数值按内存里的字节，字符串前面加长度，拼起来不会有歧义
+ */
+void SqlParam::appendKey(std::string& key) const {
+  key += (char)type;
+  key += is_unsigned ? 'u' : 's';
+  switch (type) {
+    case MYSQL_TYPE_NULL:
+      break;
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_DOUBLE:
+      key.append((const char*)&value, sizeof(value));
+      break;
+    default:
+      key.append((const char*)&length, sizeof(length));
+      key.append(str, length);
+      break;
+  }
+}
+
+StatementCache::StatementCache(size_t _capacity)
+  : capacity(_capacity > 0 ? _capacity : 1),
+    thread_id(0),
+    hit_count(0),
+    miss_count(0) {}
+
+StatementCache::~StatementCache() {
+  clear();
+}
+
+void StatementCache::clear() {
+  for (List::iterator it = lru.begin(); it != lru.end(); ++it)
+    mysql_stmt_close(it->second);
+  index.clear();
+  lru.clear();
+}
+
+void StatementCache::setCapacity(size_t n) {
+  capacity = n > 0 ? n : 1;
+  while (lru.size() > capacity)
+    evict();
+}
+
+void StatementCache::evict() {
+  index.erase(lru.back().first);
+  mysql_stmt_close(lru.back().second);
+  lru.pop_back();
+}
+
+void StatementCache::remove(std::string_view sql) {
+  std::unordered_map<std::string_view, List::iterator>::iterator it = index.find(sql);
+  if (it == index.end())
+    return;
+  List::iterator node = it->second;
+  index.erase(it);
+  mysql_stmt_close(node->second);
+  lru.erase(node);
+}
+
+/*
+ * 命中时只是一次哈希查找和一次链表挪动，不分配内存。
+ * 没命中就 prepare 一个新语句放到表头，超过容量时关掉表尾的。
+ * 打开 STMT_ATTR_UPDATE_MAX_LENGTH，取结果时可以按每列的最大长度分配缓冲区。
+ */
+MYSQL_STMT* StatementCache::get(MYSQL* conn, std::string_view sql, unsigned int* err) {
+  unsigned long id = mysql_thread_id(conn);
+  if (id != thread_id) {
+    //重连过了，旧的语句句柄在新会话里不存在
+    clear();
+    thread_id = id;
+  }
+  std::unordered_map<std::string_view, List::iterator>::iterator it = index.find(sql);
+  if (it != index.end()) {
+    hit_count++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+  }
+  miss_count++;
+  MYSQL_STMT* stmt = mysql_stmt_init(conn);
+  if (stmt == NULL) {
+    *err = mysql_errno(conn);
+    return NULL;
+  }
+  if (mysql_stmt_prepare(stmt, sql.data(), sql.size()) != 0) {
+    *err = mysql_stmt_errno(stmt);
+    std::cerr << mysql_stmt_error(stmt) << std::endl;
+    mysql_stmt_close(stmt);
+    return NULL;
+  }
+  my_bool on = 1;
+  mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &on);
+  lru.push_front(std::make_pair(std::string(sql), stmt));
+  index[lru.front().first] = lru.begin();
+  if (lru.size() > capacity)
+    evict();
+  return stmt;
+}
+
+/*
+ * 结果按字符串取回(libmysql 在客户端把二进制的值转成文本)，拷贝到 result 中，
+ * 和 MysqlPool::query 的结果一样按列序保存。
+ * 每列的缓冲区按 max_length 分配；万一被截断，再用 mysql_stmt_fetch_column 取完整的值。
+ */
+static bool fetchResult(MYSQL_STMT* stmt, MYSQL_RES* meta, ResultSet& result) {
+  unsigned int num_fields = mysql_num_fields(meta);
+  MYSQL_FIELD* fields = mysql_fetch_fields(meta);
+  std::vector<ResultSet::Column> columns(num_fields);
+  std::vector<size_t> offsets(num_fields + 1, 0);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    columns[i].name.assign(fields[i].name, fields[i].name_length);
+    columns[i].type = fields[i].type;
+    columns[i].flags = fields[i].flags;
+    //数值、日期转成文本的长度不一定算在 max_length 里，至少留 64 字节
+    size_t width = fields[i].max_length > 64 ? fields[i].max_length : 64;
+    offsets[i + 1] = offsets[i] + width + 1;
+  }
+  result.setColumns(std::move(columns));
+
+  std::vector<char> buffer(offsets[num_fields]);
+  std::vector<MYSQL_BIND> binds(num_fields);
+  std::vector<unsigned long> lengths(num_fields);
+  std::vector<my_bool> nulls(num_fields);
+  memset(binds.data(), 0, sizeof(MYSQL_BIND) * num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    binds[i].buffer_type = MYSQL_TYPE_STRING;
+    binds[i].buffer = buffer.data() + offsets[i];
+    binds[i].buffer_length = offsets[i + 1] - offsets[i];
+    binds[i].length = &lengths[i];
+    binds[i].is_null = &nulls[i];
+  }
+  if (mysql_stmt_bind_result(stmt, binds.data()) != 0)
+    return false;
+  result.reserve(mysql_stmt_num_rows(stmt), 0);
+
+  std::vector<const char*> row(num_fields);
+  std::vector<std::string> large(num_fields);
+  int rc;
+  while ((rc = mysql_stmt_fetch(stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED) {
+    for (unsigned int i = 0; i < num_fields; i++) {
+      row[i] = nulls[i] ? NULL : (const char*)binds[i].buffer;
+      if (rc == MYSQL_DATA_TRUNCATED && !nulls[i] && lengths[i] >= binds[i].buffer_length) {
+        MYSQL_BIND b = binds[i];
+        large[i].resize(lengths[i] + 1);
+        b.buffer = &large[i][0];
+        b.buffer_length = large[i].size();
+        if (mysql_stmt_fetch_column(stmt, &b, i, 0) != 0)
+          return false;
+        row[i] = large[i].data();
+      }
+    }
+    result.appendRow(row.data(), lengths.data());
+  }
+  return rc == MYSQL_NO_DATA;
+}
+
+/*
+ * 绑定参数，执行，取回全部结果。参数个数不对时不执行。
+ * 没有结果集的语句(INSERT、UPDATE等)只填 affectedRows 和 insertId。
+ */
+bool executeStatement(MYSQL_STMT* stmt, const SqlParam* params, size_t count, ResultSet& result) {
+  result.clear();
+  if (mysql_stmt_param_count(stmt) != count) {
+    std::cerr << "wrong number of parameters: " << count << ", expect "
+              << mysql_stmt_param_count(stmt) << std::endl;
+    return false;
+  }
+  MYSQL_BIND local[16];
+  std::vector<MYSQL_BIND> more;
+  MYSQL_BIND* binds = local;
+  if (count > sizeof(local) / sizeof(local[0])) {
+    more.resize(count);
+    binds = more.data();
+  }
+  for (size_t i = 0; i < count; i++)
+    params[i].bind(binds[i]);
+  if ((count > 0 && mysql_stmt_bind_param(stmt, binds) != 0) || mysql_stmt_execute(stmt) != 0) {
+    std::cerr << mysql_stmt_error(stmt) << std::endl;
+    return false;
+  }
+  MYSQL_RES* meta = mysql_stmt_result_metadata(stmt);
+  if (meta == NULL) {
+    result.setAffectedRows(mysql_stmt_affected_rows(stmt));
+    result.setInsertId(mysql_stmt_insert_id(stmt));
+    return true;
+  }
+  bool ok = mysql_stmt_store_result(stmt) == 0 && fetchResult(stmt, meta, result);
+  if (!ok)
+    std::cerr << mysql_stmt_error(stmt) << std::endl;
+  mysql_free_result(meta);
+  mysql_stmt_free_result(stmt);
+  return ok;
+}
+
+}
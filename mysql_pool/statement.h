@@ -0,0 +1,96 @@
+#ifndef STATEMENT_H
+#define STATEMENT_H
+
+#include <mysql/mysql.h>
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include "result_set.h"
+
+#define MYSQL_STMT_CACHE_SIZE 64                  //每个连接缓存的预处理语句数
+
+namespace ekko{
+
+/*
+ * 预处理语句的一个参数，按原本的类型用二进制协议发送，不转成字符串，也不用转义。
+ * 字符串只保存指针，参数要在执行完之前一直有效。
+ */
+class SqlParam {
+  public:
+    SqlParam() : type(MYSQL_TYPE_NULL), is_unsigned(false), str(NULL), length(0) { value.i = 0; }
+    SqlParam(std::nullptr_t) : SqlParam() {}
+    SqlParam(bool v) : SqlParam((long long)v) {}
+    SqlParam(int v) : SqlParam((long long)v) {}
+    SqlParam(long v) : SqlParam((long long)v) {}
+    SqlParam(long long v) : type(MYSQL_TYPE_LONGLONG), is_unsigned(false), str(NULL), length(0) { value.i = v; }
+    SqlParam(unsigned int v) : SqlParam((unsigned long long)v) {}
+    SqlParam(unsigned long v) : SqlParam((unsigned long long)v) {}
+    SqlParam(unsigned long long v) : type(MYSQL_TYPE_LONGLONG), is_unsigned(true), str(NULL), length(0) { value.u = v; }
+    SqlParam(float v) : SqlParam((double)v) {}
+    SqlParam(double v) : type(MYSQL_TYPE_DOUBLE), is_unsigned(false), str(NULL), length(0) { value.d = v; }
+    SqlParam(const char* s) : SqlParam(s ? std::string_view(s) : std::string_view()) { if (!s) type = MYSQL_TYPE_NULL; }
+    SqlParam(const std::string& s) : SqlParam(std::string_view(s)) {}
+    SqlParam(std::string_view s)
+      : type(MYSQL_TYPE_STRING), is_unsigned(false), str(s.data()), length(s.size()) { value.i = 0; }
+    static SqlParam blob(const void* data, size_t len);  //二进制数据
+
+    void bind(MYSQL_BIND& b) const;               //填好 b，b 指向本对象的数据
+    void appendLiteral(MYSQL* conn, std::string& sql) const; //写成 SQL 字面量追加到 sql，字符串按 conn 的字符集转义，conn 为 NULL 时按 mysql_escape_string 转义
+    static bool render(MYSQL* conn, std::string_view sql, const SqlParam* params, size_t count,
+                       std::string& out);         //把 ? 换成参数的字面量写到 out，个数不对返回 false
+    void appendKey(std::string& key) const;       //类型和值追加到 key，不同的参数得到不同的串，做缓存的键用
+
+  private:
+    enum_field_types type;
+    bool is_unsigned;
+    union {
+      long long i;
+      unsigned long long u;
+      double d;
+    } value;
+    const char* str;
+    unsigned long length;
+};
+
+/*
+ * 一个连接上预处理过的语句，按 SQL 文本做 LRU，满了就关掉最久没用的。
+ * 语句句柄属于服务端的会话，断线重连以后全部失效：
+ * get 时发现 mysql_thread_id 变了就清空，重新 prepare。
+ * 不加锁，同一时间只有拿着连接的线程用它。
+ */
+class StatementCache {
+  public:
+    explicit StatementCache(size_t capacity = MYSQL_STMT_CACHE_SIZE);
+    ~StatementCache();
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    MYSQL_STMT* get(MYSQL* conn, std::string_view sql, unsigned int* err); //没有就 prepare，失败返回 NULL，错误码放在 err
+    void remove(std::string_view sql);            //语句出错后丢掉，下次重新 prepare
+    void clear();                                 //关掉所有语句
+    void setCapacity(size_t n);
+    size_t size() const { return lru.size(); }
+    uint64_t hits() const { return hit_count; }
+    uint64_t misses() const { return miss_count; }
+
+  private:
+    typedef std::list<std::pair<std::string, MYSQL_STMT*> > List;
+
+    void evict();                                 //关掉最久没用的语句
+
+  private:
+    size_t capacity;
+    List lru;                                     //表头是最近用过的
+    std::unordered_map<std::string_view, List::iterator> index; //key 指向 lru 中的 SQL 文本
+    unsigned long thread_id;                      //这些语句所属的服务端会话
+    uint64_t hit_count;
+    uint64_t miss_count;
+};
+
+bool executeStatement(MYSQL_STMT* stmt, const SqlParam* params, size_t count, ResultSet& result); //执行并把结果拷贝到 result 中
+
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace ekko {
+
+/// @brief contiguous byte buffer with a read and a write index
+class Buffer {
+public:
+    Buffer(size_t init_size = 4096)
+        :buf_(init_size) {}
+
+    size_t ReadableBytes() const { return write_idx_ - read_idx_;}
+
+    size_t WritableBytes() const { return buf_.size() - write_idx_;}
+
+    const char* Peek() const { return &buf_[0] + read_idx_;}
+
+    /// @brief for parsers that rewrite what they have read in place
+    char* Peek() { return &buf_[0] + read_idx_;}
+
+    char* BeginWrite() { return &buf_[0] + write_idx_;}
+
+    void HasWritten(size_t n) { write_idx_ += n;}
+
+    void Retrieve(size_t n) {
+        if (n < ReadableBytes())
+            read_idx_ += n;
+        else
+            RetrieveAll();
+    }
+
+    void RetrieveAll() {
+        read_idx_ = write_idx_ = 0;
+    }
+
+    std::string RetrieveAllAsString() {
+        std::string str(Peek(), ReadableBytes());
+        RetrieveAll();
+        return str;
+    }
+
+    void Append(const char *data, size_t len) {
+        EnsureWritable(len);
+        memcpy(BeginWrite(), data, len);
+        write_idx_ += len;
+    }
+
+    void Append(const std::string &str) {
+        Append(str.data(), str.size());
+    }
+
+    /// @brief make room for len bytes, moving the readable bytes to the front first
+    void EnsureWritable(size_t len) {
+        if (WritableBytes() >= len)
+            return;
+        if (read_idx_ + WritableBytes() >= len) {
+            size_t readable = ReadableBytes();
+            memmove(&buf_[0], Peek(), readable);
+            read_idx_ = 0;
+            write_idx_ = readable;
+            return;
+        }
+        buf_.resize(write_idx_ + len);
+    }
+
+private:
+    std::vector<char> buf_;
+
+    size_t read_idx_ = 0;
+
+    size_t write_idx_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __CONNECTION_H__
+#define __CONNECTION_H__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unistd.h>
+#include "iobuf.h"
+#include "noncopyable.h"
+
+namespace ekko {
+
+/// @brief an open file shared by the sends reading from it, closed with the last reference
+class FileRef : Noncopyable {
+public:
+    typedef std::shared_ptr<FileRef> ptr;
+
+    explicit FileRef(int fd) :fd_(fd) {}
+
+    ~FileRef() { if (fd_ >= 0) close(fd_);}
+
+    int GetFd() const { return fd_;}
+
+private:
+    int fd_;
+};
+
+/// @brief a file range queued on a connection, with whatever was sent after it
+struct PendingFile {
+    FileRef::ptr file;
+    off_t offset;
+    size_t len;
+    IOBuf after;
+};
+
+/// @brief what a handler needs from a connection, whichever I/O backend owns it
+class Connection {
+public:
+    typedef std::shared_ptr<Connection> ptr;
+
+    virtual ~Connection() {}
+
+    /// @brief thread-safe, data is copied
+    virtual void Send(const char *data, size_t len) = 0;
+
+    void Send(const std::string &data) { Send(data.data(), data.size());}
+
+    /// @brief thread-safe, the blocks are shared rather than copied
+    virtual void Send(IOBuf &&buf) = 0;
+
+    /**
+     * @brief thread-safe, queue len bytes of file from offset behind what was
+     * sent before; they go from the page cache to the socket without a copy
+     * through user space
+    */
+    virtual void SendFile(const FileRef::ptr &file, off_t offset, size_t len) = 0;
+
+    /// @brief close once everything queued has been written
+    virtual void Shutdown() = 0;
+
+    /// @brief close right away
+    virtual void Close() = 0;
+
+    /**
+     * @brief thread-safe, close the connection once nothing has been read or
+     * written for ms, counted again on every bit of progress; 0 turns it off
+    */
+    virtual void SetIdleTimeout(uint64_t ms) = 0;
+
+    /**
+     * @brief when the loop woke up to what is being read, CLOCK_MONOTONIC
+     * ms; the time since is how long it waited behind the rest of the batch.
+     * Loop thread only
+    */
+    virtual uint64_t GetReceiveMs() const = 0;
+
+    /// @brief user data attached to the connection
+    void SetContext(const std::shared_ptr<void> &ctx) { context_ = ctx;}
+
+    const std::shared_ptr<void>& GetContext() const { return context_;}
+
+private:
+    std::shared_ptr<void> context_;
+};
+
+}
+
+#endif
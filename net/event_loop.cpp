@@ -0,0 +1,232 @@
+#include "event_loop.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define INIT_EVENTS 128
+
+namespace ekko {
+
+static thread_local EventLoop *t_loop = 0;
+
+EventLoop::EventLoop()
+    :stop_(false)
+    ,wakeup_pending_(false)
+    ,wakeups_(0)
+    ,syscalls_(0)
+    ,events_(INIT_EVENTS) {
+    pthread_mutex_init(&mutex_, 0);
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0)
+        perror("epoll_create1 error in EventLoop");
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ < 0)
+        perror("eventfd error in EventLoop");
+
+    if (epfd_ >= 0 && wakeup_fd_ >= 0) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        // a null handler marks the wake-up fd
+        ev.data.ptr = 0;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    if (wakeup_fd_ >= 0)
+        close(wakeup_fd_);
+    if (epfd_ >= 0)
+        close(epfd_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+EventLoop*
+EventLoop::GetThis()
+{
+    return t_loop;
+}
+
+bool
+EventLoop::IsInLoopThread() const
+{
+    return t_loop == this;
+}
+
+void
+EventLoop::Loop()
+{
+    int n, timeout;
+    uint64_t val;
+
+    t_loop = this;
+    while (!stop_.load(std::memory_order_acquire)) {
+        timeout = wheel_.NextTimeout(TimingWheel::NowMs());
+        n = epoll_wait(epfd_, &events_[0], events_.size(), timeout);
+        CountSyscall();
+        if (n < 0) {
+            if (errno != EINTR)
+                perror("epoll_wait error in EventLoop::Loop");
+            continue;
+        }
+        // timeouts armed by the handlers count from the wake-up, not from before the wait
+        wheel_.Update(TimingWheel::NowMs());
+        for (int i = 0; i < n; ++i) {
+            if (events_[i].data.ptr == 0) {
+                CountSyscall();
+                if (read(wakeup_fd_, &val, sizeof(val)) < 0 && errno != EAGAIN)
+                    perror("eventfd read error in EventLoop::Loop");
+                continue;
+            }
+            ((IoHandler*) events_[i].data.ptr)->HandleEvent(events_[i].events);
+        }
+        // a full batch means more may be waiting
+        if ((size_t) n == events_.size())
+            events_.resize(events_.size() * 2);
+        // after the events, so activity in this batch has pushed its timeouts back
+        wheel_.Advance(TimingWheel::NowMs());
+        DoPendingTasks();
+    }
+    DoPendingTasks();
+    t_loop = 0;
+}
+
+void
+EventLoop::Stop()
+{
+    stop_.store(true, std::memory_order_release);
+    Wakeup();
+}
+
+int
+EventLoop::AddFd(int fd, uint32_t events, IoHandler *handler)
+{
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = handler;
+    CountSyscall();
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("epoll_ctl add error in EventLoop::AddFd");
+        return -1;
+    }
+    return 0;
+}
+
+int
+EventLoop::ModFd(int fd, uint32_t events, IoHandler *handler)
+{
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = handler;
+    CountSyscall();
+    if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) != 0) {
+        perror("epoll_ctl mod error in EventLoop::ModFd");
+        return -1;
+    }
+    return 0;
+}
+
+int
+EventLoop::DelFd(int fd)
+{
+    CountSyscall();
+    if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, 0) != 0) {
+        perror("epoll_ctl del error in EventLoop::DelFd");
+        return -1;
+    }
+    return 0;
+}
+
+void
+EventLoop::RunInLoop(Task task)
+{
+    if (IsInLoopThread())
+        task();
+    else
+        QueueInLoop(std::move(task));
+}
+
+void
+EventLoop::QueueInLoop(Task task)
+{
+    pthread_mutex_lock(&mutex_);
+    pending_.push_back(std::move(task));
+    pthread_mutex_unlock(&mutex_);
+    // the loop drains the queue after its batch anyway, unless it is
+    // draining it right now
+    if (!IsInLoopThread() || calling_pending_)
+        Wakeup();
+}
+
+void
+EventLoop::RunAfter(uint64_t delay_ms, Task task)
+{
+    if (IsInLoopThread()) {
+        wheel_.RunAfter(delay_ms, std::move(task));
+        return;
+    }
+    // the delay counts from now, not from when the loop gets to it
+    uint64_t deadline = TimingWheel::NowMs() + delay_ms;
+    QueueInLoop([this, deadline, task]() {
+        uint64_t now = TimingWheel::NowMs();
+        wheel_.RunAfter(deadline > now ? deadline - now : 0, task);
+    });
+}
+
+void
+EventLoop::Wakeup()
+{
+    uint64_t one = 1;
+    if (wakeup_pending_.exchange(true, std::memory_order_acq_rel))
+        return;
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0)
+        perror("eventfd write error in EventLoop::Wakeup");
+}
+
+void
+EventLoop::DoPendingTasks()
+{
+    std::vector<Task> tasks;
+    // clear first, so a task queued from now on wakes us again
+    wakeup_pending_.store(false, std::memory_order_release);
+    pthread_mutex_lock(&mutex_);
+    tasks.swap(pending_);
+    pthread_mutex_unlock(&mutex_);
+    calling_pending_ = true;
+    for (size_t i = 0; i < tasks.size(); ++i)
+        tasks[i]();
+    calling_pending_ = false;
+}
+
+struct offload_t {
+    EventLoop *loop;
+    EventLoop::Task work;
+    EventLoop::Task resume;
+};
+
+static void
+offload_callback(void *arg)
+{
+    struct offload_t *offloadPtr = (struct offload_t*) arg;
+    offloadPtr->work();
+    offloadPtr->loop->QueueInLoop(std::move(offloadPtr->resume));
+    delete offloadPtr;
+}
+
+int
+EventLoop::Offload(struct thread_pool_t *threadPoolPtr, Task work, Task resume)
+{
+    struct offload_t *offloadPtr = new struct offload_t;
+    offloadPtr->loop = this;
+    offloadPtr->work = std::move(work);
+    offloadPtr->resume = std::move(resume);
+    if (thread_pool_push_task(threadPoolPtr, offload_callback, offloadPtr) != 0) {
+        delete offloadPtr;
+        return -1;
+    }
+    return 0;
+}
+
+}
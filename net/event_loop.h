@@ -0,0 +1,117 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "noncopyable.h"
+#include "thread_pool.h"
+#include "timing_wheel.h"
+
+namespace ekko {
+
+/// @brief something registered in an event loop, gets the epoll events of its fd
+class IoHandler {
+public:
+    virtual ~IoHandler() {}
+
+    virtual void HandleEvent(uint32_t events) = 0;
+};
+
+/// @brief one epoll instance driven by one thread. Fds are registered
+/// edge-triggered; other threads hand work over through QueueInLoop(),
+/// which wakes the loop with an eventfd. Timers live in a TimingWheel whose
+/// next deadline bounds epoll_wait; the due ones run after each batch of events.
+class EventLoop : Noncopyable {
+public:
+    typedef std::function<void()> Task;
+
+    /// @return check IsValid(), epoll or eventfd may fail
+    EventLoop();
+
+    ~EventLoop();
+
+    bool IsValid() const { return epfd_ >= 0 && wakeup_fd_ >= 0;}
+
+    /// @brief run until Stop(), on the calling thread
+    void Loop();
+
+    /// @brief thread-safe
+    void Stop();
+
+    /// @param[in] events EPOLLIN/EPOLLOUT/..., EPOLLET is always added
+    /// @return success with 0, fail with -1
+    int AddFd(int fd, uint32_t events, IoHandler *handler);
+
+    int ModFd(int fd, uint32_t events, IoHandler *handler);
+
+    int DelFd(int fd);
+
+    /// @brief run now when called on the loop thread, otherwise queue it
+    void RunInLoop(Task task);
+
+    /// @brief run after the current batch of events, thread-safe
+    void QueueInLoop(Task task);
+
+    /**
+     * @brief run work on a pool worker, then resume on this loop
+     * @return success with 0, fail with -1
+    */
+    int Offload(struct thread_pool_t *threadPoolPtr, Task work, Task resume);
+
+    bool IsInLoopThread() const;
+
+    /// @brief the loop's timers, loop thread only
+    TimingWheel& GetWheel() { return wheel_;}
+
+    /// @brief run task on the loop after delay_ms, thread-safe
+    void RunAfter(uint64_t delay_ms, Task task);
+
+    /// @return number of wake-ups written to the eventfd
+    uint64_t GetWakeups() const { return wakeups_.load(std::memory_order_relaxed);}
+
+    /// @brief account a syscall made on behalf of the loop, loop thread only
+    void CountSyscall(uint64_t n = 1) { syscalls_.store(syscalls_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);}
+
+    /// @return syscalls made by the loop and its handlers
+    uint64_t GetSyscalls() const { return syscalls_.load(std::memory_order_relaxed);}
+
+    /// @brief the loop running on this thread, 0 if none
+    static EventLoop* GetThis();
+
+private:
+    void Wakeup();
+
+    void DoPendingTasks();
+
+    int epfd_;
+
+    int wakeup_fd_;
+
+    std::atomic<bool> stop_;
+
+    /// @brief set while an eventfd write is unconsumed, saves redundant syscalls
+    std::atomic<bool> wakeup_pending_;
+
+    std::atomic<uint64_t> wakeups_;
+
+    std::atomic<uint64_t> syscalls_;
+
+    pthread_mutex_t mutex_;
+
+    std::vector<Task> pending_;
+
+    /// @brief tasks queued meanwhile wait for the next batch, which has to be woken
+    bool calling_pending_ = false;
+
+    std::vector<struct epoll_event> events_;
+
+    TimingWheel wheel_;
+};
+
+}
+
+#endif
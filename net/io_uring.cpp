@@ -0,0 +1,197 @@
+#include "io_uring.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ekko {
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                   const void *arg = 0, size_t argsz = 0)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::~IoUring()
+{
+    Close();
+}
+
+void
+IoUring::Close()
+{
+    if (sqes_)
+        munmap(sqes_, sqes_size_);
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+        munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_)
+        munmap(sq_ptr_, sq_size_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+    sqes_ = 0;
+    cq_ptr_ = sq_ptr_ = 0;
+    ring_fd_ = -1;
+}
+
+int
+IoUring::Init(unsigned entries, unsigned flags)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    ring_fd_ = sys_io_uring_setup(entries, &p);
+    if (ring_fd_ < 0)
+        return -1;
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size_ > sq_size_)
+            sq_size_ = cq_size_;
+        cq_size_ = sq_size_;
+    }
+    sq_ptr_ = mmap(0, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        sq_ptr_ = 0;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(0, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = 0;
+            goto fail;
+        }
+    }
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = (struct io_uring_sqe*) mmap(0, sqes_size_, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = 0;
+        goto fail;
+    }
+
+    sq_head_ = (unsigned*) ((char*) sq_ptr_ + p.sq_off.head);
+    sq_tail_ = (unsigned*) ((char*) sq_ptr_ + p.sq_off.tail);
+    sq_mask_ = (unsigned*) ((char*) sq_ptr_ + p.sq_off.ring_mask);
+    sq_entries_ = (unsigned*) ((char*) sq_ptr_ + p.sq_off.ring_entries);
+    sq_flags_ = (unsigned*) ((char*) sq_ptr_ + p.sq_off.flags);
+    sq_array_ = (unsigned*) ((char*) sq_ptr_ + p.sq_off.array);
+    cq_head_ = (unsigned*) ((char*) cq_ptr_ + p.cq_off.head);
+    cq_tail_ = (unsigned*) ((char*) cq_ptr_ + p.cq_off.tail);
+    cq_mask_ = (unsigned*) ((char*) cq_ptr_ + p.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe*) ((char*) cq_ptr_ + p.cq_off.cqes);
+
+    // identity mapping, sqes are always used in ring order
+    for (unsigned i = 0; i < *sq_entries_; ++i)
+        sq_array_[i] = i;
+    sqe_tail_ = *sq_tail_;
+    return 0;
+
+fail:
+    int err = errno;
+    Close();
+    errno = err;
+    return -1;
+}
+
+struct io_uring_sqe*
+IoUring::GetSqe()
+{
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= *sq_entries_) {
+        if (Submit(0) < 0)
+            return 0;
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= *sq_entries_)
+            return 0;
+    }
+    struct io_uring_sqe *sqe = &sqes_[sqe_tail_ & *sq_mask_];
+    ++sqe_tail_;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+int
+IoUring::Submit(unsigned wait_nr, int timeout_ms)
+{
+    unsigned to_submit = sqe_tail_ - *sq_tail_;
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    int ret;
+
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+    if (wait_nr || (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+        flags |= IORING_ENTER_GETEVENTS;
+    if (to_submit == 0 && flags == 0)
+        return 0;
+    if (wait_nr && timeout_ms >= 0) {
+        // EXT_ARG (5.11) bounds the wait without a timeout sqe
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        arg.ts = (uint64_t) &ts;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    do {
+        ++enter_calls_;
+        if (flags & IORING_ENTER_EXT_ARG)
+            ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags, &arg, sizeof(arg));
+        else
+            ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+unsigned
+IoUring::CqReady() const
+{
+    return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+}
+
+int
+IoUring::RegisterSparseFiles(unsigned nr)
+{
+    struct io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = nr;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    return sys_io_uring_register(ring_fd_, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0 ? -1 : 0;
+}
+
+int
+IoUring::RegisterBuffers(const struct iovec *iovs, unsigned nr)
+{
+    return sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovs, nr) < 0 ? -1 : 0;
+}
+
+int
+IoUring::RegisterBufRing(void *ring, unsigned entries, unsigned bgid)
+{
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) ring;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    return sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 ? -1 : 0;
+}
+
+}
@@ -0,0 +1,102 @@
+#ifndef __IO_URING_H__
+#define __IO_URING_H__
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "noncopyable.h"
+
+namespace ekko {
+
+/// @brief a bare io_uring instance on top of the raw syscalls, no liburing.
+/// Single threaded: only the thread driving the ring may touch it.
+class IoUring : Noncopyable {
+public:
+    IoUring() {}
+
+    ~IoUring();
+
+    /**
+     * @return success with 0, -1 with errno set when the kernel has no
+     * io_uring or it is disabled (ENOSYS, EPERM, ...)
+    */
+    int Init(unsigned entries, unsigned flags = 0);
+
+    bool IsValid() const { return ring_fd_ >= 0;}
+
+    /// @brief tear the ring down, cancelling whatever is in flight and
+    /// closing the direct descriptors
+    void Close();
+
+    /// @brief next free submission entry, zeroed; submits the queued ones
+    /// first if the ring is full
+    /// @return 0 if no entry could be made free
+    struct io_uring_sqe* GetSqe();
+
+    /**
+     * @brief submit everything queued and wait for wait_nr completions,
+     * all in one io_uring_enter
+     * @param[in] timeout_ms bound on the wait, -1 for none
+     * @return number submitted, -1 on error, errno ETIME when the wait timed out
+    */
+    int Submit(unsigned wait_nr = 0, int timeout_ms = -1);
+
+    /// @return completions ready to be reaped
+    unsigned CqReady() const;
+
+    /// @brief call func(cqe) for every ready completion and consume them
+    template<class Func>
+    unsigned ForEachCqe(Func func) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned n = tail - head;
+        for (; head != tail; ++head)
+            func(&cqes_[head & *cq_mask_]);
+        __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    /// @brief a sparse table of nr direct descriptors
+    int RegisterSparseFiles(unsigned nr);
+
+    int RegisterBuffers(const struct iovec *iovs, unsigned nr);
+
+    /// @brief ring must be page aligned and hold entries * 16 bytes
+    int RegisterBufRing(void *ring, unsigned entries, unsigned bgid);
+
+    int GetFd() const { return ring_fd_;}
+
+    /// @return io_uring_enter calls so far
+    uint64_t GetEnterCalls() const { return enter_calls_;}
+
+private:
+    int ring_fd_ = -1;
+
+    void *sq_ptr_ = 0;
+    size_t sq_size_ = 0;
+    void *cq_ptr_ = 0;
+    size_t cq_size_ = 0;
+    struct io_uring_sqe *sqes_ = 0;
+    size_t sqes_size_ = 0;
+
+    unsigned *sq_head_ = 0;
+    unsigned *sq_tail_ = 0;
+    unsigned *sq_mask_ = 0;
+    unsigned *sq_entries_ = 0;
+    unsigned *sq_flags_ = 0;
+    unsigned *sq_array_ = 0;
+
+    unsigned *cq_head_ = 0;
+    unsigned *cq_tail_ = 0;
+    unsigned *cq_mask_ = 0;
+    struct io_uring_cqe *cqes_ = 0;
+
+    /// @brief sqes handed out but not yet published to the kernel
+    unsigned sqe_tail_ = 0;
+
+    uint64_t enter_calls_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,508 @@
+#include "iobuf.h"
+#include "thread_cache.h"
+#include <new>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ekko {
+
+/// @brief the calling thread's cache, handed back to the central cache at exit
+static ThreadCache*
+iobuf_thread_cache()
+{
+    static thread_local struct holder_t {
+        ThreadCache *cache = 0;
+        ~holder_t() { delete cache;}
+    } holder;
+    if (!holder.cache)
+        holder.cache = new ThreadCache;
+    return holder.cache;
+}
+
+static inline char*
+block_inline_data(iobuf_block_t *block)
+{
+    return (char*) (block + 1);
+}
+
+iobuf_block_t*
+iobuf_block_new(size_t len)
+{
+    size_t size = (len ? len : IOBUF_BLOCK_SIZE) + sizeof(iobuf_block_t);
+    if (size > IOBUF_MAX_BLOCK)
+        size = IOBUF_MAX_BLOCK;
+    // size classes up to 64KB, whole spans above
+    size = RoundUp(size);
+    void *mem = iobuf_thread_cache()->Allocate(size);
+    if (!mem)
+        throw std::bad_alloc();
+    iobuf_block_t *block = (iobuf_block_t*) mem;
+    new (&block->refs) std::atomic<int>(1);
+    block->capacity = size - sizeof(iobuf_block_t);
+    block->alloc_size = size;
+    block->data = block_inline_data(block);
+    block->release = 0;
+    block->arg = 0;
+    return block;
+}
+
+void
+iobuf_block_ref(iobuf_block_t *block)
+{
+    block->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+iobuf_block_unref(iobuf_block_t *block)
+{
+    // the last owner needs no atomic read-modify-write
+    if (block->refs.load(std::memory_order_acquire) != 1
+            && block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    if (block->release)
+        block->release(block->arg);
+    iobuf_thread_cache()->Deallocate(block, block->alloc_size);
+}
+
+/// @brief the block is writable past a slice only when no one else sees it
+static inline bool
+block_exclusive(const iobuf_block_t *block)
+{
+    return block->data == block_inline_data((iobuf_block_t*) block)
+        && block->refs.load(std::memory_order_acquire) == 1;
+}
+
+IOBuf::IOBuf(const IOBuf &other)
+{
+    Append(other);
+}
+
+IOBuf::IOBuf(IOBuf &&other)
+    :slices_(std::move(other.slices_))
+    ,first_(other.first_)
+    ,size_(other.size_) {
+    other.slices_.clear();
+    other.first_ = other.size_ = 0;
+}
+
+IOBuf&
+IOBuf::operator=(const IOBuf &other)
+{
+    if (this != &other) {
+        Clear();
+        Append(other);
+    }
+    return *this;
+}
+
+IOBuf&
+IOBuf::operator=(IOBuf &&other)
+{
+    if (this != &other) {
+        Clear();
+        slices_.swap(other.slices_);
+        first_ = other.first_;
+        size_ = other.size_;
+        other.first_ = other.size_ = 0;
+    }
+    return *this;
+}
+
+void
+IOBuf::Clear()
+{
+    for (size_t i = first_; i < slices_.size(); ++i)
+        iobuf_block_unref(slices_[i].block);
+    slices_.clear();
+    first_ = size_ = 0;
+}
+
+void
+IOBuf::PushBack(iobuf_block_t *block, uint32_t off, uint32_t len)
+{
+    // takes over a reference; adjacent pieces of one block become one slice
+    if (SliceCount() > 0) {
+        Slice &last = slices_.back();
+        if (last.block == block && last.off + last.len == off) {
+            last.len += len;
+            size_ += len;
+            iobuf_block_unref(block);
+            return;
+        }
+    }
+    Slice s = { block, off, len };
+    slices_.push_back(s);
+    size_ += len;
+}
+
+char*
+IOBuf::TailRoom(size_t &room)
+{
+    room = 0;
+    if (SliceCount() == 0)
+        return 0;
+    Slice &last = slices_.back();
+    if (!block_exclusive(last.block))
+        return 0;
+    room = last.block->capacity - (last.off + last.len);
+    return room ? last.block->data + last.off + last.len : 0;
+}
+
+void
+IOBuf::Append(const char *data, size_t len)
+{
+    size_t room, n;
+    char *p;
+
+    while (len > 0) {
+        p = TailRoom(room);
+        if (!p) {
+            iobuf_block_t *block = iobuf_block_new(len > IOBUF_BLOCK_SIZE ? len : 0);
+            Slice s = { block, 0, 0 };
+            slices_.push_back(s);
+            p = block->data;
+            room = block->capacity;
+        }
+        n = len < room ? len : room;
+        memcpy(p, data, n);
+        slices_.back().len += n;
+        size_ += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void
+IOBuf::Append(const IOBuf &other)
+{
+    // by index: other may be this
+    size_t n = other.slices_.size();
+    for (size_t i = other.first_; i < n; ++i) {
+        Slice s = other.slices_[i];
+        iobuf_block_ref(s.block);
+        PushBack(s.block, s.off, s.len);
+    }
+}
+
+void
+IOBuf::Append(IOBuf &&other)
+{
+    if (&other == this) {
+        Append((const IOBuf&) other);
+        return;
+    }
+    if (SliceCount() == 0) {
+        *this = std::move(other);
+        return;
+    }
+    for (size_t i = other.first_; i < other.slices_.size(); ++i) {
+        Slice &s = other.slices_[i];
+        PushBack(s.block, s.off, s.len);
+    }
+    other.slices_.clear();
+    other.first_ = other.size_ = 0;
+}
+
+void
+IOBuf::AppendExternal(const char *data, size_t len, void (*release)(void*), void *arg)
+{
+    // only the header comes from the pool
+    size_t size = RoundUp(sizeof(iobuf_block_t));
+    iobuf_block_t *block = (iobuf_block_t*) iobuf_thread_cache()->Allocate(size);
+    if (!block)
+        throw std::bad_alloc();
+    new (&block->refs) std::atomic<int>(1);
+    block->capacity = len;
+    block->alloc_size = size;
+    block->data = (char*) data;
+    block->release = release;
+    block->arg = arg;
+    Slice s = { block, 0, (uint32_t) len };
+    slices_.push_back(s);
+    size_ += len;
+}
+
+void
+IOBuf::Prepend(const char *data, size_t len)
+{
+    size_t n;
+
+    // back to front, so every block but the first is filled from its end
+    while (len > 0) {
+        if (SliceCount() > 0 && slices_[first_].off > 0 && block_exclusive(slices_[first_].block)) {
+            Slice &s = slices_[first_];
+            n = len < s.off ? len : s.off;
+            s.off -= n;
+            s.len += n;
+            memcpy(s.block->data + s.off, data + len - n, n);
+            size_ += n;
+            len -= n;
+            continue;
+        }
+        iobuf_block_t *block = iobuf_block_new(len > IOBUF_BLOCK_SIZE ? len : 0);
+        Slice s = { block, block->capacity, 0 };
+        if (first_ > 0)
+            slices_[--first_] = s;
+        else
+            slices_.insert(slices_.begin(), s);
+    }
+}
+
+void
+IOBuf::Prepend(const IOBuf &other)
+{
+    IOBuf tmp(other);
+    tmp.Append(std::move(*this));
+    *this = std::move(tmp);
+}
+
+char*
+IOBuf::Reserve(size_t n)
+{
+    size_t room;
+    char *p = TailRoom(room);
+    if (p && room >= n)
+        return p;
+    iobuf_block_t *block = iobuf_block_new(n > IOBUF_BLOCK_SIZE ? n : 0);
+    Slice s = { block, 0, 0 };
+    slices_.push_back(s);
+    return block->data;
+}
+
+void
+IOBuf::Commit(size_t n)
+{
+    slices_.back().len += n;
+    size_ += n;
+}
+
+void
+IOBuf::PopFront(size_t n)
+{
+    if (n >= size_) {
+        Clear();
+        return;
+    }
+    size_ -= n;
+    while (n > 0) {
+        Slice &s = slices_[first_];
+        if (s.len > n) {
+            s.off += n;
+            s.len -= n;
+            break;
+        }
+        n -= s.len;
+        iobuf_block_unref(s.block);
+        ++first_;
+    }
+    // consumed slots are reclaimed once they are most of the vector
+    if (first_ > 16 && first_ * 2 > slices_.size()) {
+        slices_.erase(slices_.begin(), slices_.begin() + first_);
+        first_ = 0;
+    }
+}
+
+void
+IOBuf::PopBack(size_t n)
+{
+    if (n >= size_) {
+        Clear();
+        return;
+    }
+    size_ -= n;
+    while (n > 0) {
+        Slice &s = slices_.back();
+        if (s.len > n) {
+            s.len -= n;
+            break;
+        }
+        n -= s.len;
+        iobuf_block_unref(s.block);
+        slices_.pop_back();
+    }
+}
+
+void
+IOBuf::CutFront(size_t n, IOBuf &front)
+{
+    if (n >= size_) {
+        front.Append(std::move(*this));
+        return;
+    }
+    size_ -= n;
+    while (n > 0) {
+        Slice &s = slices_[first_];
+        if (s.len > n) {
+            // the boundary block ends up in both
+            iobuf_block_ref(s.block);
+            front.PushBack(s.block, s.off, n);
+            s.off += n;
+            s.len -= n;
+            break;
+        }
+        n -= s.len;
+        front.PushBack(s.block, s.off, s.len);
+        ++first_;
+    }
+}
+
+const char*
+IOBuf::Coalesce(size_t n)
+{
+    if (n > size_ || SliceCount() == 0)
+        return 0;
+    Slice &first = slices_[first_];
+    if (first.len >= n)
+        return first.block->data + first.off;
+
+    iobuf_block_t *block = iobuf_block_new(n > IOBUF_BLOCK_SIZE ? n : 0);
+    if (block->capacity < n) {
+        // more than the largest block can hold
+        iobuf_block_unref(block);
+        return 0;
+    }
+    CopyTo(block->data, n);
+    PopFront(n);
+    Slice s = { block, 0, (uint32_t) n };
+    if (first_ > 0)
+        slices_[--first_] = s;
+    else
+        slices_.insert(slices_.begin(), s);
+    size_ += n;
+    return block->data;
+}
+
+size_t
+IOBuf::AppendCompact(const IOBuf &other)
+{
+    size_t left = other.size_, off = 0, alloc = 0, n;
+
+    while (left > 0) {
+        n = left < IOBUF_MAX_BLOCK - sizeof(iobuf_block_t) ? left : IOBUF_MAX_BLOCK - sizeof(iobuf_block_t);
+        iobuf_block_t *block = iobuf_block_new(n);
+        other.CopyTo(block->data, n, off);
+        PushBack(block, 0, n);
+        alloc += block->alloc_size;
+        off += n;
+        left -= n;
+    }
+    return alloc;
+}
+
+size_t
+IOBuf::CopyTo(char *out, size_t n, size_t off) const
+{
+    size_t copied = 0, k;
+
+    for (size_t i = first_; i < slices_.size() && copied < n; ++i) {
+        const Slice &s = slices_[i];
+        if (off >= s.len) {
+            off -= s.len;
+            continue;
+        }
+        k = s.len - off;
+        if (k > n - copied)
+            k = n - copied;
+        memcpy(out + copied, s.block->data + s.off + off, k);
+        copied += k;
+        off = 0;
+    }
+    return copied;
+}
+
+std::string
+IOBuf::ToString() const
+{
+    std::string str(size_, '\0');
+    CopyTo(&str[0], size_);
+    return str;
+}
+
+int
+IOBuf::FillIovec(struct iovec *iov, int max) const
+{
+    int cnt = 0;
+    for (size_t i = first_; i < slices_.size() && cnt < max; ++i) {
+        if (slices_[i].len == 0)
+            continue;
+        iov[cnt].iov_base = slices_[i].block->data + slices_[i].off;
+        iov[cnt].iov_len = slices_[i].len;
+        ++cnt;
+    }
+    return cnt;
+}
+
+ssize_t
+IOBuf::WriteTo(int fd)
+{
+    struct iovec iov[IOBUF_MAX_IOV];
+    int cnt = FillIovec(iov, IOBUF_MAX_IOV);
+    if (cnt == 0)
+        return 0;
+    ssize_t n = writev(fd, iov, cnt);
+    if (n > 0)
+        PopFront(n);
+    return n;
+}
+
+ssize_t
+IOBuf::SendTo(int fd)
+{
+    struct iovec iov[IOBUF_MAX_IOV];
+    struct msghdr msg;
+    int cnt = FillIovec(iov, IOBUF_MAX_IOV);
+    if (cnt == 0)
+        return 0;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n > 0)
+        PopFront(n);
+    return n;
+}
+
+ssize_t
+IOBuf::ReadFrom(int fd, size_t hint)
+{
+    struct iovec iov[2];
+    iobuf_block_t *block = 0;
+    size_t room, k;
+    int cnt = 0;
+    ssize_t n;
+
+    char *p = TailRoom(room);
+    if (p) {
+        iov[cnt].iov_base = p;
+        iov[cnt].iov_len = room;
+        ++cnt;
+    }
+    if (room < hint) {
+        block = iobuf_block_new(hint - room);
+        iov[cnt].iov_base = block->data;
+        iov[cnt].iov_len = block->capacity;
+        ++cnt;
+    }
+    n = readv(fd, iov, cnt);
+    if (n <= 0) {
+        if (block)
+            iobuf_block_unref(block);
+        return n;
+    }
+    k = (size_t) n < room ? n : room;
+    if (k > 0) {
+        slices_.back().len += k;
+        size_ += k;
+    }
+    if ((size_t) n > k) {
+        Slice s = { block, 0, (uint32_t) (n - k) };
+        slices_.push_back(s);
+        size_ += n - k;
+    } else if (block) {
+        iobuf_block_unref(block);
+    }
+    return n;
+}
+
+}
@@ -0,0 +1,176 @@
+#ifndef __IOBUF_H__
+#define __IOBUF_H__
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/// @brief data bytes of a block allocated when nothing bigger is asked for
+#define IOBUF_BLOCK_SIZE 8192
+/// @brief the largest block, bigger appends are chained
+#define IOBUF_MAX_BLOCK (512 * 1024)
+#define IOBUF_MAX_IOV 64
+
+namespace ekko {
+
+/// @brief refcounted storage shared by the slices that point into it
+struct iobuf_block_t {
+    std::atomic<int> refs;
+    uint32_t capacity;
+    /// @brief bytes taken from the allocator, 0 for external data
+    uint32_t alloc_size;
+    char *data;
+    /// @brief external data: called with arg once the last slice lets go
+    void (*release)(void *arg);
+    void *arg;
+};
+
+/**
+ * @brief a chain of slices of refcounted blocks. Blocks come from a
+ * per-thread ThreadCache: the size classes up to 64KB, whole spans above.
+ *
+ * Copying an IOBuf, appending one IOBuf to another or cutting one in two
+ * shares the blocks instead of copying bytes; only Append(data, len) and
+ * Prepend(data, len) copy, into the free room of a block this chain owns
+ * alone when there is some. Not thread-safe, but blocks may be shared by
+ * chains on different threads.
+*/
+class IOBuf {
+public:
+    struct Slice {
+        iobuf_block_t *block;
+        uint32_t off;
+        uint32_t len;
+    };
+
+    IOBuf() {}
+
+    ~IOBuf() { Clear();}
+
+    IOBuf(const IOBuf &other);
+
+    IOBuf(IOBuf &&other);
+
+    IOBuf& operator=(const IOBuf &other);
+
+    IOBuf& operator=(IOBuf &&other);
+
+    size_t Size() const { return size_;}
+
+    bool Empty() const { return size_ == 0;}
+
+    size_t SliceCount() const { return slices_.size() - first_;}
+
+    const Slice& GetSlice(size_t idx) const { return slices_[first_ + idx];}
+
+    std::string_view SliceView(size_t idx) const {
+        const Slice &s = slices_[first_ + idx];
+        return std::string_view(s.block->data + s.off, s.len);
+    }
+
+    void Append(const char *data, size_t len);
+
+    void Append(std::string_view data) { Append(data.data(), data.size());}
+
+    /// @brief share other's blocks
+    void Append(const IOBuf &other);
+
+    void Append(IOBuf &&other);
+
+    /**
+     * @brief reference data without copying it
+     * @param[in] release called with arg when no slice points at data any more,
+     * may be 0 for static data
+    */
+    void AppendExternal(const char *data, size_t len, void (*release)(void*) = 0, void *arg = 0);
+
+    void Prepend(const char *data, size_t len);
+
+    void Prepend(std::string_view data) { Prepend(data.data(), data.size());}
+
+    void Prepend(const IOBuf &other);
+
+    /**
+     * @brief room for at least n contiguous bytes at the end, to be filled
+     * and then published with Commit()
+    */
+    char* Reserve(size_t n);
+
+    void Commit(size_t n);
+
+    /// @brief drop n bytes from the front
+    void PopFront(size_t n);
+
+    /// @brief drop n bytes from the back
+    void PopBack(size_t n);
+
+    /// @brief move the first n bytes to the end of front, sharing the boundary block
+    void CutFront(size_t n, IOBuf &front);
+
+    /**
+     * @brief make the first n bytes contiguous, copying only if they span slices
+     * @return pointer to them, 0 if there are fewer than n
+    */
+    const char* Coalesce(size_t n);
+
+    /// @return bytes copied, from offset off
+    size_t CopyTo(char *out, size_t n, size_t off = 0) const;
+
+    /**
+     * @brief copy other into new blocks sized to fit it, for a copy that is
+     * kept: no half-used default blocks, nothing shared with other
+     * @return bytes taken from the allocator
+    */
+    size_t AppendCompact(const IOBuf &other);
+
+    std::string ToString() const;
+
+    void Clear();
+
+    /// @return iovecs filled, at most max
+    int FillIovec(struct iovec *iov, int max) const;
+
+    /**
+     * @brief writev as much as the fd takes and drop what was written
+     * @return bytes written, -1 with errno set (EAGAIN included)
+    */
+    ssize_t WriteTo(int fd);
+
+    /// @brief WriteTo() for sockets: sendmsg with MSG_NOSIGNAL
+    ssize_t SendTo(int fd);
+
+    /**
+     * @brief readv into the free room at the end and one new block
+     * @return bytes read, 0 at EOF, -1 with errno set
+    */
+    ssize_t ReadFrom(int fd, size_t hint = 65536);
+
+private:
+    /// @brief last block, when it is ours alone and has room after the data
+    char* TailRoom(size_t &room);
+
+    void PushBack(iobuf_block_t *block, uint32_t off, uint32_t len);
+
+    std::vector<Slice> slices_;
+
+    /// @brief slices before first_ are already consumed
+    size_t first_ = 0;
+
+    size_t size_ = 0;
+};
+
+/// @return a block of at least len data bytes, len 0 for the default size
+iobuf_block_t* iobuf_block_new(size_t len);
+
+void iobuf_block_ref(iobuf_block_t *block);
+
+void iobuf_block_unref(iobuf_block_t *block);
+
+}
+
+#endif
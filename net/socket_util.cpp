@@ -0,0 +1,172 @@
+#include "socket_util.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ekko {
+
+int
+SetNonBlock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl error in SetNonBlock");
+        return -1;
+    }
+    return 0;
+}
+
+int
+SetTcpNoDelay(int fd)
+{
+    int on = 1;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+static int
+fill_addr(struct sockaddr_in *addr, const char *ip, int port)
+{
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (ip == 0) {
+        addr->sin_addr.s_addr = htonl(INADDR_ANY);
+        return 0;
+    }
+    return inet_pton(AF_INET, ip, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+int
+CreateListenSocket(const char *ip, int port, int backlog, bool reuseport)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    if (fill_addr(&addr, ip, port) != 0) {
+        fprintf(stderr, "CreateListenSocket: bad address %s\n", ip);
+        return -1;
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket error in CreateListenSocket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        perror("setsockopt SO_REUSEPORT error in CreateListenSocket");
+        close(fd);
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror("bind error in CreateListenSocket");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, backlog) != 0) {
+        perror("listen error in CreateListenSocket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+CreateListenGroup(const char *ip, int port, int backlog, int n, bool cpu_steering,
+                  std::vector<int> &fds)
+{
+    int fd;
+
+    fds.clear();
+    for (int i = 0; i < n; ++i) {
+        fd = CreateListenSocket(ip, port, backlog, true);
+        if (fd < 0)
+            break;
+        fds.push_back(fd);
+        if (port == 0)
+            port = GetLocalPort(fd);
+        // a hint, it only helps when the BPF program cannot be attached
+        if (cpu_steering)
+            SetIncomingCpu(fd, i);
+    }
+    if ((int) fds.size() == n && cpu_steering && SetReusePortCpuSteering(fds[0], n) != 0)
+        perror("setsockopt SO_ATTACH_REUSEPORT_CBPF error in CreateListenGroup");
+    if ((int) fds.size() == n)
+        return 0;
+    for (size_t i = 0; i < fds.size(); ++i)
+        close(fds[i]);
+    fds.clear();
+    return -1;
+}
+
+int
+SetReusePortCpuSteering(int fd, int nsockets)
+{
+    struct sock_filter code[] = {
+        // A = the CPU handling the SYN
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t) nsockets },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+int
+SetIncomingCpu(int fd, int cpu)
+{
+    return setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+}
+
+int
+PinThreadToCpu(pthread_t tid, int cpu)
+{
+    cpu_set_t set;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (ncpus > 0 ? ncpus : 1), &set);
+    return pthread_setaffinity_np(tid, sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+int
+ConnectTo(const char *ip, int port)
+{
+    struct sockaddr_in addr;
+    int fd;
+
+    if (fill_addr(&addr, ip, port) != 0)
+        return -1;
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket error in ConnectTo");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror("connect error in ConnectTo");
+        close(fd);
+        return -1;
+    }
+    SetTcpNoDelay(fd);
+    return fd;
+}
+
+int
+GetLocalPort(int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*) &addr, &len) != 0)
+        return -1;
+    return ntohs(addr.sin_port);
+}
+
+}
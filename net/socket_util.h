@@ -0,0 +1,59 @@
+#ifndef __SOCKET_UTIL_H__
+#define __SOCKET_UTIL_H__
+
+#include <vector>
+#include <netinet/in.h>
+#include <pthread.h>
+
+namespace ekko {
+
+/// @return success with 0, fail with -1
+int SetNonBlock(int fd);
+
+int SetTcpNoDelay(int fd);
+
+/**
+ * @brief create a non-blocking listening socket
+ * @param[in] ip 0 for any address
+ * @param[in] port 0 lets the kernel pick one, see GetLocalPort()
+ * @param[in] reuseport set SO_REUSEPORT so several sockets can share the port
+ * @return the fd, -1 on error
+*/
+int CreateListenSocket(const char *ip, int port, int backlog, bool reuseport = false);
+
+/**
+ * @brief n listening sockets on one port through SO_REUSEPORT, the kernel
+ * spreads incoming connections across them; the first one picks the port
+ * when it is 0
+ * @param[in] cpu_steering send each connection to socket cpu % n, cpu being
+ * the one that received it, see SetReusePortCpuSteering()
+ * @param[out] fds the sockets in the order they started listening
+ * @return success with 0, fail with -1 and nothing left open
+*/
+int CreateListenGroup(const char *ip, int port, int backlog, int n, bool cpu_steering,
+                      std::vector<int> &fds);
+
+/**
+ * @brief a classic BPF program on the SO_REUSEPORT group of fd picking
+ * socket cpu % nsockets, sockets counted in the order they started listening
+ * @return success with 0, fail with -1
+*/
+int SetReusePortCpuSteering(int fd, int nsockets);
+
+/// @brief SO_INCOMING_CPU, the group's preferred socket for connections arriving on cpu
+int SetIncomingCpu(int fd, int cpu);
+
+/// @brief pin a thread to cpu modulo the CPUs online
+/// @return success with 0, fail with -1
+int PinThreadToCpu(pthread_t tid, int cpu);
+
+/// @brief blocking connect, mainly for clients in tests and benchmarks
+/// @return the fd, -1 on error
+int ConnectTo(const char *ip, int port);
+
+/// @return port the socket is bound to, -1 on error
+int GetLocalPort(int fd);
+
+}
+
+#endif
@@ -0,0 +1,312 @@
+#include "tcp_connection.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define READ_CHUNK 16384
+// read at most this much per event, so one busy peer cannot starve the others
+#define READ_BUDGET (4 * READ_CHUNK)
+// above a full request with the largest body the HTTP layer accepts
+#define INPUT_HIGH_WATER (16 << 20)
+
+namespace ekko {
+
+TcpConnection::TcpConnection(EventLoop *loop, int fd, const struct sockaddr_in &peer)
+    :loop_(loop)
+    ,fd_(fd)
+    ,peer_(peer)
+    ,idle_timer_([this]() { CloseInLoop();}) {
+}
+
+TcpConnection::~TcpConnection()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+void
+TcpConnection::Establish()
+{
+    self_ = shared_from_this();
+    // edge-triggered, so EPOLLOUT can stay registered: it only fires when the
+    // socket turns writable again
+    if (loop_->AddFd(fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP, this) != 0) {
+        state_ = DISCONNECTED;
+        self_.reset();
+        return;
+    }
+    state_ = CONNECTED;
+    if (connection_cb_)
+        connection_cb_(shared_from_this());
+}
+
+void
+TcpConnection::HandleEvent(uint32_t events)
+{
+    ptr guard = shared_from_this();
+    // edge-triggered: an event is new data or the socket draining, progress either way
+    if (idle_ms_)
+        loop_->GetWheel().Reset(&idle_timer_, idle_ms_);
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        CloseInLoop();
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP))
+        HandleRead();
+    if ((events & EPOLLOUT) && state_ != DISCONNECTED)
+        HandleWrite();
+}
+
+void
+TcpConnection::HandleRead()
+{
+    ssize_t n;
+    size_t budget = READ_BUDGET;
+    bool eof = false;
+    while (budget > 0) {
+        input_.EnsureWritable(READ_CHUNK);
+        n = read(fd_, input_.BeginWrite(), std::min(input_.WritableBytes(), budget));
+        loop_->CountSyscall();
+        if (n > 0) {
+            input_.HasWritten(n);
+            budget -= n;
+            continue;
+        }
+        if (n == 0) {
+            eof = true;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            CloseInLoop();
+            return;
+        }
+        break;
+    }
+    if (input_.ReadableBytes() && message_cb_)
+        message_cb_(shared_from_this(), input_);
+    if (eof) {
+        CloseInLoop();
+        return;
+    }
+    if (state_ == DISCONNECTED)
+        return;
+    // whatever the callback left is waiting for more input: past the mark
+    // the peer is sending faster than anything is consumed
+    if (input_.ReadableBytes() > INPUT_HIGH_WATER) {
+        fprintf(stderr, "connection fd %d: %zu bytes of unconsumed input, closing\n",
+                fd_, input_.ReadableBytes());
+        CloseInLoop();
+        return;
+    }
+    // stopped before EAGAIN: edge-triggered, so no new event comes for what
+    // is still in the socket; go on after the other handlers had their turn
+    if (budget == 0) {
+        ptr self = shared_from_this();
+        loop_->QueueInLoop([self]() {
+            if (self->state_ != DISCONNECTED)
+                self->HandleRead();
+        });
+    }
+}
+
+void
+TcpConnection::HandleWrite()
+{
+    ssize_t n;
+    while (HasOutput()) {
+        if (output_.Size() > 0) {
+            n = output_.SendTo(fd_);
+        } else if (files_.front().len > 0) {
+            PendingFile &f = files_.front();
+            n = sendfile(fd_, f.file->GetFd(), &f.offset, f.len);
+            // the file shrank under us: what is left can never be sent
+            if (n == 0) {
+                CloseInLoop();
+                return;
+            }
+            if (n > 0)
+                f.len -= n;
+        } else {
+            output_ = std::move(files_.front().after);
+            files_.pop_front();
+            continue;
+        }
+        loop_->CountSyscall();
+        if (n > 0)
+            continue;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        CloseInLoop();
+        return;
+    }
+    if (state_ == DISCONNECTING)
+        CloseInLoop();
+}
+
+void
+TcpConnection::Send(const char *data, size_t len)
+{
+    if (loop_->IsInLoopThread()) {
+        SendInLoop(data, len);
+        return;
+    }
+    ptr self = shared_from_this();
+    std::string copy(data, len);
+    loop_->QueueInLoop([self, copy]() { self->SendInLoop(copy.data(), copy.size()); });
+}
+
+void
+TcpConnection::SendInLoop(const char *data, size_t len)
+{
+    ssize_t n = 0;
+    if (state_ != CONNECTED)
+        return;
+    // nothing queued: try the socket first and only buffer the rest
+    if (!HasOutput()) {
+        n = send(fd_, data, len, MSG_NOSIGNAL);
+        loop_->CountSyscall();
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                CloseInLoop();
+                return;
+            }
+            n = 0;
+        }
+    }
+    if ((size_t) n < len)
+        OutputTail().Append(data + n, len - n);
+}
+
+void
+TcpConnection::Send(IOBuf &&buf)
+{
+    if (loop_->IsInLoopThread()) {
+        SendInLoop(std::move(buf));
+        return;
+    }
+    ptr self = shared_from_this();
+    IOBuf shared(std::move(buf));
+    loop_->QueueInLoop([self, shared]() mutable { self->SendInLoop(std::move(shared)); });
+}
+
+void
+TcpConnection::SendInLoop(IOBuf &&buf)
+{
+    if (state_ != CONNECTED)
+        return;
+    if (!HasOutput()) {
+        loop_->CountSyscall();
+        if (buf.SendTo(fd_) < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            CloseInLoop();
+            return;
+        }
+    }
+    OutputTail().Append(std::move(buf));
+}
+
+void
+TcpConnection::SendFile(const FileRef::ptr &file, off_t offset, size_t len)
+{
+    if (loop_->IsInLoopThread()) {
+        SendFileInLoop(file, offset, len);
+        return;
+    }
+    ptr self = shared_from_this();
+    loop_->QueueInLoop([self, file, offset, len]() { self->SendFileInLoop(file, offset, len); });
+}
+
+void
+TcpConnection::SendFileInLoop(const FileRef::ptr &file, off_t offset, size_t len)
+{
+    ssize_t n;
+    if (state_ != CONNECTED || len == 0)
+        return;
+    if (!HasOutput()) {
+        n = sendfile(fd_, file->GetFd(), &offset, len);
+        loop_->CountSyscall();
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            CloseInLoop();
+            return;
+        }
+        if (n > 0 && (size_t) n == len)
+            return;
+        if (n > 0)
+            len -= n;
+    }
+    files_.push_back(PendingFile());
+    PendingFile &f = files_.back();
+    f.file = file;
+    f.offset = offset;
+    f.len = len;
+}
+
+size_t
+TcpConnection::GetPendingOutput() const
+{
+    size_t n = output_.Size();
+    for (size_t i = 0; i < files_.size(); ++i)
+        n += files_[i].len + files_[i].after.Size();
+    return n;
+}
+
+void
+TcpConnection::Shutdown()
+{
+    ptr self = shared_from_this();
+    loop_->RunInLoop([self]() {
+        if (self->state_ != CONNECTED)
+            return;
+        self->state_ = DISCONNECTING;
+        if (!self->HasOutput())
+            self->CloseInLoop();
+    });
+}
+
+void
+TcpConnection::Close()
+{
+    ptr self = shared_from_this();
+    loop_->RunInLoop([self]() { self->CloseInLoop(); });
+}
+
+void
+TcpConnection::SetIdleTimeout(uint64_t ms)
+{
+    ptr self = shared_from_this();
+    loop_->RunInLoop([self, ms]() {
+        self->idle_ms_ = ms;
+        if (self->state_ == DISCONNECTED)
+            return;
+        if (ms)
+            self->loop_->GetWheel().Add(&self->idle_timer_, ms);
+        else
+            self->loop_->GetWheel().Cancel(&self->idle_timer_);
+    });
+}
+
+void
+TcpConnection::CloseInLoop()
+{
+    if (state_ == DISCONNECTED)
+        return;
+    state_ = DISCONNECTED;
+    loop_->GetWheel().Cancel(&idle_timer_);
+    loop_->DelFd(fd_);
+    ptr self = self_;
+    if (close_cb_)
+        close_cb_(self);
+    close(fd_);
+    fd_ = -1;
+    // events of this batch may still point at us, free after it
+    self_.reset();
+    loop_->QueueInLoop([self]() {});
+}
+
+}
@@ -0,0 +1,126 @@
+#ifndef __TCP_CONNECTION_H__
+#define __TCP_CONNECTION_H__
+
+#include <deque>
+#include <memory>
+#include <functional>
+#include <string>
+#include <netinet/in.h>
+#include "buffer.h"
+#include "connection.h"
+#include "event_loop.h"
+
+namespace ekko {
+
+/// @brief a non-blocking TCP connection owned by one event loop. Every
+/// callback runs on that loop; Send() and Close() may be called from any thread.
+/// Each event reads a bounded amount before the message callback runs, the
+/// rest is read on a later turn of the loop; input the callback leaves
+/// unconsumed past a high-water mark closes the connection.
+class TcpConnection : public Connection, public IoHandler
+                    , public std::enable_shared_from_this<TcpConnection> {
+public:
+    typedef std::shared_ptr<TcpConnection> ptr;
+    typedef std::function<void(const ptr&)> ConnectionCallback;
+    typedef std::function<void(const ptr&, Buffer&)> MessageCallback;
+
+    TcpConnection(EventLoop *loop, int fd, const struct sockaddr_in &peer);
+
+    ~TcpConnection();
+
+    /// @brief register with the loop and call the connection callback, on the loop
+    void Establish();
+
+    void Send(const char *data, size_t len) override;
+
+    void Send(IOBuf &&buf) override;
+
+    void SendFile(const FileRef::ptr &file, off_t offset, size_t len) override;
+
+    using Connection::Send;
+
+    void Shutdown() override;
+
+    void Close() override;
+
+    void SetIdleTimeout(uint64_t ms) override;
+
+    uint64_t GetReceiveMs() const override { return loop_->GetWheel().GetNowMs();}
+
+    void HandleEvent(uint32_t events) override;
+
+    EventLoop* GetLoop() const { return loop_;}
+
+    int GetFd() const { return fd_;}
+
+    bool IsConnected() const { return state_ == CONNECTED;}
+
+    const struct sockaddr_in& GetPeer() const { return peer_;}
+
+    /// @brief bytes not yet handed to the socket, queued file ranges included
+    size_t GetPendingOutput() const;
+
+    void SetMessageCallback(const MessageCallback &cb) { message_cb_ = cb;}
+
+    void SetConnectionCallback(const ConnectionCallback &cb) { connection_cb_ = cb;}
+
+    void SetCloseCallback(const ConnectionCallback &cb) { close_cb_ = cb;}
+
+private:
+    enum State {
+        CONNECTING,
+        CONNECTED,
+        DISCONNECTING,
+        DISCONNECTED
+    };
+
+    void HandleRead();
+
+    void HandleWrite();
+
+    void SendInLoop(const char *data, size_t len);
+
+    void SendInLoop(IOBuf &&buf);
+
+    void SendFileInLoop(const FileRef::ptr &file, off_t offset, size_t len);
+
+    bool HasOutput() const { return output_.Size() > 0 || !files_.empty();}
+
+    /// @brief where new output goes: behind the last queued file, if any
+    IOBuf& OutputTail() { return files_.empty() ? output_ : files_.back().after;}
+
+    void CloseInLoop();
+
+    EventLoop *loop_;
+
+    int fd_;
+
+    State state_ = CONNECTING;
+
+    struct sockaddr_in peer_;
+
+    Buffer input_;
+
+    IOBuf output_;
+
+    /// @brief sent once output_ is drained, each followed by its own data
+    std::deque<PendingFile> files_;
+
+    MessageCallback message_cb_;
+
+    ConnectionCallback connection_cb_;
+
+    ConnectionCallback close_cb_;
+
+    /// @brief the loop holds the connection through this until it is closed
+    ptr self_;
+
+    /// @brief pushed back on every event, closes the connection when it fires
+    TimingWheel::Timer idle_timer_;
+
+    uint64_t idle_ms_ = 0;
+};
+
+}
+
+#endif
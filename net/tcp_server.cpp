@@ -0,0 +1,207 @@
+#include "tcp_server.h"
+#include "socket_util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LISTEN_BACKLOG 1024
+
+namespace ekko {
+
+Acceptor::Acceptor(TcpServer *server, size_t idx, int listen_fd)
+    :server_(server)
+    ,idx_(idx)
+    ,loop_(server->loops_[idx])
+    ,listen_fd_(listen_fd) {
+    idle_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+Acceptor::~Acceptor()
+{
+    if (listen_fd_ >= 0)
+        close(listen_fd_);
+    if (idle_fd_ >= 0)
+        close(idle_fd_);
+}
+
+int
+Acceptor::Listen()
+{
+    return loop_->AddFd(listen_fd_, EPOLLIN, this);
+}
+
+void
+Acceptor::HandleEvent(uint32_t events)
+{
+    struct sockaddr_in peer;
+    socklen_t len;
+    int fd, err;
+
+    if (events & EPOLLERR) {
+        // reading SO_ERROR clears it; accept4 below still drains the backlog
+        len = sizeof(err);
+        if (getsockopt(listen_fd_, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0)
+            fprintf(stderr, "listen socket error in Acceptor::HandleEvent: %s\n", strerror(err));
+    }
+
+    // edge-triggered: accept until the backlog is empty
+    while (1) {
+        len = sizeof(peer);
+        fd = accept4(listen_fd_, (struct sockaddr*) &peer, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        loop_->CountSyscall();
+        if (fd >= 0) {
+            accepted_.fetch_add(1, std::memory_order_relaxed);
+            server_->NewConnection(idx_, fd, peer);
+            continue;
+        }
+        if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+        if (errno == EMFILE && idle_fd_ >= 0) {
+            // out of fds: accept and drop one, or the edge never fires again
+            close(idle_fd_);
+            fd = accept(listen_fd_, 0, 0);
+            if (fd >= 0)
+                close(fd);
+            idle_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            perror("accept4 error in Acceptor::HandleEvent");
+        break;
+    }
+}
+
+TcpServer::TcpServer(const char *ip, int port, int nloops)
+    :ip_(ip ? ip : "")
+    ,port_(port) {
+    if (nloops < 1)
+        nloops = 1;
+    for (int i = 0; i < nloops; ++i)
+        loops_.push_back(new EventLoop);
+    connections_.resize(nloops);
+}
+
+TcpServer::~TcpServer()
+{
+    Stop();
+    for (size_t i = 0; i < acceptors_.size(); ++i)
+        delete acceptors_[i];
+    for (size_t i = 0; i < loops_.size(); ++i)
+        delete loops_[i];
+}
+
+void*
+TcpServer::LoopThread(void *arg)
+{
+    ((EventLoop*) arg)->Loop();
+    return 0;
+}
+
+int
+TcpServer::Start()
+{
+    int fd;
+    pthread_t tid;
+    std::vector<int> fds;
+
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        if (!loops_[i]->IsValid())
+            return -1;
+    }
+
+    if (accept_mode_ == ACCEPT_SINGLE) {
+        fd = CreateListenSocket(ip_.empty() ? 0 : ip_.c_str(), port_, LISTEN_BACKLOG);
+        if (fd < 0)
+            return -1;
+        fds.push_back(fd);
+    } else if (CreateListenGroup(ip_.empty() ? 0 : ip_.c_str(), port_, LISTEN_BACKLOG, loops_.size(),
+                                 accept_mode_ == ACCEPT_SHARDED_CPU, fds) != 0) {
+        return -1;
+    }
+    port_ = GetLocalPort(fds[0]);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        acceptors_.push_back(new Acceptor(this, i, fds[i]));
+        if (acceptors_.back()->Listen() != 0)
+            return -1;
+    }
+
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        if (pthread_create(&tid, 0, LoopThread, loops_[i]) != 0) {
+            perror("pthread_create error in TcpServer::Start");
+            Stop();
+            return -1;
+        }
+        threads_.push_back(tid);
+        // loop i takes the connections of CPU i, so it has to run there
+        if (accept_mode_ == ACCEPT_SHARDED_CPU && PinThreadToCpu(tid, i) != 0)
+            perror("pthread_setaffinity_np error in TcpServer::Start");
+    }
+    started_ = true;
+    return 0;
+}
+
+void
+TcpServer::Stop()
+{
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        loops_[i]->QueueInLoop([this, i]() { CloseAll(i); });
+        loops_[i]->Stop();
+    }
+    for (size_t i = 0; i < threads_.size(); ++i)
+        pthread_join(threads_[i], 0);
+    threads_.clear();
+    started_ = false;
+}
+
+size_t
+TcpServer::NextLoop()
+{
+    // only the accepting loop calls this
+    size_t idx = next_loop_;
+    next_loop_ = (next_loop_ + 1) % loops_.size();
+    return idx;
+}
+
+void
+TcpServer::CloseAll(size_t idx)
+{
+    std::unordered_map<int, TcpConnection::ptr> conns;
+    conns.swap(connections_[idx]);
+    for (auto &it : conns)
+        it.second->Close();
+}
+
+uint64_t
+TcpServer::GetAccepted(int idx) const
+{
+    return (size_t) idx < acceptors_.size() ? acceptors_[idx]->GetAccepted() : 0;
+}
+
+void
+TcpServer::NewConnection(size_t accept_idx, int fd, const struct sockaddr_in &peer)
+{
+    // sharded, a connection stays on the loop that accepted it: the task
+    // below runs right away, with no hand-off to another thread
+    size_t idx = accept_mode_ == ACCEPT_SINGLE ? NextLoop() : accept_idx;
+    EventLoop *loop = loops_[idx];
+    SetTcpNoDelay(fd);
+    TcpConnection::ptr conn(new TcpConnection(loop, fd, peer));
+    conn->SetConnectionCallback(connection_cb_);
+    conn->SetMessageCallback(message_cb_);
+    conn->SetCloseCallback([this, idx](const TcpConnection::ptr &c) {
+        connections_[idx].erase(c->GetFd());
+        if (close_cb_)
+            close_cb_(c);
+    });
+    loop->RunInLoop([this, idx, conn]() {
+        connections_[idx][conn->GetFd()] = conn;
+        conn->Establish();
+        if (idle_ms_ && conn->IsConnected())
+            conn->SetIdleTimeout(idle_ms_);
+    });
+}
+
+}
@@ -0,0 +1,142 @@
+#ifndef __TCP_SERVER_H__
+#define __TCP_SERVER_H__
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include "event_loop.h"
+#include "tcp_connection.h"
+
+namespace ekko {
+
+class TcpServer;
+
+/// @brief which sockets listen and which loop takes an accepted connection
+enum AcceptMode {
+    /// @brief one listener on the first loop, connections dealt round-robin
+    ACCEPT_SINGLE,
+    /// @brief a SO_REUSEPORT listener per loop, the kernel spreads connections
+    /// by hash and each stays on the loop that accepted it
+    ACCEPT_SHARDED,
+    /// @brief sharded, with loop i pinned to CPU i and every connection steered
+    /// to the listener of the CPU that took its SYN; fully CPU-local when
+    /// there are as many loops as CPUs receiving
+    ACCEPT_SHARDED_CPU
+};
+
+/// @brief a listening socket, hands accepted fds to the server
+class Acceptor : public IoHandler {
+public:
+    /// @param[in] idx the loop it accepts on
+    Acceptor(TcpServer *server, size_t idx, int listen_fd);
+
+    ~Acceptor();
+
+    /// @return success with 0, fail with -1
+    int Listen();
+
+    void HandleEvent(uint32_t events) override;
+
+    uint64_t GetAccepted() const { return accepted_.load(std::memory_order_relaxed);}
+
+private:
+    TcpServer *server_;
+
+    size_t idx_;
+
+    EventLoop *loop_;
+
+    int listen_fd_;
+
+    /// @brief kept open to shed connections once we run out of fds
+    int idle_fd_;
+
+    std::atomic<uint64_t> accepted_{0};
+};
+
+/// @brief a reactor per thread: nloops event loops each run on their own thread.
+/// By default the listener accepts on the first one and spreads connections
+/// round-robin; sharded, every loop accepts its own, see AcceptMode.
+class TcpServer : Noncopyable {
+friend class Acceptor;
+public:
+    TcpServer(const char *ip, int port, int nloops);
+
+    ~TcpServer();
+
+    /// @brief bind, listen and start the loop threads
+    /// @return success with 0, fail with -1
+    int Start();
+
+    /// @brief stop every loop and join the threads
+    void Stop();
+
+    /// @brief the bound port, useful when constructed with port 0
+    int GetPort() const { return port_;}
+
+    int GetLoopCount() const { return loops_.size();}
+
+    EventLoop* GetLoop(int idx) const { return loops_[idx];}
+
+    void SetConnectionCallback(const TcpConnection::ConnectionCallback &cb) { connection_cb_ = cb;}
+
+    void SetMessageCallback(const TcpConnection::MessageCallback &cb) { message_cb_ = cb;}
+
+    void SetCloseCallback(const TcpConnection::ConnectionCallback &cb) { close_cb_ = cb;}
+
+    /// @brief close connections idle for ms, 0 for never; set before Start()
+    void SetIdleTimeout(uint64_t ms) { idle_ms_ = ms;}
+
+    /// @brief set before Start()
+    void SetAcceptMode(AcceptMode mode) { accept_mode_ = mode;}
+
+    AcceptMode GetAcceptMode() const { return accept_mode_;}
+
+    /// @return connections accepted by loop idx's acceptor so far, 0 when it has none
+    uint64_t GetAccepted(int idx) const;
+
+private:
+    static void* LoopThread(void *arg);
+
+    /// @brief called by an acceptor on its loop idx
+    void NewConnection(size_t idx, int fd, const struct sockaddr_in &peer);
+
+    /// @brief index of the loop for the next accepted connection
+    size_t NextLoop();
+
+    /// @brief close every connection of loop idx, on that loop
+    void CloseAll(size_t idx);
+
+    std::string ip_;
+
+    int port_;
+
+    std::vector<EventLoop*> loops_;
+
+    std::vector<pthread_t> threads_;
+
+    std::vector<Acceptor*> acceptors_;
+
+    /// @brief open connections by fd, one map per loop and only touched by it
+    std::vector<std::unordered_map<int, TcpConnection::ptr> > connections_;
+
+    size_t next_loop_ = 0;
+
+    bool started_ = false;
+
+    uint64_t idle_ms_ = 0;
+
+    AcceptMode accept_mode_ = ACCEPT_SINGLE;
+
+    TcpConnection::ConnectionCallback connection_cb_;
+
+    TcpConnection::MessageCallback message_cb_;
+
+    TcpConnection::ConnectionCallback close_cb_;
+};
+
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include "timing_wheel.h"
+#include <time.h>
+
+namespace ekko {
+
+static inline void
+list_init(wheel_node_t *head)
+{
+    head->prev = head->next = head;
+}
+
+static inline bool
+list_empty(const wheel_node_t *head)
+{
+    return head->next == head;
+}
+
+static inline void
+list_add_tail(wheel_node_t *head, wheel_node_t *node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static inline void
+list_del(wheel_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = 0;
+}
+
+/// @brief move everything of from to the end of to
+static inline void
+list_splice(wheel_node_t *from, wheel_node_t *to)
+{
+    if (list_empty(from))
+        return;
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    list_init(from);
+}
+
+uint64_t
+TimingWheel::NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+TimingWheel::TimingWheel(uint32_t tick_ms)
+    :tick_ms_(tick_ms ? tick_ms : 1) {
+    now_tick_ = clock_tick_ = NowMs() / tick_ms_;
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        busy_[level] = 0;
+        for (int i = 0; i < WHEEL_SLOTS; ++i)
+            list_init(&slots_[level][i]);
+    }
+}
+
+TimingWheel::~TimingWheel()
+{
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        for (int i = 0; i < WHEEL_SLOTS; ++i) {
+            wheel_node_t *head = &slots_[level][i];
+            while (!list_empty(head)) {
+                Timer *timer = static_cast<Timer*>(head->next);
+                list_del(timer);
+                timer->wheel_ = 0;
+                if (timer->owned_)
+                    delete timer;
+            }
+        }
+    }
+}
+
+void
+TimingWheel::Place(Timer *timer)
+{
+    uint64_t delta;
+    int level;
+
+    // past the last level: parked at its far end, placed again from there
+    if (timer->placed_ - now_tick_ >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+        timer->placed_ = now_tick_ + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    delta = timer->placed_ - now_tick_;
+    for (level = 0; level < WHEEL_LEVELS - 1; ++level) {
+        if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+            break;
+    }
+    uint32_t idx = (timer->placed_ >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer->slot_ = level * WHEEL_SLOTS + idx;
+    list_add_tail(&slots_[level][idx], timer);
+    busy_[level] |= 1ULL << idx;
+}
+
+void
+TimingWheel::Unlink(Timer *timer)
+{
+    wheel_node_t *head = &slots_[timer->slot_ / WHEEL_SLOTS][timer->slot_ % WHEEL_SLOTS];
+    list_del(timer);
+    if (list_empty(head))
+        busy_[timer->slot_ / WHEEL_SLOTS] &= ~(1ULL << (timer->slot_ % WHEEL_SLOTS));
+}
+
+void
+TimingWheel::Add(Timer *timer, uint64_t delay_ms)
+{
+    if (timer->wheel_)
+        Unlink(timer);
+    else
+        ++size_;
+    timer->wheel_ = this;
+    // at least one tick: the current one is already done
+    uint64_t ticks = (delay_ms + tick_ms_ - 1) / tick_ms_;
+    timer->expire_ = timer->placed_ = clock_tick_ + (ticks ? ticks : 1);
+    Place(timer);
+}
+
+void
+TimingWheel::Reset(Timer *timer, uint64_t delay_ms)
+{
+    uint64_t ticks = (delay_ms + tick_ms_ - 1) / tick_ms_;
+    uint64_t expire = clock_tick_ + (ticks ? ticks : 1);
+    if (timer->wheel_ == this && expire >= timer->placed_) {
+        // it is looked at when its slot comes up and placed again from there
+        timer->expire_ = expire;
+        return;
+    }
+    Add(timer, delay_ms);
+}
+
+void
+TimingWheel::Cancel(Timer *timer)
+{
+    if (timer->wheel_ != this)
+        return;
+    Unlink(timer);
+    timer->wheel_ = 0;
+    --size_;
+}
+
+void
+TimingWheel::RunAfter(uint64_t delay_ms, Callback cb)
+{
+    Timer *timer = new Timer(std::move(cb));
+    timer->owned_ = true;
+    Add(timer, delay_ms);
+}
+
+void
+TimingWheel::Cascade(int level, uint32_t idx)
+{
+    wheel_node_t head;
+
+    list_init(&head);
+    list_splice(&slots_[level][idx], &head);
+    busy_[level] &= ~(1ULL << idx);
+    while (!list_empty(&head)) {
+        Timer *timer = static_cast<Timer*>(head.next);
+        list_del(timer);
+        Place(timer);
+        ++moved_;
+    }
+}
+
+uint64_t
+TimingWheel::NextTick(int level) const
+{
+    int shift = WHEEL_BITS * level;
+    uint64_t busy = busy_[level];
+    if (!busy)
+        return UINT64_MAX;
+    // rotate so that bit 0 is the slot after the current one
+    uint32_t from = ((now_tick_ >> shift) + 1) & WHEEL_MASK;
+    uint64_t rotated = from ? (busy >> from) | (busy << (WHEEL_SLOTS - from)) : busy;
+    uint64_t off = __builtin_ctzll(rotated) + 1;
+    if (level == 0)
+        return now_tick_ + off;
+    // an upper slot matters when it is cascaded, at the start of its span
+    return ((now_tick_ >> shift) + off) << shift;
+}
+
+size_t
+TimingWheel::Advance(uint64_t now_ms)
+{
+    uint64_t target = now_ms / tick_ms_, next, boundary;
+    wheel_node_t due;
+    size_t ran = 0;
+    uint32_t idx;
+    int level;
+
+    Update(now_ms);
+    list_init(&due);
+    while (now_tick_ < target) {
+        // straight to the next busy slot of level 0 or the next cascade
+        boundary = (now_tick_ | WHEEL_MASK) + 1;
+        next = NextTick(0);
+        if (next > boundary)
+            next = boundary;
+        if (next > target) {
+            now_tick_ = target;
+            break;
+        }
+        now_tick_ = next;
+        // each level's slot for the new span, from the bottom up
+        for (level = 1; level < WHEEL_LEVELS; ++level) {
+            if (now_tick_ & ((1ULL << (WHEEL_BITS * level)) - 1))
+                break;
+            Cascade(level, (now_tick_ >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        }
+        idx = now_tick_ & WHEEL_MASK;
+        list_splice(&slots_[0][idx], &due);
+        busy_[0] &= ~(1ULL << idx);
+    }
+
+    while (!list_empty(&due)) {
+        Timer *timer = static_cast<Timer*>(due.next);
+        list_del(timer);
+        if (timer->expire_ > now_tick_) {
+            // pushed back by Reset() since it was placed
+            timer->placed_ = timer->expire_;
+            Place(timer);
+            ++moved_;
+            continue;
+        }
+        timer->wheel_ = 0;
+        --size_;
+        ++fired_;
+        ++ran;
+        if (timer->owned_) {
+            Callback cb(std::move(timer->cb_));
+            delete timer;
+            cb();
+        } else if (timer->cb_) {
+            timer->cb_();
+        }
+    }
+    return ran;
+}
+
+int
+TimingWheel::NextTimeout(uint64_t now_ms) const
+{
+    uint64_t tick = UINT64_MAX, t;
+
+    if (size_ == 0)
+        return -1;
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        t = NextTick(level);
+        if (t < tick)
+            tick = t;
+    }
+    if (tick == UINT64_MAX)
+        return -1;
+    uint64_t at = tick * tick_ms_;
+    if (at <= now_ms)
+        return 0;
+    return at - now_ms > INT32_MAX ? INT32_MAX : (int) (at - now_ms);
+}
+
+}
@@ -0,0 +1,157 @@
+#ifndef __TIMING_WHEEL_H__
+#define __TIMING_WHEEL_H__
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include "noncopyable.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+/// @brief with 1ms ticks: 64ms, 4s, 4.4min and 4.7h per level; longer delays
+/// are parked in the last level and placed again when they come up
+#define WHEEL_LEVELS 4
+
+namespace ekko {
+
+struct wheel_node_t {
+    wheel_node_t *prev;
+    wheel_node_t *next;
+};
+
+/**
+ * @brief a hierarchical timing wheel, one per loop and used from its thread only.
+ *
+ * Timers are intrusive, so arming, cancelling and resetting one never
+ * allocates and is O(1): a doubly-linked list per slot plus a bitmap of
+ * the busy slots per level. Reset() to a later deadline, the case of an
+ * idle timeout pushed back on every read, only stores the new deadline; the
+ * timer is moved when its old slot comes up, at most once per level.
+ *
+ * The wheel keeps its own idea of now, set by Update() and Advance();
+ * deadlines are counted from there, the time of the loop's last wake-up,
+ * so arming a timer does not read the clock.
+*/
+class TimingWheel : Noncopyable {
+public:
+    typedef std::function<void()> Callback;
+
+    class Timer : private wheel_node_t, Noncopyable {
+    friend class TimingWheel;
+    public:
+        Timer() { prev = next = 0;}
+
+        explicit Timer(Callback cb) :cb_(std::move(cb)) { prev = next = 0;}
+
+        /// @brief a timer going away is cancelled
+        ~Timer() { if (wheel_) wheel_->Cancel(this);}
+
+        void SetCallback(Callback cb) { cb_ = std::move(cb);}
+
+        bool IsArmed() const { return wheel_ != 0;}
+
+    private:
+        TimingWheel *wheel_ = 0;
+
+        /// @brief deadline, in ticks
+        uint64_t expire_ = 0;
+
+        /// @brief the tick its slot was chosen for, expire_ or earlier
+        uint64_t placed_ = 0;
+
+        /// @brief level * WHEEL_SLOTS + slot
+        uint32_t slot_ = 0;
+
+        /// @brief made by RunAfter(), deleted once it has run
+        bool owned_ = false;
+
+        Callback cb_;
+    };
+
+    /// @param[in] tick_ms resolution, deadlines are rounded up to it
+    explicit TimingWheel(uint32_t tick_ms = 1);
+
+    /// @brief armed timers are left unfired
+    ~TimingWheel();
+
+    /// @brief arm timer, or re-arm it exactly, delay_ms from now
+    void Add(Timer *timer, uint64_t delay_ms);
+
+    /// @brief push the deadline to delay_ms from now: only a store when it moves later
+    void Reset(Timer *timer, uint64_t delay_ms);
+
+    void Cancel(Timer *timer);
+
+    /// @brief a one-off timer owned by the wheel
+    void RunAfter(uint64_t delay_ms, Callback cb);
+
+    /// @brief move the time deadlines count from, without running anything
+    void Update(uint64_t now_ms) {
+        if (now_ms / tick_ms_ > clock_tick_)
+            clock_tick_ = now_ms / tick_ms_;
+    }
+
+    /**
+     * @brief move time on to now_ms and run every timer due, as one batch:
+     * the due timers are collected first, so callbacks may arm or cancel any
+     * timer, due ones included
+     * @return timers run
+    */
+    size_t Advance(uint64_t now_ms);
+
+    /**
+     * @brief how long the loop may sleep: until the first busy slot of level 0
+     * or the next cascade of a busy upper slot, so possibly early, never late
+     * @return ms, -1 when no timer is armed
+    */
+    int NextTimeout(uint64_t now_ms) const;
+
+    size_t Size() const { return size_;}
+
+    /// @brief now as the wheel sees it, the loop's last wake-up, in ms
+    uint64_t GetNowMs() const { return clock_tick_ * tick_ms_;}
+
+    uint64_t GetFired() const { return fired_;}
+
+    /// @return timers moved down a level or placed again after a lazy reset
+    uint64_t GetMoved() const { return moved_;}
+
+    /// @brief CLOCK_MONOTONIC in ms
+    static uint64_t NowMs();
+
+private:
+    /// @brief link timer into the slot for placed_, counted from now_tick_
+    void Place(Timer *timer);
+
+    void Unlink(Timer *timer);
+
+    /// @brief re-place every timer of a slot, they all belong lower down now
+    void Cascade(int level, uint32_t idx);
+
+    /// @brief the first tick after now_tick_ with something to do, for level
+    uint64_t NextTick(int level) const;
+
+    uint32_t tick_ms_;
+
+    /// @brief slots are processed up to here
+    uint64_t now_tick_;
+
+    /// @brief deadlines count from here, at or after now_tick_
+    uint64_t clock_tick_;
+
+    wheel_node_t slots_[WHEEL_LEVELS][WHEEL_SLOTS];
+
+    /// @brief bit i set when slot i of the level has timers
+    uint64_t busy_[WHEEL_LEVELS];
+
+    size_t size_ = 0;
+
+    uint64_t fired_ = 0;
+
+    uint64_t moved_ = 0;
+};
+
+}
+
+#endif
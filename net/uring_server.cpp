@@ -0,0 +1,1154 @@
+#include "uring_server.h"
+#include "io_uring.h"
+#include "page_cache.h"
+#include "socket_util.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#define LISTEN_BACKLOG 1024
+#define RING_ENTRIES 1024
+#define MAX_DIRECT_FILES 4096
+#define RECV_BGID 0
+/// @brief provided recv buffers per loop, a power of two
+#define RECV_BUFS 256
+/// @brief registered send slots per loop
+#define SEND_SLOTS 256
+/// @brief recv buffers and send slots are a page each, carved from spans this big
+#define SLOT_SPAN_PAGES 64
+/// @brief bytes moved through a connection's pipe per splice, the default pipe size
+#define SPLICE_CHUNK 65536
+
+namespace ekko {
+
+enum uring_op_t {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_SPLICE_IN,
+    OP_SPLICE_OUT,
+    OP_CANCEL,
+    OP_CLOSE,
+    OP_WAKE
+};
+
+/// @brief user_data: the op in the high half, the direct descriptor in the low one
+static inline uint64_t
+make_user_data(int op, uint32_t idx)
+{
+    return ((uint64_t) op << 32) | idx;
+}
+
+class UringConnection;
+
+/// @brief one ring driven by one thread, the io_uring counterpart of EventLoop
+class UringLoop : Noncopyable {
+public:
+    typedef std::function<void()> Task;
+    typedef std::shared_ptr<UringConnection> ConnPtr;
+
+    UringLoop(const UringServer::ConnectionCallback &connection_cb,
+              const UringServer::MessageCallback &message_cb,
+              const UringServer::ConnectionCallback &close_cb)
+        :connection_cb_(connection_cb)
+        ,message_cb_(message_cb)
+        ,close_cb_(close_cb) {}
+
+    ~UringLoop();
+
+    /// @brief set up the ring, its tables and buffers, and arm the accept
+    /// @return success with 0, fail with -1
+    int Init(int listen_fd);
+
+    void Loop();
+
+    /// @brief thread-safe
+    void Stop();
+
+    /// @brief thread-safe
+    void QueueInLoop(Task task);
+
+    bool IsInLoopThread() const;
+
+    uint64_t GetSyscalls() const { return syscalls_.load(std::memory_order_relaxed);}
+
+    uint64_t GetAccepted() const { return accepted_.load(std::memory_order_relaxed);}
+
+    /// @brief for every accepted connection, before the loop starts
+    void SetIdleTimeout(uint64_t ms) { idle_ms_ = ms;}
+
+    TimingWheel& GetWheel() { return wheel_;}
+
+    void SendInLoop(const ConnPtr &conn, const char *data, size_t len);
+
+    void SendInLoop(const ConnPtr &conn, IOBuf &&buf);
+
+    void SendFileInLoop(const ConnPtr &conn, const FileRef::ptr &file, off_t offset, size_t len);
+
+    void ShutdownInLoop(const ConnPtr &conn);
+
+    void CloseInLoop(const ConnPtr &conn);
+
+    void SetIdleTimeoutInLoop(const ConnPtr &conn, uint64_t ms);
+
+private:
+    void HandleCqe(struct io_uring_cqe *cqe);
+
+    void HandleAccept(int res, uint32_t flags);
+
+    void HandleRecv(const ConnPtr &conn, int res, uint32_t flags);
+
+    void HandleSend(const ConnPtr &conn, int res);
+
+    void HandleSplice(const ConnPtr &conn, int op, int res);
+
+    /// @brief the send or file in flight is over, start the next or close
+    void SendDone(const ConnPtr &conn, int res);
+
+    void HandleClose(uint32_t idx);
+
+    /// @brief data came in or went out, push the idle timeout back
+    void Touch(const ConnPtr &conn);
+
+    void ArmAccept();
+
+    void ArmRecv(const ConnPtr &conn);
+
+    void ArmWake();
+
+    void StartSend(const ConnPtr &conn);
+
+    void SubmitSend(const ConnPtr &conn);
+
+    /// @brief file to pipe, then pipe to socket: io_uring has no sendfile
+    void SubmitSpliceIn(const ConnPtr &conn);
+
+    void SubmitSpliceOut(const ConnPtr &conn);
+
+    void SubmitClose(const ConnPtr &conn);
+
+    char* RecvBuf(unsigned bid) const;
+
+    char* SendSlot(unsigned slot) const;
+
+    /// @brief hand a recv buffer back to the kernel, visible after PublishBufs()
+    void RecycleBuf(unsigned bid);
+
+    void PublishBufs();
+
+    void Wakeup();
+
+    void DoPendingTasks();
+
+    IoUring ring_;
+
+    int listen_fd_ = -1;
+
+    int wake_fd_ = -1;
+
+    bool accept_armed_ = false;
+
+    std::atomic<bool> stop_{false};
+
+    std::atomic<bool> wakeup_pending_{false};
+
+    std::atomic<uint64_t> syscalls_{0};
+
+    std::atomic<uint64_t> accepted_{0};
+
+    /// @brief before conns_, the connections' timers are cancelled into it
+    TimingWheel wheel_;
+
+    uint64_t idle_ms_ = 0;
+
+    /// @brief eventfd reads, the only syscalls besides io_uring_enter
+    uint64_t reads_ = 0;
+
+    /// @brief connections by direct descriptor
+    std::vector<ConnPtr> conns_;
+
+    Span *buf_ring_span_ = 0;
+
+    struct io_uring_buf_ring *buf_ring_ = 0;
+
+    uint16_t buf_tail_ = 0;
+
+    std::vector<Span*> recv_spans_;
+
+    std::vector<Span*> send_spans_;
+
+    /// @brief free registered send slots, empty when registration failed
+    std::vector<int> free_slots_;
+
+    pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+    std::vector<Task> pending_;
+
+    UringServer::ConnectionCallback connection_cb_;
+
+    UringServer::MessageCallback message_cb_;
+
+    UringServer::ConnectionCallback close_cb_;
+};
+
+class UringConnection : public Connection
+                      , public std::enable_shared_from_this<UringConnection> {
+friend class UringLoop;
+public:
+    UringConnection(UringLoop *loop, int idx)
+        :loop_(loop)
+        ,idx_(idx) {}
+
+    ~UringConnection();
+
+    void Send(const char *data, size_t len) override;
+
+    void Send(IOBuf &&buf) override;
+
+    void SendFile(const FileRef::ptr &file, off_t offset, size_t len) override;
+
+    using Connection::Send;
+
+    void Shutdown() override;
+
+    void Close() override;
+
+    void SetIdleTimeout(uint64_t ms) override;
+
+    uint64_t GetReceiveMs() const override { return loop_->GetWheel().GetNowMs();}
+
+private:
+    enum State {
+        CONNECTED,
+        DISCONNECTING,
+        DISCONNECTED
+    };
+
+    UringLoop *loop_;
+
+    /// @brief slot in the ring's direct descriptor table
+    int idx_;
+
+    State state_ = CONNECTED;
+
+    /// @brief ops in flight on the descriptor, it is closed once this drops to 0
+    int inflight_ = 0;
+
+    bool sending_ = false;
+
+    bool close_submitted_ = false;
+
+    /// @brief registered slot of the send in flight, -1 when it goes from send_buf_
+    int send_slot_ = -1;
+
+    const char *send_ptr_ = 0;
+
+    size_t send_len_ = 0;
+
+    /// @brief slices of a SENDMSG in flight, the kernel reads send_iov_ at submit
+    IOBuf send_buf_;
+
+    struct iovec send_iov_[IOBUF_MAX_IOV];
+
+    struct msghdr send_msg_;
+
+    Buffer input_;
+
+    IOBuf output_;
+
+    /// @brief sent once output_ is drained, each followed by its own data
+    std::deque<PendingFile> files_;
+
+    /// @brief made on the first file sent, the splices go through it
+    int pipe_[2] = { -1, -1 };
+
+    /// @brief bytes spliced into the pipe and not yet out to the socket
+    size_t pipe_bytes_ = 0;
+
+    TimingWheel::Timer idle_timer_;
+
+    uint64_t idle_ms_ = 0;
+};
+
+static thread_local UringLoop *t_uring_loop = 0;
+
+UringConnection::~UringConnection()
+{
+    if (pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+}
+
+void
+UringConnection::Send(const char *data, size_t len)
+{
+    std::shared_ptr<UringConnection> self = shared_from_this();
+    if (loop_->IsInLoopThread()) {
+        loop_->SendInLoop(self, data, len);
+        return;
+    }
+    std::string copy(data, len);
+    loop_->QueueInLoop([self, copy]() { self->loop_->SendInLoop(self, copy.data(), copy.size()); });
+}
+
+void
+UringConnection::Send(IOBuf &&buf)
+{
+    std::shared_ptr<UringConnection> self = shared_from_this();
+    if (loop_->IsInLoopThread()) {
+        loop_->SendInLoop(self, std::move(buf));
+        return;
+    }
+    IOBuf shared(std::move(buf));
+    loop_->QueueInLoop([self, shared]() mutable { self->loop_->SendInLoop(self, std::move(shared)); });
+}
+
+void
+UringConnection::SendFile(const FileRef::ptr &file, off_t offset, size_t len)
+{
+    std::shared_ptr<UringConnection> self = shared_from_this();
+    if (loop_->IsInLoopThread()) {
+        loop_->SendFileInLoop(self, file, offset, len);
+        return;
+    }
+    loop_->QueueInLoop([self, file, offset, len]() { self->loop_->SendFileInLoop(self, file, offset, len); });
+}
+
+void
+UringConnection::Shutdown()
+{
+    std::shared_ptr<UringConnection> self = shared_from_this();
+    if (loop_->IsInLoopThread())
+        loop_->ShutdownInLoop(self);
+    else
+        loop_->QueueInLoop([self]() { self->loop_->ShutdownInLoop(self); });
+}
+
+void
+UringConnection::Close()
+{
+    std::shared_ptr<UringConnection> self = shared_from_this();
+    if (loop_->IsInLoopThread())
+        loop_->CloseInLoop(self);
+    else
+        loop_->QueueInLoop([self]() { self->loop_->CloseInLoop(self); });
+}
+
+void
+UringConnection::SetIdleTimeout(uint64_t ms)
+{
+    std::shared_ptr<UringConnection> self = shared_from_this();
+    if (loop_->IsInLoopThread())
+        loop_->SetIdleTimeoutInLoop(self, ms);
+    else
+        loop_->QueueInLoop([self, ms]() { self->loop_->SetIdleTimeoutInLoop(self, ms); });
+}
+
+UringLoop::~UringLoop()
+{
+    // the kernel lets go of the buffers with the ring
+    ring_.Close();
+    for (size_t i = 0; i < recv_spans_.size(); ++i)
+        PageCache::GetInstance()->Deallocate(recv_spans_[i]);
+    for (size_t i = 0; i < send_spans_.size(); ++i)
+        PageCache::GetInstance()->Deallocate(send_spans_[i]);
+    if (buf_ring_span_)
+        PageCache::GetInstance()->Deallocate(buf_ring_span_);
+    if (wake_fd_ >= 0)
+        close(wake_fd_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+static Span*
+alloc_slot_spans(std::vector<Span*> &spans, unsigned nslots)
+{
+    Span *spanPtr = 0;
+    for (unsigned i = 0; i < nslots; i += SLOT_SPAN_PAGES) {
+        spanPtr = PageCache::GetInstance()->Allocate(SLOT_SPAN_PAGES);
+        if (!spanPtr)
+            return 0;
+        spans.push_back(spanPtr);
+    }
+    return spanPtr;
+}
+
+int
+UringLoop::Init(int listen_fd)
+{
+    struct rlimit rlim;
+    unsigned nfiles = MAX_DIRECT_FILES;
+    std::vector<struct iovec> iovs;
+
+    listen_fd_ = listen_fd;
+    // SUBMIT_ALL keeps a batch going past a failed sqe, COOP_TASKRUN skips
+    // the IPI when completions are posted; both are optimizations only
+    if (ring_.Init(RING_ENTRIES, IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN) != 0
+            && ring_.Init(RING_ENTRIES) != 0)
+        return -1;
+
+    // the table is charged against RLIMIT_NOFILE
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < nfiles)
+        nfiles = rlim.rlim_cur;
+    if (ring_.RegisterSparseFiles(nfiles) != 0) {
+        perror("register files error in UringLoop::Init");
+        return -1;
+    }
+    conns_.resize(nfiles);
+
+    buf_ring_span_ = PageCache::GetInstance()->Allocate(1);
+    if (!buf_ring_span_ || !alloc_slot_spans(recv_spans_, RECV_BUFS))
+        return -1;
+    buf_ring_ = (struct io_uring_buf_ring*) (buf_ring_span_->pageid << PAGE_SHIFT);
+    memset(buf_ring_, 0, PAGE_SIZE);
+    if (ring_.RegisterBufRing(buf_ring_, RECV_BUFS, RECV_BGID) != 0) {
+        perror("register buffer ring error in UringLoop::Init");
+        return -1;
+    }
+    for (unsigned bid = 0; bid < RECV_BUFS; ++bid)
+        RecycleBuf(bid);
+    PublishBufs();
+
+    // registered send slots spare the kernel pinning the pages on every
+    // write; RLIMIT_MEMLOCK may refuse them, sends then go from the heap
+    if (alloc_slot_spans(send_spans_, SEND_SLOTS)) {
+        for (unsigned i = 0; i < SEND_SLOTS; ++i) {
+            struct iovec iov;
+            iov.iov_base = SendSlot(i);
+            iov.iov_len = PAGE_SIZE;
+            iovs.push_back(iov);
+        }
+        if (ring_.RegisterBuffers(&iovs[0], iovs.size()) == 0) {
+            for (int i = SEND_SLOTS - 1; i >= 0; --i)
+                free_slots_.push_back(i);
+        }
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        perror("eventfd error in UringLoop::Init");
+        return -1;
+    }
+    ArmWake();
+    ArmAccept();
+    return ring_.Submit(0) < 0 ? -1 : 0;
+}
+
+bool
+UringLoop::IsInLoopThread() const
+{
+    return t_uring_loop == this;
+}
+
+char*
+UringLoop::RecvBuf(unsigned bid) const
+{
+    Span *spanPtr = recv_spans_[bid / SLOT_SPAN_PAGES];
+    return (char*) ((spanPtr->pageid + bid % SLOT_SPAN_PAGES) << PAGE_SHIFT);
+}
+
+char*
+UringLoop::SendSlot(unsigned slot) const
+{
+    Span *spanPtr = send_spans_[slot / SLOT_SPAN_PAGES];
+    return (char*) ((spanPtr->pageid + slot % SLOT_SPAN_PAGES) << PAGE_SHIFT);
+}
+
+void
+UringLoop::RecycleBuf(unsigned bid)
+{
+    // not buf_ring_->bufs: in C++ the header's flex array sits behind an
+    // empty struct, one byte off
+    struct io_uring_buf *buf = (struct io_uring_buf*) buf_ring_ + (buf_tail_ & (RECV_BUFS - 1));
+    buf->addr = (uint64_t) RecvBuf(bid);
+    buf->len = PAGE_SIZE;
+    buf->bid = bid;
+    ++buf_tail_;
+}
+
+void
+UringLoop::PublishBufs()
+{
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+void
+UringLoop::ArmAccept()
+{
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    // straight into a free slot of the table, no fd is ever installed
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    sqe->user_data = make_user_data(OP_ACCEPT, 0);
+    accept_armed_ = true;
+}
+
+void
+UringLoop::ArmRecv(const ConnPtr &conn)
+{
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (!sqe) {
+        CloseInLoop(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->idx_;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = RECV_BGID;
+    sqe->user_data = make_user_data(OP_RECV, conn->idx_);
+    ++conn->inflight_;
+}
+
+void
+UringLoop::ArmWake()
+{
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd_;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = make_user_data(OP_WAKE, 0);
+}
+
+void
+UringLoop::Loop()
+{
+    t_uring_loop = this;
+    while (!stop_.load(std::memory_order_acquire)) {
+        // whatever the last batch queued goes in with the wait, which the
+        // next timer bounds
+        if (ring_.Submit(1, wheel_.NextTimeout(TimingWheel::NowMs())) < 0
+                && errno != EBUSY && errno != ETIME)
+            perror("io_uring_enter error in UringLoop::Loop");
+        wheel_.Update(TimingWheel::NowMs());
+        ring_.ForEachCqe([this](struct io_uring_cqe *cqe) { HandleCqe(cqe); });
+        wheel_.Advance(TimingWheel::NowMs());
+        PublishBufs();
+        DoPendingTasks();
+        syscalls_.store(ring_.GetEnterCalls() + reads_, std::memory_order_relaxed);
+    }
+    DoPendingTasks();
+    // the descriptors close with the ring
+    for (size_t i = 0; i < conns_.size(); ++i) {
+        if (!conns_[i])
+            continue;
+        ConnPtr conn;
+        conn.swap(conns_[i]);
+        conn->state_ = UringConnection::DISCONNECTED;
+        wheel_.Cancel(&conn->idle_timer_);
+        if (close_cb_)
+            close_cb_(conn);
+    }
+    t_uring_loop = 0;
+}
+
+void
+UringLoop::Stop()
+{
+    stop_.store(true, std::memory_order_release);
+    Wakeup();
+}
+
+void
+UringLoop::QueueInLoop(Task task)
+{
+    pthread_mutex_lock(&mutex_);
+    pending_.push_back(std::move(task));
+    pthread_mutex_unlock(&mutex_);
+    if (!IsInLoopThread())
+        Wakeup();
+}
+
+void
+UringLoop::Wakeup()
+{
+    uint64_t one = 1;
+    if (wakeup_pending_.exchange(true, std::memory_order_acq_rel))
+        return;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+        perror("eventfd write error in UringLoop::Wakeup");
+}
+
+void
+UringLoop::DoPendingTasks()
+{
+    std::vector<Task> tasks;
+    wakeup_pending_.store(false, std::memory_order_release);
+    pthread_mutex_lock(&mutex_);
+    tasks.swap(pending_);
+    pthread_mutex_unlock(&mutex_);
+    for (size_t i = 0; i < tasks.size(); ++i)
+        tasks[i]();
+}
+
+void
+UringLoop::HandleCqe(struct io_uring_cqe *cqe)
+{
+    uint64_t val;
+    int op = cqe->user_data >> 32;
+    uint32_t idx = (uint32_t) cqe->user_data;
+
+    switch (op) {
+    case OP_ACCEPT:
+        HandleAccept(cqe->res, cqe->flags);
+        break;
+    case OP_RECV:
+        if (idx < conns_.size() && conns_[idx])
+            HandleRecv(conns_[idx], cqe->res, cqe->flags);
+        break;
+    case OP_SEND:
+        if (idx < conns_.size() && conns_[idx])
+            HandleSend(conns_[idx], cqe->res);
+        break;
+    case OP_SPLICE_IN:
+    case OP_SPLICE_OUT:
+        if (idx < conns_.size() && conns_[idx])
+            HandleSplice(conns_[idx], op, cqe->res);
+        break;
+    case OP_CLOSE:
+        HandleClose(idx);
+        break;
+    case OP_WAKE:
+        ++reads_;
+        if (read(wake_fd_, &val, sizeof(val)) < 0 && errno != EAGAIN)
+            perror("eventfd read error in UringLoop::HandleCqe");
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            ArmWake();
+        break;
+    default:
+        break;
+    }
+}
+
+void
+UringLoop::HandleAccept(int res, uint32_t flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+        accept_armed_ = false;
+    if (res >= 0 && (size_t) res < conns_.size()) {
+        accepted_.fetch_add(1, std::memory_order_relaxed);
+        ConnPtr conn(new UringConnection(this, res));
+        UringConnection *raw = conn.get();
+        conns_[res] = conn;
+        // a raw pointer, the connection owns the timer; it is cancelled on close
+        conn->idle_timer_.SetCallback([this, raw]() { CloseInLoop(raw->shared_from_this()); });
+        if (idle_ms_)
+            SetIdleTimeoutInLoop(conn, idle_ms_);
+        if (connection_cb_)
+            connection_cb_(conn);
+        if (conn->state_ == UringConnection::CONNECTED)
+            ArmRecv(conn);
+    } else if (res < 0 && res != -ECANCELED && res != -ENFILE) {
+        fprintf(stderr, "accept error in UringLoop::HandleAccept: %s\n", strerror(-res));
+    }
+    // a full table is re-armed by the next close
+    if (!accept_armed_ && res != -ENFILE && res != -ECANCELED && !stop_.load(std::memory_order_relaxed))
+        ArmAccept();
+}
+
+void
+UringLoop::HandleRecv(const ConnPtr &conn, int res, uint32_t flags)
+{
+    bool more = flags & IORING_CQE_F_MORE;
+    unsigned bid;
+
+    if (!more)
+        --conn->inflight_;
+    if (res > 0) {
+        Touch(conn);
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        conn->input_.Append(RecvBuf(bid), res);
+        RecycleBuf(bid);
+        if (conn->state_ == UringConnection::CONNECTED && message_cb_)
+            message_cb_(conn, conn->input_);
+        if (!more && conn->state_ == UringConnection::CONNECTED)
+            ArmRecv(conn);
+    } else if (res == -ENOBUFS) {
+        // out of provided buffers, they are recycled by the time this goes in
+        if (conn->state_ == UringConnection::CONNECTED)
+            ArmRecv(conn);
+    } else if (res != -ECANCELED) {
+        // 0 is the peer closing
+        CloseInLoop(conn);
+    }
+    if (conn->state_ == UringConnection::DISCONNECTED && conn->inflight_ == 0)
+        SubmitClose(conn);
+}
+
+void
+UringLoop::SendInLoop(const ConnPtr &conn, const char *data, size_t len)
+{
+    if (conn->state_ != UringConnection::CONNECTED)
+        return;
+    if (conn->files_.empty())
+        conn->output_.Append(data, len);
+    else
+        conn->files_.back().after.Append(data, len);
+    if (!conn->sending_)
+        StartSend(conn);
+}
+
+void
+UringLoop::SendInLoop(const ConnPtr &conn, IOBuf &&buf)
+{
+    if (conn->state_ != UringConnection::CONNECTED)
+        return;
+    if (conn->files_.empty())
+        conn->output_.Append(std::move(buf));
+    else
+        conn->files_.back().after.Append(std::move(buf));
+    if (!conn->sending_)
+        StartSend(conn);
+}
+
+void
+UringLoop::SendFileInLoop(const ConnPtr &conn, const FileRef::ptr &file, off_t offset, size_t len)
+{
+    if (conn->state_ != UringConnection::CONNECTED || len == 0)
+        return;
+    conn->files_.push_back(PendingFile());
+    PendingFile &f = conn->files_.back();
+    f.file = file;
+    f.offset = offset;
+    f.len = len;
+    if (!conn->sending_)
+        StartSend(conn);
+}
+
+void
+UringLoop::StartSend(const ConnPtr &conn)
+{
+    size_t n = conn->output_.Size();
+
+    if (n == 0 && !conn->files_.empty()) {
+        if (conn->pipe_[0] < 0 && pipe2(conn->pipe_, O_CLOEXEC) < 0) {
+            perror("pipe2 error in UringLoop::StartSend");
+            CloseInLoop(conn);
+            return;
+        }
+        conn->sending_ = true;
+        SubmitSpliceIn(conn);
+        return;
+    }
+    if (n == 0)
+        return;
+    // small replies are gathered into a registered slot, anything bigger
+    // goes out of its own slices with SENDMSG
+    if (n <= PAGE_SIZE && !free_slots_.empty()) {
+        conn->send_slot_ = free_slots_.back();
+        free_slots_.pop_back();
+        conn->output_.CopyTo(SendSlot(conn->send_slot_), n);
+        conn->output_.Clear();
+        conn->send_ptr_ = SendSlot(conn->send_slot_);
+        conn->send_len_ = n;
+    } else {
+        conn->send_buf_ = std::move(conn->output_);
+    }
+    conn->sending_ = true;
+    SubmitSend(conn);
+}
+
+void
+UringLoop::SubmitSend(const ConnPtr &conn)
+{
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (!sqe) {
+        CloseInLoop(conn);
+        return;
+    }
+    if (conn->send_slot_ >= 0) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = conn->send_slot_;
+        sqe->addr = (uint64_t) conn->send_ptr_;
+        sqe->len = conn->send_len_;
+    } else {
+        memset(&conn->send_msg_, 0, sizeof(conn->send_msg_));
+        conn->send_msg_.msg_iov = conn->send_iov_;
+        conn->send_msg_.msg_iovlen = conn->send_buf_.FillIovec(conn->send_iov_, IOBUF_MAX_IOV);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->addr = (uint64_t) &conn->send_msg_;
+        sqe->len = 1;
+    }
+    sqe->fd = conn->idx_;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->user_data = make_user_data(OP_SEND, conn->idx_);
+    ++conn->inflight_;
+}
+
+void
+UringLoop::HandleSend(const ConnPtr &conn, int res)
+{
+    --conn->inflight_;
+    if (res > 0 && conn->state_ != UringConnection::DISCONNECTED) {
+        Touch(conn);
+        // short write, or more slices than one SENDMSG takes: go on from where it stopped
+        bool more;
+        if (conn->send_slot_ >= 0) {
+            conn->send_ptr_ += res;
+            conn->send_len_ -= res;
+            more = conn->send_len_ > 0;
+        } else {
+            conn->send_buf_.PopFront(res);
+            more = !conn->send_buf_.Empty();
+        }
+        if (more) {
+            SubmitSend(conn);
+            return;
+        }
+    }
+    if (conn->send_slot_ >= 0)
+        free_slots_.push_back(conn->send_slot_);
+    conn->send_slot_ = -1;
+    conn->send_len_ = 0;
+    conn->send_buf_.Clear();
+    SendDone(conn, res);
+}
+
+void
+UringLoop::SubmitSpliceIn(const ConnPtr &conn)
+{
+    PendingFile &f = conn->files_.front();
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (!sqe) {
+        CloseInLoop(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = conn->pipe_[1];
+    sqe->off = (uint64_t) -1;
+    sqe->splice_fd_in = f.file->GetFd();
+    sqe->splice_off_in = f.offset;
+    sqe->len = f.len < SPLICE_CHUNK ? f.len : SPLICE_CHUNK;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->user_data = make_user_data(OP_SPLICE_IN, conn->idx_);
+    ++conn->inflight_;
+}
+
+void
+UringLoop::SubmitSpliceOut(const ConnPtr &conn)
+{
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (!sqe) {
+        CloseInLoop(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = conn->idx_;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->off = (uint64_t) -1;
+    sqe->splice_fd_in = conn->pipe_[0];
+    sqe->splice_off_in = (uint64_t) -1;
+    sqe->len = conn->pipe_bytes_;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->user_data = make_user_data(OP_SPLICE_OUT, conn->idx_);
+    ++conn->inflight_;
+}
+
+void
+UringLoop::HandleSplice(const ConnPtr &conn, int op, int res)
+{
+    --conn->inflight_;
+    if (res > 0 && conn->state_ != UringConnection::DISCONNECTED) {
+        PendingFile &f = conn->files_.front();
+        if (op == OP_SPLICE_IN) {
+            f.offset += res;
+            f.len -= res;
+            conn->pipe_bytes_ = res;
+            SubmitSpliceOut(conn);
+            return;
+        }
+        Touch(conn);
+        conn->pipe_bytes_ -= res;
+        if (conn->pipe_bytes_ > 0) {
+            SubmitSpliceOut(conn);
+            return;
+        }
+        if (f.len > 0) {
+            SubmitSpliceIn(conn);
+            return;
+        }
+        conn->output_ = std::move(f.after);
+        conn->files_.pop_front();
+    } else if (res == 0 && conn->state_ != UringConnection::DISCONNECTED) {
+        // end of file before the range was: what is left can never be sent
+        res = -EIO;
+    }
+    SendDone(conn, res);
+}
+
+void
+UringLoop::SendDone(const ConnPtr &conn, int res)
+{
+    conn->sending_ = false;
+    if (res < 0 && res != -ECANCELED)
+        CloseInLoop(conn);
+    else if (conn->output_.Size() > 0 || !conn->files_.empty())
+        StartSend(conn);
+    else if (conn->state_ == UringConnection::DISCONNECTING)
+        CloseInLoop(conn);
+    if (conn->state_ == UringConnection::DISCONNECTED && conn->inflight_ == 0)
+        SubmitClose(conn);
+}
+
+void
+UringLoop::ShutdownInLoop(const ConnPtr &conn)
+{
+    if (conn->state_ != UringConnection::CONNECTED)
+        return;
+    conn->state_ = UringConnection::DISCONNECTING;
+    if (!conn->sending_)
+        CloseInLoop(conn);
+}
+
+void
+UringLoop::CloseInLoop(const ConnPtr &conn)
+{
+    struct io_uring_sqe *sqe;
+
+    if (conn->state_ == UringConnection::DISCONNECTED)
+        return;
+    conn->state_ = UringConnection::DISCONNECTED;
+    wheel_.Cancel(&conn->idle_timer_);
+    if (conn->inflight_ == 0) {
+        SubmitClose(conn);
+        return;
+    }
+    // the close goes in once the cancelled ops have completed
+    sqe = ring_.GetSqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = conn->idx_;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = make_user_data(OP_CANCEL, conn->idx_);
+}
+
+void
+UringLoop::SetIdleTimeoutInLoop(const ConnPtr &conn, uint64_t ms)
+{
+    conn->idle_ms_ = ms;
+    if (conn->state_ == UringConnection::DISCONNECTED)
+        return;
+    if (ms)
+        wheel_.Add(&conn->idle_timer_, ms);
+    else
+        wheel_.Cancel(&conn->idle_timer_);
+}
+
+void
+UringLoop::Touch(const ConnPtr &conn)
+{
+    if (conn->idle_ms_)
+        wheel_.Reset(&conn->idle_timer_, conn->idle_ms_);
+}
+
+void
+UringLoop::SubmitClose(const ConnPtr &conn)
+{
+    struct io_uring_sqe *sqe;
+
+    if (conn->close_submitted_)
+        return;
+    sqe = ring_.GetSqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = conn->idx_ + 1;
+    sqe->user_data = make_user_data(OP_CLOSE, conn->idx_);
+    conn->close_submitted_ = true;
+}
+
+void
+UringLoop::HandleClose(uint32_t idx)
+{
+    ConnPtr conn;
+
+    if (idx >= conns_.size())
+        return;
+    conn.swap(conns_[idx]);
+    if (conn && close_cb_)
+        close_cb_(conn);
+    if (!accept_armed_ && !stop_.load(std::memory_order_relaxed))
+        ArmAccept();
+}
+
+UringServer::UringServer(const char *ip, int port, int nloops, bool use_uring)
+    :ip_(ip ? ip : "")
+    ,port_(port)
+    ,nloops_(nloops < 1 ? 1 : nloops)
+    ,use_uring_(use_uring) {
+}
+
+UringServer::~UringServer()
+{
+    Stop();
+    delete fallback_;
+}
+
+bool
+UringServer::IsSupported()
+{
+    static int supported = -1;
+    struct utsname uts;
+    int major = 0, minor = 0;
+    IoUring ring;
+
+    if (supported >= 0)
+        return supported;
+    // multishot recv arrived in 6.0, the rest of what we use before it
+    supported = 0;
+    if (uname(&uts) != 0 || sscanf(uts.release, "%d.%d", &major, &minor) != 2)
+        return false;
+    if (major < 6)
+        return false;
+    // may still be off through kernel.io_uring_disabled or a seccomp filter
+    supported = ring.Init(4) == 0;
+    return supported;
+}
+
+void*
+UringServer::LoopThread(void *arg)
+{
+    ((UringLoop*) arg)->Loop();
+    return 0;
+}
+
+int
+UringServer::Start()
+{
+    pthread_t tid;
+
+    if (!use_uring_ || !IsSupported())
+        return StartFallback();
+
+    // single, every ring accepts from the one listener; sharded, each from its own
+    if (accept_mode_ == ACCEPT_SINGLE) {
+        int fd = CreateListenSocket(ip_.empty() ? 0 : ip_.c_str(), port_, LISTEN_BACKLOG);
+        if (fd < 0)
+            return -1;
+        listen_fds_.push_back(fd);
+    } else if (CreateListenGroup(ip_.empty() ? 0 : ip_.c_str(), port_, LISTEN_BACKLOG, nloops_,
+                                 accept_mode_ == ACCEPT_SHARDED_CPU, listen_fds_) != 0) {
+        return -1;
+    }
+    // accepted sockets inherit it, there is no fd to set it on afterwards
+    for (size_t i = 0; i < listen_fds_.size(); ++i)
+        SetTcpNoDelay(listen_fds_[i]);
+    port_ = GetLocalPort(listen_fds_[0]);
+
+    for (int i = 0; i < nloops_; ++i) {
+        loops_.push_back(new UringLoop(connection_cb_, message_cb_, close_cb_));
+        loops_.back()->SetIdleTimeout(idle_ms_);
+        if (loops_.back()->Init(listen_fds_[i % listen_fds_.size()]) != 0) {
+            for (size_t j = 0; j < loops_.size(); ++j)
+                delete loops_[j];
+            loops_.clear();
+            for (size_t j = 0; j < listen_fds_.size(); ++j)
+                close(listen_fds_[j]);
+            listen_fds_.clear();
+            return StartFallback();
+        }
+    }
+    // WRITE_FIXED has no MSG_NOSIGNAL
+    signal(SIGPIPE, SIG_IGN);
+
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        if (pthread_create(&tid, 0, LoopThread, loops_[i]) != 0) {
+            perror("pthread_create error in UringServer::Start");
+            Stop();
+            return -1;
+        }
+        threads_.push_back(tid);
+        if (accept_mode_ == ACCEPT_SHARDED_CPU && PinThreadToCpu(tid, i) != 0)
+            perror("pthread_setaffinity_np error in UringServer::Start");
+    }
+    uring_ = true;
+    return 0;
+}
+
+int
+UringServer::StartFallback()
+{
+    ConnectionCallback connection_cb = connection_cb_;
+    MessageCallback message_cb = message_cb_;
+    ConnectionCallback close_cb = close_cb_;
+
+    fallback_ = new TcpServer(ip_.empty() ? 0 : ip_.c_str(), port_, nloops_);
+    if (connection_cb)
+        fallback_->SetConnectionCallback([connection_cb](const TcpConnection::ptr &conn) { connection_cb(conn); });
+    if (message_cb)
+        fallback_->SetMessageCallback([message_cb](const TcpConnection::ptr &conn, Buffer &buf) { message_cb(conn, buf); });
+    if (close_cb)
+        fallback_->SetCloseCallback([close_cb](const TcpConnection::ptr &conn) { close_cb(conn); });
+    fallback_->SetIdleTimeout(idle_ms_);
+    fallback_->SetAcceptMode(accept_mode_);
+    if (fallback_->Start() != 0)
+        return -1;
+    port_ = fallback_->GetPort();
+    return 0;
+}
+
+void
+UringServer::Stop()
+{
+    if (fallback_) {
+        fallback_->Stop();
+        return;
+    }
+    for (size_t i = 0; i < threads_.size(); ++i)
+        loops_[i]->Stop();
+    for (size_t i = 0; i < threads_.size(); ++i)
+        pthread_join(threads_[i], 0);
+    threads_.clear();
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        retired_syscalls_ += loops_[i]->GetSyscalls();
+        delete loops_[i];
+    }
+    loops_.clear();
+    for (size_t i = 0; i < listen_fds_.size(); ++i)
+        close(listen_fds_[i]);
+    listen_fds_.clear();
+}
+
+uint64_t
+UringServer::GetAccepted(int idx) const
+{
+    if (fallback_)
+        return fallback_->GetAccepted(idx);
+    return (size_t) idx < loops_.size() ? loops_[idx]->GetAccepted() : 0;
+}
+
+uint64_t
+UringServer::GetSyscalls() const
+{
+    uint64_t n = retired_syscalls_;
+    if (fallback_) {
+        for (int i = 0; i < fallback_->GetLoopCount(); ++i)
+            n += fallback_->GetLoop(i)->GetSyscalls();
+        return n;
+    }
+    for (size_t i = 0; i < loops_.size(); ++i)
+        n += loops_[i]->GetSyscalls();
+    return n;
+}
+
+}
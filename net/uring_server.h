@@ -0,0 +1,111 @@
+#ifndef __URING_SERVER_H__
+#define __URING_SERVER_H__
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "buffer.h"
+#include "connection.h"
+#include "noncopyable.h"
+#include "tcp_server.h"
+
+namespace ekko {
+
+class UringLoop;
+
+/**
+ * @brief the same reactor-per-thread server as TcpServer on io_uring: each
+ * loop thread owns a ring with a multishot accept on the shared listener,
+ * or on a SO_REUSEPORT listener of its own when sharded; connections live
+ * in the ring's direct descriptor table and are read with multishot recv
+ * into a provided buffer ring carved from PageCache spans. Submissions are
+ * batched and go in with the wait, one io_uring_enter per loop iteration.
+ *
+ * Falls back to an epoll TcpServer when the kernel has no usable io_uring
+ * (older than 6.0, disabled by sysctl or seccomp) or a ring cannot be set up.
+*/
+class UringServer : Noncopyable {
+public:
+    typedef std::function<void(const Connection::ptr&)> ConnectionCallback;
+    typedef std::function<void(const Connection::ptr&, Buffer&)> MessageCallback;
+
+    /// @param[in] use_uring false forces the epoll backend
+    UringServer(const char *ip, int port, int nloops, bool use_uring = true);
+
+    ~UringServer();
+
+    /// @return success with 0, fail with -1
+    int Start();
+
+    void Stop();
+
+    int GetPort() const { return port_;}
+
+    /// @brief valid after Start(), false when running on the epoll fallback
+    bool IsUring() const { return uring_;}
+
+    /// @return io_uring_enter and other syscalls made by the loops, or the
+    /// epoll loops' count on the fallback
+    uint64_t GetSyscalls() const;
+
+    /// @brief true when io_uring has what the server needs on this kernel
+    static bool IsSupported();
+
+    void SetConnectionCallback(const ConnectionCallback &cb) { connection_cb_ = cb;}
+
+    void SetMessageCallback(const MessageCallback &cb) { message_cb_ = cb;}
+
+    void SetCloseCallback(const ConnectionCallback &cb) { close_cb_ = cb;}
+
+    /// @brief close connections idle for ms, 0 for never; set before Start()
+    void SetIdleTimeout(uint64_t ms) { idle_ms_ = ms;}
+
+    /// @brief set before Start(); with ACCEPT_SINGLE every ring accepts from
+    /// the one listener, on the epoll fallback only the first loop does
+    void SetAcceptMode(AcceptMode mode) { accept_mode_ = mode;}
+
+    /// @return connections accepted by loop idx so far
+    uint64_t GetAccepted(int idx) const;
+
+private:
+    static void* LoopThread(void *arg);
+
+    int StartFallback();
+
+    std::string ip_;
+
+    int port_;
+
+    int nloops_;
+
+    bool use_uring_;
+
+    bool uring_ = false;
+
+    uint64_t idle_ms_ = 0;
+
+    AcceptMode accept_mode_ = ACCEPT_SINGLE;
+
+    /// @brief one, or one per loop when sharded
+    std::vector<int> listen_fds_;
+
+    std::vector<UringLoop*> loops_;
+
+    std::vector<pthread_t> threads_;
+
+    /// @brief syscalls of loops already torn down by Stop()
+    uint64_t retired_syscalls_ = 0;
+
+    TcpServer *fallback_ = 0;
+
+    ConnectionCallback connection_cb_;
+
+    MessageCallback message_cb_;
+
+    ConnectionCallback close_cb_;
+};
+
+}
+
+#endif
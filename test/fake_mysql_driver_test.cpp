@@ -0,0 +1,246 @@
+#include "fake_mysql_driver.h"
+#include "mysql_pool.h"
+#include "query_cache.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <assert.h>
+#include <stdio.h>
+
+using namespace ekko;
+
+static ResultSet
+rows(int n)
+{
+	ResultSet rs;
+	rs.setColumns({ { "id", MYSQL_TYPE_LONGLONG, 0 }, { "name", MYSQL_TYPE_VAR_STRING, 0 } });
+	for (int i = 0; i < n; i++) {
+		std::string id = std::to_string(i), name = "user" + id;
+		const char *row[] = { id.c_str(), name.c_str() };
+		unsigned long lengths[] = { id.size(), name.size() };
+		rs.appendRow(row, lengths);
+	}
+	return rs;
+}
+
+static MysqlPool *
+new_pool(FakeMysqlDriver *fake, unsigned int max_connect)
+{
+	MysqlPool *pool = new MysqlPool();
+	pool->setDriver(fake);
+	pool->setParameter("fake", "user", "pwd", "db", 0, NULL, 0, max_connect);
+	return pool;
+}
+
+static void
+test_render()
+{
+	SqlParam params[] = { 42, "it's", nullptr, 1.5 };
+	std::string sql;
+	assert(SqlParam::render(NULL, "select ?, '?', ? -- ?\n, ?, ?", params, 4, sql));
+	assert(sql == "select 42, '?', 'it\\'s' -- ?\n, NULL, 1.5");
+	assert(!SqlParam::render(NULL, "select ?", params, 2, sql));
+	assert(!SqlParam::render(NULL, "select ?, ?", params, 1, sql));
+}
+
+static void
+test_results()
+{
+	FakeMysqlDriver fake;
+	FakeMysqlRule slow;
+	slow.prefix = "select sleep";
+	slow.has_latency = true;
+	slow.latency = FakeLatency::fixed(20000);
+	fake.addRule(slow);
+	fake.addResult("select", rows(3));
+	MysqlPool *pool = new_pool(&fake, 2);
+	ResultSet rs;
+	assert(pool->query("  SELECT id, name FROM users", rs));
+	assert(rs.rowCount() == 3 && rs.getString(2, "name") == "user2");
+	assert(pool->execute(rs, "select * from users where id = ?", 1));
+	assert(rs.rowCount() == 3);
+	assert(pool->query("update users set name = 'x'", rs));
+	assert(rs.columnCount() == 0);
+	std::vector<ResultSet> results;
+	assert(!pool->batch("select 1; select 2", results));
+
+	auto begin = std::chrono::steady_clock::now();
+	assert(pool->query("select sleep(1)", rs) && rs.rowCount() == 0);
+	assert(std::chrono::steady_clock::now() - begin >= std::chrono::milliseconds(20));
+	delete pool;
+	assert(fake.getStats().open == 0);
+}
+
+static void
+test_waiting()
+{
+	FakeMysqlDriver fake;
+	MysqlPool *pool = new_pool(&fake, 2);
+	PooledConnection a = pool->acquire(0), b = pool->acquire(0);
+	assert(a && b);
+	assert(!pool->acquire(0));
+	assert(!pool->acquire(20));
+	std::thread giver([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		a.release();
+	});
+	assert(pool->acquire(1000));
+	giver.join();
+	MysqlPoolStats stats = pool->getStats();
+	assert(stats.rejected == 1 && stats.timeouts == 1 && stats.waited == 2);
+	b.release();
+	delete pool;
+	assert(fake.getStats().max_open == 2);
+}
+
+static void
+test_failures()
+{
+	FakeMysqlDriver fake;
+	FakeMysqlRule deadlock;
+	deadlock.prefix = "update";
+	deadlock.error_rate = 1;
+	fake.addRule(deadlock);
+	MysqlPool *pool = new_pool(&fake, 2);
+	ResultSet rs;
+
+	// a server error leaves the connection in the pool
+	assert(pool->query("select 1", rs));
+	assert(!pool->query("update t set a = 1", rs));
+	assert(pool->getStats().total == 1 && fake.getStats().errors == 1);
+	{
+		PooledConnection conn = pool->acquire();
+		assert(!conn.query("update t set a = 1", rs) && conn.errorCode() == ER_LOCK_DEADLOCK);
+	}
+
+	// a lost connection is closed, the next query gets a new one
+	fake.setLostRate(1);
+	assert(!pool->query("select 1", rs));
+	assert(pool->getStats().total == 0 && fake.getStats().open == 0);
+	fake.setLostRate(0);
+	assert(pool->query("select 1", rs));
+
+	// nothing can connect while the server is down
+	fake.setDown(true);
+	assert(!pool->query("select 1", rs));
+	assert(!pool->query("select 1", rs));
+	assert(pool->getStats().connect_failed == 1);
+	fake.setDown(false);
+	fake.setMaxConnections(1);
+	PooledConnection a = pool->acquire(0);
+	assert(a && !pool->acquire(0));
+	assert(pool->getStats().connect_failed == 2);
+	assert(pool->getStats().acquired == 7);		// failed connects are not counted
+	a.release();
+	delete pool;
+}
+
+/*
+ * The maintenance thread pings idle connections, drops the ones that died
+ * with the server and refills min_idle once it is back.
+ */
+static void
+test_health_check()
+{
+	FakeMysqlDriver fake;
+	MysqlPool *pool = new_pool(&fake, 4);
+	pool->setMaintenance(2, 0);
+	assert(pool->start());
+	assert(pool->getStats().idle == 2);
+	fake.setDown(true);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1300));
+	assert(pool->getStats().total == 0 && fake.getStats().ping_failed == 2);
+	fake.setDown(false);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+	assert(pool->getStats().idle == 2 && fake.getStats().open == 2);
+	ResultSet rs;
+	assert(pool->query("select 1", rs));
+	delete pool;
+}
+
+static void
+test_cache()
+{
+	FakeMysqlDriver fake;
+	fake.addResult("select", rows(10));
+	MysqlPool *pool = new_pool(&fake, 2);
+	{
+		QueryCache cache(pool);
+		SqlParam id[] = { 1 };
+		assert(cache.query("select * from users")->rowCount() == 10);
+		assert(cache.query("select  *  from users")->rowCount() == 10);
+		assert(cache.execute("select * from users where id = ?", id, 1));
+		assert(cache.execute("select * from users where id = ?", id, 1));
+		assert(fake.getStats().queries == 2);
+		assert(cache.query("update users set name = 'x' where id = 1"));
+		assert(cache.query("select * from users"));
+		assert(fake.getStats().queries == 4);
+		QueryCacheStats stats = cache.getStats();
+		assert(stats.hits == 2 && stats.misses == 3 && stats.invalidations == 2);
+
+		// the connection is lost on COMMIT, the tables it wrote are invalidated
+		{
+			PooledConnection conn = pool->acquire();
+			ResultSet rs;
+			assert(conn.query("begin", rs) && conn.query("update users set name = 'y'", rs));
+			assert(cache.query("select * from users"));
+			fake.setLostRate(1);
+			assert(!conn.query("commit", rs));
+			fake.setLostRate(0);
+		}
+		assert(cache.query("select * from users"));
+		assert(fake.getStats().queries == 9 && cache.getStats().misses == 5);
+	}
+	delete pool;
+}
+
+/*
+ * Statements whose result changes from one run to the next, or that do
+ * something, run every time and are never shared between callers.
+ */
+static void
+test_cache_bypass()
+{
+	FakeMysqlDriver fake;
+	fake.addResult("select", rows(1));
+	MysqlPool *pool = new_pool(&fake, 2);
+	{
+		QueryCache cache(pool);
+		const char *sqls[] = {
+			"select now()",
+			"select id from users where created > now()",
+			"select rand() from users",
+			"select last_insert_id()",
+			"select @last",
+			"select @@session.autocommit",
+			"select get_lock('job', 0)",
+			"select 1",
+		};
+		for (const char *sql : sqls) {
+			assert(cache.query(sql));
+			assert(cache.query(sql));
+		}
+		QueryCacheStats stats = cache.getStats();
+		assert(stats.hits == 0 && stats.misses == 0 && stats.bypassed == 16 && stats.entries == 0);
+		assert(fake.getStats().queries == 16);
+		SqlParam id[] = { 1 };
+		assert(cache.execute("select * from users where id = ? and name = current_user()", id, 1));
+		assert(cache.execute("select * from users where id = ? and name = current_user()", id, 1));
+		assert(fake.getStats().queries == 18 && cache.getStats().bypassed == 18);
+	}
+	delete pool;
+}
+
+int
+main()
+{
+	test_render();
+	test_results();
+	test_waiting();
+	test_failures();
+	test_health_check();
+	test_cache();
+	test_cache_bypass();
+	printf("done \n");
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include "scheduler.h"
+#include "fiber_sync.h"
+#include "log.h"
+#include <vector>
+#include <assert.h>
+#define NFIBERS 2000
+
+using namespace ekko;
+
+int
+main()
+{
+	struct thread_pool_t pool;
+	thread_pool_init(&pool, 4);
+	Scheduler *scheduler = new Scheduler(&pool, 4, 16384);
+
+	// thousands of fibers fighting over one fiber mutex
+	FiberMutex mutex;
+	long long counter = 0;
+	std::vector<Fiber::ptr> fibers;
+	for (int i = 0; i < NFIBERS; ++i) {
+		fibers.push_back(scheduler->Spawn([&] {
+			for (int j = 0; j < 10; ++j) {
+				FiberMutex::Lock lock(mutex);
+				long long v = counter;
+				Fiber::Yield();
+				counter = v + 1;
+			}
+		}));
+	}
+	for (auto &f : fibers)
+		f->Join();
+	assert(counter == NFIBERS * 10);
+
+	// producer/consumer over a condition, joined from inside a fiber
+	FiberCondition cond;
+	std::vector<int> queue;
+	int consumed = 0;
+	Fiber::ptr consumer = scheduler->Spawn([&] {
+		FiberMutex::Lock lock(mutex);
+		while (consumed < 100) {
+			while (queue.empty())
+				cond.wait(mutex);
+			consumed += queue.size();
+			queue.clear();
+		}
+	});
+	Fiber::ptr producer = scheduler->Spawn([&] {
+		for (int i = 0; i < 100; ++i) {
+			{
+				FiberMutex::Lock lock(mutex);
+				queue.push_back(i);
+			}
+			cond.notify_one();
+			if (i % 10 == 0)
+				Fiber::SleepFor(1);
+		}
+		consumer->Join();
+	});
+	producer->Join();
+	assert(consumed == 100);
+
+	// sleeping fibers wake up in deadline order
+	std::vector<int> order;
+	FiberMutex order_mutex;
+	for (int i = 3; i > 0; --i) {
+		scheduler->Spawn([&, i] {
+			Fiber::SleepFor(i * 20);
+			FiberMutex::Lock lock(order_mutex);
+			order.push_back(i);
+		});
+	}
+
+	// the fiber id reaches log events
+	uint32_t logged_id = 0, fiber_id = 0;
+	scheduler->Spawn([&] {
+		fiber_id = Fiber::GetThis()->GetId();
+		logged_id = GetFiberId();
+		EKKO_LOG_INFO(LoggerManager::GetInstance()->GetRoot()) << "hello from a fiber";
+	});
+
+	delete scheduler;
+	assert(order.size() == 3 && order[0] == 1 && order[1] == 2 && order[2] == 3);
+	assert(fiber_id != 0 && logged_id == fiber_id);
+	assert(GetFiberId() == 0);
+	thread_pool_destroy(&pool);
+	printf("done \n");
+}
@@ -0,0 +1,894 @@
+#include "http_parser.h"
+#include "http_server.h"
+#include "overload.h"
+#include "response_cache.h"
+#include "router.h"
+#include "socket_util.h"
+#include "static_file.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace ekko;
+
+struct parsed_t {
+	int status;
+	int error;
+	size_t consumed;
+	std::string method;
+	std::string target;
+	std::string body;
+	std::string headers;
+	bool keep_alive;
+
+	bool operator==(const parsed_t &o) const {
+		return status == o.status && error == o.error && consumed == o.consumed
+			&& method == o.method && target == o.target && body == o.body
+			&& headers == o.headers && keep_alive == o.keep_alive;
+	}
+};
+
+static parsed_t
+record(HttpParser &parser, HttpParser::Status status)
+{
+	parsed_t r;
+	const HttpRequest &req = parser.GetRequest();
+	r.status = status;
+	r.error = parser.GetError();
+	r.consumed = parser.GetConsumed();
+	r.keep_alive = false;
+	if (status != HttpParser::DONE)
+		return r;
+	r.method = std::string(req.Method());
+	r.target = std::string(req.Target());
+	r.body = std::string(req.Body());
+	for (int i = 0; i < req.HeaderCount(); ++i)
+		r.headers += std::string(req.HeaderName(i)) + "=" + std::string(req.HeaderValue(i)) + "\n";
+	r.keep_alive = req.IsKeepAlive();
+	return r;
+}
+
+/// @brief feed wire as it would arrive, growing at every cut; collect the requests
+static std::vector<parsed_t>
+parse_stream(std::string wire, const std::vector<size_t> &cuts)
+{
+	std::vector<parsed_t> out;
+	HttpParser parser;
+	size_t start = 0;
+
+	for (size_t c = 0; c <= cuts.size(); ++c) {
+		size_t avail = c < cuts.size() ? cuts[c] : wire.size();
+		while (start < avail) {
+			HttpParser::Status status = parser.Parse(&wire[start], avail - start);
+			if (status == HttpParser::AGAIN)
+				break;
+			out.push_back(record(parser, status));
+			if (status == HttpParser::ERROR)
+				return out;
+			start += parser.GetConsumed();
+			parser.Reset();
+		}
+	}
+	return out;
+}
+
+static parsed_t
+parse_one(const std::string &wire)
+{
+	std::vector<parsed_t> r = parse_stream(wire, std::vector<size_t>());
+	if (r.empty()) {
+		parsed_t again;
+		again.status = HttpParser::AGAIN;
+		return again;
+	}
+	return r[0];
+}
+
+static void
+test_basic()
+{
+	std::string wire = "GET /index.html?a=1&b=2 HTTP/1.1\r\n"
+		"Host: example.com\r\n"
+		"User-Agent:  curl/8.0 \r\n"
+		"Accept: */*\r\n"
+		"\r\n";
+	HttpParser parser;
+	assert(parser.Parse(&wire[0], wire.size()) == HttpParser::DONE);
+	const HttpRequest &req = parser.GetRequest();
+	assert(parser.GetConsumed() == wire.size());
+	assert(req.GetMethod() == HTTP_GET);
+	assert(req.Path() == "/index.html");
+	assert(req.Query() == "a=1&b=2");
+	assert(req.GetMinorVersion() == 1 && req.IsKeepAlive());
+	assert(req.HeaderCount() == 3);
+	assert(req.GetHeader("host") == "example.com");
+	// surrounding whitespace is not part of the value
+	assert(req.GetHeader("USER-AGENT") == "curl/8.0");
+	assert(!req.HasHeader("Cookie") && req.GetHeader("Cookie").empty());
+	assert(req.Body().empty());
+	// zero-copy: the views point into the buffer
+	assert(req.Path().data() == &wire[4]);
+
+	// incomplete heads, wherever they stop
+	for (size_t i = 0; i < wire.size(); ++i) {
+		HttpParser p;
+		assert(p.Parse(&wire[0], i) == HttpParser::AGAIN);
+	}
+
+	// leading empty lines and bare LF line ends
+	parsed_t r = parse_one("\r\n\nPOST /x HTTP/1.0\nContent-Length: 3\nConnection: keep-alive\n\nabc");
+	assert(r.status == HttpParser::DONE && r.method == "POST" && r.body == "abc" && r.keep_alive);
+}
+
+static void
+test_keep_alive()
+{
+	assert(!parse_one("GET / HTTP/1.0\r\n\r\n").keep_alive);
+	assert(parse_one("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n").keep_alive);
+	assert(!parse_one("GET / HTTP/1.1\r\nConnection: close\r\n\r\n").keep_alive);
+	assert(!parse_one("GET / HTTP/1.1\r\nConnection: Upgrade, close\r\n\r\n").keep_alive);
+	assert(parse_one("GET / HTTP/1.1\r\nConnection: Upgrade\r\n\r\n").keep_alive);
+}
+
+static void
+test_pipelining()
+{
+	std::string wire = "GET /1 HTTP/1.1\r\nHost: a\r\n\r\n"
+		"POST /2 HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+		"GET /3 HTTP/1.1\r\n\r\n";
+	std::vector<parsed_t> r = parse_stream(wire, std::vector<size_t>());
+	assert(r.size() == 3);
+	assert(r[0].target == "/1" && r[1].target == "/2" && r[1].body == "hello" && r[2].target == "/3");
+	assert(r[0].consumed + r[1].consumed + r[2].consumed == wire.size());
+}
+
+static void
+test_chunked()
+{
+	std::string wire = "POST /up HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"5\r\nhello\r\n"
+		"6;ext=1\r\n world\r\n"
+		"A\r\n0123456789\r\n"
+		"0\r\nX-Trailer: 1\r\n\r\n"
+		"GET /next HTTP/1.1\r\n\r\n";
+	std::vector<parsed_t> r = parse_stream(wire, std::vector<size_t>());
+	assert(r.size() == 2);
+	assert(r[0].status == HttpParser::DONE && r[0].body == "hello world0123456789");
+	assert(r[1].target == "/next");
+
+	// byte at a time, the decoder resumes mid chunk and mid size line
+	std::vector<size_t> cuts;
+	for (size_t i = 1; i < wire.size(); ++i)
+		cuts.push_back(i);
+	assert(parse_stream(wire, cuts) == r);
+}
+
+static void
+test_errors()
+{
+	struct {
+		const char *wire;
+		int error;
+	} cases[] = {
+		{ "GET / HTTP/2.0\r\n\r\n", 400 },
+		{ "GET  / HTTP/1.1\r\n\r\n", 400 },
+		{ "GET / HTTP/1.1\r\nHost : a\r\n\r\n", 400 },
+		{ "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n", 400 },
+		{ "GET / HTTP/1.1\r\nBad\x01Name: a\r\n\r\n", 400 },
+		{ "GET / HTTP/1.1\r\nX: a\x01z\r\n\r\n", 400 },
+		{ "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n", 400 },
+		{ "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", 400 },
+		{ "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n", 400 },
+		{ "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", 501 },
+		{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", 400 },
+		{ "POST / HTTP/1.1\r\nContent-Length: 999999999999\r\n\r\n", 413 },
+		{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", 400 },
+		{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n", 400 },
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		parsed_t r = parse_one(cases[i].wire);
+		assert(r.status == HttpParser::ERROR && r.error == cases[i].error);
+	}
+
+	std::string many = "GET / HTTP/1.1\r\n";
+	for (int i = 0; i <= HTTP_MAX_HEADERS; ++i)
+		many += "X-" + std::to_string(i) + ": v\r\n";
+	many += "\r\n";
+	assert(parse_one(many).error == 431);
+
+	std::string huge = "GET / HTTP/1.1\r\nX: " + std::string(HTTP_MAX_HEAD_BYTES, 'a');
+	assert(parse_one(huge).error == 431);
+}
+
+static const char s_alnum[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_";
+
+static std::string
+random_string(std::mt19937 &rng, size_t len, const char *alphabet, size_t n)
+{
+	std::string s(len, 'x');
+	for (size_t i = 0; i < len; ++i)
+		s[i] = alphabet[rng() % n];
+	return s;
+}
+
+/// @brief a random valid request and what parsing it has to give
+static std::string
+random_request(std::mt19937 &rng, parsed_t &expect)
+{
+	static const char *methods[] = { "GET", "POST", "PUT", "DELETE", "OPTIONS", "PURGE" };
+	static const char value_chars[] = "abcdefghijklmnopqrstuvwxyz0123456789 ;=,/\t\"()\x80\xff";
+	std::string wire, headers;
+
+	expect.method = methods[rng() % 6];
+	expect.target = "/" + random_string(rng, rng() % 200, s_alnum, 64);
+	if (rng() % 2)
+		expect.target += "?" + random_string(rng, rng() % 50, s_alnum, 64);
+	wire = expect.method + " " + expect.target + " HTTP/1.1\r\n";
+
+	int nheaders = rng() % 20;
+	for (int i = 0; i < nheaders; ++i) {
+		std::string name = "X-" + random_string(rng, 1 + rng() % 20, s_alnum, 64);
+		// long values take the vector paths, the tails the scalar one
+		std::string value = random_string(rng, rng() % 120, value_chars, sizeof(value_chars) - 1);
+		while (!value.empty() && (value[0] == ' ' || value[0] == '\t'))
+			value.erase(0, 1);
+		while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+			value.pop_back();
+		wire += name + ":" + (rng() % 2 ? " " : "") + value + "\r\n";
+		expect.headers += name + "=" + value + "\n";
+	}
+
+	expect.body = random_string(rng, rng() % 3 == 0 ? rng() % 5000 : 0, s_alnum, 64);
+	if (!expect.body.empty() && rng() % 2) {
+		wire += "Transfer-Encoding: chunked\r\n\r\n";
+		expect.headers += "Transfer-Encoding=chunked\n";
+		for (size_t off = 0; off < expect.body.size(); ) {
+			size_t n = std::min<size_t>(1 + rng() % 700, expect.body.size() - off);
+			char size[32];
+			snprintf(size, sizeof(size), "%zx", n);
+			wire += std::string(size) + "\r\n" + expect.body.substr(off, n) + "\r\n";
+			off += n;
+		}
+		wire += "0\r\n\r\n";
+	} else {
+		wire += "Content-Length: " + std::to_string(expect.body.size()) + "\r\n\r\n";
+		expect.headers += "Content-Length=" + std::to_string(expect.body.size()) + "\n";
+		wire += expect.body;
+	}
+	expect.status = HttpParser::DONE;
+	expect.error = 0;
+	expect.consumed = wire.size();
+	expect.keep_alive = true;
+	return wire;
+}
+
+static std::vector<size_t>
+random_cuts(std::mt19937 &rng, size_t len)
+{
+	std::vector<size_t> cuts;
+	for (size_t at = 0; at < len; ) {
+		at += 1 + rng() % 300;
+		if (at < len)
+			cuts.push_back(at);
+	}
+	return cuts;
+}
+
+static void
+test_fuzz()
+{
+	std::mt19937 rng(7);
+	HttpParser::SimdLevel levels[] = { HttpParser::SIMD_SCALAR, HttpParser::SIMD_SSE42, HttpParser::SIMD_AVX2 };
+	HttpParser::SimdLevel best = HttpParser::GetSimdLevel();
+
+	// pipelined streams of valid requests, split at random, on every scanner
+	for (int round = 0; round < 300; ++round) {
+		std::vector<parsed_t> expect;
+		std::string wire;
+		int n = 1 + rng() % 8;
+		for (int i = 0; i < n; ++i) {
+			parsed_t e;
+			wire += random_request(rng, e);
+			expect.push_back(e);
+		}
+		std::vector<size_t> cuts = random_cuts(rng, wire.size());
+		for (int l = 0; l < 3; ++l) {
+			HttpParser::SetSimdLevel(levels[l]);
+			assert(parse_stream(wire, cuts) == expect);
+		}
+	}
+
+	// mutated bytes: no crash, and every scanner agrees on the outcome
+	for (int round = 0; round < 3000; ++round) {
+		parsed_t e;
+		std::string wire = random_request(rng, e);
+		int nflips = 1 + rng() % 4;
+		for (int i = 0; i < nflips; ++i)
+			wire[rng() % wire.size()] = rng() % 256;
+		std::vector<size_t> cuts = random_cuts(rng, wire.size());
+		HttpParser::SetSimdLevel(HttpParser::SIMD_SCALAR);
+		std::vector<parsed_t> ref = parse_stream(wire, cuts);
+		for (int l = 1; l < 3; ++l) {
+			HttpParser::SetSimdLevel(levels[l]);
+			assert(parse_stream(wire, cuts) == ref);
+		}
+		// and the split does not matter either
+		assert(parse_stream(wire, std::vector<size_t>()) == ref);
+	}
+	HttpParser::SetSimdLevel(best);
+}
+
+static std::string
+read_responses(int fd, int n)
+{
+	std::string got;
+	char buf[4096];
+	// every test response ends with its body "ok" or "bye"
+	while (1) {
+		int count = 0;
+		for (size_t at = 0; (at = got.find("HTTP/1.1 ", at)) != std::string::npos; ++at)
+			++count;
+		if (count >= n && (got.size() >= 2 && (got.compare(got.size() - 2, 2, "ok") == 0
+				|| got.compare(got.size() - 3, 3, "bye") == 0)))
+			break;
+		ssize_t r = read(fd, buf, sizeof(buf));
+		if (r <= 0)
+			break;
+		got.append(buf, r);
+	}
+	return got;
+}
+
+static void
+test_server(bool use_uring)
+{
+	HttpServer server("127.0.0.1", 0, 1, use_uring);
+	server.SetHandler([](const HttpRequest &req, HttpResponse &resp) {
+		resp.AddHeader("Content-Type", "text/plain");
+		resp.SetBody(req.Path() == "/bye" ? "bye" : "ok");
+		if (req.Path() == "/bye")
+			resp.SetKeepAlive(false);
+	});
+	assert(server.Start() == 0);
+
+	int fd = ConnectTo("127.0.0.1", server.GetPort());
+	assert(fd >= 0);
+	// three pipelined requests, the last split across writes
+	std::string reqs = "GET /a HTTP/1.1\r\n\r\nHEAD /b HTTP/1.1\r\n\r\nGET /c HTTP/1.1\r\nHo";
+	assert(write(fd, reqs.data(), reqs.size()) == (ssize_t) reqs.size());
+	usleep(10000);
+	assert(write(fd, "st: x\r\n\r\n", 9) == 9);
+	std::string got = read_responses(fd, 3);
+	assert(got == "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nok"
+		"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\n"
+		"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nok");
+
+	std::string bye = "GET /bye HTTP/1.1\r\n\r\n";
+	assert(write(fd, bye.data(), bye.size()) == (ssize_t) bye.size());
+	got = read_responses(fd, 1);
+	assert(got.find("Connection: close\r\n") != std::string::npos);
+	char c;
+	assert(read(fd, &c, 1) == 0);
+	close(fd);
+
+	// a malformed request gets its status and the connection closed
+	fd = ConnectTo("127.0.0.1", server.GetPort());
+	assert(write(fd, "GET / HTTP/9.9\r\n\r\n", 18) == 18);
+	char buf[256];
+	ssize_t n = read(fd, buf, sizeof(buf));
+	assert(n > 0 && std::string(buf, n).find("400 Bad Request") != std::string::npos);
+	close(fd);
+
+	assert(server.GetRequests() == 4);
+	server.Stop();
+}
+
+static void
+write_file(const std::string &path, const std::string &data)
+{
+	std::string tmp = path + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	assert(fp);
+	assert(fwrite(data.data(), 1, data.size(), fp) == data.size());
+	fclose(fp);
+	// replaced the way deploys do it
+	assert(rename(tmp.c_str(), path.c_str()) == 0);
+}
+
+/// @brief one response: the head up to its blank line and Content-Length bytes of body
+static int
+fetch(int fd, const std::string &req, std::string &head, std::string &body, bool no_body = false)
+{
+	static std::string pending;
+	char buf[65536];
+
+	if (!req.empty())
+		assert(write(fd, req.data(), req.size()) == (ssize_t) req.size());
+	size_t end;
+	while ((end = pending.find("\r\n\r\n")) == std::string::npos) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		assert(n > 0);
+		pending.append(buf, n);
+	}
+	head = pending.substr(0, end + 4);
+	pending.erase(0, end + 4);
+	size_t len = 0, pos = head.find("Content-Length: ");
+	if (pos != std::string::npos && !no_body)
+		len = atol(head.c_str() + pos + 16);
+	while (pending.size() < len) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		assert(n > 0);
+		pending.append(buf, n);
+	}
+	body = pending.substr(0, len);
+	pending.erase(0, len);
+	return atoi(head.c_str() + 9);
+}
+
+static std::string
+header_of(const std::string &head, const std::string &name)
+{
+	size_t pos = head.find("\r\n" + name + ": ");
+	if (pos == std::string::npos)
+		return "";
+	pos += name.size() + 4;
+	return head.substr(pos, head.find("\r\n", pos) - pos);
+}
+
+static void
+test_static_file(bool use_uring, bool inotify)
+{
+	char dir[] = "/tmp/static_test_XXXXXX";
+	assert(mkdtemp(dir));
+	std::string root = dir;
+	std::string small = "hello, static world\n";
+	std::string mid(100000, 'm'), big(3 << 20, 'b');
+	for (size_t i = 0; i < mid.size(); ++i)
+		mid[i] = 'a' + i % 26;
+	for (size_t i = 0; i < big.size(); ++i)
+		big[i] = 'A' + (i * 7) % 26;
+	write_file(root + "/small.txt", small);
+	write_file(root + "/mid.js", mid);
+	write_file(root + "/big.bin", big);
+	assert(system(("mkdir " + root + "/sub").c_str()) == 0);
+	write_file(root + "/sub/index.html", "<p>index</p>");
+
+	StaticFileHandler files(root);
+	if (!inotify)
+		files.DisableInotify();
+	HttpServer server("127.0.0.1", 0, 1, use_uring);
+	server.SetHandler([&](const HttpRequest &req, HttpResponse &resp) { files.Handle(req, resp); });
+	assert(server.Start() == 0);
+	int fd = ConnectTo("127.0.0.1", server.GetPort());
+	assert(fd >= 0);
+	std::string head, body;
+
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\n\r\n", head, body) == 200);
+	assert(body == small);
+	assert(header_of(head, "Content-Type") == "text/plain; charset=utf-8");
+	std::string etag = header_of(head, "ETag"), modified = header_of(head, "Last-Modified");
+	assert(etag.size() > 2 && etag[0] == '"' && !modified.empty());
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\n\r\n", head, body) == 200 && body == small);
+	assert(files.GetHits() == 1 && files.GetMisses() == 1);
+
+	// conditional requests
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nIf-None-Match: \"x\", W/" + etag + "\r\n\r\n", head, body) == 304);
+	assert(body.empty() && head.find("Content-Length") == std::string::npos);
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nIf-Modified-Since: " + modified + "\r\n\r\n", head, body) == 304);
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nIf-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n\r\n", head, body) == 200);
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nIf-None-Match: \"other\"\r\n\r\n", head, body) == 200);
+
+	// ranges, from the cache (read and mapped) and from disk
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nRange: bytes=7-12\r\n\r\n", head, body) == 206);
+	assert(body == "static" && header_of(head, "Content-Range") == "bytes 7-12/20");
+	assert(fetch(fd, "GET /mid.js HTTP/1.1\r\nRange: bytes=-10\r\n\r\n", head, body) == 206);
+	assert(body == mid.substr(mid.size() - 10));
+	assert(fetch(fd, "GET /big.bin HTTP/1.1\r\nRange: bytes=1000000-\r\n\r\n", head, body) == 206);
+	assert(body == big.substr(1000000));
+	assert(fetch(fd, "GET /big.bin HTTP/1.1\r\nRange: bytes=5-9\r\n\r\n", head, body) == 206);
+	assert(body == big.substr(5, 5));
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nRange: bytes=20-\r\n\r\n", head, body) == 416);
+	assert(header_of(head, "Content-Range") == "bytes */20");
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nRange: bytes=0-1,4-5\r\n\r\n", head, body) == 200);
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\nRange: bytes=0-4\r\nIf-Range: \"stale\"\r\n\r\n", head, body) == 200);
+	assert(body == small);
+
+	// whole files, pipelined: a file sent from disk sits between cached ones
+	std::string reqs = "GET /mid.js HTTP/1.1\r\n\r\nGET /big.bin HTTP/1.1\r\n\r\n"
+		"HEAD /big.bin HTTP/1.1\r\n\r\nGET /sub/ HTTP/1.1\r\n\r\n";
+	assert(fetch(fd, reqs, head, body) == 200 && body == mid);
+	assert(header_of(head, "Content-Type") == "text/javascript; charset=utf-8");
+	assert(fetch(fd, "", head, body) == 200 && body == big);
+	assert(fetch(fd, "", head, body, true) == 200 && header_of(head, "Content-Length") == std::to_string(big.size()));
+	assert(fetch(fd, "", head, body) == 200 && body == "<p>index</p>");
+
+	// not found, out of the root, wrong method
+	assert(fetch(fd, "GET /missing HTTP/1.1\r\n\r\n", head, body) == 404);
+	assert(fetch(fd, "GET /sub/../../etc/passwd HTTP/1.1\r\n\r\n", head, body) == 404);
+	assert(fetch(fd, "GET /%2e%2e/etc/passwd HTTP/1.1\r\n\r\n", head, body) == 404);
+	assert(fetch(fd, "GET /sub HTTP/1.1\r\n\r\n", head, body) == 404);
+	assert(fetch(fd, "POST /small.txt HTTP/1.1\r\nContent-Length: 0\r\n\r\n", head, body) == 405);
+
+	// a changed file is picked up: through inotify, or the periodic stat
+	std::string changed = "changed content";
+	write_file(root + "/small.txt", changed);
+	usleep((inotify ? STATIC_INOTIFY_POLL_MS : STATIC_REVALIDATE_MS) * 1000 + 100000);
+	assert(fetch(fd, "GET /small.txt HTTP/1.1\r\n\r\n", head, body) == 200);
+	assert(body == changed && header_of(head, "ETag") != etag);
+	assert(files.GetInvalidations() >= 1);
+
+	close(fd);
+	server.Stop();
+	assert(system(("rm -rf " + root).c_str()) == 0);
+}
+
+/// @brief parse wire and answer it through cache; the body is returned
+static std::string
+cache_get(ResponseCache &cache, const ResponseCache::Handler &handler, const std::string &wire,
+	HttpResponse *out = 0)
+{
+	std::string buf = wire;
+	HttpParser parser;
+	HttpResponse resp;
+
+	assert(parser.Parse(&buf[0], buf.size()) == HttpParser::DONE);
+	cache.Handle(parser.GetRequest(), resp, handler);
+	if (out)
+		*out = resp;
+	return resp.GetBody().ToString();
+}
+
+static void
+test_response_cache()
+{
+	std::atomic<int> calls(0);
+	ResponseCache::Handler handler = [&calls](const HttpRequest &req, HttpResponse &resp) {
+		int n = ++calls;
+		std::string path(req.Path());
+		if (path == "/nostore")
+			resp.AddHeader("Cache-Control", "no-store");
+		else if (path == "/cookie")
+			resp.AddRawHeaders("Set-Cookie: a=b\r\n");
+		else if (path == "/gzip")
+			resp.AddHeader("Vary", "Accept-Encoding, accept-language");
+		else if (path == "/v")
+			resp.AddHeader("Vary", "accept-language");
+		else if (path == "/short")
+			resp.AddHeader("Cache-Control", "public, max-age=1");
+		else if (path == "/missing")
+			resp.SetStatus(404);
+		else if (path == "/error")
+			resp.SetStatus(500);
+		else if (path == "/slow")
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		resp.AddHeader("Content-Type", "text/plain");
+		resp.SetBody(path + " " + std::to_string(n) + " " + std::string(req.GetHeader("Accept-Language")));
+	};
+
+	assert(ResponseCache::NormalizeQuery("b=2&&a=%7e1&c=%2f") == "a=~1&b=2&c=%2F");
+	assert(ResponseCache::NormalizeQuery("") == "");
+
+	// the query is normalized, the method and path are not
+	{
+		ResponseCache cache;
+		assert(cache_get(cache, handler, "GET /p?a=1&b=2 HTTP/1.1\r\n\r\n") == "/p 1 ");
+		HttpResponse resp;
+		assert(cache_get(cache, handler, "GET /p?b=2&a=%31 HTTP/1.1\r\n\r\n", &resp) == "/p 1 ");
+		assert(resp.GetRawHeaders() == "Content-Type: text/plain\r\n" && resp.GetStatus() == 200);
+		assert(cache_get(cache, handler, "GET /q?a=1&b=2 HTTP/1.1\r\n\r\n") == "/q 2 ");
+		assert(cache_get(cache, handler, "POST /p?a=1&b=2 HTTP/1.1\r\nContent-Length: 0\r\n\r\n") == "/p 3 ");
+		assert(cache_get(cache, handler, "GET /p?a=1&b=2 HTTP/1.1\r\nAuthorization: x\r\n\r\n") == "/p 4 ");
+		assert(cache_get(cache, handler, "GET /p?a=1&b=2 HTTP/1.1\r\nCache-Control: no-cache\r\n\r\n") == "/p 5 ");
+		assert(cache_get(cache, handler, "GET /missing HTTP/1.1\r\n\r\n") == "/missing 6 ");
+		assert(cache_get(cache, handler, "GET /missing HTTP/1.1\r\n\r\n", &resp) == "/missing 6 ");
+		assert(resp.GetStatus() == 404);
+		ResponseCacheStats stats = cache.GetStats();
+		assert(stats.hits == 2 && stats.misses == 3 && stats.bypassed == 3 && stats.entries == 3);
+		assert(stats.bytes > 0);
+	}
+
+	// what the response forbids is not kept
+	{
+		ResponseCache cache;
+		calls = 0;
+		assert(cache_get(cache, handler, "GET /nostore HTTP/1.1\r\n\r\n") == "/nostore 1 ");
+		assert(cache_get(cache, handler, "GET /nostore HTTP/1.1\r\n\r\n") == "/nostore 2 ");
+		assert(cache_get(cache, handler, "GET /cookie HTTP/1.1\r\n\r\n") == "/cookie 3 ");
+		assert(cache_get(cache, handler, "GET /cookie HTTP/1.1\r\n\r\n") == "/cookie 4 ");
+		assert(cache_get(cache, handler, "GET /error HTTP/1.1\r\n\r\n") == "/error 5 ");
+		assert(cache_get(cache, handler, "GET /error HTTP/1.1\r\n\r\n") == "/error 6 ");
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\n\r\n") == "/gzip 7 ");
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\n\r\n") == "/gzip 8 ");
+		assert(cache.GetStats().entries == 0);
+	}
+
+	// Vary headers are part of the key
+	{
+		ResponseCache cache;
+		cache.SetVary({"Accept-Language"});
+		calls = 0;
+		assert(cache_get(cache, handler, "GET /v HTTP/1.1\r\nAccept-Language: en\r\n\r\n") == "/v 1 en");
+		assert(cache_get(cache, handler, "GET /v HTTP/1.1\r\nAccept-Language: fr\r\n\r\n") == "/v 2 fr");
+		assert(cache_get(cache, handler, "GET /v HTTP/1.1\r\naccept-language: en\r\n\r\n") == "/v 1 en");
+		assert(cache_get(cache, handler, "GET /v HTTP/1.1\r\n\r\n") == "/v 3 ");
+		// a Vary header the key does not cover keeps the response out
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n") == "/gzip 4 ");
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\n\r\n") == "/gzip 5 ");
+		cache.SetVary({"Accept-Language", "accept-encoding"});
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n") == "/gzip 6 ");
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\n\r\n") == "/gzip 7 ");
+		assert(cache_get(cache, handler, "GET /gzip HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n") == "/gzip 6 ");
+	}
+
+	// TTL, from the constructor or max-age
+	{
+		ResponseCache cache(1 << 20, 100, 1);
+		calls = 0;
+		assert(cache_get(cache, handler, "GET /t HTTP/1.1\r\n\r\n") == "/t 1 ");
+		assert(cache_get(cache, handler, "GET /short HTTP/1.1\r\n\r\n") == "/short 2 ");
+		std::this_thread::sleep_for(std::chrono::milliseconds(150));
+		assert(cache_get(cache, handler, "GET /t HTTP/1.1\r\n\r\n") == "/t 3 ");
+		assert(cache_get(cache, handler, "GET /short HTTP/1.1\r\n\r\n") == "/short 2 ");
+		std::this_thread::sleep_for(std::chrono::milliseconds(900));
+		assert(cache_get(cache, handler, "GET /short HTTP/1.1\r\n\r\n") == "/short 4 ");
+		assert(cache.GetStats().expired == 2);
+	}
+
+	// identical misses in flight make one call
+	{
+		ResponseCache cache;
+		std::vector<std::thread> threads;
+		calls = 0;
+		for (int i = 0; i < 8; ++i) {
+			threads.emplace_back([&]() {
+				assert(cache_get(cache, handler, "GET /slow HTTP/1.1\r\n\r\n") == "/slow 1 ");
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		ResponseCacheStats stats = cache.GetStats();
+		assert(calls == 1 && stats.misses == 1 && stats.hits + stats.coalesced == 7);
+	}
+
+	// the budget holds, and a scan of one-off keys does not push out a hot one
+	{
+		ResponseCache cache(64 << 10, 10000, 1);
+		calls = 0;
+		for (int i = 0; i < 8; ++i)
+			cache_get(cache, handler, "GET /hot HTTP/1.1\r\n\r\n");
+		for (int i = 0; i < 2000; ++i)
+			cache_get(cache, handler, "GET /scan?i=" + std::to_string(i) + " HTTP/1.1\r\n\r\n");
+		ResponseCacheStats stats = cache.GetStats();
+		assert(stats.bytes <= (64 << 10) && stats.rejected > 0);
+		assert(cache_get(cache, handler, "GET /hot HTTP/1.1\r\n\r\n") == "/hot 1 ");
+
+		cache.Clear();
+		cache.SetAdmission(false);
+		calls = 0;
+		for (int i = 0; i < 8; ++i)
+			cache_get(cache, handler, "GET /hot HTTP/1.1\r\n\r\n");
+		for (int i = 0; i < 2000; ++i)
+			cache_get(cache, handler, "GET /scan?i=" + std::to_string(i) + " HTTP/1.1\r\n\r\n");
+		assert(cache_get(cache, handler, "GET /hot HTTP/1.1\r\n\r\n") == "/hot 2002 ");
+		stats = cache.GetStats();
+		assert(stats.bytes <= (64 << 10) && stats.evictions > 0);
+	}
+}
+
+static int
+guard_get(OverloadGuard &guard, const OverloadGuard::Handler &handler, const std::string &wire,
+	uint64_t recv_ms = 0)
+{
+	std::string buf = wire;
+	HttpParser parser;
+	HttpResponse resp;
+
+	assert(parser.Parse(&buf[0], buf.size()) == HttpParser::DONE);
+	parser.SetReceiveMs(recv_ms);
+	guard.Handle(parser.GetRequest(), resp, handler);
+	return resp.GetStatus();
+}
+
+/// @brief limit requests in at once, each rtt_us, until samples have been taken
+static void
+feed_limit(ConcurrencyLimit &limit, int samples, uint64_t rtt_us)
+{
+	while (samples > 0) {
+		int n = limit.GetLimit();
+		for (int i = 0; i < n; ++i)
+			assert(limit.TryAcquire());
+		assert(!limit.TryAcquire());
+		for (int i = 0; i < n; ++i)
+			limit.Release(rtt_us);
+		samples -= n;
+	}
+}
+
+static void
+test_overload()
+{
+	TokenBucket bucket(0, 3);
+	assert(bucket.Take() && bucket.Take() && bucket.Take() && !bucket.Take());
+	TokenBucket fast(1e6, 1);
+	assert(fast.Take());
+	usleep(1000);
+	assert(fast.Take());
+
+	ConcurrencyLimit fixed(LIMIT_FIXED, 2);
+	assert(fixed.TryAcquire() && fixed.TryAcquire() && !fixed.TryAcquire());
+	fixed.Release(100000, true);
+	assert(fixed.GetInflight() == 1 && fixed.TryAcquire() && fixed.GetLimit() == 2);
+
+	// AIMD climbs by one a window while fast, backs off when slow
+	ConcurrencyLimit aimd(LIMIT_AIMD, 10);
+	feed_limit(aimd, 200, 1000);
+	int grown = aimd.GetLimit();
+	assert(grown > 10);
+	feed_limit(aimd, 400, 50000);
+	assert(aimd.GetLimit() < grown);
+	// a window far below the limit does not raise it
+	int before = aimd.GetLimit();
+	for (int i = 0; i < 100; ++i) {
+		assert(aimd.TryAcquire());
+		aimd.Release(1000);
+	}
+	assert(aimd.GetLimit() == before);
+
+	// the gradient grows the limit on steady latency and cuts it when latency rises
+	ConcurrencyLimit gradient(LIMIT_GRADIENT, 10);
+	feed_limit(gradient, 500, 1000);
+	grown = gradient.GetLimit();
+	assert(grown > 10);
+	feed_limit(gradient, 500, 10000);
+	assert(gradient.GetLimit() < grown);
+
+	OverloadGuard guard(LIMIT_FIXED, 1);
+	int inner = 0;
+	OverloadGuard::Handler handler = [](const HttpRequest&, HttpResponse &resp) { resp.SetBody("ok");};
+	// the one place is taken by the outer request
+	OverloadGuard::Handler nested = [&](const HttpRequest &req, HttpResponse &resp) {
+		HttpResponse r;
+		guard.Handle(req, r, handler);
+		inner = r.GetStatus();
+		resp.SetBody("outer");
+	};
+	guard.AddRoute("/api", 0, 2);
+	guard.AddRoute("/api/slow", 0, 1);
+	assert(guard_get(guard, handler, "GET /api/x HTTP/1.1\r\n\r\n") == 200);
+	assert(guard_get(guard, handler, "GET /api/x HTTP/1.1\r\n\r\n") == 200);
+	assert(guard_get(guard, handler, "GET /api/x HTTP/1.1\r\n\r\n") == 429);
+	assert(guard_get(guard, handler, "GET /api/slow HTTP/1.1\r\n\r\n") == 200);
+	assert(guard_get(guard, handler, "GET /api/slow HTTP/1.1\r\n\r\n") == 429);
+	assert(guard.GetRouteShed("/api") == 1 && guard.GetRouteShed("/api/slow") == 1);
+	assert(guard_get(guard, nested, "GET /other HTTP/1.1\r\n\r\n") == 200 && inner == 503);
+	guard.SetQueueBudget(50);
+	assert(guard_get(guard, handler, "GET /other HTTP/1.1\r\n\r\n", TimingWheel::NowMs() - 100) == 503);
+	assert(guard_get(guard, handler, "GET /other HTTP/1.1\r\n\r\n", TimingWheel::NowMs()) == 200);
+	OverloadStats stats = guard.GetStats();
+	assert(stats.admitted == 5 && stats.shed_rate == 2 && stats.shed_limit == 1 && stats.shed_queue == 1);
+	assert(stats.inflight == 0 && stats.limit == 1);
+}
+
+static constexpr StaticRoute s_static_routes[] = {
+	{"/health", 0}, {"/metrics", 1}, {"/", 2}, {"/api/v1/status", 3}
+};
+static constexpr auto s_static_table = MakeStaticRoutes(s_static_routes);
+static_assert(s_static_table.Find("/metrics") == 1, "looked up when compiled");
+static_assert(s_static_table.Find("/nope") == -1, "looked up when compiled");
+
+/// @brief the route the router picks for path, with its captures as name=value
+static std::string
+route_of(const Router &router, HttpMethod method, const std::string &path)
+{
+	RouteParams params;
+	const Router::Handler *handler = router.Find(method, path, params);
+	if (!handler)
+		return "-";
+	HttpResponse resp;
+	(*handler)(HttpRequest(), resp, params);
+	std::string out = resp.GetBody().ToString();
+	for (int i = 0; i < params.size; ++i)
+		out += " " + std::string(params.names[i]) + "=" + std::string(params.values[i]);
+	return out;
+}
+
+static void
+test_router()
+{
+	Router router;
+	auto named = [](const char *name) {
+		return [name](const HttpRequest&, HttpResponse &resp, const RouteParams&) { resp.SetBody(name);};
+	};
+
+	assert(router.Get("/", named("root")) == 0);
+	assert(router.Get("/users", named("users")) == 0);
+	assert(router.Get("/user", named("user")) == 0);
+	assert(router.Get("/users/:id", named("user_id")) == 0);
+	assert(router.Get("/users/new", named("user_new")) == 0);
+	assert(router.Post("/users/:id", named("user_post")) == 0);
+	assert(router.Get("/users/:id/posts/:post", named("post")) == 0);
+	assert(router.Get("/users/:id/posts/latest", named("latest")) == 0);
+	assert(router.Get("/static/*file", named("static")) == 0);
+	assert(router.Get("/users/:uid/friends", named("friends")) == 0);
+	// malformed, or already there
+	assert(router.Get("users", named("x")) == -1);
+	assert(router.Get("/a:b", named("x")) == -1);
+	assert(router.Get("/a/:", named("x")) == -1);
+	assert(router.Get("/a/*", named("x")) == -1);
+	assert(router.Get("/users/:id", named("x")) == -1);
+	router.Compile();
+	assert(router.RouteCount() == 9);
+
+	assert(route_of(router, HTTP_GET, "/") == "root");
+	assert(route_of(router, HTTP_GET, "/users") == "users");
+	assert(route_of(router, HTTP_GET, "/user") == "user");
+	assert(route_of(router, HTTP_GET, "/users/") == "-");
+	assert(route_of(router, HTTP_GET, "/users/42") == "user_id id=42");
+	assert(route_of(router, HTTP_POST, "/users/42") == "user_post id=42");
+	assert(route_of(router, HTTP_GET, "/users/new") == "user_new");
+	assert(route_of(router, HTTP_GET, "/users/newer") == "user_id id=newer");
+	assert(route_of(router, HTTP_GET, "/users/7/posts/9") == "post id=7 post=9");
+	assert(route_of(router, HTTP_GET, "/users/7/posts/latest") == "latest id=7");
+	// the parameter node is shared, the names are the route's own
+	assert(route_of(router, HTTP_GET, "/users/7/friends") == "friends uid=7");
+	assert(route_of(router, HTTP_GET, "/users/7/posts") == "-");
+	assert(route_of(router, HTTP_GET, "/static/css/a.css") == "static file=css/a.css");
+	assert(route_of(router, HTTP_GET, "/static/") == "static file=");
+	assert(route_of(router, HTTP_GET, "/static") == "-");
+	assert(route_of(router, HTTP_HEAD, "/users") == "users");
+	assert(route_of(router, HTTP_DELETE, "/users") == "-");
+
+	std::string buf = "DELETE /users HTTP/1.1\r\n\r\n";
+	HttpParser parser;
+	assert(parser.Parse(&buf[0], buf.size()) == HttpParser::DONE);
+	HttpResponse resp;
+	router.Dispatch(parser.GetRequest(), resp);
+	assert(resp.GetStatus() == 405);
+	buf = "GET /nowhere HTTP/1.1\r\n\r\n";
+	parser.Reset();
+	assert(parser.Parse(&buf[0], buf.size()) == HttpParser::DONE);
+	HttpResponse missing;
+	router.Bind()(parser.GetRequest(), missing);
+	assert(missing.GetStatus() == 404);
+
+	// many siblings, binary searched
+	Router wide;
+	for (int c = 'a'; c <= 'z'; ++c) {
+		std::string p = "/";
+		p += (char) c;
+		assert(wide.Get(p + "/:x", named("w")) == 0);
+	}
+	wide.Compile();
+	assert(route_of(wide, HTTP_GET, "/q/1") == "w x=1");
+	assert(route_of(wide, HTTP_GET, "/Q/1") == "-");
+
+	assert(s_static_table.Find("/") == 2 && s_static_table.Find("/api/v1/status") == 3);
+	assert(s_static_table.Find("/api/v1/statu") == -1);
+}
+
+int
+main()
+{
+	test_basic();
+	test_keep_alive();
+	test_pipelining();
+	test_chunked();
+	test_errors();
+	test_fuzz();
+	test_server(true);
+	test_server(false);
+	test_static_file(true, true);
+	test_static_file(false, false);
+	test_response_cache();
+	test_overload();
+	test_router();
+	printf("done \n");
+}
@@ -0,0 +1,232 @@
+#include "iobuf.h"
+#include <string>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace ekko;
+
+static void
+test_append_prepend()
+{
+	IOBuf buf;
+	assert(buf.Empty() && buf.SliceCount() == 0);
+	buf.Append("world");
+	buf.Append("!");
+	// the second append lands in the same block
+	assert(buf.SliceCount() == 1 && buf.ToString() == "world!");
+	buf.Prepend("hello, ");
+	assert(buf.ToString() == "hello, world!");
+	assert(buf.Size() == 13);
+
+	// bigger than a block: one block of the right size
+	std::string big(3 * IOBUF_BLOCK_SIZE + 7, 'x');
+	for (size_t i = 0; i < big.size(); ++i)
+		big[i] = 'a' + i % 26;
+	IOBuf b2;
+	b2.Append(big);
+	assert(b2.ToString() == big);
+	b2.Prepend(big);
+	assert(b2.ToString() == big + big);
+
+	// many small prepends keep their order
+	IOBuf b3;
+	std::string expect;
+	for (int i = 0; i < 5000; ++i) {
+		std::string s = std::to_string(i) + ",";
+		b3.Prepend(s);
+		expect = s + expect;
+	}
+	assert(b3.ToString() == expect);
+
+	// Reserve/Commit
+	IOBuf b4;
+	char *p = b4.Reserve(100);
+	memcpy(p, "abc", 3);
+	b4.Commit(3);
+	assert(b4.ToString() == "abc");
+}
+
+static void
+test_share()
+{
+	IOBuf a;
+	a.Append("shared body");
+	IOBuf b(a);
+	assert(b.ToString() == "shared body");
+	assert(b.GetSlice(0).block == a.GetSlice(0).block);
+	assert(a.GetSlice(0).block->refs == 2);
+
+	// a shared block is never written past its slice
+	b.Append("+tail");
+	a.Append("-other");
+	assert(a.ToString() == "shared body-other");
+	assert(b.ToString() == "shared body+tail");
+	b.Prepend("head:");
+	assert(b.ToString() == "head:shared body+tail");
+
+	// appending a chain to itself
+	IOBuf c;
+	c.Append("xy");
+	c.Append(c);
+	assert(c.ToString() == "xyxy");
+
+	// move leaves the source empty
+	IOBuf d(std::move(c));
+	assert(c.Empty() && c.SliceCount() == 0 && d.ToString() == "xyxy");
+	IOBuf e;
+	e.Append("1");
+	e.Append(std::move(d));
+	assert(d.Empty() && e.ToString() == "1xyxy");
+
+	IOBuf f;
+	f.Append("front");
+	f.Prepend(e);
+	assert(f.ToString() == "1xyxyfront");
+}
+
+static int s_released = 0;
+
+static void
+release(void *arg)
+{
+	s_released += (int) (long) arg;
+}
+
+static void
+test_external()
+{
+	static const char body[] = "0123456789";
+	{
+		IOBuf a;
+		a.AppendExternal(body, 10, release, (void*) 1);
+		a.Prepend("<");
+		a.Append(">");
+		assert(a.ToString() == "<0123456789>");
+		assert(a.SliceCount() == 3);
+		IOBuf b(a);
+		a.Clear();
+		assert(s_released == 0);
+		b.PopFront(5);
+		assert(b.ToString() == "456789>");
+		assert(s_released == 0);
+	}
+	assert(s_released == 1);
+	// static data needs no callback
+	IOBuf c;
+	c.AppendExternal(body, 4);
+	assert(c.ToString() == "0123");
+}
+
+static void
+test_split()
+{
+	IOBuf buf;
+	buf.Append("abc");
+	buf.AppendExternal("defgh", 5);
+	buf.Append("ijkl");
+	assert(buf.SliceCount() == 3);
+
+	IOBuf front;
+	buf.CutFront(4, front);
+	assert(front.ToString() == "abcd" && buf.ToString() == "efghijkl");
+	assert(front.Size() == 4 && buf.Size() == 8);
+	buf.CutFront(100, front);
+	assert(front.ToString() == "abcdefghijkl" && buf.Empty());
+
+	front.PopBack(3);
+	assert(front.ToString() == "abcdefghi");
+	front.PopFront(2);
+	assert(front.ToString() == "cdefghi");
+	front.PopBack(7);
+	assert(front.Empty());
+
+	// Coalesce copies only across slices
+	IOBuf c;
+	c.Append("ab");
+	c.AppendExternal("cdef", 4);
+	const char *p = c.Coalesce(2);
+	assert(p && memcmp(p, "ab", 2) == 0 && c.SliceCount() == 2);
+	p = c.Coalesce(5);
+	assert(p && memcmp(p, "abcde", 5) == 0);
+	assert(c.ToString() == "abcdef");
+	assert(c.Coalesce(7) == 0);
+
+	char out[8];
+	assert(c.CopyTo(out, 3, 2) == 3 && memcmp(out, "cde", 3) == 0);
+	assert(c.CopyTo(out, 8, 4) == 2);
+}
+
+static void
+test_io()
+{
+	int fds[2];
+	int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(rc == 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	int sndbuf = 4096;
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	// more slices than one writev takes, and more bytes than the socket
+	IOBuf out;
+	std::string expect;
+	for (int i = 0; i < 3 * IOBUF_MAX_IOV; ++i) {
+		std::string s(1000, 'a' + i % 26);
+		IOBuf piece;
+		piece.Append(s);
+		out.Append(piece);
+		expect += s;
+	}
+	assert(out.SliceCount() == 3 * IOBUF_MAX_IOV);
+
+	IOBuf in;
+	size_t got = 0;
+	bool partial = false;
+	while (got < expect.size()) {
+		if (!out.Empty()) {
+			size_t before = out.Size();
+			ssize_t n = out.SendTo(fds[0]);
+			if (n < 0)
+				assert(errno == EAGAIN);
+			else if ((size_t) n < before)
+				partial = true;
+		}
+		ssize_t n = in.ReadFrom(fds[1], 8192);
+		assert(n > 0);
+		got += n;
+	}
+	assert(partial);
+	assert(out.Empty());
+	assert(in.ToString() == expect);
+
+	// writev on a pipe
+	int pfd[2];
+	rc = pipe(pfd);
+	assert(rc == 0);
+	IOBuf w;
+	w.Append("pipe ");
+	w.AppendExternal("data", 4);
+	assert(w.WriteTo(pfd[1]) == 9 && w.Empty());
+	close(pfd[1]);
+	IOBuf r;
+	assert(r.ReadFrom(pfd[0]) == 9);
+	assert(r.ReadFrom(pfd[0]) == 0);
+	assert(r.ToString() == "pipe data");
+	close(pfd[0]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main()
+{
+	test_append_prepend();
+	test_share();
+	test_external();
+	test_split();
+	test_io();
+	printf("done \n");
+}
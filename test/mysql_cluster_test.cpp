@@ -0,0 +1,176 @@
+#include "fake_mysql_driver.h"
+#include "mysql_cluster.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+
+using namespace ekko;
+
+/*
+ * A primary and two replicas, each on its own FakeMysqlDriver. getStats
+ * lists the primary first, then the replicas in the order they were added.
+ */
+struct Fixture {
+	FakeMysqlDriver primary, replica1, replica2;
+	MysqlCluster cluster;
+
+	Fixture()
+	{
+		ResultSet rs;
+		rs.setColumns({ { "id", MYSQL_TYPE_LONGLONG, 0 } });
+		const char *row[] = { "1" };
+		unsigned long lengths[] = { 1 };
+		rs.appendRow(row, lengths);
+		FakeMysqlDriver *fakes[] = { &primary, &replica1, &replica2 };
+		for (FakeMysqlDriver *fake : fakes)
+			fake->addResult("select", rs);
+		cluster.setPrimary("primary", "user", "pwd", "db", 3306, NULL, 0, 4);
+		cluster.addReplica("replica1", "user", "pwd", "db", 3306, NULL, 0, 4);
+		cluster.addReplica("replica2", "user", "pwd", "db", 3306, NULL, 0, 4);
+		cluster.primaryPool()->setDriver(&primary);
+		cluster.replicaPool(0)->setDriver(&replica1);
+		cluster.replicaPool(1)->setDriver(&replica2);
+		cluster.setEjection(2, 100, 400);
+		assert(cluster.start());
+	}
+
+	uint64_t queries(size_t i) { return cluster.getStats()[i].queries; }
+
+	/*
+	 * reads from fresh sessions, never sticky
+	 */
+	void read(int n)
+	{
+		ResultSet rs;
+		for (int i = 0; i < n; i++) {
+			MysqlSession s;
+			assert(cluster.query("select id from t", rs, &s) && rs.rowCount() == 1);
+		}
+	}
+};
+
+static void
+test_is_read()
+{
+	assert(MysqlCluster::isRead("select 1"));
+	assert(MysqlCluster::isRead("  /* hint */ -- note\n# more\n SELECT 1"));
+	assert(MysqlCluster::isRead("((select 1) union (select 2))"));
+	assert(MysqlCluster::isRead("show tables"));
+	assert(MysqlCluster::isRead("explain select * from t"));
+	assert(MysqlCluster::isRead("select 'for update', `for`, \"lock in share mode\" from t"));
+	assert(MysqlCluster::isRead("select ';' from t /* ; */ -- ;\n"));
+	assert(!MysqlCluster::isRead("select * from t for  update"));
+	assert(!MysqlCluster::isRead("select * from t\nFOR\tSHARE"));
+	assert(!MysqlCluster::isRead("select * from t lock in\n share   mode"));
+	assert(!MysqlCluster::isRead("select * from t /* x */ for /* y */ update"));
+	assert(!MysqlCluster::isRead("select 1; delete from t"));
+	assert(!MysqlCluster::isRead("select 1;"));
+	assert(!MysqlCluster::isRead("select 1 /* unterminated"));
+	assert(!MysqlCluster::isRead("update t set a = 1"));
+	assert(!MysqlCluster::isRead("(insert into t values (1))"));
+	assert(!MysqlCluster::isRead(""));
+}
+
+static void
+test_routing()
+{
+	Fixture f;
+	f.read(10);
+	assert(f.queries(0) == 0 && f.queries(1) == 5 && f.queries(2) == 5);
+	ResultSet rs;
+	MysqlSession s;
+	assert(f.cluster.query("select * from t for update", rs, &s));
+	assert(f.queries(0) == 1);
+	assert(f.primary.getStats().queries == 1);
+}
+
+/*
+ * After a write the same session reads from the primary until the
+ * stickiness runs out; other sessions keep reading from the replicas.
+ */
+static void
+test_stickiness()
+{
+	Fixture f;
+	f.cluster.setStickiness(100);
+	ResultSet rs;
+	MysqlSession s;
+	assert(f.cluster.query("update t set a = 1", rs, &s));
+	assert(f.cluster.query("select id from t", rs, &s));
+	assert(f.cluster.query("select id from t", rs, &s));
+	f.read(2);
+	assert(f.queries(0) == 3 && f.queries(1) + f.queries(2) == 2);
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	assert(f.cluster.query("select id from t", rs, &s));
+	assert(f.queries(0) == 3 && f.queries(1) + f.queries(2) == 3);
+}
+
+/*
+ * A replica that cannot be reached is ejected after two failures, reads
+ * retried on the other one in the meantime. One probe goes through when
+ * the backoff runs out; it fails and the backoff doubles. Once the server
+ * is back the next probe brings it back in.
+ */
+static void
+test_ejection()
+{
+	Fixture f;
+	f.replica2.setDown(true);
+	f.read(4);
+	std::vector<MysqlHostStats> stats = f.cluster.getStats();
+	assert(stats[2].failures == 2 && stats[2].ejections == 1 && !stats[2].healthy);
+	assert(stats[1].queries == 4 && stats[0].queries == 0);
+	f.read(4);
+	assert(f.queries(2) == 2 && f.queries(1) == 8);
+
+	// the first backoff is 100ms, the probe fails and it doubles to 200ms
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	f.read(2);
+	stats = f.cluster.getStats();
+	assert(stats[2].queries == 3 && stats[2].ejections == 2 && !stats[2].healthy);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	f.read(4);
+	assert(f.queries(2) == 3);
+
+	f.replica2.setDown(false);
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	f.read(4);
+	stats = f.cluster.getStats();
+	assert(stats[2].healthy && stats[2].ejections == 2 && stats[2].queries > 3);
+	assert(stats[0].queries == 0 && f.replica2.getStats().connect_failed == 3);
+}
+
+/*
+ * A read that fails on one replica is retried on the other; with both
+ * down it fails. Once both are ejected reads fall back to the primary.
+ */
+static void
+test_all_replicas_down()
+{
+	Fixture f;
+	f.replica1.setDown(true);
+	f.replica2.setDown(true);
+	ResultSet rs;
+	MysqlSession s;
+	assert(!f.cluster.query("select id from t", rs, &s));
+	assert(!f.cluster.query("select id from t", rs, &s));
+	std::vector<MysqlHostStats> stats = f.cluster.getStats();
+	assert(!stats[1].healthy && !stats[2].healthy && stats[0].queries == 0);
+	f.read(3);
+	assert(f.queries(0) == 3);
+}
+
+int
+main()
+{
+	test_is_read();
+	test_routing();
+	test_stickiness();
+	test_ejection();
+	test_all_replicas_down();
+	printf("done \n");
+	return 0;
+}
@@ -11,6 +11,31 @@ int main() {
       std::cout <<  m[field][i]  << std::endl;
     }
   }
+  ResultSet rs;
+  if (mysql->execute(rs, "select * from test limit ?", 10)) {
+    for (size_t r = 0; r < rs.rowCount(); r++) {
+      for (int i = 0; i < rs.columnCount(); i++)
+        std::cout << rs.column(i).name << "=" << (rs.isNull(r, i) ? "NULL" : rs.getCString(r, i)) << " ";
+      std::cout << std::endl;
+    }
+  }
+  {
+    //同一个连接上的几条语句
+    PooledConnection conn = mysql->acquire(1000);
+    if (conn && conn.query("begin", rs) && conn.execute(rs, "select count(*) from test where 1 = ?", 1)) {
+      std::cout << "count " << rs.getInt64(0, 0) << std::endl;
+      conn.query("commit", rs);
+    }
+  }
+  {
+    //几条语句一次往返
+    std::vector<ResultSet> results;
+    if (mysql->batch("select count(*) from test; select 1", results))
+      std::cout << "batch " << results.size() << " results, count " << results[0].getInt64(0, 0) << std::endl;
+  }
+  MysqlPoolStats stats = mysql->getStats();
+  std::cout << "acquired " << stats.acquired << " timeouts " << stats.timeouts
+            << " wait p99 " << stats.waitPercentile(99) << "us" << std::endl;
   delete mysql;
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,248 @@
+#include "tcp_server.h"
+#include "uring_server.h"
+#include "socket_util.h"
+#include <atomic>
+#include <string>
+#include <assert.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace ekko;
+
+static std::string
+roundtrip(int fd, const std::string &msg)
+{
+	std::string reply;
+	char buf[4096];
+	assert(write(fd, msg.data(), msg.size()) == (ssize_t) msg.size());
+	while (reply.size() < msg.size()) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		assert(n > 0);
+		reply.append(buf, n);
+	}
+	return reply;
+}
+
+static void
+test_uring_server(bool use_uring)
+{
+	// plain echo, "bye" is answered and then the server shuts the connection down
+	std::atomic<int> opened(0), closed(0);
+	UringServer server("127.0.0.1", 0, 2, use_uring);
+	server.SetConnectionCallback([&](const Connection::ptr&) { ++opened; });
+	server.SetCloseCallback([&](const Connection::ptr&) { ++closed; });
+	server.SetMessageCallback([&](const Connection::ptr &conn, Buffer &buf) {
+		std::string msg = buf.RetrieveAllAsString();
+		if (msg == "iobuf") {
+			// a chain of many slices, more than one SENDMSG takes
+			IOBuf out;
+			for (int i = 0; i < 3 * IOBUF_MAX_IOV; ++i) {
+				IOBuf piece;
+				piece.Append(std::string(1000, 'a' + i % 26));
+				out.Append(piece);
+			}
+			conn->Send(std::move(out));
+			return;
+		}
+		conn->Send(msg);
+		if (msg == "bye")
+			conn->Shutdown();
+	});
+	int rc = server.Start();
+	assert(rc == 0 && server.GetPort() > 0);
+	assert(server.IsUring() == (use_uring && UringServer::IsSupported()));
+
+	int fds[4];
+	for (int i = 0; i < 4; ++i) {
+		fds[i] = ConnectTo("127.0.0.1", server.GetPort());
+		assert(fds[i] >= 0);
+	}
+	for (int round = 0; round < 100; ++round) {
+		for (int i = 0; i < 4; ++i) {
+			std::string msg = "hello " + std::to_string(round * 4 + i);
+			assert(roundtrip(fds[i], msg) == msg);
+		}
+	}
+	// bigger than a recv buffer and a send slot
+	std::string big(1 << 20, 'y');
+	assert(roundtrip(fds[1], big) == big);
+
+	std::string chained;
+	for (int i = 0; i < 3 * IOBUF_MAX_IOV; ++i)
+		chained += std::string(1000, 'a' + i % 26);
+	assert(write(fds[0], "iobuf", 5) == 5);
+	std::string reply;
+	char rbuf[4096];
+	while (reply.size() < chained.size()) {
+		ssize_t n = read(fds[0], rbuf, sizeof(rbuf));
+		assert(n > 0);
+		reply.append(rbuf, n);
+	}
+	assert(reply == chained);
+
+	char c;
+	assert(roundtrip(fds[3], "bye") == "bye");
+	assert(read(fds[3], &c, 1) == 0);
+	close(fds[2]);
+	while (closed != 2)
+		usleep(1000);
+	assert(opened == 4);
+	assert(server.GetSyscalls() > 0);
+
+	server.Stop();
+	assert(closed == 4);
+	for (int i = 0; i < 4; ++i) {
+		if (i != 2)
+			close(fds[i]);
+	}
+}
+
+/// @brief a listener per loop; a connection is served by the loop that accepted it
+static void
+test_sharded(bool use_uring, AcceptMode mode)
+{
+	std::atomic<int> closed(0);
+	UringServer server("127.0.0.1", 0, 2, use_uring);
+	server.SetAcceptMode(mode);
+	server.SetCloseCallback([&](const Connection::ptr&) { ++closed; });
+	server.SetMessageCallback([](const Connection::ptr &conn, Buffer &buf) {
+		conn->Send(buf.RetrieveAllAsString());
+	});
+	assert(server.Start() == 0);
+
+	// churn: connect, one round trip, close
+	for (int i = 0; i < 64; ++i) {
+		int fd = ConnectTo("127.0.0.1", server.GetPort());
+		assert(fd >= 0);
+		assert(roundtrip(fd, "churn") == "churn");
+		close(fd);
+	}
+	while (closed != 64)
+		usleep(1000);
+	assert(server.GetAccepted(0) + server.GetAccepted(1) == 64);
+	// the kernel hashes the 4-tuple, both listeners get some
+	if (mode == ACCEPT_SHARDED)
+		assert(server.GetAccepted(0) > 0 && server.GetAccepted(1) > 0);
+	server.Stop();
+}
+
+/// @brief reads are bounded per event, input nobody consumes closes the connection
+static void
+test_read_budget()
+{
+	std::atomic<int> closed(0);
+	std::atomic<size_t> received(0), largest(0);
+	TcpServer server("127.0.0.1", 0, 1);
+	server.SetCloseCallback([&](const TcpConnection::ptr&) { ++closed; });
+	server.SetMessageCallback([&](const TcpConnection::ptr&, Buffer &buf) {
+		// "h..." is held on to, as if waiting for the rest of a request
+		if (*buf.Peek() == 'h')
+			return;
+		if (buf.ReadableBytes() > largest)
+			largest = buf.ReadableBytes();
+		received += buf.ReadableBytes();
+		buf.RetrieveAll();
+	});
+	assert(server.Start() == 0);
+
+	int fd = ConnectTo("127.0.0.1", server.GetPort());
+	assert(fd >= 0);
+	std::string big(4 << 20, 'x');
+	assert(write(fd, big.data(), big.size()) == (ssize_t) big.size());
+	while (received != big.size())
+		usleep(1000);
+	assert(largest <= 64 * 1024);
+	close(fd);
+
+	fd = ConnectTo("127.0.0.1", server.GetPort());
+	assert(fd >= 0);
+	std::string held(1 << 20, 'h');
+	ssize_t n;
+	size_t sent = 0;
+	while ((n = send(fd, held.data(), held.size(), MSG_NOSIGNAL)) > 0)
+		sent += n;
+	assert(sent > (16 << 20));
+	while (closed != 2)
+		usleep(1000);
+	close(fd);
+	server.Stop();
+}
+
+int
+main()
+{
+	struct thread_pool_t pool;
+	thread_pool_init(&pool, 2);
+
+	// "up:" messages are upper-cased on the pool and answered from the owning loop
+	std::atomic<int> opened(0), closed(0), wrong_thread(0);
+	TcpServer server("127.0.0.1", 0, 2);
+	server.SetConnectionCallback([&](const TcpConnection::ptr&) { ++opened; });
+	server.SetCloseCallback([&](const TcpConnection::ptr&) { ++closed; });
+	server.SetMessageCallback([&](const TcpConnection::ptr &conn, Buffer &buf) {
+		std::string msg = buf.RetrieveAllAsString();
+		if (msg.compare(0, 3, "up:") != 0) {
+			conn->Send(msg);
+			return;
+		}
+		std::shared_ptr<std::string> result(new std::string(msg));
+		EventLoop *loop = conn->GetLoop();
+		loop->Offload(&pool, [result]() {
+			for (auto &c : *result)
+				c = toupper(c);
+		}, [conn, result, loop, &wrong_thread]() {
+			if (EventLoop::GetThis() != loop)
+				++wrong_thread;
+			conn->Send(*result);
+		});
+	});
+	int rc = server.Start();
+	assert(rc == 0 && server.GetPort() > 0);
+
+	int fds[4];
+	for (int i = 0; i < 4; ++i) {
+		fds[i] = ConnectTo("127.0.0.1", server.GetPort());
+		assert(fds[i] >= 0);
+	}
+	for (int round = 0; round < 100; ++round) {
+		for (int i = 0; i < 4; ++i) {
+			std::string msg = "hello " + std::to_string(round * 4 + i);
+			assert(roundtrip(fds[i], msg) == msg);
+		}
+	}
+	assert(roundtrip(fds[0], "up:abc") == "UP:ABC");
+	assert(wrong_thread == 0);
+
+	// large message: the echo has to go through the output buffer
+	std::string big(1 << 20, 'x');
+	assert(roundtrip(fds[1], big) == big);
+
+	// cross-thread task queue
+	std::atomic<int> ran(0);
+	for (int i = 0; i < 1000; ++i)
+		server.GetLoop(i % 2)->QueueInLoop([&]() { ++ran; });
+	while (ran != 1000)
+		usleep(1000);
+
+	close(fds[2]);
+	while (closed != 1)
+		usleep(1000);
+	assert(opened == 4);
+
+	server.Stop();
+	assert(closed == 4);
+	close(fds[0]);
+	close(fds[1]);
+	close(fds[3]);
+	thread_pool_destroy(&pool);
+
+	test_read_budget();
+	test_uring_server(true);
+	test_uring_server(false);
+	test_sharded(true, ACCEPT_SHARDED);
+	test_sharded(false, ACCEPT_SHARDED);
+	test_sharded(true, ACCEPT_SHARDED_CPU);
+	test_sharded(false, ACCEPT_SHARDED_CPU);
+	printf("done \n");
+}
@@ -0,0 +1,91 @@
+#include "query_cache.h"
+#include <string>
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+
+using namespace ekko;
+
+static std::vector<std::string>
+tables_of(const char *sql)
+{
+	std::vector<std::string> out;
+	QueryCache::tables(sql, out);
+	return out;
+}
+
+static bool
+same(const std::vector<std::string> &got, std::vector<std::string> want)
+{
+	return got == want;
+}
+
+static void
+test_normalize()
+{
+	assert(QueryCache::normalize("  select *\n\tfrom  t  where a = 1 ; ") == "select * from t where a = 1");
+	// whitespace inside literals and quoted names is part of the query
+	assert(QueryCache::normalize("select 'a  b',  `x  y` from t") == "select 'a  b', `x  y` from t");
+	assert(QueryCache::normalize("select 'it''s  ;'") == "select 'it''s  ;'");
+	assert(QueryCache::normalize("select 1") != QueryCache::normalize("SELECT 1"));
+}
+
+static void
+test_tables()
+{
+	assert(same(tables_of("select * from users where id = 1"), {"users"}));
+	assert(same(tables_of("SELECT u.name FROM Users u JOIN `orders` AS o ON o.uid = u.id"), {"users", "orders"}));
+	assert(same(tables_of("select * from a, b x, shop.c where a.id = x.id"), {"a", "b", "c"}));
+	assert(same(tables_of("select * from a natural join b straight_join c"), {"a", "b", "c"}));
+	assert(same(tables_of("select * from a where id in (select aid from b)"), {"a", "b"}));
+	assert(same(tables_of("select * from (select * from a) t"), {"a"}));
+	// table names inside strings and comments do not count
+	assert(same(tables_of("select 'from x' /* from y */ from a -- from z\n"), {"a"}));
+	assert(same(tables_of("select 1"), {}));
+
+	assert(same(tables_of("insert into audit (user_id, action) values (1, 'from t')"), {"audit"}));
+	assert(same(tables_of("INSERT IGNORE INTO audit SELECT * FROM staging"), {"audit", "staging"}));
+	assert(same(tables_of("replace into t values (1)"), {"t"}));
+	assert(same(tables_of("update low_priority ignore counters set hits = hits + 1"), {"counters"}));
+	assert(same(tables_of("update a join b on a.id = b.id set a.x = b.x"), {"a", "b"}));
+	assert(same(tables_of("delete from sessions where expires < now()"), {"sessions"}));
+	assert(same(tables_of("delete t1 from t1 inner join t2 on t1.id = t2.id"), {"t1", "t2"}));
+	assert(same(tables_of("truncate table logs"), {"logs"}));
+	assert(same(tables_of("truncate logs"), {"logs"}));
+	assert(same(tables_of("drop table if exists a, b"), {"a", "b"}));
+	assert(same(tables_of("alter table t add column c int"), {"t"}));
+	assert(same(tables_of("rename table a to b"), {"a", "b"}));
+	assert(same(tables_of("insert into t values (1) on duplicate key update n = n + 1"), {"t"}));
+}
+
+static void
+test_cacheable()
+{
+	assert(QueryCache::cacheable("select * from users where id = 1"));
+	assert(QueryCache::cacheable("select now from t where user = 'now()' /* rand() */"));
+	assert(QueryCache::cacheable("select `user`, database_id from t"));
+	assert(!QueryCache::cacheable("select 1"));
+	assert(!QueryCache::cacheable("select now()"));
+	assert(!QueryCache::cacheable("select * from t where created > NOW ()"));
+	assert(!QueryCache::cacheable("select * from t where created > current_timestamp"));
+	assert(!QueryCache::cacheable("select * from t order by rand() limit 1"));
+	assert(!QueryCache::cacheable("select uuid(), id from t"));
+	assert(!QueryCache::cacheable("select * from t where id = last_insert_id()"));
+	assert(!QueryCache::cacheable("select found_rows()"));
+	assert(!QueryCache::cacheable("select * from t where id = @id"));
+	assert(!QueryCache::cacheable("select @@session.sql_mode"));
+	assert(!QueryCache::cacheable("select get_lock('job', 0) from dual"));
+	assert(!QueryCache::cacheable("select sleep(1) from t"));
+	assert(!QueryCache::cacheable("select sql_no_cache * from t"));
+	assert(!QueryCache::cacheable("select * from information_schema.processlist"));
+}
+
+int
+main()
+{
+	test_normalize();
+	test_tables();
+	test_cacheable();
+	printf("done \n");
+	return 0;
+}
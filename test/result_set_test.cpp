@@ -0,0 +1,138 @@
+#include "result_set.h"
+#include <string>
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace ekko;
+
+static ResultSet
+make_result()
+{
+	ResultSet rs;
+	std::vector<ResultSet::Column> columns(4);
+	// not in alphabetical order, which is where the map-based result went wrong
+	columns[0].name = "name";
+	columns[1].name = "id";
+	columns[2].name = "score";
+	columns[3].name = "blob";
+	rs.setColumns(columns);
+	rs.reserve(3, 64);
+
+	const char *row0[] = { "alice", "1", "2.5", "a\0b" };
+	unsigned long len0[] = { 5, 1, 3, 3 };
+	rs.appendRow(row0, len0);
+	const char *row1[] = { "bob", "-42", NULL, "" };
+	unsigned long len1[] = { 3, 3, 0, 0 };
+	rs.appendRow(row1, len1);
+	const char *row2[] = { NULL, "18446744073709551615", "x", "z" };
+	rs.appendRow(row2, NULL);
+	return rs;
+}
+
+static void
+test_access()
+{
+	ResultSet rs = make_result();
+	assert(rs.rowCount() == 3);
+	assert(rs.columnCount() == 4);
+	assert(rs.column(0).name == "name");
+	assert(rs.column(3).name == "blob");
+
+	assert(rs.columnIndex("name") == 0);
+	assert(rs.columnIndex("id") == 1);
+	assert(rs.columnIndex("score") == 2);
+	assert(rs.columnIndex("blob") == 3);
+	assert(rs.columnIndex("missing") == -1);
+
+	assert(rs.getString(0, 0) == "alice");
+	assert(rs.getString(0, 3) == std::string_view("a\0b", 3));
+	assert(strcmp(rs.getCString(1, 0), "bob") == 0);
+	assert(rs.getInt64(0, "id") == 1);
+	assert(rs.getInt64(1, 1) == -42);
+	assert(rs.getDouble(0, "score") == 2.5);
+	assert(rs.getUint64(2, "id") == 18446744073709551615ULL);
+	// out of range, not a number, NULL, no such column: the default
+	assert(rs.getInt64(2, 1, 7) == 7);
+	assert(rs.getInt64(0, 0, 7) == 7);
+	assert(rs.getDouble(2, 2, -1) == -1);
+	assert(rs.getUint64(1, 1, 3) == 3);
+	assert(rs.getInt64(0, "missing", 9) == 9);
+
+	assert(rs.isNull(1, 2));
+	assert(rs.isNull(2, "name"));
+	assert(rs.isNull(0, "missing"));
+	assert(!rs.isNull(1, 3));
+	assert(rs.getCString(1, 2) == NULL);
+	assert(rs.getString(1, 2).empty());
+	assert(rs.getString(1, 3).empty() && rs.getCString(1, 3) != NULL);
+}
+
+static void
+test_arena()
+{
+	ResultSet rs = make_result();
+	// every cell, NUL-terminated, back to back in one block
+	const char *first = rs.getCString(0, 0);
+	assert(rs.getCString(0, 1) == first + 6);
+	assert(rs.getCString(0, 2) == first + 8);
+	assert(rs.getCString(1, 0) == first + 16);
+
+	// a copy owns its data
+	ResultSet copy = rs;
+	rs.clear();
+	assert(rs.rowCount() == 0 && rs.columnIndex("id") == -1);
+	assert(copy.getString(1, "name") == "bob");
+	assert(copy.getCString(0, 0) != first);
+
+	// enough reserved: no reallocation however many rows go in
+	std::vector<ResultSet::Column> columns(1);
+	columns[0].name = "v";
+	rs.setColumns(columns);
+	rs.reserve(1000, 1000 * 4);
+	const char *cell[] = { "abcd" };
+	rs.appendRow(cell, NULL);
+	first = rs.getCString(0, 0);
+	for (int i = 1; i < 1000; ++i)
+		rs.appendRow(cell, NULL);
+	assert(rs.getCString(0, 0) == first);
+	assert(rs.getCString(999, 0) == first + 999 * 5);
+
+	// the next batch of a stream: same columns, same memory
+	rs.clearRows();
+	assert(rs.rowCount() == 0 && rs.columnIndex("v") == 0);
+	rs.appendRow(cell, NULL);
+	assert(rs.getCString(0, 0) == first);
+}
+
+static void
+test_columns()
+{
+	ResultSet rs;
+	std::vector<ResultSet::Column> columns(100);
+	for (int i = 0; i < 100; ++i)
+		columns[i].name = "c" + std::to_string(i);
+	// the same name twice: lookups find the first
+	columns[99].name = "c5";
+	rs.setColumns(columns);
+	for (int i = 0; i < 99; ++i)
+		assert(rs.columnIndex("c" + std::to_string(i)) == i);
+	assert(rs.columnIndex("c99") == -1);
+	assert(rs.empty());
+
+	rs.setColumns(std::vector<ResultSet::Column>());
+	rs.setAffectedRows(3);
+	rs.setInsertId(12);
+	assert(rs.columnCount() == 0 && rs.rowCount() == 0);
+	assert(rs.affectedRows() == 3 && rs.insertId() == 12);
+}
+
+int
+main()
+{
+	test_access();
+	test_arena();
+	test_columns();
+	printf("done \n");
+}
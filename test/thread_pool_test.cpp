@@ -0,0 +1,118 @@
+#include "thread_pool.h"
+#include "parallel.h"
+#include "task_graph.h"
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <assert.h>
+#define N 1000003
+
+int
+main()
+{
+	struct ekko::thread_pool_t pool;
+	ekko::thread_pool_init(&pool, 4);
+
+	// every index visited exactly once, whatever the grain
+	std::vector<int> hits(N, 0);
+	for (size_t grain : {0, 1, 7, 4096, 2 * N}) {
+		std::fill(hits.begin(), hits.end(), 0);
+		ekko::parallel_for(&pool, 0, N, grain, [&](size_t lo, size_t hi) {
+			for (size_t i = lo; i < hi; ++i)
+				++hits[i];
+		});
+		assert(std::count(hits.begin(), hits.end(), 1) == N);
+	}
+
+	long long sum = ekko::parallel_reduce(&pool, 0, N, 0, 0LL,
+		[](size_t lo, size_t hi, long long acc) {
+			for (size_t i = lo; i < hi; ++i)
+				acc += i;
+			return acc;
+		},
+		[](long long a, long long b) { return a + b; });
+	assert(sum == (long long) N * (N - 1) / 2);
+
+	std::vector<unsigned> keys(N);
+	unsigned seed = 1;
+	for (size_t i = 0; i < N; ++i)
+		keys[i] = seed = seed * 1103515245 + 12345;
+	std::vector<unsigned> expect(keys);
+	std::sort(expect.begin(), expect.end());
+	ekko::parallel_sort(&pool, keys.begin(), keys.end());
+	assert(keys == expect);
+
+	// nested calls from inside a worker must not deadlock
+	std::atomic<long long> nested(0);
+	ekko::parallel_for(&pool, 0, 16, 1, [&](size_t lo, size_t hi) {
+		for (size_t i = lo; i < hi; ++i)
+			ekko::parallel_for(&pool, 0, 1000, 10, [&](size_t l, size_t h) { nested += h - l; });
+	});
+	assert(nested == 16000);
+
+	// diamond layers: every node must see both of its predecessors done
+	ekko::TaskGraph graph;
+	std::vector<std::atomic<int>> stamp(40 * 8);
+	std::atomic<int> clock(0), bad(0);
+	for (int layer = 0; layer < 40; ++layer) {
+		for (int k = 0; k < 8; ++k) {
+			int id = graph.AddTask([&, layer, k] {
+				if (layer > 0 && (stamp[(layer - 1) * 8 + k] == 0 || stamp[(layer - 1) * 8 + (k + 1) % 8] == 0))
+					++bad;
+				stamp[layer * 8 + k] = ++clock;
+			});
+			if (layer > 0) {
+				graph.Precede((layer - 1) * 8 + k, id);
+				graph.Precede((layer - 1) * 8 + (k + 1) % 8, id);
+			}
+		}
+	}
+	// reused across runs
+	for (int run = 0; run < 50; ++run) {
+		for (auto &s : stamp)
+			s = 0;
+		int rc = graph.Run(&pool);
+		assert(rc == 0 && bad == 0 && std::count(stamp.begin(), stamp.end(), 0) == 0);
+	}
+
+	ekko::TaskGraph cyclic;
+	int a = cyclic.AddTask([] {}), b = cyclic.AddTask([] {});
+	cyclic.Precede(a, b);
+	cyclic.Precede(b, a);
+	int rc = cyclic.Run(&pool);
+	assert(rc == -1);
+
+	ekko::thread_pool_destroy(&pool);
+
+	// instrumentation: every task shows up once in the snapshot. A fresh
+	// pool, so no helper task left over from the calls above is counted.
+	struct ekko::thread_pool_t counted;
+	ekko::thread_pool_init(&counted, 4);
+	ekko::thread_pool_stats_enable(&counted, 1);
+	std::atomic<int> ran(0);
+	for (int i = 0; i < 1000; ++i)
+		ekko::thread_pool_push_task(&counted, [](void *arg) { ++*(std::atomic<int>*) arg; }, &ran);
+	// a task is counted after it returns: wait for the counts, not for ran
+	struct ekko::thread_pool_stats_t stats;
+	struct ekko::worker_stats_t workers[4];
+	int nworkers;
+	for (int tries = 0; tries < 1000; ++tries) {
+		nworkers = ekko::thread_pool_stats(&counted, &stats, workers, 4);
+		if (stats.total.tasks >= 1000)
+			break;
+		usleep(1000);
+	}
+	assert(ran == 1000);
+	assert(nworkers == 4 && stats.numWorkers == 4);
+	assert(stats.queueDepth == 0 && stats.pushed == 1000 && stats.maxQueueDepth > 0);
+	assert(stats.total.tasks == 1000 && stats.total.queueWait.count == 1000 && stats.total.run.count == 1000);
+	uint64_t per_worker = 0;
+	for (int i = 0; i < nworkers; ++i)
+		per_worker += workers[i].tasks;
+	assert(per_worker == 1000);
+	assert(ekko::thread_pool_hist_percentile(&stats.total.queueWait, 50) <= ekko::thread_pool_hist_percentile(&stats.total.queueWait, 99));
+	assert(ekko::thread_pool_hist_percentile(&stats.total.run, 100) <= stats.total.run.maxNs);
+	ekko::thread_pool_stats_enable(&counted, 0);
+	ekko::thread_pool_destroy(&counted);
+	printf("done \n");
+}
@@ -0,0 +1,226 @@
+#include "timing_wheel.h"
+#include "event_loop.h"
+#include "socket_util.h"
+#include "uring_server.h"
+#include <atomic>
+#include <string>
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace ekko;
+
+// time is driven by hand, from a base a little ahead of the wheel's own clock
+static uint64_t base;
+
+static void
+start(TimingWheel &wheel)
+{
+	base = TimingWheel::NowMs() + 1000;
+	wheel.Advance(base);
+}
+
+static void
+test_order()
+{
+	TimingWheel wheel;
+	start(wheel);
+	std::vector<int> fired;
+	std::vector<TimingWheel::Timer*> timers;
+	int delays[] = { 5, 1, 70, 3, 5000, 64, 300000, 2 };
+
+	for (int i = 0; i < 8; ++i) {
+		timers.push_back(new TimingWheel::Timer([&fired, &delays, i]() { fired.push_back(delays[i]);}));
+		wheel.Add(timers[i], delays[i]);
+	}
+	assert(wheel.Size() == 8);
+	for (uint64_t t = 0; t <= 300001; t += 1 + rand() % 97)
+		wheel.Advance(base + t);
+	wheel.Advance(base + 300001);
+	assert(fired.size() == 8 && wheel.Size() == 0);
+	for (size_t i = 1; i < fired.size(); ++i)
+		assert(fired[i - 1] <= fired[i]);
+	for (size_t i = 0; i < timers.size(); ++i)
+		delete timers[i];
+}
+
+/// @brief nothing fires early or late by more than a tick, at any level
+static void
+test_deadlines()
+{
+	TimingWheel wheel;
+	start(wheel);
+	const int n = 2000;
+	std::vector<uint64_t> want(n), got(n);
+	std::vector<TimingWheel::Timer*> timers;
+	uint64_t now = base;
+
+	for (int i = 0; i < n; ++i) {
+		// up to ~2 days, past the last level
+		uint64_t delay = (uint64_t) rand() % (1 << (6 * (1 + i % 5)));
+		want[i] = base + (delay ? delay : 1);
+		timers.push_back(new TimingWheel::Timer([&, i]() { got[i] = now;}));
+		wheel.Add(timers[i], delay);
+	}
+	// step straight from timeout to timeout, as the loop does
+	while (wheel.Size() > 0) {
+		int timeout = wheel.NextTimeout(now);
+		assert(timeout >= 0);
+		now += timeout;
+		wheel.Advance(now);
+	}
+	for (int i = 0; i < n; ++i) {
+		assert(got[i] == want[i]);
+		delete timers[i];
+	}
+	assert(wheel.GetFired() == (uint64_t) n);
+	assert(wheel.NextTimeout(now) == -1);
+}
+
+static void
+test_cancel_reset()
+{
+	TimingWheel wheel;
+	start(wheel);
+	int a = 0, b = 0, c = 0;
+	TimingWheel::Timer ta([&]() { ++a;}), tb([&]() { ++b;}), tc([&]() { ++c;});
+
+	wheel.Add(&ta, 10);
+	wheel.Add(&tb, 10);
+	wheel.Add(&tc, 1000);
+	wheel.Cancel(&tb);
+	assert(!tb.IsArmed() && wheel.Size() == 2);
+	wheel.Cancel(&tb);
+	wheel.Advance(base + 10);
+	assert(a == 1 && b == 0 && !ta.IsArmed());
+
+	// pushed back on every "read": only a store, never fires while active
+	uint64_t moved = wheel.GetMoved();
+	for (uint64_t t = 10; t < 5000; t += 7) {
+		wheel.Update(base + t);
+		wheel.Reset(&tc, 1000);
+		wheel.Advance(base + t);
+	}
+	assert(c == 0 && tc.IsArmed());
+	// a handful of moves, not one per reset
+	assert(wheel.GetMoved() - moved < 100);
+	wheel.Advance(base + 4999 + 1000);
+	assert(c == 1);
+
+	// an earlier deadline re-links at once
+	wheel.Add(&tc, 5000);
+	wheel.Reset(&tc, 10);
+	wheel.Advance(base + 6010);
+	assert(c == 2);
+
+	// a timer going away cancels itself
+	{
+		TimingWheel::Timer td([&]() { ++c;});
+		wheel.Add(&td, 5);
+	}
+	assert(wheel.Size() == 0);
+	wheel.Advance(base + 7000);
+	assert(c == 2);
+}
+
+/// @brief callbacks may arm, reset and cancel timers of the same batch
+static void
+test_callbacks()
+{
+	TimingWheel wheel;
+	start(wheel);
+	int ran = 0, cancelled = 0, rearmed = 0;
+	TimingWheel::Timer victim([&]() { ++cancelled;});
+	TimingWheel::Timer again;
+	again.SetCallback([&]() {
+		if (++rearmed < 3)
+			wheel.Add(&again, 10);
+	});
+
+	wheel.Add(&victim, 5);
+	wheel.RunAfter(5, [&]() { ++ran; wheel.Cancel(&victim);});
+	wheel.Add(&victim, 5);
+	wheel.Add(&again, 5);
+	// the one-off timers are owned and freed by the wheel
+	for (int i = 0; i < 100; ++i)
+		wheel.RunAfter(i, [&]() { ++ran;});
+	wheel.Advance(base + 5);
+	assert(cancelled == 0 && ran == 7 && rearmed == 1);
+	// a timer armed by a callback counts from the time Advance() was given
+	wheel.Advance(base + 1000);
+	assert(ran == 101 && rearmed == 2 && wheel.Size() == 1);
+	wheel.Advance(base + 1010);
+	assert(rearmed == 3 && wheel.Size() == 0);
+	// left armed at destruction: not run, not leaked
+	wheel.RunAfter(10, [&]() { ++ran;});
+}
+
+/// @brief RunAfter on the loops and idle connections closed by both backends
+static void
+test_loop(bool use_uring)
+{
+	std::atomic<int> closed(0);
+	UringServer server("127.0.0.1", 0, 1, use_uring);
+	server.SetIdleTimeout(100);
+	server.SetMessageCallback([](const Connection::ptr &conn, Buffer &buf) {
+		std::string msg = buf.RetrieveAllAsString();
+		if (msg == "off")
+			conn->SetIdleTimeout(0);
+		conn->Send(msg);
+	});
+	server.SetCloseCallback([&](const Connection::ptr&) { ++closed;});
+	assert(server.Start() == 0);
+
+	int quiet = ConnectTo("127.0.0.1", server.GetPort());
+	int busy = ConnectTo("127.0.0.1", server.GetPort());
+	int off = ConnectTo("127.0.0.1", server.GetPort());
+	char buf[16];
+	assert(write(off, "off", 3) == 3 && read(off, buf, sizeof(buf)) == 3);
+	// traffic every 30ms keeps busy open well past the timeout
+	for (int i = 0; i < 10; ++i) {
+		assert(write(busy, "x", 1) == 1 && read(busy, buf, sizeof(buf)) == 1);
+		usleep(30000);
+	}
+	assert(read(quiet, buf, sizeof(buf)) == 0);
+	assert(read(busy, buf, sizeof(buf)) == 0);
+	while (closed != 2)
+		usleep(1000);
+	assert(write(off, "x", 1) == 1 && read(off, buf, sizeof(buf)) == 1);
+	server.Stop();
+	close(quiet);
+	close(busy);
+	close(off);
+}
+
+static void
+test_run_after()
+{
+	EventLoop loop;
+	std::atomic<int> ran(0);
+	pthread_t tid;
+
+	pthread_create(&tid, 0, [](void *arg) -> void* { ((EventLoop*) arg)->Loop(); return 0;}, &loop);
+	uint64_t t0 = TimingWheel::NowMs();
+	loop.RunAfter(50, [&]() { ++ran;});
+	loop.RunAfter(10, [&]() { ++ran; loop.RunAfter(10, [&]() { ++ran;});});
+	while (ran != 3)
+		usleep(1000);
+	assert(TimingWheel::NowMs() - t0 >= 50);
+	loop.Stop();
+	pthread_join(tid, 0);
+}
+
+int
+main()
+{
+	test_order();
+	test_deadlines();
+	test_cancel_reset();
+	test_callbacks();
+	test_run_after();
+	test_loop(true);
+	test_loop(false);
+	printf("done \n");
+}
@@ -0,0 +1,124 @@
+#include "parallel.h"
+#include <atomic>
+
+namespace ekko{
+
+// shared by the caller and its helper tasks, freed by whoever drops the last reference
+struct parallel_job_t {
+    void (*run)(void*, size_t, size_t);
+    void *ctx;
+    size_t begin;
+    size_t end;
+    size_t grain;
+    size_t nchunks;
+    std::atomic<size_t> next;
+    std::atomic<size_t> done;
+    std::atomic<int> refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void
+parallel_job_release(struct parallel_job_t *jobPtr)
+{
+    if (jobPtr->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    pthread_mutex_destroy(&jobPtr->mutex);
+    pthread_cond_destroy(&jobPtr->cond);
+    delete jobPtr;
+}
+
+/**
+ * @brief claim chunks until none are left
+*/
+static void
+parallel_job_work(struct parallel_job_t *jobPtr)
+{
+    size_t chunk, lo, hi;
+    while ( (chunk = jobPtr->next.fetch_add(1, std::memory_order_relaxed)) < jobPtr->nchunks) {
+        lo = jobPtr->begin + chunk * jobPtr->grain;
+        hi = lo + jobPtr->grain;
+        if (hi > jobPtr->end)
+            hi = jobPtr->end;
+        jobPtr->run(jobPtr->ctx, lo, hi);
+        if (jobPtr->done.fetch_add(1, std::memory_order_acq_rel) + 1 == jobPtr->nchunks) {
+            pthread_mutex_lock(&jobPtr->mutex);
+            pthread_cond_signal(&jobPtr->cond);
+            pthread_mutex_unlock(&jobPtr->mutex);
+        }
+    }
+}
+
+static void
+parallel_helper(void *arg)
+{
+    struct parallel_job_t *jobPtr = (struct parallel_job_t*) arg;
+    parallel_job_work(jobPtr);
+    parallel_job_release(jobPtr);
+}
+
+size_t
+parallel_grain(struct thread_pool_t *threadPoolPtr, size_t n, size_t grain)
+{
+    size_t nthreads;
+    if (grain)
+        return grain;
+    // a few chunks per thread so a slow worker does not hold up the rest
+    nthreads = threadPoolPtr->numWorkers + 1;
+    grain = n / (nthreads * 4);
+    return grain ? grain : 1;
+}
+
+int
+parallel_run(struct thread_pool_t *threadPoolPtr, size_t begin, size_t end, size_t grain,
+             void (*run)(void*, size_t, size_t), void *ctx)
+{
+    struct parallel_job_t *jobPtr;
+    size_t nhelpers, idx;
+
+    if (begin >= end)
+        return 0;
+    grain = parallel_grain(threadPoolPtr, end - begin, grain);
+
+    nhelpers = (end - begin + grain - 1) / grain - 1;
+    if (nhelpers > (size_t) threadPoolPtr->numWorkers)
+        nhelpers = threadPoolPtr->numWorkers;
+    if (nhelpers == 0) {
+        run(ctx, begin, end);
+        return 0;
+    }
+
+    jobPtr = new struct parallel_job_t;
+    jobPtr->run = run;
+    jobPtr->ctx = ctx;
+    jobPtr->begin = begin;
+    jobPtr->end = end;
+    jobPtr->grain = grain;
+    jobPtr->nchunks = (end - begin + grain - 1) / grain;
+    jobPtr->next.store(0, std::memory_order_relaxed);
+    jobPtr->done.store(0, std::memory_order_relaxed);
+    jobPtr->refs.store(nhelpers + 1, std::memory_order_relaxed);
+    pthread_mutex_init(&jobPtr->mutex, 0);
+    pthread_cond_init(&jobPtr->cond, 0);
+
+    for (idx = 0; idx < nhelpers; ++idx) {
+        if (thread_pool_push_task(threadPoolPtr, parallel_helper, jobPtr) != 0)
+            break;
+    }
+    // references of helpers never queued
+    for (size_t failed = idx; failed < nhelpers; ++failed)
+        jobPtr->refs.fetch_sub(1, std::memory_order_relaxed);
+
+    parallel_job_work(jobPtr);
+
+    if (jobPtr->done.load(std::memory_order_acquire) != jobPtr->nchunks) {
+        pthread_mutex_lock(&jobPtr->mutex);
+        while (jobPtr->done.load(std::memory_order_acquire) != jobPtr->nchunks)
+            pthread_cond_wait(&jobPtr->cond, &jobPtr->mutex);
+        pthread_mutex_unlock(&jobPtr->mutex);
+    }
+    parallel_job_release(jobPtr);
+    return idx;
+}
+
+}
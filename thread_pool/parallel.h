@@ -0,0 +1,127 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include "thread_pool.h"
+#include <stddef.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+namespace ekko {
+
+/**
+ * @brief split [begin, end) into chunks of grain indices and run them on the pool.
+ * The calling thread takes chunks as well and only waits for chunks already
+ * started by the workers, so it never blocks on tasks still sitting in the queue.
+ * If no helper task can be queued the caller simply runs every chunk itself.
+ * @param run called as run(ctx, lo, hi) once for every chunk
+ * @param grain chunk size, 0 picks one from the number of workers
+ * @return the number of workers asked to help
+*/
+int parallel_run(struct thread_pool_t *threadPoolPtr, size_t begin, size_t end, size_t grain,
+                 void (*run)(void*, size_t, size_t), void *ctx);
+
+/**
+ * @return the grain parallel_run uses for n indices when asked for grain
+*/
+size_t parallel_grain(struct thread_pool_t *threadPoolPtr, size_t n, size_t grain);
+
+template<class Func>
+void
+parallel_range_trampoline(void *ctx, size_t lo, size_t hi)
+{
+    (*(Func*) ctx)(lo, hi);
+}
+
+/**
+ * @brief call func(lo, hi) on disjoint subranges covering [begin, end)
+ * @param grain number of indices per subrange, 0 for automatic
+*/
+template<class Func>
+int
+parallel_for(struct thread_pool_t *threadPoolPtr, size_t begin, size_t end, size_t grain, Func func)
+{
+    if (begin >= end)
+        return 0;
+    return parallel_run(threadPoolPtr, begin, end, grain, parallel_range_trampoline<Func>, &func);
+}
+
+/**
+ * @brief reduce [begin, end): every subrange computes map(lo, hi, identity),
+ * the partials are then folded with combine in index order, so combine only
+ * has to be associative.
+*/
+template<class T, class Map, class Combine>
+T
+parallel_reduce(struct thread_pool_t *threadPoolPtr, size_t begin, size_t end, size_t grain,
+                const T &identity, Map map, Combine combine)
+{
+    if (begin >= end)
+        return identity;
+    grain = parallel_grain(threadPoolPtr, end - begin, grain);
+    std::vector<T> partials((end - begin + grain - 1) / grain, identity);
+    auto body = [&](size_t lo, size_t hi) {
+        partials[(lo - begin) / grain] = map(lo, hi, identity);
+    };
+    parallel_run(threadPoolPtr, begin, end, grain, parallel_range_trampoline<decltype(body)>, &body);
+    T result = identity;
+    for (size_t i = 0; i < partials.size(); ++i)
+        result = combine(result, partials[i]);
+    return result;
+}
+
+/**
+ * @brief sort [first, last): the chunks are sorted in parallel and then merged
+ * pairwise, every merge round again running in parallel.
+*/
+template<class RandomIt, class Compare>
+void
+parallel_sort(struct thread_pool_t *threadPoolPtr, RandomIt first, RandomIt last, Compare comp)
+{
+    size_t n = last - first;
+    size_t grain, width;
+
+    if (n < 2)
+        return;
+    // below this a chunk is not worth a task
+    grain = parallel_grain(threadPoolPtr, n, 0);
+    if (grain < 4096)
+        grain = 4096;
+    if (grain >= n || threadPoolPtr->numWorkers == 0) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    size_t nchunks = (n + grain - 1) / grain;
+    auto sortChunk = [&](size_t lo, size_t hi) {
+        for (size_t c = lo; c < hi; ++c)
+            std::sort(first + c * grain, first + std::min(n, (c + 1) * grain), comp);
+    };
+    parallel_for(threadPoolPtr, 0, nchunks, 1, sortChunk);
+
+    for (width = grain; width < n; width <<= 1) {
+        size_t npairs = (n + 2 * width - 1) / (2 * width);
+        auto mergePair = [&](size_t lo, size_t hi) {
+            for (size_t p = lo; p < hi; ++p) {
+                size_t l = p * 2 * width;
+                size_t m = std::min(n, l + width);
+                size_t r = std::min(n, l + 2 * width);
+                if (m < r)
+                    std::inplace_merge(first + l, first + m, first + r, comp);
+            }
+        };
+        parallel_for(threadPoolPtr, 0, npairs, 1, mergePair);
+    }
+}
+
+template<class RandomIt>
+void
+parallel_sort(struct thread_pool_t *threadPoolPtr, RandomIt first, RandomIt last)
+{
+    parallel_sort(threadPoolPtr, first, last,
+                  std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+}
+#endif
@@ -0,0 +1,189 @@
+#include "task_graph.h"
+
+namespace ekko{
+
+TaskGraph::TaskGraph()
+{
+    remaining_.store(0, std::memory_order_relaxed);
+    helpers_.store(0, std::memory_order_relaxed);
+    pthread_mutex_init(&mutex_, 0);
+    pthread_cond_init(&cond_, 0);
+}
+
+TaskGraph::~TaskGraph()
+{
+    pthread_mutex_lock(&mutex_);
+    while (helpers_.load(std::memory_order_acquire))
+        pthread_cond_wait(&cond_, &mutex_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_mutex_destroy(&mutex_);
+    pthread_cond_destroy(&cond_);
+}
+
+int
+TaskGraph::AddTask(std::function<void()> func)
+{
+    nodes_.push_back(Node());
+    nodes_.back().func = std::move(func);
+    dirty_ = true;
+    return nodes_.size() - 1;
+}
+
+int
+TaskGraph::Precede(int before, int after)
+{
+    if (before < 0 || after < 0 || before >= (int) nodes_.size()
+            || after >= (int) nodes_.size() || before == after)
+        return -1;
+    nodes_[before].successors.push_back(after);
+    ++nodes_[after].indegree;
+    dirty_ = true;
+    return 0;
+}
+
+int
+TaskGraph::Prepare()
+{
+    std::vector<int> indegree, stack;
+    size_t visited = 0;
+    int node;
+
+    if (!dirty_)
+        return cyclic_ ? -1 : 0;
+
+    roots_.clear();
+    indegree.resize(nodes_.size());
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        indegree[i] = nodes_[i].indegree;
+        if (indegree[i] == 0)
+            roots_.push_back(i);
+    }
+    // Kahn's algorithm, every node is visited iff there is no cycle
+    stack = roots_;
+    while (!stack.empty()) {
+        node = stack.back();
+        stack.pop_back();
+        ++visited;
+        for (size_t i = 0; i < nodes_[node].successors.size(); ++i) {
+            if (--indegree[nodes_[node].successors[i]] == 0)
+                stack.push_back(nodes_[node].successors[i]);
+        }
+    }
+    cyclic_ = visited != nodes_.size();
+
+    pending_.reset(new std::atomic<int>[nodes_.size()]);
+    ready_.reserve(nodes_.size());
+    dirty_ = false;
+    return cyclic_ ? -1 : 0;
+}
+
+void
+TaskGraph::HelperCallback(void *arg)
+{
+    TaskGraph *graph = (TaskGraph*) arg;
+    int node;
+    while ( (node = graph->PopReady()) >= 0)
+        graph->RunChain(node);
+
+    // the destructor may free the graph as soon as the count drops to zero
+    pthread_mutex_lock(&graph->mutex_);
+    if (graph->helpers_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pthread_cond_broadcast(&graph->cond_);
+    pthread_mutex_unlock(&graph->mutex_);
+}
+
+void
+TaskGraph::PushReady(int node)
+{
+    pthread_mutex_lock(&mutex_);
+    ready_.push_back(node);
+    if (waiting_)
+        pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+
+    helpers_.fetch_add(1, std::memory_order_relaxed);
+    if (thread_pool_push_task(threadPoolPtr_, HelperCallback, this) != 0)
+        // Run() picks the node up itself
+        helpers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+int
+TaskGraph::PopReady()
+{
+    int node = -1;
+    pthread_mutex_lock(&mutex_);
+    if (!ready_.empty()) {
+        node = ready_.back();
+        ready_.pop_back();
+    }
+    pthread_mutex_unlock(&mutex_);
+    return node;
+}
+
+void
+TaskGraph::RunChain(int node)
+{
+    int next, succ;
+    while (node >= 0) {
+        nodes_[node].func();
+
+        next = -1;
+        for (size_t i = 0; i < nodes_[node].successors.size(); ++i) {
+            succ = nodes_[node].successors[i];
+            if (pending_[succ].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                continue;
+            // keep the first released successor on this thread
+            if (next < 0)
+                next = succ;
+            else
+                PushReady(succ);
+        }
+
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            pthread_mutex_lock(&mutex_);
+            pthread_cond_broadcast(&cond_);
+            pthread_mutex_unlock(&mutex_);
+        }
+        node = next;
+    }
+}
+
+int
+TaskGraph::Run(struct thread_pool_t *threadPoolPtr)
+{
+    int node;
+
+    if (Prepare() != 0)
+        return -1;
+    if (nodes_.empty())
+        return 0;
+
+    threadPoolPtr_ = threadPoolPtr;
+    for (size_t i = 0; i < nodes_.size(); ++i)
+        pending_[i].store(nodes_[i].indegree, std::memory_order_relaxed);
+    remaining_.store(nodes_.size(), std::memory_order_release);
+
+    for (size_t i = 1; i < roots_.size(); ++i)
+        PushReady(roots_[i]);
+    RunChain(roots_[0]);
+
+    // help with whatever is ready until the last node is done
+    pthread_mutex_lock(&mutex_);
+    while (remaining_.load(std::memory_order_acquire)) {
+        if (!ready_.empty()) {
+            node = ready_.back();
+            ready_.pop_back();
+            pthread_mutex_unlock(&mutex_);
+            RunChain(node);
+            pthread_mutex_lock(&mutex_);
+            continue;
+        }
+        waiting_ = true;
+        pthread_cond_wait(&cond_, &mutex_);
+        waiting_ = false;
+    }
+    pthread_mutex_unlock(&mutex_);
+    return 0;
+}
+
+}
@@ -0,0 +1,95 @@
+#ifndef __TASK_GRAPH_H__
+#define __TASK_GRAPH_H__
+
+#include "thread_pool.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace ekko {
+
+/**
+ * @brief a reusable DAG of tasks run on a thread_pool_t.
+ * Every node keeps its in-degree, a run only resets the per-node counters,
+ * so running the same graph again allocates nothing. When a task finishes,
+ * its successors are released with an atomic decrement; the thread that
+ * finished it goes on with the first one released and queues the rest.
+ * The thread calling Run() executes nodes too until the graph is done.
+*/
+class TaskGraph {
+public:
+    TaskGraph();
+
+    /// @brief waits for helper tasks still queued in the pool
+    ~TaskGraph();
+
+    /// @return index of the new node
+    int AddTask(std::function<void()> func);
+
+    /// @brief after only starts once before has finished
+    /// @return success with 0, fail with -1
+    int Precede(int before, int after);
+
+    size_t Size() const { return nodes_.size();}
+
+    /**
+     * @brief run every task once and wait for all of them
+     * @return success with 0, -1 if the graph has a cycle
+    */
+    int Run(struct thread_pool_t *threadPoolPtr);
+
+private:
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    struct Node {
+        std::function<void()> func;
+        std::vector<int> successors;
+        int indegree = 0;
+    };
+
+    static void HelperCallback(void *arg);
+
+    /// @brief run node and keep following the first successor it releases
+    void RunChain(int node);
+
+    /// @brief queue a ready node and ask the pool for one more helper
+    void PushReady(int node);
+
+    /// @return -1 if nothing is queued
+    int PopReady();
+
+    /// @brief checks for cycles and sizes the counters, only when the graph changed
+    int Prepare();
+
+    std::vector<Node> nodes_;
+
+    /// @brief outstanding predecessors of every node in the current run
+    std::unique_ptr<std::atomic<int>[]> pending_;
+
+    std::vector<int> roots_;
+
+    std::vector<int> ready_;
+
+    std::atomic<size_t> remaining_;
+
+    /// @brief helper tasks queued in the pool and not finished yet
+    std::atomic<size_t> helpers_;
+
+    struct thread_pool_t *threadPoolPtr_ = 0;
+
+    pthread_mutex_t mutex_;
+
+    pthread_cond_t cond_;
+
+    bool waiting_ = false;
+
+    bool dirty_ = true;
+
+    bool cyclic_ = false;
+};
+
+}
+
+#endif
@@ -1,24 +1,96 @@
 #include "thread_pool.h"
 
 namespace ekko{
+
+#ifndef THREAD_POOL_NO_STATS
+static inline uint64_t
+monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// counters have a single writer, the relaxed atomics only keep snapshots tear-free
+static inline void
+stat_add(uint64_t *counterPtr, uint64_t val)
+{
+    __atomic_store_n(counterPtr, *counterPtr + val, __ATOMIC_RELAXED);
+}
+
+static void
+hist_add(struct thread_pool_hist_t *histPtr, uint64_t ns)
+{
+    int idx = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (idx >= THREAD_POOL_HIST_BUCKETS)
+        idx = THREAD_POOL_HIST_BUCKETS - 1;
+    stat_add(&histPtr->buckets[idx], 1);
+    stat_add(&histPtr->count, 1);
+    stat_add(&histPtr->sumNs, ns);
+    if (ns > histPtr->maxNs)
+        __atomic_store_n(&histPtr->maxNs, ns, __ATOMIC_RELAXED);
+}
+#endif
+
 void*
 thread_callback(void *arg)
 {
     struct worker_t *workerPtr = (struct worker_t*) arg;
     struct task_t *taskPtr;
+#ifndef THREAD_POOL_NO_STATS
+    struct worker_stats_t *statsPtr = &workerPtr->stats;
+    uint64_t idleStart = 0, start = 0, end;
+    int stats;
+#endif
     while (1) {
         pthread_mutex_lock(&workerPtr->threadPoolPtr->mutex);
-        while (workerPtr->threadPoolPtr->tasks == 0 && workerPtr->isTerm == 0)
+#ifndef THREAD_POOL_NO_STATS
+        stats = workerPtr->threadPoolPtr->statsEnabled;
+        if (stats)
+            idleStart = monotonic_ns();
+#endif
+        while (workerPtr->threadPoolPtr->tasks == 0 && workerPtr->isTerm == 0) {
             pthread_cond_wait(&workerPtr->threadPoolPtr->cond, &workerPtr->threadPoolPtr->mutex);
+#ifndef THREAD_POOL_NO_STATS
+            if (stats) {
+                stat_add(&statsPtr->wakes, 1);
+                if (workerPtr->threadPoolPtr->tasks == 0 && workerPtr->isTerm == 0)
+                    stat_add(&statsPtr->steals, 1);
+            }
+#endif
+        }
         taskPtr = workerPtr->threadPoolPtr->tasks;
         if (taskPtr == 0) {
             pthread_mutex_unlock(&workerPtr->threadPoolPtr->mutex);
             pthread_exit(0);
         }
         workerPtr->threadPoolPtr->tasks = taskPtr->next;
+        --workerPtr->threadPoolPtr->queueDepth;
+#ifndef THREAD_POOL_NO_STATS
+        // switched on while we were sleeping: idle time of this round is unknown
+        if (!stats && (stats = workerPtr->threadPoolPtr->statsEnabled))
+            idleStart = 0;
+#endif
         pthread_mutex_unlock(&workerPtr->threadPoolPtr->mutex);
 
+#ifndef THREAD_POOL_NO_STATS
+        if (stats) {
+            start = monotonic_ns();
+            if (idleStart)
+                stat_add(&statsPtr->idleNs, start - idleStart);
+            if (taskPtr->enqueueNs)
+                hist_add(&statsPtr->queueWait, start - taskPtr->enqueueNs);
+        }
+#endif
         taskPtr->func(taskPtr->arg);
+#ifndef THREAD_POOL_NO_STATS
+        if (stats) {
+            end = monotonic_ns();
+            hist_add(&statsPtr->run, end - start);
+            stat_add(&statsPtr->busyNs, end - start);
+            stat_add(&statsPtr->tasks, 1);
+        }
+#endif
         free(taskPtr);
     }
 }
@@ -48,17 +120,21 @@ thread_pool_init(struct thread_pool_t *threadPoolPtr, int numThreads)
             return idx;
         }
 
+        // the worker may run before pthread_create returns, so fill it first
+        memset(workerPtr, 0, sizeof(struct worker_t));
+        workerPtr->isTerm = 0;
+        workerPtr->threadPoolPtr = threadPoolPtr;
+
         if ( pthread_create(&threadId, 0, thread_callback, workerPtr) != 0) {
             perror("pthread_create error in thread_pool_init\n");
             free(workerPtr);
             return idx;
         }
 
-        workerPtr->isTerm = 0;
-        workerPtr->threadPoolPtr = threadPoolPtr;
         workerPtr->thread = threadId;
         workerPtr->next = threadPoolPtr->workers;
         threadPoolPtr->workers = workerPtr;
+        ++threadPoolPtr->numWorkers;
     }
 
     return idx;
@@ -79,9 +155,17 @@ thread_pool_push_task(struct thread_pool_t *threadPoolPtr, void (*func)(void*),
     taskPtr->arg = arg;
     taskPtr->func = func;
     taskPtr->next = 0;
+    taskPtr->enqueueNs = 0;
+#ifndef THREAD_POOL_NO_STATS
+    if (__atomic_load_n(&threadPoolPtr->statsEnabled, __ATOMIC_RELAXED))
+        taskPtr->enqueueNs = monotonic_ns();
+#endif
     pthread_mutex_lock(&threadPoolPtr->mutex);
     taskPtr->next = threadPoolPtr->tasks;
     threadPoolPtr->tasks = taskPtr;
+    ++threadPoolPtr->pushed;
+    if (++threadPoolPtr->queueDepth > threadPoolPtr->maxQueueDepth)
+        threadPoolPtr->maxQueueDepth = threadPoolPtr->queueDepth;
     pthread_cond_signal(&threadPoolPtr->cond);
     pthread_mutex_unlock(&threadPoolPtr->mutex);
     return 0;
@@ -106,4 +190,114 @@ thread_pool_destroy(struct thread_pool_t *threadPoolPtr)
     }
 
 }
+
+/**
+ * @brief switch recording of per-task timestamps and worker counters,
+ * a sleeping worker picks the change up with the next task it takes
+*/
+void
+thread_pool_stats_enable(struct thread_pool_t *threadPoolPtr, int enable)
+{
+    pthread_mutex_lock(&threadPoolPtr->mutex);
+    __atomic_store_n(&threadPoolPtr->statsEnabled, enable, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&threadPoolPtr->mutex);
+}
+
+static void
+hist_load(struct thread_pool_hist_t *dst, const struct thread_pool_hist_t *src)
+{
+    for (int i = 0; i < THREAD_POOL_HIST_BUCKETS; ++i)
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sumNs = __atomic_load_n(&src->sumNs, __ATOMIC_RELAXED);
+    dst->maxNs = __atomic_load_n(&src->maxNs, __ATOMIC_RELAXED);
+}
+
+static void
+hist_merge(struct thread_pool_hist_t *dst, const struct thread_pool_hist_t *src)
+{
+    for (int i = 0; i < THREAD_POOL_HIST_BUCKETS; ++i)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sumNs += src->sumNs;
+    if (src->maxNs > dst->maxNs)
+        dst->maxNs = src->maxNs;
+}
+
+/**
+ * @brief take a snapshot of the pool counters
+ * @param workerStats filled with up to maxWorkers per worker entries, may be 0
+ * @return the number of workers
+*/
+int
+thread_pool_stats(struct thread_pool_t *threadPoolPtr, struct thread_pool_stats_t *statsPtr,
+                  struct worker_stats_t *workerStats, int maxWorkers)
+{
+    struct worker_t *workerPtr;
+    struct worker_stats_t cur;
+    int idx = 0;
+
+    memset(statsPtr, 0, sizeof(struct thread_pool_stats_t));
+    pthread_mutex_lock(&threadPoolPtr->mutex);
+    statsPtr->numWorkers = threadPoolPtr->numWorkers;
+    statsPtr->queueDepth = threadPoolPtr->queueDepth;
+    statsPtr->maxQueueDepth = threadPoolPtr->maxQueueDepth;
+    statsPtr->pushed = threadPoolPtr->pushed;
+    for (workerPtr = threadPoolPtr->workers; workerPtr; workerPtr = workerPtr->next, ++idx) {
+        hist_load(&cur.queueWait, &workerPtr->stats.queueWait);
+        hist_load(&cur.run, &workerPtr->stats.run);
+        cur.tasks = __atomic_load_n(&workerPtr->stats.tasks, __ATOMIC_RELAXED);
+        cur.busyNs = __atomic_load_n(&workerPtr->stats.busyNs, __ATOMIC_RELAXED);
+        cur.idleNs = __atomic_load_n(&workerPtr->stats.idleNs, __ATOMIC_RELAXED);
+        cur.wakes = __atomic_load_n(&workerPtr->stats.wakes, __ATOMIC_RELAXED);
+        cur.steals = __atomic_load_n(&workerPtr->stats.steals, __ATOMIC_RELAXED);
+        if (workerStats && idx < maxWorkers)
+            workerStats[idx] = cur;
+
+        hist_merge(&statsPtr->total.queueWait, &cur.queueWait);
+        hist_merge(&statsPtr->total.run, &cur.run);
+        statsPtr->total.tasks += cur.tasks;
+        statsPtr->total.busyNs += cur.busyNs;
+        statsPtr->total.idleNs += cur.idleNs;
+        statsPtr->total.wakes += cur.wakes;
+        statsPtr->total.steals += cur.steals;
+    }
+    pthread_mutex_unlock(&threadPoolPtr->mutex);
+    return idx;
+}
+
+/**
+ * @brief zero every counter, counts recorded concurrently by a running task may survive
+*/
+void
+thread_pool_stats_reset(struct thread_pool_t *threadPoolPtr)
+{
+    struct worker_t *workerPtr;
+    pthread_mutex_lock(&threadPoolPtr->mutex);
+    threadPoolPtr->maxQueueDepth = threadPoolPtr->queueDepth;
+    threadPoolPtr->pushed = 0;
+    for (workerPtr = threadPoolPtr->workers; workerPtr; workerPtr = workerPtr->next)
+        memset(&workerPtr->stats, 0, sizeof(struct worker_stats_t));
+    pthread_mutex_unlock(&threadPoolPtr->mutex);
+}
+
+/**
+ * @return upper bound in ns of the bucket holding the p-th percentile, p in [0, 100]
+*/
+uint64_t
+thread_pool_hist_percentile(const struct thread_pool_hist_t *histPtr, double p)
+{
+    uint64_t rank, seen = 0;
+    if (histPtr->count == 0)
+        return 0;
+    rank = (uint64_t) (histPtr->count * p / 100.0);
+    if (rank >= histPtr->count)
+        rank = histPtr->count - 1;
+    for (int i = 0; i < THREAD_POOL_HIST_BUCKETS; ++i) {
+        seen += histPtr->buckets[i];
+        if (seen > rank)
+            return (2ull << i) - 1 < histPtr->maxNs ? (2ull << i) - 1 : histPtr->maxNs;
+    }
+    return histPtr->maxNs;
+}
 }
\ No newline at end of file
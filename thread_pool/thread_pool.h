@@ -9,21 +9,53 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+
+// log2 buckets: bucket i counts durations in [2^i, 2^(i+1)) ns
+#define THREAD_POOL_HIST_BUCKETS 40
 
 namespace ekko{
 struct thread_pool_t;
 
+struct thread_pool_hist_t {
+    uint64_t buckets[THREAD_POOL_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+};
+
+/**
+ * @brief per worker counters, only written by the worker itself.
+ * Recorded while thread_pool_t::statsEnabled is set; building with
+ * -DTHREAD_POOL_NO_STATS removes the hooks, the fields stay for the layout.
+*/
+struct worker_stats_t {
+    struct thread_pool_hist_t queueWait;
+    struct thread_pool_hist_t run;
+    uint64_t tasks;
+    uint64_t busyNs;
+    uint64_t idleNs;
+    /// @brief returns from pthread_cond_wait
+    uint64_t wakes;
+    /// @brief wakes that found the queue already drained by another worker
+    uint64_t steals;
+};
+
 struct worker_t {
     struct worker_t *next;
     pthread_t thread;
     struct thread_pool_t *threadPoolPtr;
     int isTerm;
+    struct worker_stats_t stats;
 };
 
 struct task_t {
     struct task_t *next;
     void (*func)(void*);
     void* arg;
+    /// @brief CLOCK_MONOTONIC ns at push, 0 when stats were off
+    uint64_t enqueueNs;
 };
 
 struct thread_pool_t {
@@ -31,6 +63,21 @@ struct thread_pool_t {
     struct task_t *tasks;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    int numWorkers;
+    /// @brief tasks waiting in the queue
+    int queueDepth;
+    int maxQueueDepth;
+    uint64_t pushed;
+    int statsEnabled;
+};
+
+struct thread_pool_stats_t {
+    int numWorkers;
+    int queueDepth;
+    int maxQueueDepth;
+    uint64_t pushed;
+    /// @brief sum over all workers
+    struct worker_stats_t total;
 };
 
 
@@ -40,5 +87,14 @@ int thread_pool_push_task(struct thread_pool_t *threadPoolPtr, void (*func)(void
 
 void thread_pool_destroy(struct thread_pool_t *threadPoolPtr);
 
+void thread_pool_stats_enable(struct thread_pool_t *threadPoolPtr, int enable);
+
+int thread_pool_stats(struct thread_pool_t *threadPoolPtr, struct thread_pool_stats_t *statsPtr,
+                      struct worker_stats_t *workerStats, int maxWorkers);
+
+void thread_pool_stats_reset(struct thread_pool_t *threadPoolPtr);
+
+uint64_t thread_pool_hist_percentile(const struct thread_pool_hist_t *histPtr, double p);
+
 }
 #endif
\ No newline at end of file